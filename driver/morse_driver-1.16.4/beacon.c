@@ -17,6 +17,7 @@
 #include "utils.h"
 #include "mbssid.h"
 #include "mesh.h"
+#include "trace.h"
 
 #define FRAGMENTATION_OVERHEAD			(36)
 
@@ -40,9 +41,24 @@ module_param(enable_short_bcn_as_dtim_override, int, 0644);
 MODULE_PARM_DESC(enable_short_bcn_as_dtim_override,
 		 "Override enable for short beacon to be the DTIM beacon (experimental)");
 
+static bool enable_beacon_template __read_mostly = true;
+module_param(enable_beacon_template, bool, 0644);
+MODULE_PARM_DESC(enable_beacon_template,
+		 "Cache converted S1G beacons and only patch the per-beacon elements each TBTT");
+
 static unsigned long beacon_irqs_enabled;
 static bool enable_short_bcn_as_dtim;
 
+/* Elements which may differ between consecutive beacons and are never cached */
+static const u8 morse_beacon_dynamic_eids[] = {
+	WLAN_EID_TIM,
+	WLAN_EID_S1G_RPS,
+	WLAN_EID_S1G_CAC,
+	WLAN_EID_MULTIPLE_BSSID,
+	WLAN_EID_BEACON_TIMING,
+	WLAN_EID_PAGE_SLICE,
+};
+
 bool morse_mac_is_s1g_long_beacon(struct morse *mors, struct sk_buff *skb)
 {
 	bool ret = false;
@@ -136,6 +152,180 @@ static void morse_beacon_fill_tx_info(struct morse *mors, struct morse_skb_tx_in
 		tx_info->flags |= cpu_to_le32(MORSE_TX_CONF_FLAGS_IMMEDIATE_REPORT);
 }
 
+void morse_beacon_template_invalidate(struct morse_vif *mors_vif)
+{
+	atomic_inc(&mors_vif->beacon_template_gen);
+}
+
+static void morse_beacon_template_clear_dynamic(struct dot11ah_ies_mask *ies_mask)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(morse_beacon_dynamic_eids); i++)
+		morse_dot11_clear_eid_from_ies_mask(ies_mask, morse_beacon_dynamic_eids[i]);
+}
+
+static void morse_beacon_template_free(struct morse_beacon_template *tmpl)
+{
+	morse_dot11ah_ies_mask_free(tmpl->ies_mask);
+	kfree(tmpl->frame);
+	memset(tmpl, 0, sizeof(*tmpl));
+}
+
+/**
+ * morse_beacon_template_cacheable() - Check if the beacon of an interface may be cached
+ *
+ * @mors_vif: Interface to check
+ *
+ * Mesh beacons carry MBCA state which changes every beacon, and during a channel switch
+ * mac80211 updates the switch count on every beacon without signalling a change.
+ *
+ * Return: true if a template may be captured or used
+ */
+static bool morse_beacon_template_cacheable(struct morse_vif *mors_vif)
+{
+	struct ieee80211_vif *vif = morse_vif_to_ieee80211_vif(mors_vif);
+
+	return enable_beacon_template &&
+	       !ieee80211_vif_is_mesh(vif) &&
+	       !morse_mac_is_csa_active(vif) &&
+	       !mors_vif->chan_switch_in_progress &&
+	       !mors_vif->ecsa_chan_configured;
+}
+
+/**
+ * morse_beacon_template_capture() - Cache a fully converted S1G beacon
+ *
+ * @mors_vif: Interface the beacon belongs to
+ * @tmpl: Template slot to fill
+ * @beacon: Converted S1G beacon, ready for transmission
+ * @hdr_len: Length of the S1G header in @beacon
+ * @gen: Template generation read before mac80211 was asked for the beacon
+ *
+ * Must be called with the vendor IE lock held.
+ */
+static void morse_beacon_template_capture(struct morse_vif *mors_vif,
+					  struct morse_beacon_template *tmpl,
+					  const struct sk_buff *beacon, int hdr_len, u32 gen)
+{
+	morse_beacon_template_free(tmpl);
+
+	tmpl->frame = kmemdup(beacon->data, beacon->len, GFP_ATOMIC);
+	if (!tmpl->frame)
+		return;
+
+	tmpl->ies_mask = morse_dot11ah_ies_to_ies_mask(tmpl->frame + hdr_len,
+						       beacon->len - hdr_len);
+	if (!tmpl->ies_mask) {
+		morse_beacon_template_free(tmpl);
+		return;
+	}
+
+	morse_beacon_template_clear_dynamic(tmpl->ies_mask);
+	tmpl->len = beacon->len;
+	tmpl->hdr_len = hdr_len;
+	tmpl->gen = gen;
+	tmpl->vendor_ie_gen = mors_vif->vendor_ie.generation;
+	tmpl->channel_info = mors_vif->custom_configs->channel_info;
+	tmpl->valid = true;
+}
+
+/**
+ * morse_beacon_template_build() - Build the S1G beacon from a cached template
+ *
+ * @mors_vif: Interface to build the beacon for
+ * @tmpl: Template to build from
+ * @beacon: On entry, the beacon returned by mac80211. On success, the S1G beacon.
+ * @tim_ie: TIM element in the mac80211 beacon, or NULL
+ *
+ * The mac80211 beacon is still fetched every TBTT so that mac80211 keeps its TIM and DTIM
+ * state, but only its TIM is used. The RPS, CAC, multiple BSSID and timing information
+ * are refreshed, everything else comes from the template.
+ *
+ * Must be called with the vendor IE lock held.
+ *
+ * Return: 0 on success, -ENOENT if the template is not usable, otherwise an error code
+ */
+static int morse_beacon_template_build(struct morse_vif *mors_vif,
+				       struct morse_beacon_template *tmpl,
+				       struct sk_buff **beacon, const u8 *tim_ie)
+{
+	struct morse *mors = morse_vif_to_morse(mors_vif);
+	struct ieee80211_vif *vif = morse_vif_to_ieee80211_vif(mors_vif);
+	struct dot11ah_ies_mask *ies_mask = tmpl->ies_mask;
+	struct dot11ah_s1g_bcn_compat_ie *compat;
+	struct sk_buff *skb = *beacon;
+	u8 page_slice_no = S1G_TIM_PAGE_SLICE_ENTIRE_PAGE;
+	u8 page_index = 0;
+	__le16 fc;
+	u8 rps_ie_size;
+	int ies_len;
+	int ret = 0;
+
+	if (!tmpl->valid || tmpl->gen != atomic_read(&mors_vif->beacon_template_gen) ||
+	    tmpl->vendor_ie_gen != mors_vif->vendor_ie.generation ||
+	    memcmp(&tmpl->channel_info, &mors_vif->custom_configs->channel_info,
+		   sizeof(tmpl->channel_info)))
+		return -ENOENT;
+
+	fc = ((struct ieee80211_ext *)tmpl->frame)->frame_control;
+
+	rps_ie_size = morse_raw_get_rps_ie_size(mors_vif);
+	if (rps_ie_size != 0)
+		morse_dot11ah_insert_element(ies_mask, WLAN_EID_S1G_RPS,
+					     morse_raw_get_rps_ie(mors_vif), rps_ie_size);
+
+	morse_cac_insert_ie(ies_mask, vif,
+			    cpu_to_le16(IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_BEACON));
+
+	if (tim_ie) {
+		/* Point at the mac80211 TIM, it is copied out when converted to S1G */
+		morse_dot11_ies_mask_set_ie(ies_mask, WLAN_EID_TIM, (u8 *)tim_ie + 2, tim_ie[1]);
+
+		if (mors_vif->page_slicing_info.enabled)
+			morse_page_slicing_process_tim_element(vif, ies_mask,
+							       &page_slice_no, &page_index);
+
+		morse_dot11ah_insert_s1g_tim(vif, ies_mask, page_slice_no, page_index);
+	}
+
+	morse_mbssid_insert_ie(mors_vif, mors, ies_mask);
+
+	compat = (struct dot11ah_s1g_bcn_compat_ie *)ies_mask->ies[WLAN_EID_S1G_BCN_COMPAT].ptr;
+	if (compat) {
+		u64 now_usecs = jiffies_to_usecs((get_jiffies_64() - mors_vif->epoch));
+
+		compat->tsf_completion = cpu_to_le32(UPPER_32_BITS(now_usecs));
+	}
+
+	ies_len = morse_dot11_insert_ordered_ies_from_ies_mask(skb, NULL, ies_mask, fc);
+
+	if ((skb->len + skb_tailroom(skb)) < (tmpl->hdr_len + ies_len)) {
+		struct sk_buff *skb2;
+
+		skb2 = skb_copy_expand(skb, skb_headroom(skb),
+				       (tmpl->hdr_len + ies_len) - skb->len, GFP_ATOMIC);
+		if (!skb2) {
+			ret = -ENOMEM;
+			goto exit;
+		}
+
+		/* Just say we transmitted it */
+		MORSE_IEEE80211_TX_STATUS(mors->hw, skb);
+		skb = skb2;
+		*beacon = skb;
+	}
+
+	/* The template elements do not live in the skb, so they can be written straight in */
+	memcpy(skb->data, tmpl->frame, tmpl->hdr_len);
+	skb_trim(skb, tmpl->hdr_len);
+	morse_dot11_insert_ordered_ies_from_ies_mask(skb, skb_put(skb, ies_len), ies_mask, fc);
+
+exit:
+	morse_beacon_template_clear_dynamic(ies_mask);
+	return ret;
+}
+
 static void morse_beacon_tasklet(unsigned long data)
 {
 	struct morse_skbq *mq;
@@ -162,6 +352,14 @@ static void morse_beacon_tasklet(unsigned long data)
 	bool fw_reports_tx_beacon_comp;
 	int num_bcn_vifs;
 	uint long_beacon_dtim_count;
+	struct morse_beacon_template *tmpl;
+	bool cacheable;
+	u32 tmpl_gen;
+	ktime_t start = 0;
+	int ret;
+
+	if (trace_morse_beacon_tasklet_enabled())
+		start = ktime_get();
 
 	if (!mors_vif || !mors_vif->custom_configs)
 		return;
@@ -206,9 +404,9 @@ static void morse_beacon_tasklet(unsigned long data)
 		MORSE_BEACON_DBG(mors, "%s: number of beacons awaiting tx status: %u\n",
 						__func__, morse_skbq_pending_count(mq));
 
-	ies_mask = morse_dot11ah_ies_mask_alloc();
-	if (!ies_mask)
-		return;
+	/* Read before fetching the beacon so a concurrent change invalidates what we capture */
+	tmpl_gen = atomic_read(&mors_vif->beacon_template_gen);
+	cacheable = morse_beacon_template_cacheable(mors_vif);
 
 	short_beacon = (mors_vif->dtim_count != long_beacon_dtim_count);
 
@@ -247,6 +445,27 @@ static void morse_beacon_tasklet(unsigned long data)
 	if (vif->type == NL80211_IFTYPE_ADHOC)
 		short_beacon = false;
 
+	tmpl = &mors_vif->beacon_template[short_beacon];
+	if (cacheable) {
+		spin_lock_bh(&mors_vif->vendor_ie.lock);
+		ret = morse_beacon_template_build(mors_vif, tmpl, &beacon, tim_ie);
+		spin_unlock_bh(&mors_vif->vendor_ie.lock);
+
+		if (!ret)
+			goto tx_beacon;
+
+		if (ret != -ENOENT) {
+			kfree_skb(beacon);
+			goto exit;
+		}
+	}
+
+	ies_mask = morse_dot11ah_ies_mask_alloc();
+	if (!ies_mask) {
+		kfree_skb(beacon);
+		goto exit;
+	}
+
 	s1g_beacon_ies = morse_mac_get_ie_pos(beacon, &s1g_ies_length, &s1g_hdr_length, false);
 
 	/* Parse out the original IEs so we can mess with them */
@@ -317,12 +536,6 @@ static void morse_beacon_tasklet(unsigned long data)
 		goto exit;
 	}
 
-	s1g_beacon = (struct ieee80211_ext *)beacon->data;
-
-	/* Lower 32 bits Get inserted into the timestamp field here */
-	s1g_beacon->u.s1g_beacon.timestamp =
-	    cpu_to_le32(LOWER_32_BITS(morse_mac_generate_timestamp_for_frame(mors_vif)));
-
 	morse_mac_update_custom_s1g_capab(mors_vif, ies_mask, vif->type);
 
 	/* Need to calculate the IEs length from the ies_mask */
@@ -362,8 +575,21 @@ static void morse_beacon_tasklet(unsigned long data)
 	memcpy(s1g_beacon_ies, s1g_ordered_ies_buff, s1g_ies_length);
 	kfree(s1g_ordered_ies_buff);
 
+	/* Check again as the conversion above tracks channel switch announcements */
+	if (cacheable && morse_beacon_template_cacheable(mors_vif))
+		morse_beacon_template_capture(mors_vif, tmpl, beacon, s1g_hdr_length, tmpl_gen);
+	else
+		morse_beacon_template_free(tmpl);
+
 	spin_unlock_bh(&mors_vif->vendor_ie.lock);
 
+tx_beacon:
+	s1g_beacon = (struct ieee80211_ext *)beacon->data;
+
+	/* Lower 32 bits Get inserted into the timestamp field here */
+	s1g_beacon->u.s1g_beacon.timestamp =
+	    cpu_to_le32(LOWER_32_BITS(morse_mac_generate_timestamp_for_frame(mors_vif)));
+
 	if (vif->bss_conf.dtim_period)
 		mors_vif->dtim_count = (mors_vif->dtim_count + 1) % vif->bss_conf.dtim_period;
 	else
@@ -382,6 +608,10 @@ static void morse_beacon_tasklet(unsigned long data)
 	    mors->custom_configs.channel_info.op_bw_mhz :
 	    mors->custom_configs.channel_info.pri_bw_mhz;
 	morse_beacon_fill_tx_info(mors, &tx_info, beacon, mors_vif, tx_bw_mhz);
+	/* Skip the event if tracing was switched on after the start was taken */
+	if (trace_morse_beacon_tasklet_enabled() && start)
+		trace_morse_beacon_tasklet(mors, mors_vif->id, beacon->len, short_beacon,
+					   ktime_to_ns(ktime_sub(ktime_get(), start)));
 	morse_skbq_skb_tx(mq, &beacon, &tx_info, MORSE_SKB_CHAN_BEACON);
 
 	/* Wake up pageset handler */
@@ -473,4 +703,7 @@ void morse_beacon_finish(struct morse_vif *mors_vif)
 	morse_beacon_irq_enable(mors_vif, false);
 	tasklet_kill(&mors_vif->beacon_tasklet);
 	atomic_dec(&mors->num_bcn_vifs);
+
+	morse_beacon_template_free(&mors_vif->beacon_template[0]);
+	morse_beacon_template_free(&mors_vif->beacon_template[1]);
 }
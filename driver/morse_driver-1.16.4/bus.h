@@ -99,6 +99,7 @@ enum morse_host_bus_type {
 	MORSE_HOST_BUS_TYPE_SDIO,
 	MORSE_HOST_BUS_TYPE_SPI,
 	MORSE_HOST_BUS_TYPE_USB,
+	MORSE_HOST_BUS_TYPE_LOOPBACK,
 };
 
 #endif /* !_MORSE_BUS_H_ */
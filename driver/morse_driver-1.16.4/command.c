@@ -28,6 +28,7 @@
 #include "mesh.h"
 #include "morse_commands.h"
 #include "wiphy.h"
+#include "trace.h"
 
 #define MM_BA_TIMEOUT (5000)
 #define MM_MAX_COMMAND_RETRY 2
@@ -51,10 +52,28 @@ enum morse_interface_type {
 	MORSE_INTERFACE_TYPE_MAX = INT_MAX,
 };
 
-struct morse_cmd_resp_cb {
-	int ret;
-	u32 length;
+/* Upper bound for the max_outstanding_cmds module parameter */
+#define MM_MAX_OUTSTANDING_CMDS 16
+
+/**
+ * struct morse_cmd_inflight - A command waiting on a response from the chip
+ *
+ * @list: Entry in &morse->cmd_inflight
+ * @message_id: Command ID of the request
+ * @seq: Sequence number portion of the request host ID
+ * @comp: Completed once the response has been received
+ * @dest_resp: Where to copy the response, may be NULL
+ * @length: Size of @dest_resp
+ * @ret: Command status when there is no @dest_resp to hold it
+ */
+struct morse_cmd_inflight {
+	struct list_head list;
+	u16 message_id;
+	u16 seq;
+	struct completion comp;
 	struct morse_cmd_resp *dest_resp;
+	u32 length;
+	int ret;
 };
 
 /* Set driver to chip command timeout: max to wait (in ms) before failing the command */
@@ -62,6 +81,11 @@ static u32 default_cmd_timeout_ms __read_mostly = MM_CMD_DEFAULT_TIMEOUT_MS;
 module_param(default_cmd_timeout_ms, uint, 0644);
 MODULE_PARM_DESC(default_cmd_timeout_ms, "Default command timeout (in ms)");
 
+static uint max_outstanding_cmds __read_mostly = 4;
+module_param(max_outstanding_cmds, uint, 0444);
+MODULE_PARM_DESC(max_outstanding_cmds,
+		 "Maximum number of commands awaiting a response from the chip (1 to serialise all)");
+
 static void morse_cmd_init(struct morse *mors, struct morse_cmd_header *hdr,
 			   enum morse_cmd_id cmd, u16 vif_id, u16 len)
 {
@@ -107,6 +131,68 @@ static const char *morse_cmd_standby_exit_reason_to_str(enum
 	}
 }
 
+void morse_cmd_tx_init(struct morse *mors)
+{
+	mutex_init(&mors->cmd_lock);
+	init_rwsem(&mors->cmd_order);
+	INIT_LIST_HEAD(&mors->cmd_inflight);
+	sema_init(&mors->cmd_slots, clamp_t(uint, max_outstanding_cmds, 1,
+					    MM_MAX_OUTSTANDING_CMDS));
+}
+
+/**
+ * morse_cmd_needs_ordering() - Check if a command must not overlap with any other command
+ *
+ * @message_id: Command ID
+ *
+ * These commands change chip state that other commands depend on (interfaces, channel,
+ * power state), or check the health of the command path itself, so they wait for every
+ * outstanding command to complete and hold off new ones until they are responded to.
+ *
+ * Return: true if the command must be serialised
+ */
+static bool morse_cmd_needs_ordering(u16 message_id)
+{
+	switch (message_id) {
+	case MORSE_CMD_ID_SET_CHANNEL:
+	case MORSE_CMD_ID_ADD_INTERFACE:
+	case MORSE_CMD_ID_REMOVE_INTERFACE:
+	case MORSE_CMD_ID_CONFIG_PS:
+	case MORSE_CMD_ID_HEALTH_CHECK:
+	case MORSE_CMD_ID_STANDBY_MODE:
+	case MORSE_CMD_ID_FORCE_POWER_MODE:
+	case MORSE_CMD_ID_LI_SLEEP:
+	case MORSE_CMD_ID_COREDUMP:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Must be called with cmd_lock held */
+static struct morse_cmd_inflight *morse_cmd_inflight_find(struct morse *mors, u16 seq)
+{
+	struct morse_cmd_inflight *cmd;
+
+	list_for_each_entry(cmd, &mors->cmd_inflight, list)
+		if (cmd->seq == seq)
+			return cmd;
+
+	return NULL;
+}
+
+/* Must be called with cmd_lock held. Skips sequence numbers still in use by older commands */
+static u16 morse_cmd_next_seq(struct morse *mors)
+{
+	do {
+		mors->cmd_seq++;
+		if (mors->cmd_seq > MORSE_CMD_HOST_ID_SEQ_MAX)
+			mors->cmd_seq = 1;
+	} while (morse_cmd_inflight_find(mors, mors->cmd_seq << MORSE_CMD_HOST_ID_SEQ_SHIFT));
+
+	return mors->cmd_seq << MORSE_CMD_HOST_ID_SEQ_SHIFT;
+}
+
 static int morse_cmd_tx(struct morse *mors, struct morse_cmd_resp *resp,
 			struct morse_cmd_req *req, u32 length, u32 timeout, const char *func)
 {
@@ -115,12 +201,11 @@ static int morse_cmd_tx(struct morse *mors, struct morse_cmd_resp *resp,
 	u16 host_id;
 	int retry = 0;
 	unsigned long wait_ret = 0;
+	ktime_t sent = 0;
 	struct sk_buff *skb;
 	struct morse_skbq *cmd_q = mors->cfg->ops->skbq_cmd_tc_q(mors);
-	struct morse_cmd_resp_cb *resp_cb;
-	DECLARE_COMPLETION_ONSTACK(cmd_comp);
-
-	BUILD_BUG_ON(sizeof(struct morse_cmd_resp_cb) > IEEE80211_TX_INFO_DRIVER_DATA_SIZE);
+	struct morse_cmd_inflight cmd;
+	bool ordered;
 
 	if (!cmd_q)
 		/* No control pageset, not supported by FW */
@@ -129,11 +214,25 @@ static int morse_cmd_tx(struct morse *mors, struct morse_cmd_resp *resp,
 	cmd_len = sizeof(*req) + le16_to_cpu(req->hdr.len);
 	req->hdr.flags = cpu_to_le16(MORSE_CMD_TYPE_REQ);
 
-	mutex_lock(&mors->cmd_wait);
-	mors->cmd_seq++;
-	if (mors->cmd_seq > MORSE_CMD_HOST_ID_SEQ_MAX)
-		mors->cmd_seq = 1;
-	host_id = mors->cmd_seq << MORSE_CMD_HOST_ID_SEQ_SHIFT;
+	ordered = morse_cmd_needs_ordering(le16_to_cpu(req->hdr.message_id));
+	if (ordered) {
+		down_write(&mors->cmd_order);
+	} else {
+		down_read(&mors->cmd_order);
+		down(&mors->cmd_slots);
+	}
+
+	init_completion(&cmd.comp);
+	cmd.message_id = le16_to_cpu(req->hdr.message_id);
+	cmd.dest_resp = resp;
+	cmd.length = length;
+	cmd.ret = 0;
+
+	mutex_lock(&mors->cmd_lock);
+	host_id = morse_cmd_next_seq(mors);
+	cmd.seq = host_id;
+	list_add_tail(&cmd.list, &mors->cmd_inflight);
+	mutex_unlock(&mors->cmd_lock);
 
 	/* Make sure no one enables PS until the command is responded to or timed out */
 	morse_ps_disable(mors);
@@ -148,18 +247,18 @@ static int morse_cmd_tx(struct morse *mors, struct morse_cmd_resp *resp,
 		}
 
 		memcpy(skb->data, req, cmd_len);
-		resp_cb = (struct morse_cmd_resp_cb *)IEEE80211_SKB_CB(skb)->driver_data;
-		resp_cb->length = length;
-		resp_cb->dest_resp = resp;
 
 		MORSE_DBG(mors, "CMD 0x%04x:%04x\n", le16_to_cpu(req->hdr.message_id),
 			  le16_to_cpu(req->hdr.host_id));
 
 		mutex_lock(&mors->cmd_lock);
-		mors->cmd_comp = &cmd_comp;
 		if (retry > 0)
-			reinit_completion(&cmd_comp);
+			reinit_completion(&cmd.comp);
 		timeout = timeout ? timeout : default_cmd_timeout_ms;
+		trace_morse_cmd_send(mors, le16_to_cpu(req->hdr.message_id),
+				     le16_to_cpu(req->hdr.host_id), cmd_len, retry);
+		if (trace_morse_cmd_done_enabled())
+			sent = ktime_get();
 		ret = morse_skbq_skb_tx(cmd_q, &skb, NULL, MORSE_SKB_CHAN_COMMAND);
 		mutex_unlock(&mors->cmd_lock);
 
@@ -168,9 +267,8 @@ static int morse_cmd_tx(struct morse *mors, struct morse_cmd_resp *resp,
 			break;
 		}
 
-		wait_ret = wait_for_completion_timeout(&cmd_comp, msecs_to_jiffies(timeout));
+		wait_ret = wait_for_completion_timeout(&cmd.comp, msecs_to_jiffies(timeout));
 		mutex_lock(&mors->cmd_lock);
-		mors->cmd_comp = NULL;
 
 		if (!wait_ret) {
 			MORSE_INFO(mors, "Try:%d Command %04x:%04x timeout after %u ms\n",
@@ -178,7 +276,7 @@ static int morse_cmd_tx(struct morse *mors, struct morse_cmd_resp *resp,
 				   le16_to_cpu(req->hdr.host_id), timeout);
 			ret = -ETIMEDOUT;
 		} else {
-			ret = (length && resp) ? le32_to_cpu(resp->status) : resp_cb->ret;
+			ret = (length && resp) ? le32_to_cpu(resp->status) : cmd.ret;
 
 			MORSE_DBG(mors, "Command 0x%04x:%04x status 0x%08x\n",
 				  le16_to_cpu(req->hdr.message_id),
@@ -188,6 +286,11 @@ static int morse_cmd_tx(struct morse *mors, struct morse_cmd_resp *resp,
 					  le16_to_cpu(req->hdr.message_id),
 					  le16_to_cpu(req->hdr.host_id), ret);
 		}
+		/* Skip the event if tracing was switched on after the send */
+		if (trace_morse_cmd_done_enabled() && sent)
+			trace_morse_cmd_done(mors, le16_to_cpu(req->hdr.message_id),
+					     le16_to_cpu(req->hdr.host_id), ret,
+					     ktime_us_delta(ktime_get(), sent));
 		/* Free the command request */
 		spin_lock_bh(&cmd_q->lock);
 		morse_skbq_skb_finish(cmd_q, skb, NULL);
@@ -197,8 +300,19 @@ static int morse_cmd_tx(struct morse *mors, struct morse_cmd_resp *resp,
 		retry++;
 	} while ((ret == -ETIMEDOUT) && retry < MM_MAX_COMMAND_RETRY);
 
+	/* Any response arriving from here on is late and will be dropped */
+	mutex_lock(&mors->cmd_lock);
+	list_del(&cmd.list);
+	mutex_unlock(&mors->cmd_lock);
+
 	morse_ps_enable(mors);
-	mutex_unlock(&mors->cmd_wait);
+
+	if (ordered) {
+		up_write(&mors->cmd_order);
+	} else {
+		up(&mors->cmd_slots);
+		up_read(&mors->cmd_order);
+	}
 
 	if (ret == -ETIMEDOUT)
 		MORSE_ERR(mors, "Command %s %02x:%02x timed out\n",
@@ -609,19 +723,14 @@ static int morse_cmd_drv(struct morse *mors, struct ieee80211_vif *vif, struct m
 int morse_cmd_resp_process(struct morse *mors, struct sk_buff *skb)
 {
 	int length, ret = -ESRCH;	/* No such process */
-	struct morse_skbq *cmd_q = mors->cfg->ops->skbq_cmd_tc_q(mors);
 	struct morse_cmd_resp *src_resp = (struct morse_cmd_resp *)(skb->data);
-	struct sk_buff *cmd_skb = NULL;
-	struct morse_cmd_resp_cb *resp_cb;
-	struct morse_cmd_resp *dest_resp;
-	struct morse_cmd_req *req;
-	u16 message_id = 0;
-	u16 host_id = 0;
+	struct morse_cmd_inflight *cmd;
 	u16 resp_message_id = le16_to_cpu(src_resp->hdr.message_id);
 	u16 resp_host_id = le16_to_cpu(src_resp->hdr.host_id);
-	bool is_late_response = false;
 
 	MORSE_DBG(mors, "EVT 0x%04x:0x%04x\n", resp_message_id, resp_host_id);
+	trace_morse_cmd_resp(mors, resp_message_id, resp_host_id, skb->len,
+			     MORSE_CMD_IS_RESP(src_resp));
 
 	if (!MORSE_CMD_IS_RESP(src_resp)) {
 		ret = morse_mac_event_recv(mors, skb);
@@ -630,56 +739,43 @@ int morse_cmd_resp_process(struct morse *mors, struct sk_buff *skb)
 
 	mutex_lock(&mors->cmd_lock);
 
-	cmd_skb = morse_skbq_tx_pending(cmd_q);
-	if (cmd_skb) {
-		morse_skb_remove_hdr_after_sent_to_chip(cmd_skb);
-		req = (struct morse_cmd_req *)cmd_skb->data;
-		message_id = le16_to_cpu(req->hdr.message_id);
-		host_id = le16_to_cpu(req->hdr.host_id);
-	}
-
 	/*
-	 * If there is no pending command or the sequence ID does not match, this is a late response
+	 * If there is no outstanding command with this sequence ID, this is a late response
 	 * for a timed out command which has been cleaned up, so just free up the response.
 	 * If a command was retried, the response may be from the retry or from the original
 	 * command (late response) but not from both because the firmware will silently drop
 	 * a retry if it received the initial request. So a mismatched retry counter is treated
 	 * as a matched command and response.
 	 */
-	if (!cmd_skb || message_id != resp_message_id ||
-	    (host_id & MORSE_CMD_HOST_ID_SEQ_MASK) != (resp_host_id & MORSE_CMD_HOST_ID_SEQ_MASK)) {
+	cmd = morse_cmd_inflight_find(mors, resp_host_id & MORSE_CMD_HOST_ID_SEQ_MASK);
+	if (!cmd || cmd->message_id != resp_message_id) {
 		MORSE_ERR(mors,
 			  "Late response for timed out req 0x%04x:%04x have 0x%04x:%04x 0x%04x\n",
-			  resp_message_id, resp_host_id, message_id, host_id, mors->cmd_seq);
-		is_late_response = true;
+			  resp_message_id, resp_host_id, cmd ? cmd->message_id : 0,
+			  cmd ? cmd->seq : 0, mors->cmd_seq);
+		goto exit;
+	}
+
+	if (completion_done(&cmd->comp)) {
+		MORSE_INFO(mors, "Duplicate response 0x%04x:%04x\n",
+			   resp_message_id, resp_host_id);
 		goto exit;
 	}
-	if ((host_id & MORSE_CMD_HOST_ID_RETRY_MASK) !=
-	    (resp_host_id & MORSE_CMD_HOST_ID_RETRY_MASK))
-		MORSE_INFO(mors, "Command retry mismatch 0x%04x:%04x 0x%04x:%04x\n",
-			   message_id, host_id, resp_message_id, resp_host_id);
-
-	resp_cb = (struct morse_cmd_resp_cb *)IEEE80211_SKB_CB(cmd_skb)->driver_data;
-	length = resp_cb->length;
-	dest_resp = resp_cb->dest_resp;
-	if (length >= sizeof(struct morse_cmd_resp) && dest_resp) {
+
+	length = cmd->length;
+	if (length >= sizeof(struct morse_cmd_resp) && cmd->dest_resp) {
 		ret = 0;
 		length = min_t(int, length, le16_to_cpu(src_resp->hdr.len) +
 			       sizeof(struct morse_cmd_header));
-		memcpy(dest_resp, src_resp, length);
+		memcpy(cmd->dest_resp, src_resp, length);
 	} else {
 		ret = le32_to_cpu(src_resp->status);
 	}
 
-	resp_cb->ret = ret;
+	cmd->ret = ret;
+	complete(&cmd->comp);
 
 exit:
-	if (cmd_skb && !is_late_response) {
-		/* Complete if not already timed out */
-		if (mors->cmd_comp)
-			complete(mors->cmd_comp);
-	}
-
 	mutex_unlock(&mors->cmd_lock);
 exit_free:
 	dev_kfree_skb(skb);
@@ -5,6 +5,7 @@
  *
  */
 
+#include <linux/math64.h>
 #include <linux/ratelimit.h>
 #include <linux/semaphore.h>
 #include <linux/wait.h>
@@ -54,6 +55,8 @@ static const char * const morse_log_features[] = {
 	[FEATURE_ID_YAPS] = "yaps",
 	[FEATURE_ID_USB] = "usb",
 	[FEATURE_ID_HWCLOCK] = "hwclock",
+	[FEATURE_ID_APF] = "apf",
+	[FEATURE_ID_LOOPBACK] = "loopback",
 };
 
 /*
@@ -166,6 +169,8 @@ static int read_page_stats(struct seq_file *file, void *data)
 	print_stat(file, "Invalid checksum", mors->debug.page_stats.invalid_checksum);
 	print_stat(file, "Invalid TX status checksum",
 		mors->debug.page_stats.invalid_tx_status_checksum);
+	print_stat(file, "RX burst reads", mors->debug.page_stats.rx_burst_reads);
+	print_stat(file, "RX pages read in bursts", mors->debug.page_stats.rx_burst_pages);
 
 	return 0;
 }
@@ -198,6 +203,60 @@ static int read_firmware_path(struct seq_file *file, void *data)
 	return 0;
 }
 
+static int read_firmware_load(struct seq_file *file, void *data)
+{
+	struct morse *mors = dev_get_drvdata(file->private);
+	const struct morse_fw_load_info *info = &mors->fw_load;
+
+	seq_printf(file, "Image crc32: 0x%08x\n", info->image_crc);
+	seq_printf(file, "Segments: %u\n", info->num_segments);
+	seq_printf(file, "Bytes written: %u\n", info->bytes_written);
+	seq_printf(file, "Bytes skipped: %u\n", info->bytes_skipped);
+	seq_printf(file, "Write (us): %u\n", info->write_us);
+	seq_printf(file, "Verify (us): %u\n", info->verify_us);
+	seq_printf(file, "BCF (us): %u\n", info->bcf_us);
+	seq_printf(file, "Boot (us): %u\n", info->boot_us);
+	seq_printf(file, "Total (us): %u\n", info->total_us);
+
+	return 0;
+}
+
+static void read_wq_stats(struct seq_file *file, const char *name, struct morse_wq_stats *stats)
+{
+	u64 now_ns = ktime_get_ns();
+	u64 busy_ns = atomic64_read(&stats->busy_ns);
+	u64 window_ns = stats->last_read_ns ? now_ns - stats->last_read_ns : 0;
+	u64 window_busy_ns = busy_ns - stats->last_read_busy_ns;
+
+	seq_printf(file, "%s:\n", name);
+	seq_printf(file, "  Runs: %llu\n", (u64)atomic64_read(&stats->runs));
+	seq_printf(file, "  Busy (ms): %llu\n", div_u64(busy_ns, NSEC_PER_MSEC));
+	seq_printf(file, "  Max run (us): %llu\n", div_u64(READ_ONCE(stats->max_ns), NSEC_PER_USEC));
+	if (window_ns)
+		seq_printf(file, "  Utilisation since last read: %llu%%\n",
+			   div64_u64(window_busy_ns * 100, window_ns));
+
+	stats->last_read_busy_ns = busy_ns;
+	stats->last_read_ns = now_ns;
+}
+
+static int read_workqueues(struct seq_file *file, void *data)
+{
+	struct morse *mors = dev_get_drvdata(file->private);
+
+	seq_printf(file, "High priority: %s\n", wq_highpri ? "yes" : "no");
+	if (net_wq_max_active <= 1)
+		seq_puts(file, "Net workqueue: ordered\n");
+	else
+		seq_printf(file, "Net workqueue: unbound, max active %u\n",
+			   min_t(uint, net_wq_max_active, WQ_MAX_ACTIVE));
+
+	read_wq_stats(file, "Chip interface work", &mors->chip_wq_stats);
+	read_wq_stats(file, "Net dispatch work", &mors->net_wq_stats);
+
+	return 0;
+}
+
 static const char *rc_method_to_string(enum morse_rc_method method)
 {
 	switch (method) {
@@ -392,10 +451,14 @@ static int dump_raw_configs(struct seq_file *file, void *data)
 					config->periodic.periodicity);
 			}
 			if (config->beacon_spreading.nominal_sta_per_beacon) {
-				seq_printf(file, "  bcn spread: max=%d nom_spb=%d, last=%d\n",
+				seq_printf(file,
+					"  bcn spread: max=%d nom_spb=%d, last=%d spb=%u(+%u) next_idx=%d\n",
 					config->beacon_spreading.max_spread,
 					config->beacon_spreading.nominal_sta_per_beacon,
-					config->beacon_spreading.last_aid);
+					config->beacon_spreading.last_aid,
+					config->beacon_spreading.sta_per_beacon,
+					config->beacon_spreading.sta_per_beacon_mod,
+					config->beacon_spreading.next_aid_idx);
 			}
 			seq_puts(file, "\n");
 		}
@@ -1122,6 +1185,12 @@ int morse_init_debug(struct morse *mors)
 	debugfs_create_devm_seqfile(mors->dev, "firmware_path",
 				    mors->debug.debugfs_phy, read_firmware_path);
 
+	debugfs_create_devm_seqfile(mors->dev, "firmware_load",
+				    mors->debug.debugfs_phy, read_firmware_load);
+
+	debugfs_create_devm_seqfile(mors->dev, "workqueues",
+				    mors->debug.debugfs_phy, read_workqueues);
+
 	debugfs_create_devm_seqfile(mors->dev, "vendor_info",
 				    mors->debug.debugfs_phy, read_vendor_info_tbl);
 
@@ -52,6 +52,7 @@ enum morse_feature_id {
 	FEATURE_ID_USB,
 	FEATURE_ID_HWCLOCK,
 	FEATURE_ID_APF,
+	FEATURE_ID_LOOPBACK,
 	NUM_FEATURE_IDS
 };
 
@@ -358,8 +358,17 @@ struct morse_dot11ah_s1g_assoc_resp {
 	u8 variable[];
 };
 
+/**
+ * struct morse_dot11ah_cssid_item - Cached BSS information, keyed by BSSID.
+ *
+ * Items are looked up under rcu_read_lock() and must not be held past the
+ * matching rcu_read_unlock(). The stored IEs are immutable: when they change
+ * the whole item is replaced and the old one freed after a grace period.
+ * The remaining scalar fields are updated in place.
+ */
 struct morse_dot11ah_cssid_item {
-	struct list_head list;
+	struct hlist_node node;
+	struct rcu_head rcu;
 	__le32 cssid;
 	unsigned long last_seen;
 	u16 capab_info;
@@ -368,11 +377,13 @@ struct morse_dot11ah_cssid_item {
 	u8 ssid[IEEE80211_MAX_SSID_LEN];
 	/** Set to true if beacon contains MESH ID otherwise false */
 	bool mesh_beacon;
-	int ies_len;
-	u8 *ies;
 	u8 fc_bss_bw_subfield;
 	/** Beacon interval */
 	u16 beacon_int;
+	/** CRC32 of @ies, checked before comparing IEs byte by byte */
+	u32 ies_crc;
+	int ies_len;
+	u8 ies[];
 };
 
 /*
@@ -440,8 +451,8 @@ struct dot11ah_update_rx_beacon_vals {
 	__le16 bcn_int;
 	u8 tim_len;
 	const u8 *tim_ie;
-	u8 cssid_ies_len;
-	u8 *cssid_ies;
+	int cssid_ies_len;
+	const u8 *cssid_ies;
 };
 
 struct s1g_operation_params_expanded {
@@ -511,12 +522,23 @@ struct ie_element {
 	struct ie_element *next;
 };
 
+/* Number of repeated-EID list entries held in each ies mask before falling back to kzalloc */
+#define DOT11AH_IES_MASK_NUM_EXTRA		(16)
+/* Bytes held in each ies mask for inserted element data before falling back to kzalloc */
+#define DOT11AH_IES_MASK_ARENA_SIZE		(512)
+
 /**
  * struct dot11ah_ies_mask - Stores IE values
  *
  * @ies: Array of IEs, indexed by element ID
  * @more_than_one_ie: bitmask where if bit is set, there are multiple IEs with the same element ID
  *	in the mask
+ * @present: bitmask of the element IDs which have been populated, so that clearing the mask is
+ *	proportional to the number of IEs rather than %DOT11AH_MAX_EID
+ * @extra: preallocated entries for the lists of repeated element IDs
+ * @n_extra: number of @extra entries in use
+ * @arena: preallocated storage for the data of inserted elements
+ * @arena_used: number of @arena bytes in use
  * @fils_data: FILS Session element and encrypted data, which if present, is always at the end of a
  *	management frame
  * @fils_data_length: Length of the FILS Session element and encrypted data
@@ -525,12 +547,15 @@ struct dot11ah_ies_mask {
 	struct ie_element ies[DOT11AH_MAX_EID];
 	/* makes freeing/clearing easier */
 	DECLARE_BITMAP(more_than_one_ie, DOT11AH_MAX_EID);
+	DECLARE_BITMAP(present, DOT11AH_MAX_EID);
+	struct ie_element extra[DOT11AH_IES_MASK_NUM_EXTRA];
+	u8 n_extra;
+	u16 arena_used;
+	u8 arena[DOT11AH_IES_MASK_ARENA_SIZE] __aligned(sizeof(u64));
 	u8 *fils_data;
 	int fils_data_len;
 };
 
-extern spinlock_t cssid_list_lock;
-
 struct morse_channel {
 	u32 frequency_khz;
 	u8 channel_5g;
@@ -588,8 +613,33 @@ int morse_dot11ah_s1g_to_probe_resp_ies_size(struct dot11ah_ies_mask *ies_mask);
 void morse_dot11ah_s1g_to_probe_resp_ies(u8 *ies_11n, int length_11n,
 					 struct dot11ah_ies_mask *ies_mask);
 
+/**
+ * morse_dot11ah_ies_mask_alloc() - Get an empty ies mask
+ *
+ * Masks are taken from a small per-CPU pool of preallocated masks, falling back to an atomic
+ * allocation when the pool is empty. Release with morse_dot11ah_ies_mask_free().
+ *
+ * Return: an empty ies mask, or NULL on allocation failure
+ */
 struct dot11ah_ies_mask *morse_dot11ah_ies_mask_alloc(void);
 
+int morse_dot11ah_ies_mask_pool_init(void);
+
+void morse_dot11ah_ies_mask_pool_finish(void);
+
+/**
+ * morse_dot11_ies_mask_set_ie() - Point an ies mask entry at existing element data
+ *
+ * @ies_mask: ies mask to update
+ * @eid: element ID
+ * @ptr: element data, not owned by the mask
+ * @len: length of @ptr
+ *
+ * Use this instead of assigning &dot11ah_ies_mask->ies directly, so the entry is cleared when
+ * the mask is.
+ */
+void morse_dot11_ies_mask_set_ie(struct dot11ah_ies_mask *ies_mask, u8 eid, u8 *ptr, u8 len);
+
 void morse_dot11ah_ies_mask_free(struct dot11ah_ies_mask *ies_mask);
 
 void morse_dot11ah_mask_ies(struct dot11ah_ies_mask *ies_mask, bool mask_ext_cap, bool is_beacon);
@@ -690,15 +740,14 @@ int morse_dot11ah_s1g_chan_to_5g_chan(int chan_s1g);
 u32 morse_dot11ah_channel_get_flags(int chan_s1g);
 
 /**
- * morse_dot11ah_find_cssid_item_for_bssid() - Find the cssid list entry matching with given bssid.
+ * morse_dot11ah_find_bssid() - Find the cssid cache entry matching with given bssid.
  * @bssid: bssid for the item to find
  *
- * Use of this function and any returned items must be protected with cssid_list_lock
+ * Must be called under rcu_read_lock(), and the returned item must not be used after
+ * the matching rcu_read_unlock(). Refreshes the entry's last seen time.
  *
- * Return: the cssid list entry if entry with matching bssid found, NULL otherwise.
+ * Return: the cssid cache entry if entry with matching bssid found, NULL otherwise.
  */
-struct morse_dot11ah_cssid_item *morse_dot11ah_find_cssid_item_for_bssid(const u8 bssid[ETH_ALEN]);
-
 struct morse_dot11ah_cssid_item *morse_dot11ah_find_bssid(const u8 bssid[ETH_ALEN]);
 
 /**
@@ -264,7 +264,24 @@ static const u8 morse_mgmt_mesh_peering_mgmt_ies_order[] = {
 		WLAN_EID_MIC,
 };
 
-static void free_eid_ies_list(struct ie_element *list_head)
+/* Number of empty ies masks kept ready on each CPU */
+#define DOT11AH_IES_MASK_POOL_SIZE	(4)
+
+struct dot11ah_ies_mask_pool {
+	struct dot11ah_ies_mask *masks[DOT11AH_IES_MASK_POOL_SIZE];
+	unsigned int count;
+};
+
+static DEFINE_PER_CPU(struct dot11ah_ies_mask_pool, ies_mask_pool);
+
+static bool ies_mask_owns_element(const struct dot11ah_ies_mask *ies_mask,
+				  const struct ie_element *element)
+{
+	return element >= ies_mask->extra &&
+	       element < ies_mask->extra + ARRAY_SIZE(ies_mask->extra);
+}
+
+static void free_eid_ies_list(struct dot11ah_ies_mask *ies_mask, struct ie_element *list_head)
 {
 	struct ie_element *next, *cur;
 
@@ -272,26 +289,73 @@ static void free_eid_ies_list(struct ie_element *list_head)
 		next = cur->next;
 		if (cur->needs_free)
 			kfree(cur->ptr);
-		kfree(cur);
+		if (!ies_mask_owns_element(ies_mask, cur))
+			kfree(cur);
 	}
 }
 
+static struct ie_element *ies_mask_new_element(struct dot11ah_ies_mask *ies_mask)
+{
+	if (ies_mask->n_extra < ARRAY_SIZE(ies_mask->extra))
+		return &ies_mask->extra[ies_mask->n_extra++];
+
+	return kzalloc(sizeof(struct ie_element), GFP_ATOMIC);
+}
+
+/* Zeroed element data from the mask arena, or NULL if it is exhausted */
+static u8 *ies_mask_arena_alloc(struct dot11ah_ies_mask *ies_mask, int length)
+{
+	u16 size = ALIGN(length, sizeof(u64));
+	u8 *ptr;
+
+	if (ies_mask->arena_used + size > sizeof(ies_mask->arena))
+		return NULL;
+
+	ptr = &ies_mask->arena[ies_mask->arena_used];
+	ies_mask->arena_used += size;
+	memset(ptr, 0, length);
+
+	return ptr;
+}
+
 void morse_dot11_clear_eid_from_ies_mask(struct dot11ah_ies_mask *ies_mask, u8 eid)
 {
-	free_eid_ies_list(ies_mask->ies[eid].next);
+	free_eid_ies_list(ies_mask, ies_mask->ies[eid].next);
 	if (ies_mask->ies[eid].needs_free)
 		kfree(ies_mask->ies[eid].ptr);
 	ies_mask->ies[eid].ptr = NULL;
 	ies_mask->ies[eid].len = 0;
+	ies_mask->ies[eid].needs_free = false;
+	ies_mask->ies[eid].next = NULL;
+	clear_bit(eid, ies_mask->more_than_one_ie);
+	clear_bit(eid, ies_mask->present);
 }
 EXPORT_SYMBOL(morse_dot11_clear_eid_from_ies_mask);
 
+void morse_dot11_ies_mask_set_ie(struct dot11ah_ies_mask *ies_mask, u8 eid, u8 *ptr, u8 len)
+{
+	ies_mask->ies[eid].ptr = ptr;
+	ies_mask->ies[eid].len = len;
+	ies_mask->ies[eid].needs_free = false;
+	set_bit(eid, ies_mask->present);
+}
+EXPORT_SYMBOL(morse_dot11_ies_mask_set_ie);
+
 struct dot11ah_ies_mask *morse_dot11ah_ies_mask_alloc(void)
 {
+	struct dot11ah_ies_mask_pool *pool;
 	struct dot11ah_ies_mask *ies_mask = NULL;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pool = this_cpu_ptr(&ies_mask_pool);
+	if (pool->count)
+		ies_mask = pool->masks[--pool->count];
+	local_irq_restore(flags);
 
 	/* Atomic as ies mask can be allocated from the beacon tasklet */
-	ies_mask = kzalloc(sizeof(*ies_mask), GFP_ATOMIC);
+	if (!ies_mask)
+		ies_mask = kzalloc(sizeof(*ies_mask), GFP_ATOMIC);
 
 	return ies_mask;
 }
@@ -299,18 +363,21 @@ EXPORT_SYMBOL(morse_dot11ah_ies_mask_alloc);
 
 void morse_dot11ah_ies_mask_free(struct dot11ah_ies_mask *ies_mask)
 {
-	int pos;
+	struct dot11ah_ies_mask_pool *pool;
+	unsigned long flags;
 
 	if (!ies_mask)
 		return;
 
-	for_each_set_bit(pos, ies_mask->more_than_one_ie, DOT11AH_MAX_EID)
-		free_eid_ies_list(ies_mask->ies[pos].next);
+	morse_dot11ah_ies_mask_clear(ies_mask);
 
-	for (pos = 0; pos < ARRAY_SIZE(ies_mask->ies); pos++) {
-		if (ies_mask->ies[pos].needs_free)
-			kfree(ies_mask->ies[pos].ptr);
+	local_irq_save(flags);
+	pool = this_cpu_ptr(&ies_mask_pool);
+	if (pool->count < ARRAY_SIZE(pool->masks)) {
+		pool->masks[pool->count++] = ies_mask;
+		ies_mask = NULL;
 	}
+	local_irq_restore(flags);
 
 	kfree(ies_mask);
 }
@@ -323,20 +390,62 @@ void morse_dot11ah_ies_mask_clear(struct dot11ah_ies_mask *ies_mask)
 	if (!ies_mask)
 		return;
 
-	for_each_set_bit(pos, ies_mask->more_than_one_ie, DOT11AH_MAX_EID) {
-		free_eid_ies_list(ies_mask->ies[pos].next);
-	}
+	for_each_set_bit(pos, ies_mask->present, DOT11AH_MAX_EID) {
+		if (test_bit(pos, ies_mask->more_than_one_ie))
+			free_eid_ies_list(ies_mask, ies_mask->ies[pos].next);
 
-	for (pos = 0; pos < ARRAY_SIZE(ies_mask->ies); pos++) {
 		if (ies_mask->ies[pos].needs_free)
 			kfree(ies_mask->ies[pos].ptr);
+
+		memset(&ies_mask->ies[pos], 0, sizeof(ies_mask->ies[pos]));
 	}
 
 	/* clear the ies_mask */
-	memset(ies_mask, 0, sizeof(*ies_mask));
+	bitmap_zero(ies_mask->present, DOT11AH_MAX_EID);
+	bitmap_zero(ies_mask->more_than_one_ie, DOT11AH_MAX_EID);
+	memset(ies_mask->extra, 0, ies_mask->n_extra * sizeof(ies_mask->extra[0]));
+	ies_mask->n_extra = 0;
+	ies_mask->arena_used = 0;
+	ies_mask->fils_data = NULL;
+	ies_mask->fils_data_len = 0;
 }
 EXPORT_SYMBOL(morse_dot11ah_ies_mask_clear);
 
+int morse_dot11ah_ies_mask_pool_init(void)
+{
+	struct dot11ah_ies_mask_pool *pool;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pool = per_cpu_ptr(&ies_mask_pool, cpu);
+
+		while (pool->count < ARRAY_SIZE(pool->masks)) {
+			pool->masks[pool->count] = kzalloc(sizeof(struct dot11ah_ies_mask),
+							   GFP_KERNEL);
+			if (!pool->masks[pool->count]) {
+				morse_dot11ah_ies_mask_pool_finish();
+				return -ENOMEM;
+			}
+			pool->count++;
+		}
+	}
+
+	return 0;
+}
+
+void morse_dot11ah_ies_mask_pool_finish(void)
+{
+	struct dot11ah_ies_mask_pool *pool;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pool = per_cpu_ptr(&ies_mask_pool, cpu);
+
+		while (pool->count)
+			kfree(pool->masks[--pool->count]);
+	}
+}
+
 struct ie_element *morse_dot11_ies_create_ie_element(struct dot11ah_ies_mask *ies_mask,
 	u8 eid, int length, bool alloc, bool only_one)
 {
@@ -351,7 +460,7 @@ struct ie_element *morse_dot11_ies_create_ie_element(struct dot11ah_ies_mask *ie
 			for (cur = &ies_mask->ies[eid]; cur->next; cur = cur->next)
 				continue; /* walk to the end of the list */
 
-			new = kzalloc(sizeof(*new), GFP_ATOMIC);
+			new = ies_mask_new_element(ies_mask);
 			if (!new)
 				return NULL;
 
@@ -361,11 +470,17 @@ struct ie_element *morse_dot11_ies_create_ie_element(struct dot11ah_ies_mask *ie
 		}
 	}
 
+	set_bit(eid, ies_mask->present);
+
 	if (alloc) {
-		cur->ptr = kzalloc(length, GFP_ATOMIC);
-		if (!cur->ptr)
-			return NULL;
-		cur->needs_free = true;
+		cur->ptr = ies_mask_arena_alloc(ies_mask, length);
+		cur->needs_free = false;
+		if (!cur->ptr) {
+			cur->ptr = kzalloc(length, GFP_ATOMIC);
+			if (!cur->ptr)
+				return NULL;
+			cur->needs_free = true;
+		}
 	} else {
 		cur->needs_free = false;
 	}
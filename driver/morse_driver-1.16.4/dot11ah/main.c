@@ -5,8 +5,10 @@
  */
 
 #include <linux/types.h>
-#include <linux/list.h>
+#include <linux/hashtable.h>
+#include <linux/rculist.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 #include <net/mac80211.h>
 #include <linux/crc32.h>
 #include <linux/ieee80211.h>
@@ -20,9 +22,21 @@
 /* Validity of the cssid entry */
 #define MORSE_CSSID_ENTRY_VALIDITY_TIME	(60 * HZ)
 
-/* Serialise operations that manipulate the CSSID list */
-spinlock_t cssid_list_lock;
-static LIST_HEAD(cssid_list);
+/* Period of the deferred sweep that removes expired cssid entries */
+#define MORSE_CSSID_EXPIRY_INTERVAL	(10 * HZ)
+
+/* log2 of the number of buckets in the cssid cache */
+#define MORSE_CSSID_HASH_BITS		(6)
+
+/*
+ * CSSID cache, keyed by BSSID. Lookups on the RX path run under RCU; the lock only
+ * serialises insertion, replacement and removal of entries.
+ */
+static DEFINE_HASHTABLE(cssid_table, MORSE_CSSID_HASH_BITS);
+static DEFINE_SPINLOCK(cssid_table_lock);
+
+static void morse_dot11ah_cssid_expiry_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(cssid_expiry_work, morse_dot11ah_cssid_expiry_work);
 
 /*
  * Static functions used only here
@@ -31,14 +45,19 @@ static int __init morse_dot11ah_init(void)
 {
 	int ret = 0;
 
-	spin_lock_init(&cssid_list_lock);
+	ret = morse_dot11ah_ies_mask_pool_init();
+	if (ret)
+		return ret;
+
 	pr_info("Morse Micro Dot11ah driver registration. Version %s\n", DOT11AH_VERSION);
 	return ret;
 }
 
 static void __exit morse_dot11ah_exit(void)
 {
+	cancel_delayed_work_sync(&cssid_expiry_work);
 	morse_dot11ah_clear_list();
+	morse_dot11ah_ies_mask_pool_finish();
 }
 
 /** morse_dot11ah_cssid_has_expired - Checks if the given cssid entry is expired or not.
@@ -56,47 +75,119 @@ static bool morse_dot11ah_cssid_has_expired(struct morse_dot11ah_cssid_item *ite
 	else
 		age_limit = MORSE_CSSID_ENTRY_VALIDITY_TIME;
 
-	if (time_before(item->last_seen + age_limit, jiffies))
+	if (time_before(READ_ONCE(item->last_seen) + age_limit, jiffies))
 		return true;
 
 	return false;
 }
 
-/*
- * Public functions used in  dot11ah module
+/* Must be called with cssid_table_lock held */
+static void morse_dot11ah_cssid_del(struct morse_dot11ah_cssid_item *item)
+{
+	hash_del_rcu(&item->node);
+	kfree_rcu(item, rcu);
+}
+
+static void morse_dot11ah_cssid_expiry_work(struct work_struct *work)
+{
+	struct morse_dot11ah_cssid_item *item;
+	struct hlist_node *tmp;
+	bool empty;
+	int bkt;
+
+	spin_lock_bh(&cssid_table_lock);
+	hash_for_each_safe(cssid_table, bkt, tmp, item, node) {
+		if (morse_dot11ah_cssid_has_expired(item))
+			morse_dot11ah_cssid_del(item);
+	}
+	empty = hash_empty(cssid_table);
+	spin_unlock_bh(&cssid_table_lock);
+
+	if (!empty)
+		schedule_delayed_work(&cssid_expiry_work, MORSE_CSSID_EXPIRY_INTERVAL);
+}
+
+/**
+ * morse_dot11ah_cssid_ies_crc - CRC32 of the IEs an entry would store.
+ * @s1g_ies: IEs from the received frame (may be NULL).
+ * @s1g_ies_len: length of @s1g_ies.
+ * @rsn_ie: RSN IE to append after @s1g_ies, or NULL.
+ * @rsnx_ie: RSNX IE to append after @rsn_ie, or NULL.
+ *
+ * Return: the CRC of the concatenated IEs.
  */
-struct morse_dot11ah_cssid_item *morse_dot11ah_find_cssid_item_for_bssid(const u8 bssid[ETH_ALEN])
+static u32 morse_dot11ah_cssid_ies_crc(const u8 *s1g_ies, int s1g_ies_len,
+				       const u8 *rsn_ie, const u8 *rsnx_ie)
 {
-	struct morse_dot11ah_cssid_item *item, *tmp;
-	u64 bssid_64 = mac2uint64(bssid);
+	u32 crc = ~0;
 
-	list_for_each_entry_safe(item, tmp, &cssid_list, list) {
-		if (mac2uint64(item->bssid) == bssid_64) {
-			item->last_seen = jiffies;
-			return item;
-		}
+	if (s1g_ies)
+		crc = crc32(crc, s1g_ies, s1g_ies_len);
+	if (rsn_ie)
+		crc = crc32(crc, rsn_ie, rsn_ie[1] + 2);
+	if (rsnx_ie)
+		crc = crc32(crc, rsnx_ie, rsnx_ie[1] + 2);
 
-		if (morse_dot11ah_cssid_has_expired(item)) {
-			list_del(&item->list);
-			kfree(item->ies);
-			kfree(item);
-		}
+	return crc;
+}
+
+/* Compare stored IEs against the IEs that morse_dot11ah_cssid_ies_crc() describes */
+static bool morse_dot11ah_cssid_ies_equal(const struct morse_dot11ah_cssid_item *item,
+					  const u8 *s1g_ies, int s1g_ies_len,
+					  const u8 *rsn_ie, const u8 *rsnx_ie)
+{
+	const u8 *pos = item->ies;
+
+	if (s1g_ies) {
+		if (memcmp(pos, s1g_ies, s1g_ies_len))
+			return false;
+		pos += s1g_ies_len;
+	}
+	if (rsn_ie) {
+		if (memcmp(pos, rsn_ie, rsn_ie[1] + 2))
+			return false;
+		pos += rsn_ie[1] + 2;
 	}
+	if (rsnx_ie && memcmp(pos, rsnx_ie, rsnx_ie[1] + 2))
+		return false;
 
-	return NULL;
+	return true;
 }
 
-/** Use of this function and any returned items must be protected with cssid_list_lock */
+static void morse_dot11ah_cssid_fill_ies(struct morse_dot11ah_cssid_item *item,
+					 const u8 *s1g_ies, int s1g_ies_len,
+					 const u8 *rsn_ie, const u8 *rsnx_ie)
+{
+	u8 *pos = item->ies;
+
+	if (s1g_ies) {
+		memcpy(pos, s1g_ies, s1g_ies_len);
+		pos += s1g_ies_len;
+	}
+	if (rsn_ie) {
+		memcpy(pos, rsn_ie, rsn_ie[1] + 2);
+		pos += rsn_ie[1] + 2;
+	}
+	if (rsnx_ie)
+		memcpy(pos, rsnx_ie, rsnx_ie[1] + 2);
+}
+
+/*
+ * Public functions used in  dot11ah module
+ */
 struct morse_dot11ah_cssid_item *morse_dot11ah_find_bssid(const u8 bssid[ETH_ALEN])
 {
-	struct morse_dot11ah_cssid_item *item, *tmp;
+	struct morse_dot11ah_cssid_item *item;
+	u64 bssid_64;
 
 	if (!bssid)
 		return NULL;
 
-	list_for_each_entry_safe(item, tmp, &cssid_list, list) {
-		if (memcmp(item->bssid, bssid, ETH_ALEN) == 0) {
-			item->last_seen = jiffies;
+	bssid_64 = mac2uint64(bssid);
+
+	hash_for_each_possible_rcu(cssid_table, item, node, bssid_64) {
+		if (mac2uint64(item->bssid) == bssid_64) {
+			WRITE_ONCE(item->last_seen, jiffies);
 			return item;
 		}
 	}
@@ -112,7 +203,11 @@ void morse_dot11ah_store_cssid(struct dot11ah_ies_mask *ies_mask, u16 capab_info
 	 * within a spin lock.
 	 */
 	struct morse_dot11ah_cssid_item *item, *stored;
+	const u8 *rsn_ie = NULL;
+	const u8 *rsnx_ie = NULL;
 	u32 cssid = 0;
+	int ies_len;
+	u32 ies_crc;
 	int length;
 	const u8 *ssid;
 	u8 network_id_eid;
@@ -120,71 +215,64 @@ void morse_dot11ah_store_cssid(struct dot11ah_ies_mask *ies_mask, u16 capab_info
 	if (WARN_ON(!bssid))
 		return;
 
+	if (!s1g_ies)
+		s1g_ies_len = 0;
+
 	network_id_eid = morse_is_mesh_network(ies_mask) ? WLAN_EID_MESH_ID : WLAN_EID_SSID;
-	cssid = morse_generate_cssid(ies_mask->ies[network_id_eid].ptr,
-		ies_mask->ies[network_id_eid].len);
 	ssid = ies_mask->ies[network_id_eid].ptr;
 	length = ies_mask->ies[network_id_eid].len;
 
-	spin_lock_bh(&cssid_list_lock);
-	stored = morse_dot11ah_find_cssid_item_for_bssid(bssid);
+	spin_lock_bh(&cssid_table_lock);
+	stored = morse_dot11ah_find_bssid(bssid);
 
 	if (stored) {
-		int s1g_ies_len_updated = s1g_ies_len;
-		bool update_beacon = (vals && vals->cssid_ies);
-		bool stored_ies_needs_update;
-		u8 *s1g_ies_updated;
-
 		if (stored->capab_info != capab_info && capab_info != 0)
-			stored->capab_info = capab_info;
-
-		if (update_beacon && s1g_ies) {
-			/* Get the RSN/RSNX IE from stored IEs to update incoming beacon IEs */
-			const u8 *rsn_ie = morse_dot11_find_ie(WLAN_EID_RSN, vals->cssid_ies,
-						vals->cssid_ies_len);
-			const u8 *rsnx_ie = morse_dot11_find_ie(WLAN_EID_RSNX, vals->cssid_ies,
-						vals->cssid_ies_len);
-
-			/* Update IEs length with RSN/RSNX IE if present */
-			if (rsn_ie && !ies_mask->ies[WLAN_EID_RSN].ptr)
-				s1g_ies_len_updated += *(rsn_ie + 1) + 2;
-			if (rsnx_ie && !ies_mask->ies[WLAN_EID_RSNX].ptr)
-				s1g_ies_len_updated += *(rsnx_ie + 1) + 2;
-		}
-		s1g_ies_updated = kmalloc(s1g_ies_len_updated, GFP_ATOMIC);
+			WRITE_ONCE(stored->capab_info, capab_info);
 
 		/*
-		 * Take a copy of the new beacon's IEs and insert the stored RSN IEs, in order to
-		 * check for differences other than in the RSN IEs.
+		 * Beacons do not carry the RSN/RSNX IEs learnt from the probe response. Keep
+		 * them in the stored IEs so only other differences cause an update.
 		 */
-		if (s1g_ies && s1g_ies_updated) {
-			memcpy(s1g_ies_updated, s1g_ies, s1g_ies_len);
-
-			/* Update beacon IEs with stored RSN and RSNX IE (from probe response)
-			 * before storing again.
-			 */
-			if (update_beacon)
-				morse_dot11_insert_rsn_and_rsnx_ie(s1g_ies_updated + s1g_ies_len,
-								   vals, ies_mask);
-		}
-
-		stored_ies_needs_update = (s1g_ies_updated &&
-				(stored->ies_len != s1g_ies_len_updated ||
-				 memcmp(stored->ies, s1g_ies_updated, stored->ies_len) != 0));
-
-		if (stored_ies_needs_update) {
-			kfree(stored->ies);
-			stored->ies = s1g_ies_updated;
-			stored->ies_len = s1g_ies_len_updated;
-		} else {
-			kfree(s1g_ies_updated);
+		if (vals && vals->cssid_ies && s1g_ies) {
+			rsn_ie = morse_dot11_find_ie(WLAN_EID_RSN, vals->cssid_ies,
+						     vals->cssid_ies_len);
+			rsnx_ie = morse_dot11_find_ie(WLAN_EID_RSNX, vals->cssid_ies,
+						      vals->cssid_ies_len);
+			if (ies_mask->ies[WLAN_EID_RSN].ptr)
+				rsn_ie = NULL;
+			if (ies_mask->ies[WLAN_EID_RSNX].ptr)
+				rsnx_ie = NULL;
 		}
 
-		memcpy(stored->bssid, bssid, ETH_ALEN);
+		ies_len = s1g_ies_len;
+		if (rsn_ie)
+			ies_len += rsn_ie[1] + 2;
+		if (rsnx_ie)
+			ies_len += rsnx_ie[1] + 2;
+		ies_crc = morse_dot11ah_cssid_ies_crc(s1g_ies, s1g_ies_len, rsn_ie, rsnx_ie);
+
+		if (stored->ies_len == ies_len && stored->ies_crc == ies_crc &&
+		    morse_dot11ah_cssid_ies_equal(stored, s1g_ies, s1g_ies_len, rsn_ie, rsnx_ie))
+			goto exit;
+
+		/* IEs changed: publish a new copy of the entry in place of the stored one */
+		item = kmalloc(struct_size(item, ies, ies_len), GFP_ATOMIC);
+		if (!item)
+			goto exit;
+
+		memcpy(item, stored, sizeof(*item));
+		item->ies_len = ies_len;
+		item->ies_crc = ies_crc;
+		morse_dot11ah_cssid_fill_ies(item, s1g_ies, s1g_ies_len, rsn_ie, rsnx_ie);
+
+		hlist_replace_rcu(&stored->node, &item->node);
+		kfree_rcu(stored, rcu);
 		goto exit;
 	}
 
-	item = kmalloc(sizeof(*item), GFP_ATOMIC);
+	cssid = morse_generate_cssid(ssid, length);
+
+	item = kmalloc(struct_size(item, ies, s1g_ies_len), GFP_ATOMIC);
 	if (!item)
 		goto exit;
 
@@ -194,23 +282,21 @@ void morse_dot11ah_store_cssid(struct dot11ah_ies_mask *ies_mask, u16 capab_info
 	item->capab_info = capab_info;
 	item->fc_bss_bw_subfield = MORSE_FC_BSS_BW_INVALID;
 	item->mesh_beacon = (network_id_eid == WLAN_EID_MESH_ID);
+	item->beacon_int = 0;
 	memcpy(item->ssid, ssid, length);
 
-	item->ies = kmalloc(s1g_ies_len, GFP_ATOMIC);
-	if (!item->ies) {
-		kfree(item);
-		goto exit;
-	}
-
 	item->ies_len = s1g_ies_len;
-
-	memcpy(item->ies, s1g_ies, s1g_ies_len);
+	item->ies_crc = morse_dot11ah_cssid_ies_crc(s1g_ies, s1g_ies_len, NULL, NULL);
+	morse_dot11ah_cssid_fill_ies(item, s1g_ies, s1g_ies_len, NULL, NULL);
 	memcpy(item->bssid, bssid, ETH_ALEN);
 
-	list_add(&item->list, &cssid_list);
+	hash_add_rcu(cssid_table, &item->node, mac2uint64(bssid));
+
+	/* No-op if the sweep is already scheduled */
+	schedule_delayed_work(&cssid_expiry_work, MORSE_CSSID_EXPIRY_INTERVAL);
 
 exit:
-	spin_unlock_bh(&cssid_list_lock);
+	spin_unlock_bh(&cssid_table_lock);
 }
 
 /*
@@ -224,7 +310,7 @@ bool morse_mac_find_channel_info_for_bssid(const u8 bssid[ETH_ALEN],
 	u8 *op = NULL;
 	struct morse_dot11ah_cssid_item *item = NULL;
 
-	spin_lock_bh(&cssid_list_lock);
+	rcu_read_lock();
 
 	item = morse_dot11ah_find_bssid(bssid);
 
@@ -246,7 +332,7 @@ bool morse_mac_find_channel_info_for_bssid(const u8 bssid[ETH_ALEN],
 		}
 	}
 
-	spin_unlock_bh(&cssid_list_lock);
+	rcu_read_unlock();
 
 	return found;
 }
@@ -255,11 +341,12 @@ EXPORT_SYMBOL(morse_mac_find_channel_info_for_bssid);
 int morse_dot11_find_bssid_on_channel(u32 op_chan_freq_hz, u8 bssid[ETH_ALEN])
 {
 	bool found = false;
-	struct morse_dot11ah_cssid_item *item, *tmp;
+	struct morse_dot11ah_cssid_item *item;
+	int bkt;
 
-	spin_lock_bh(&cssid_list_lock);
+	rcu_read_lock();
 
-	list_for_each_entry_safe(item, tmp, &cssid_list, list) {
+	hash_for_each_rcu(cssid_table, bkt, item, node) {
 		u8 *op = (u8 *)morse_dot11_find_ie(WLAN_EID_S1G_OPERATION, item->ies,
 						   item->ies_len);
 
@@ -276,7 +363,7 @@ int morse_dot11_find_bssid_on_channel(u32 op_chan_freq_hz, u8 bssid[ETH_ALEN])
 		}
 	}
 
-	spin_unlock_bh(&cssid_list_lock);
+	rcu_read_unlock();
 
 	return found ? 0 : -ENOENT;
 }
@@ -284,16 +371,15 @@ EXPORT_SYMBOL(morse_dot11_find_bssid_on_channel);
 
 void morse_dot11ah_clear_list(void)
 {
-	struct morse_dot11ah_cssid_item *item, *tmp;
-
-	spin_lock_bh(&cssid_list_lock);
-	/* Free allocated list */
-	list_for_each_entry_safe(item, tmp, &cssid_list, list) {
-		list_del(&item->list);
-		kfree(item->ies);
-		kfree(item);
-	}
-	spin_unlock_bh(&cssid_list_lock);
+	struct morse_dot11ah_cssid_item *item;
+	struct hlist_node *tmp;
+	int bkt;
+
+	spin_lock_bh(&cssid_table_lock);
+	/* Free allocated entries */
+	hash_for_each_safe(cssid_table, bkt, tmp, item, node)
+		morse_dot11ah_cssid_del(item);
+	spin_unlock_bh(&cssid_table_lock);
 }
 EXPORT_SYMBOL(morse_dot11ah_clear_list);
 
@@ -303,7 +389,7 @@ bool morse_dot11ah_find_s1g_caps_for_bssid(u8 *bssid, struct ieee80211_s1g_cap *
 	bool found = false;
 	u8 *ie = NULL;
 
-	spin_lock_bh(&cssid_list_lock);
+	rcu_read_lock();
 
 	item = morse_dot11ah_find_bssid(bssid);
 	if (item) {
@@ -314,7 +400,7 @@ bool morse_dot11ah_find_s1g_caps_for_bssid(u8 *bssid, struct ieee80211_s1g_cap *
 		}
 	}
 
-	spin_unlock_bh(&cssid_list_lock);
+	rcu_read_unlock();
 	return found;
 }
 EXPORT_SYMBOL(morse_dot11ah_find_s1g_caps_for_bssid);
@@ -324,14 +410,14 @@ bool morse_dot11ah_find_bss_bw(u8 *bssid, u8 *fc_bss_bw_subfield)
 	struct morse_dot11ah_cssid_item *bssid_item = NULL;
 	bool found = false;
 
-	spin_lock_bh(&cssid_list_lock);
+	rcu_read_lock();
 	bssid_item = morse_dot11ah_find_bssid(bssid);
 
 	if (bssid_item) {
-		*fc_bss_bw_subfield = bssid_item->fc_bss_bw_subfield;
+		*fc_bss_bw_subfield = READ_ONCE(bssid_item->fc_bss_bw_subfield);
 		found = true;
 	}
-	spin_unlock_bh(&cssid_list_lock);
+	rcu_read_unlock();
 
 	return found;
 }
@@ -344,9 +430,9 @@ bool morse_dot11ah_is_mesh_peer_known(const u8 *peer_mac_addr)
 	if (!peer_mac_addr)
 		return false;
 
-	spin_lock_bh(&cssid_list_lock);
-	ret = morse_dot11ah_find_cssid_item_for_bssid(peer_mac_addr);
-	spin_unlock_bh(&cssid_list_lock);
+	rcu_read_lock();
+	ret = morse_dot11ah_find_bssid(peer_mac_addr);
+	rcu_read_unlock();
 
 	return ret;
 }
@@ -367,25 +453,19 @@ EXPORT_SYMBOL(morse_dot11ah_add_mesh_peer);
 
 bool morse_dot11ah_del_mesh_peer(const u8 *peer_mac_addr)
 {
-	struct morse_dot11ah_cssid_item *item, *tmp;
-	u64 bssid_64;
+	struct morse_dot11ah_cssid_item *item;
 	bool ret = false;
 
 	if (!peer_mac_addr)
 		return false;
-	bssid_64 = mac2uint64(peer_mac_addr);
 
-	spin_lock_bh(&cssid_list_lock);
-	list_for_each_entry_safe(item, tmp, &cssid_list, list) {
-		if (mac2uint64(item->bssid) == bssid_64) {
-			list_del(&item->list);
-			kfree(item->ies);
-			kfree(item);
-			ret = true;
-			break;
-		}
+	spin_lock_bh(&cssid_table_lock);
+	item = morse_dot11ah_find_bssid(peer_mac_addr);
+	if (item) {
+		morse_dot11ah_cssid_del(item);
+		ret = true;
 	}
-	spin_unlock_bh(&cssid_list_lock);
+	spin_unlock_bh(&cssid_table_lock);
 
 	return ret;
 }
@@ -409,20 +489,18 @@ EXPORT_SYMBOL(morse_dot11_calc_prim_s1g_chan_loc);
 
 int morse_dot11ah_find_no_of_mesh_neighbors(u16 beacon_int)
 {
-	struct morse_dot11ah_cssid_item *item, *tmp;
+	struct morse_dot11ah_cssid_item *item;
 	int mesh_neighbor_count = 0;
+	int bkt;
 
-	spin_lock_bh(&cssid_list_lock);
-	list_for_each_entry_safe(item, tmp, &cssid_list, list) {
-		if (morse_dot11ah_cssid_has_expired(item)) {
-			list_del(&item->list);
-			kfree(item->ies);
-			kfree(item);
-		} else if (item->mesh_beacon && (item->beacon_int == beacon_int)) {
+	/* Expired entries are left for the deferred sweep to remove */
+	rcu_read_lock();
+	hash_for_each_rcu(cssid_table, bkt, item, node) {
+		if (item->mesh_beacon && READ_ONCE(item->beacon_int) == beacon_int &&
+		    !morse_dot11ah_cssid_has_expired(item))
 			mesh_neighbor_count++;
-		}
 	}
-	spin_unlock_bh(&cssid_list_lock);
+	rcu_read_unlock();
 
 	return mesh_neighbor_count;
 }
@@ -435,7 +513,7 @@ bool morse_dot11ah_is_page_slicing_enabled_on_bss(u8 *bssid)
 	u8 *ie = NULL;
 	struct ieee80211_s1g_cap *s1g_caps;
 
-	spin_lock_bh(&cssid_list_lock);
+	rcu_read_lock();
 
 	item = morse_dot11ah_find_bssid(bssid);
 	if (item) {
@@ -446,7 +524,7 @@ bool morse_dot11ah_is_page_slicing_enabled_on_bss(u8 *bssid)
 		}
 	}
 
-	spin_unlock_bh(&cssid_list_lock);
+	rcu_read_unlock();
 	return enabled;
 }
 EXPORT_SYMBOL(morse_dot11ah_is_page_slicing_enabled_on_bss);
@@ -546,7 +546,7 @@ static int morse_dot11_required_rx_ies_size(struct dot11ah_ies_mask *ies_mask,
 	/* TODO: For now, assume TIM is 2 bytes (bitmap_ctrl & virt map). We need an s1g_to_tim_size
 	 * API that just loops over the incoming S1G TIM's and calculate the needed size for 11n TIM
 	 */
-	for (eid = 0; eid < DOT11AH_MAX_EID; eid++) {
+	for_each_set_bit(eid, ies_mask->present, DOT11AH_MAX_EID) {
 		struct ie_element *elem;
 
 		if (ies_mask->ies[eid].ptr) {
@@ -588,10 +588,10 @@ static u8 *morse_dot11ah_insert_required_rx_ie(struct dot11ah_ies_mask *ies_mask
 	int eid = 0;
 
 	/* Supported rate will always be included for all rx management frames */
-	ies_mask->ies[WLAN_EID_SUPP_RATES].ptr = (u8 *)__s1g_supp_rates_ie;
-	ies_mask->ies[WLAN_EID_SUPP_RATES].len = sizeof(__s1g_supp_rates_ie);
+	morse_dot11_ies_mask_set_ie(ies_mask, WLAN_EID_SUPP_RATES, (u8 *)__s1g_supp_rates_ie,
+				    sizeof(__s1g_supp_rates_ie));
 
-	for (eid = 0; eid < DOT11AH_MAX_EID; eid++) {
+	for_each_set_bit(eid, ies_mask->present, DOT11AH_MAX_EID) {
 		if (ies_mask->ies[eid].ptr) {
 			if (eid == WLAN_EID_S1G_OPERATION || eid == WLAN_EID_S1G_CAPABILITIES) {
 				continue;
@@ -634,23 +634,17 @@ morse_dot11ah_update_rx_beacon_elements(struct dot11ah_update_rx_beacon_vals *va
 	vals_to_update->tim_ie = ies_mask->ies[WLAN_EID_TIM].ptr;
 	vals_to_update->tim_len = ies_mask->ies[WLAN_EID_TIM].len;
 
-	spin_lock_bh(&cssid_list_lock);
-
-	/* Try to find the CSSID item using source address and save a backup of IEs
-	 * presumably stored from previous probe response or beacon, before it gets
-	 * overwritten by IEs of incoming frame
+	/* Try to find the CSSID item using source address and keep a reference to the IEs
+	 * presumably stored from previous probe response or beacon. Stored IEs are never
+	 * modified in place, so they remain valid after the entry is updated with the IEs of
+	 * the incoming frame, until the caller leaves its RCU read-side critical section.
 	 */
 	item = morse_dot11ah_find_bssid(bssid);
 
-	if (item && item->ies) {
-		vals_to_update->cssid_ies = kmalloc(item->ies_len, GFP_ATOMIC);
-
-		if (vals_to_update->cssid_ies) {
-			memcpy(vals_to_update->cssid_ies, item->ies, item->ies_len);
-			vals_to_update->cssid_ies_len = item->ies_len;
-		}
+	if (item && item->ies_len) {
+		vals_to_update->cssid_ies = item->ies;
+		vals_to_update->cssid_ies_len = item->ies_len;
 	}
-	spin_unlock_bh(&cssid_list_lock);
 }
 
 static int morse_dot11ah_s1g_to_beacon_size(struct ieee80211_vif *vif, struct sk_buff *skb,
@@ -702,13 +696,10 @@ static int morse_dot11ah_s1g_to_beacon_size(struct ieee80211_vif *vif, struct sk
 	 */
 	network_id_eid = morse_is_mesh_network(ies_mask) ? WLAN_EID_MESH_ID : WLAN_EID_SSID;
 
-	spin_lock_bh(&cssid_list_lock);
+	rcu_read_lock();
 	/* Try to find the CSSID item using source address */
 	item = morse_dot11ah_find_bssid(s1g_beacon->u.s1g_beacon.sa);
 
-	if (!item)
-		spin_unlock_bh(&cssid_list_lock);
-
 	if (!ies_mask->ies[network_id_eid].len) {
 		if (item) {
 			/* parse received beacons for any missing IEs */
@@ -761,8 +752,7 @@ static int morse_dot11ah_s1g_to_beacon_size(struct ieee80211_vif *vif, struct sk
 		}
 	}
 exit:
-	if (item)
-		spin_unlock_bh(&cssid_list_lock);
+	rcu_read_unlock();
 
 	/* NB: We do not need to strip out DS PARAMS, ERP INFO, or the Extended supported rates
 	 * EID as we reconstruct the S1G beacon from scratch when we TX.
@@ -986,11 +976,7 @@ static void morse_dot11ah_s1g_to_beacon(struct ieee80211_vif *vif, struct sk_buf
 		network_id_eid = WLAN_EID_SSID;
 	}
 
-	/* Update Capab info from original beacon*/
-	morse_dot11ah_update_rx_beacon_elements(&updated_vals, ies_mask,
-						s1g_beacon->u.s1g_beacon.sa);
-
-	/* Allocate beacon before spinlock section */
+	/* Allocate beacon before RCU read-side section */
 	beacon = kmalloc(beacon_len, GFP_KERNEL);
 	if (!beacon)
 		goto exit;
@@ -998,6 +984,12 @@ static void morse_dot11ah_s1g_to_beacon(struct ieee80211_vif *vif, struct sk_buf
 	memset(beacon, 0, beacon_len);
 	frame_good = true;
 
+	rcu_read_lock();
+
+	/* Update Capab info from original beacon*/
+	morse_dot11ah_update_rx_beacon_elements(&updated_vals, ies_mask,
+						s1g_beacon->u.s1g_beacon.sa);
+
 	/* Store SSID or restore it */
 	if (ies_mask->ies[network_id_eid].ptr) {
 		morse_dot11ah_store_cssid(ies_mask, le16_to_cpu(updated_vals.capab_info),
@@ -1006,21 +998,17 @@ static void morse_dot11ah_s1g_to_beacon(struct ieee80211_vif *vif, struct sk_buf
 		/* Fill in fc_bss_bw_subfield here, otherwise it will be
 		 * always set to 255 when DTIM period is 1 (no short beacons)
 		 */
-		spin_lock_bh(&cssid_list_lock);
 		item = morse_dot11ah_find_bssid(s1g_beacon->u.s1g_beacon.sa);
 		if (item)
-			item->fc_bss_bw_subfield =
-				IEEE80211AH_GET_FC_BSS_BW(le16_to_cpu(s1g_beacon->frame_control));
-		else
-			spin_unlock_bh(&cssid_list_lock);
+			WRITE_ONCE(item->fc_bss_bw_subfield,
+				IEEE80211AH_GET_FC_BSS_BW(le16_to_cpu(s1g_beacon->frame_control)));
 	} else {
-		spin_lock_bh(&cssid_list_lock);
 		/* Try to find the CSSID item using source address */
 		item = morse_dot11ah_find_bssid(s1g_beacon->u.s1g_beacon.sa);
 
 		if (item) {
-			item->fc_bss_bw_subfield =
-				IEEE80211AH_GET_FC_BSS_BW(le16_to_cpu(s1g_beacon->frame_control));
+			WRITE_ONCE(item->fc_bss_bw_subfield,
+				IEEE80211AH_GET_FC_BSS_BW(le16_to_cpu(s1g_beacon->frame_control)));
 			/* Reparse for stored beacon */
 			if (morse_dot11ah_parse_ies(item->ies, item->ies_len, ies_mask) < 0) {
 				dot11ah_warn("Failed to parse stored beacon\n");
@@ -1034,21 +1022,20 @@ static void morse_dot11ah_s1g_to_beacon(struct ieee80211_vif *vif, struct sk_buf
 			if (!ies_mask->ies[network_id_eid].ptr) {
 				frame_good = false;
 				kfree(beacon);
-				goto exit;
+				goto exit_unlock;
 			}
 
 			/* Overwrite history TIM with actual one */
-			ies_mask->ies[WLAN_EID_TIM].ptr = (u8 *)updated_vals.tim_ie;
-			ies_mask->ies[WLAN_EID_TIM].len = updated_vals.tim_len;
+			morse_dot11_ies_mask_set_ie(ies_mask, WLAN_EID_TIM,
+						    (u8 *)updated_vals.tim_ie,
+						    updated_vals.tim_len);
 			/* Overwrite capab_info from stored */
 			s1g_bcn_comp = (struct dot11ah_s1g_bcn_compat_ie *)
 						ies_mask->ies[WLAN_EID_S1G_BCN_COMPAT].ptr;
 			if (s1g_bcn_comp)
 				updated_vals.capab_info = s1g_bcn_comp->information;
 			else
-				updated_vals.capab_info = cpu_to_le16(item->capab_info);
-		} else {
-			spin_unlock_bh(&cssid_list_lock);
+				updated_vals.capab_info = cpu_to_le16(READ_ONCE(item->capab_info));
 		}
 	}
 
@@ -1064,7 +1051,7 @@ static void morse_dot11ah_s1g_to_beacon(struct ieee80211_vif *vif, struct sk_buf
 		updated_vals.bcn_int = s1g_bcn_comp->beacon_interval;
 
 	if (item) /* Update bcn interval in the cssid item */
-		item->beacon_int = le16_to_cpu(updated_vals.bcn_int);
+		WRITE_ONCE(item->beacon_int, le16_to_cpu(updated_vals.bcn_int));
 
 	beacon->frame_control = cpu_to_le16(IEEE80211_FTYPE_MGMT) |
 		cpu_to_le16(IEEE80211_STYPE_BEACON);
@@ -1105,13 +1092,9 @@ static void morse_dot11ah_s1g_to_beacon(struct ieee80211_vif *vif, struct sk_buf
 	kfree(beacon);
 
 	skb_trim(skb, beacon_len);
+exit_unlock:
+	rcu_read_unlock();
 exit:
-	if (item)
-		spin_unlock_bh(&cssid_list_lock);
-
-	/* Free the allocated IEs memory */
-	kfree(updated_vals.cssid_ies);
-
 	if (!frame_good)
 		skb_trim(skb, 0);
 }
@@ -1453,6 +1436,7 @@ static void morse_dot11ah_s1g_to_assoc_resp(struct ieee80211_vif *vif, struct sk
 	bool frame_good = false;
 	struct morse_vif *mors_vif = (struct morse_vif *)vif->drv_priv;
 	struct morse_dot11ah_cssid_item *bssid_item = NULL;
+	u8 fc_bss_bw_subfield;
 	u8 *pri_bw_mhz = &mors_vif->custom_configs->channel_info.pri_bw_mhz;
 
 	if (length_11n <= 0)
@@ -1470,11 +1454,14 @@ static void morse_dot11ah_s1g_to_assoc_resp(struct ieee80211_vif *vif, struct sk
 	assoc_resp->u.assoc_resp.aid =
 		cpu_to_le16(*((u16 *)&ies_mask->ies[WLAN_EID_AID_RESPONSE].ptr[0]));
 
-	spin_lock_bh(&cssid_list_lock);
+	rcu_read_lock();
 	bssid_item = morse_dot11ah_find_bssid(assoc_resp->bssid);
+	fc_bss_bw_subfield = bssid_item ? READ_ONCE(bssid_item->fc_bss_bw_subfield) :
+					  MORSE_FC_BSS_BW_INVALID;
+	rcu_read_unlock();
 
-	if (bssid_item && MORSE_IS_FC_BSS_BW_SUBFIELD_VALID(bssid_item->fc_bss_bw_subfield)) {
-		*pri_bw_mhz = s1g_fc_bss_bw_lookup_min[bssid_item->fc_bss_bw_subfield];
+	if (MORSE_IS_FC_BSS_BW_SUBFIELD_VALID(fc_bss_bw_subfield)) {
+		*pri_bw_mhz = s1g_fc_bss_bw_lookup_min[fc_bss_bw_subfield];
 	} else {
 		/* The min bss bw is == s1g op pri bw, if we don't have that then use 1MHz */
 		if (ies_mask->ies[WLAN_EID_S1G_OPERATION].ptr) {
@@ -1485,7 +1472,6 @@ static void morse_dot11ah_s1g_to_assoc_resp(struct ieee80211_vif *vif, struct sk
 			*pri_bw_mhz = 1;
 		}
 	}
-	spin_unlock_bh(&cssid_list_lock);
 
 	pos = assoc_resp->u.assoc_resp.variable;
 	pos = morse_dot11ah_insert_required_rx_ie(ies_mask, pos, true);
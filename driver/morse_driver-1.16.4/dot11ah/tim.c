@@ -5,6 +5,8 @@
  */
 
 #include <linux/types.h>
+#include <linux/module.h>
+#include <linux/bitops.h>
 #include <linux/ieee80211.h>
 
 #include "dot11ah.h"
@@ -15,6 +17,11 @@
 /* TODO: ADE for AIDs > 7 (not tested in WFA nor advertised in marketing material) */
 #define ADE_AID_LIMIT		(7)
 
+static bool tim_enc_mode_auto;
+module_param(tim_enc_mode_auto, bool, 0644);
+MODULE_PARM_DESC(tim_enc_mode_auto,
+		 "Choose the smallest of block bitmap and single AID encoding for each TIM block");
+
 /**
  * State structure for parsing from 11n TIM to S1G TIM
  */
@@ -450,7 +457,6 @@ static void morse_dot11_tim_to_s1g_parse_block_mode(struct tim_to_s1g_parse_stat
 						    bool inverse_bitmap, u16 max_aid)
 {
 	int i;
-	int j;
 	u8 num_subblocks;
 	u16 aid_base = state->octet_offset_11n * 8;
 	u8 subblocks_to_block_boundary = S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK -
@@ -484,27 +490,19 @@ static void morse_dot11_tim_to_s1g_parse_block_mode(struct tim_to_s1g_parse_stat
 	s1g_tim_append_octet(state, block_ctrl |
 			     (block_offset << IEEE80211_S1G_TIM_BLOCK_CTL_BLOCK_OFFSET_SHIFT));
 
-	/* fill out block_bitmap & subblocks from 11n tim virtual map */
+	/*
+	 * Fill out subblocks from 11n tim virtual map. Each 11n octet holds the 8 AIDs of exactly
+	 * one subblock (pos_q is the bit in the octet), so copy whole octets rather than AIDs.
+	 */
 	for (i = 0; i < state->length_11n && i < subblocks_to_block_boundary; i++) {
-		u8 temp = state->virtual_map_11n[i];
-
-		for (j = 0; temp != 0; temp >>= 1, j++) {
-			/* bit found */
-			if (temp & 0x1) {
-				/* Work out actual AID (to account for bitmap_offset in 11n tim) */
-				u16 aid = aid_base + (i * S1G_TIM_NUM_AID_PER_SUBBLOCK) + j;
-
-				/* convert aid to positions */
-				u8 pos_m = ((aid >> 3) & 0x7);
-				u8 pos_q = (aid & 0x7);
-
-				/* set/clear the bit in the corresponding subblock */
-				if (inverse_bitmap)
-					subblocks[pos_m] &= ~(0x1 << pos_q);
-				else
-					subblocks[pos_m] |= (0x1 << pos_q);
-			}
-		}
+		u8 octet = state->virtual_map_11n[i];
+		u8 pos_m = (state->octet_offset_11n + i) % S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK;
+
+		/* set/clear the bits in the corresponding subblock */
+		if (inverse_bitmap)
+			subblocks[pos_m] &= ~octet;
+		else
+			subblocks[pos_m] |= octet;
 	}
 
 	consume_11n_tim_octets(state, i);
@@ -540,11 +538,10 @@ static void morse_dot11_tim_to_s1g_parse_block_mode(struct tim_to_s1g_parse_stat
 static void morse_dot11_tim_to_s1g_parse_single_mode(struct tim_to_s1g_parse_state *state,
 						     bool inverse_bitmap)
 {
-	int remainder;
 	u16 aid_base = state->octet_offset_11n * 8;
 	u8 block_ctrl;
 	u8 block_offset = 0;
-	u8 bitmap;
+	unsigned long bitmap;
 
 	/*
 	 * Set Block Control, block[0] (bit0:bit2)
@@ -576,15 +573,13 @@ static void morse_dot11_tim_to_s1g_parse_single_mode(struct tim_to_s1g_parse_sta
 
 	block_offset = S1G_TIM_AID_TO_BLOCK_OFFSET(aid_base);
 
-	for (remainder = 0; remainder < 8; remainder++) {
-		if ((bitmap >> remainder) & 0x01) {
-			u8 single_aid = (aid_base | remainder) & 0x003F;
+	for (; bitmap; bitmap &= bitmap - 1) {
+		u8 single_aid = (aid_base | __ffs(bitmap)) & 0x003F;
 
-			s1g_tim_append_octet(state, block_ctrl | (block_offset <<
-						IEEE80211_S1G_TIM_BLOCK_CTL_BLOCK_OFFSET_SHIFT));
+		s1g_tim_append_octet(state, block_ctrl | (block_offset <<
+					IEEE80211_S1G_TIM_BLOCK_CTL_BLOCK_OFFSET_SHIFT));
 
-			s1g_tim_append_octet(state, single_aid);
-		}
+		s1g_tim_append_octet(state, single_aid);
 	}
 }
 
@@ -593,7 +588,6 @@ static void morse_dot11_tim_to_s1g_parse_olb_mode(struct tim_to_s1g_parse_state
 						  bool inverse_bitmap, u16 max_aid)
 {
 	int i;
-	int j;
 	u16 aid_base = state->octet_offset_11n * 8;
 	u8 block_ctrl;
 	u8 block_offset;
@@ -647,33 +641,24 @@ static void morse_dot11_tim_to_s1g_parse_olb_mode(struct tim_to_s1g_parse_state
 	start_idx = block_offset * S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK;
 
 	/*
-	 * Walk the 11n tim and copy
+	 * Walk the 11n tim and copy. Each 11n octet is one subblock, indexed by its octet number
+	 * in the full length 11n TIM.
 	 */
 	for (i = 0; i < state->length_11n && i < ARRAY_SIZE(subblocks); i++) {
-		u8 temp = state->virtual_map_11n[i];
-
-		for (j = 0; temp != 0; temp >>= 1, j++) {
-			/* bit found */
-			if (temp & 0x1) {
-				/*
-				 * Work out actual AID (to account for bitmap_offset in 11n tim)
-				 */
-				u16 aid = aid_base + (i * S1G_TIM_NUM_AID_PER_SUBBLOCK) + j;
-
-				/* convert aid to positions */
-				u8 pos_m = (aid >> 3);
-				u8 pos_q = (aid & 0x7);
-
-				/* set/clear the bit in the corresponding subblock */
-				if (inverse_bitmap) {
-					subblocks[pos_m] &= ~(0x1 << pos_q);
-				} else {
-					subblocks[pos_m] |= (0x1 << pos_q);
-					/* Store largest used subblock */
-					if (pos_m >= stop_idx)
-						stop_idx = pos_m + 1;
-				}
-			}
+		u8 octet = state->virtual_map_11n[i];
+		u8 pos_m = state->octet_offset_11n + i;
+
+		if (!octet)
+			continue;
+
+		/* set/clear the bits in the corresponding subblock */
+		if (inverse_bitmap) {
+			subblocks[pos_m] &= ~octet;
+		} else {
+			subblocks[pos_m] |= octet;
+			/* Store largest used subblock */
+			if (pos_m >= stop_idx)
+				stop_idx = pos_m + 1;
 		}
 	}
 
@@ -783,6 +768,44 @@ static void morse_dot11_tim_to_s1g_parse_ade_mode(struct tim_to_s1g_parse_state
 	}
 }
 
+/**
+ * morse_dot11_tim_auto_enc_mode() - Pick the encoding that gives the shortest encoded block for
+ * the block the parse state is pointing at
+ *
+ * @state: 11n->S1G parse state
+ *
+ * Only block bitmap and single AID modes are considered, both can be mixed freely between blocks
+ * of the same element. Sizes are worked out per octet (subblock) with popcounts rather than by
+ * walking AIDs.
+ *
+ * Return: the encoding mode to use for this block
+ */
+static enum dot11ah_tim_encoding_mode
+morse_dot11_tim_auto_enc_mode(const struct tim_to_s1g_parse_state *state)
+{
+	int num_octets = min_t(int, state->length_11n, S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK -
+			       (state->octet_offset_11n % S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK));
+	int num_subblocks = 0;
+	int num_aids = 0;
+	int i;
+
+	for (i = 0; i < num_octets; i++) {
+		u8 octet = state->virtual_map_11n[i];
+
+		num_subblocks += !!octet;
+		num_aids += hweight8(octet);
+	}
+
+	/*
+	 * Block bitmap: block control + block bitmap + one octet per present subblock.
+	 * Single AID: block control + single AID octet for every AID.
+	 */
+	if (2 * num_aids < 2 + num_subblocks)
+		return ENC_MODE_AID;
+
+	return ENC_MODE_BLOCK;
+}
+
 /*
  * Convert S1G TIM to Non-S1G TIM.
  * The output Non-S1G map is limited only to the first 8 AIDs.
@@ -988,7 +1011,13 @@ int morse_dot11_tim_to_s1g(struct dot11ah_s1g_tim_ie *s1g_tim,
 	consume_11n_tim_octets(&state, 0);
 
 	while (state.length_11n > 0 && state.index_s1g < sizeof(s1g_tim->encoded_block_info)) {
-		switch (enc_mode) {
+		enum dot11ah_tim_encoding_mode block_enc_mode = enc_mode;
+
+		/* Inverse bitmap is applied to the whole element, so keep the configured mode */
+		if (tim_enc_mode_auto && !inverse_bitmap)
+			block_enc_mode = morse_dot11_tim_auto_enc_mode(&state);
+
+		switch (block_enc_mode) {
 		case ENC_MODE_BLOCK:
 			morse_dot11_tim_to_s1g_parse_block_mode(&state, inverse_bitmap, max_aid);
 			break;
@@ -1027,6 +1056,66 @@ error:
 	return s1g_tim_length;
 }
 
+/**
+ * morse_dot11_tim_to_s1g_cached() - convert non S1G TIM to S1G TIM, reusing the previous
+ * conversion if the traffic bitmap and encoding parameters have not changed
+ *
+ * Parameters as for morse_dot11_tim_to_s1g(), with @cache holding the previous conversion.
+ *
+ * Return: The length of the S1G TIM element.
+ */
+static int morse_dot11_tim_to_s1g_cached(struct dot11ah_s1g_tim_cache *cache,
+					 struct dot11ah_s1g_tim_ie *s1g_tim,
+					 const struct ieee80211_tim_ie *tim,
+					 u8 tim_virtual_map_length,
+					 enum dot11ah_tim_encoding_mode enc_mode,
+					 bool inverse_bitmap,
+					 u16 max_aid,
+					 u8 page_slice_no,
+					 u8 page_index)
+{
+	int length;
+
+	if (!cache || !tim || tim_virtual_map_length > sizeof(cache->virtual_map))
+		return morse_dot11_tim_to_s1g(s1g_tim, tim, tim_virtual_map_length, enc_mode,
+					      inverse_bitmap, max_aid, page_slice_no, page_index);
+
+	if (cache->valid &&
+	    cache->bitmap_ctrl == tim->bitmap_ctrl &&
+	    cache->virtual_map_len == tim_virtual_map_length &&
+	    cache->enc_mode == enc_mode &&
+	    cache->inverse_bitmap == inverse_bitmap &&
+	    cache->enc_mode_auto == tim_enc_mode_auto &&
+	    cache->max_aid == max_aid &&
+	    cache->page_slice_no == page_slice_no &&
+	    cache->page_index == page_index &&
+	    !memcmp(cache->virtual_map, tim->virtual_map, tim_virtual_map_length)) {
+		/* Only the DTIM fields change from beacon to beacon */
+		memcpy(s1g_tim, &cache->s1g_tim, cache->s1g_tim_len);
+		s1g_tim->dtim_count = tim->dtim_count;
+		s1g_tim->dtim_period = tim->dtim_period;
+		return cache->s1g_tim_len;
+	}
+
+	length = morse_dot11_tim_to_s1g(s1g_tim, tim, tim_virtual_map_length, enc_mode,
+					inverse_bitmap, max_aid, page_slice_no, page_index);
+
+	cache->bitmap_ctrl = tim->bitmap_ctrl;
+	cache->virtual_map_len = tim_virtual_map_length;
+	cache->enc_mode = enc_mode;
+	cache->inverse_bitmap = inverse_bitmap;
+	cache->enc_mode_auto = tim_enc_mode_auto;
+	cache->max_aid = max_aid;
+	cache->page_slice_no = page_slice_no;
+	cache->page_index = page_index;
+	memcpy(cache->virtual_map, tim->virtual_map, tim_virtual_map_length);
+	memcpy(&cache->s1g_tim, s1g_tim, length);
+	cache->s1g_tim_len = length;
+	cache->valid = true;
+
+	return length;
+}
+
 void morse_dot11ah_insert_s1g_tim(struct ieee80211_vif *vif, struct dot11ah_ies_mask *ies_mask,
 				  u8 page_slice_no, u8 page_index)
 {
@@ -1056,14 +1145,15 @@ void morse_dot11ah_insert_s1g_tim(struct ieee80211_vif *vif, struct dot11ah_ies_
 
 	morse_dot11_clear_eid_from_ies_mask(ies_mask, WLAN_EID_TIM);
 
-	length = morse_dot11_tim_to_s1g(&s1g_tim_ie,
-					tim,
-					tim_virtual_map_len_11n,
-					enc_mode,
-					inverse_bitmap,
-					mors_vif->ap->largest_aid,
-					page_slice_no,
-					page_index);
+	length = morse_dot11_tim_to_s1g_cached(&mors_vif->ap->tim_cache,
+					       &s1g_tim_ie,
+					       tim,
+					       tim_virtual_map_len_11n,
+					       enc_mode,
+					       inverse_bitmap,
+					       mors_vif->ap->largest_aid,
+					       page_slice_no,
+					       page_index);
 
 	morse_dot11ah_insert_element(ies_mask, WLAN_EID_TIM, (u8 *)&s1g_tim_ie, length);
 }
@@ -78,6 +78,40 @@ struct dot11ah_s1g_tim_ie {
 	u8 encoded_block_info[S1G_TIM_MAX_BLOCK_SIZE];
 } __packed;
 
+/**
+ * struct dot11ah_s1g_tim_cache - The last 11n TIM converted for an interface and its S1G form
+ *
+ * The traffic bitmap is often unchanged between beacons, in which case the previous encoding is
+ * reused and only the DTIM count and period are updated.
+ *
+ * @valid: the cache holds a conversion
+ * @bitmap_ctrl: 11n bitmap control of the cached TIM
+ * @virtual_map_len: length of the cached 11n partial virtual bitmap
+ * @virtual_map: cached 11n partial virtual bitmap
+ * @enc_mode: encoding mode used
+ * @inverse_bitmap: inverse bitmap used
+ * @enc_mode_auto: per block encoding mode selection was enabled
+ * @max_aid: largest AID in use at the time of encoding
+ * @page_slice_no: page slice number encoded
+ * @page_index: page index encoded
+ * @s1g_tim_len: length of @s1g_tim
+ * @s1g_tim: the S1G TIM element the cached 11n TIM was converted to
+ */
+struct dot11ah_s1g_tim_cache {
+	bool valid;
+	u8 bitmap_ctrl;
+	u8 virtual_map_len;
+	u8 virtual_map[DOT11_MAX_TIM_VIRTUAL_MAP_LENGTH];
+	enum dot11ah_tim_encoding_mode enc_mode;
+	bool inverse_bitmap;
+	bool enc_mode_auto;
+	u16 max_aid;
+	u8 page_slice_no;
+	u8 page_index;
+	int s1g_tim_len;
+	struct dot11ah_s1g_tim_ie s1g_tim;
+};
+
 /**
  * morse_dot11_tim_to_s1g() - convert non S1G TIM to S1G TIM
  *
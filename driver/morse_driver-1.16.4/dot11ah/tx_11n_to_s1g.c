@@ -347,8 +347,9 @@ static void morse_dot11ah_assoc_resp_to_s1g(struct ieee80211_vif *vif,
 		/* Convert to S1G (USF/UI) format */
 		bss_max_idle_period->max_idle_period = cpu_to_le16(s1g_period);
 
-		ies_mask->ies[WLAN_EID_BSS_MAX_IDLE_PERIOD].ptr = (u8 *)bss_max_idle_period;
-		ies_mask->ies[WLAN_EID_BSS_MAX_IDLE_PERIOD].len = sizeof(*bss_max_idle_period);
+		morse_dot11_ies_mask_set_ie(ies_mask, WLAN_EID_BSS_MAX_IDLE_PERIOD,
+					    (u8 *)bss_max_idle_period,
+					    sizeof(*bss_max_idle_period));
 	}
 
 	ht_cap = (const struct ieee80211_ht_cap *)ies_mask->ies[WLAN_EID_HT_CAPABILITY].ptr;
@@ -883,8 +884,7 @@ static void morse_dot11ah_beacon_to_s1g(struct ieee80211_vif *vif,
 	morse_dot11ah_mask_ies(ies_mask, true, true);
 	/* Include RSN IE for Beacon in Mesh for SAE connection */
 	if (ieee80211_vif_is_mesh(vif)) {
-		ies_mask->ies[WLAN_EID_RSN].ptr = rsn_ie;
-		ies_mask->ies[WLAN_EID_RSN].len = rsn_ie_len;
+		morse_dot11_ies_mask_set_ie(ies_mask, WLAN_EID_RSN, rsn_ie, rsn_ie_len);
 	}
 
 	/* The SSID is 2 octets into the value returned by find ie, and the
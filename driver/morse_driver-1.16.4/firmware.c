@@ -11,6 +11,7 @@
 #include <linux/delay.h>
 #include <net/mac80211.h>
 #include <linux/elf.h>
+#include <linux/ktime.h>
 #include <linux/crc32.h>
 #include <linux/completion.h>
 
@@ -27,6 +28,23 @@
 /* Maximum wait time (milliseconds) for firmware to boot (for host table pointer to be available) */
 #define MAX_WAIT_FOR_HOST_TABLE_PTR_MS 1200
 
+/* Size of the bounce buffer firmware segments are streamed to the chip through */
+#ifndef MORSE_FW_LOAD_CHUNK_SIZE
+#define MORSE_FW_LOAD_CHUNK_SIZE (64 * 1024)
+#endif
+
+/*
+ * A resident segment is checked by reading back this many windows spread evenly across it rather
+ * than the whole segment, so the check costs a fixed, small read per segment.
+ */
+#ifndef MORSE_FW_RESIDENT_SAMPLES
+#define MORSE_FW_RESIDENT_SAMPLES (8)
+#endif
+
+#ifndef MORSE_FW_RESIDENT_SAMPLE_SIZE
+#define MORSE_FW_RESIDENT_SAMPLE_SIZE (64)
+#endif
+
 struct fw_init_params {
 	bool download_fw;
 	bool get_host_table_ptr;
@@ -56,6 +74,15 @@ static char fw_bin_file[MAX_FW_BIN_FILE_NAME_LEN];
 module_param_string(fw_bin_file, fw_bin_file, sizeof(fw_bin_file), 0644);
 MODULE_PARM_DESC(fw_bin_file, "Firmware binary filename to load");
 
+static bool fw_load_verify;
+module_param(fw_load_verify, bool, 0644);
+MODULE_PARM_DESC(fw_load_verify, "Verify the checksum of each firmware segment after download");
+
+static bool fw_load_skip_resident;
+module_param(fw_load_skip_resident, bool, 0644);
+MODULE_PARM_DESC(fw_load_skip_resident,
+		 "Skip rewriting unchanged read-only segments whose sampled read-back matches (not a full verify)");
+
 
 static int get_file_header(const u8 *data, morse_elf_ehdr *ehdr)
 {
@@ -153,20 +180,133 @@ static int morse_set_boot_addr(struct morse *mors, uint32_t addr)
 	return status;
 }
 
-static int morse_firmware_load(struct morse *mors, const struct firmware *fw)
+/* crc32 of a segment as written to the chip, including its 0xff padding */
+static u32 morse_firmware_segment_crc(const u8 *data, u32 filesz, u32 padded_size)
+{
+	static const u8 padding[3] = { 0xff, 0xff, 0xff };
+	u32 crc = crc32_le(~0, data, filesz);
+
+	return ~crc32_le(crc, padding, padded_size - filesz);
+}
+
+/* crc32 of a region of chip memory, read back through the bounce buffer */
+static int morse_firmware_read_crc(struct morse *mors, u32 address, u32 len,
+				   u8 *buf, u32 buf_len, u32 *crc)
+{
+	int ret;
+	u32 chunk;
+	u32 offset;
+	u32 c = ~0;
+
+	for (offset = 0; offset < len; offset += chunk) {
+		chunk = min(len - offset, buf_len);
+		ret = morse_dm_read(mors, address + offset, buf, chunk);
+		if (ret)
+			return ret;
+		c = crc32_le(c, buf, chunk);
+	}
+
+	*crc = ~c;
+	return 0;
+}
+
+/* Stream a segment to the chip in bounce buffer sized chunks */
+static int morse_firmware_write_segment(struct morse *mors, u32 address, const u8 *data,
+					u32 filesz, u32 padded_size, u8 *buf, u32 buf_len)
+{
+	int ret;
+	u32 copy;
+	u32 chunk;
+	u32 offset;
+
+	for (offset = 0; offset < padded_size; offset += chunk) {
+		chunk = min(padded_size - offset, buf_len);
+		copy = offset < filesz ? min(filesz - offset, chunk) : 0;
+
+		memcpy(buf, data + offset, copy);
+		/* Set padding to 0xff */
+		memset(buf + copy, 0xff, chunk - copy);
+		ret = morse_dm_write(mors, address + offset, buf, chunk);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Compare sample windows of a segment on the chip with the image. Reading the whole segment back
+ * would cost as much as rewriting it, so only MORSE_FW_RESIDENT_SAMPLES windows of
+ * MORSE_FW_RESIDENT_SAMPLE_SIZE bytes are read, which catches a segment lost over a reset.
+ */
+static bool morse_firmware_segment_sample_matches(struct morse *mors, u32 address,
+						  const u8 *data, u32 filesz, u32 padded_size,
+						  u8 *buf, u32 buf_len)
+{
+	u32 sample_len = min_t(u32, min_t(u32, padded_size, buf_len),
+			       MORSE_FW_RESIDENT_SAMPLE_SIZE);
+	u32 span = padded_size - sample_len;
+	int i;
+
+	for (i = 0; i < MORSE_FW_RESIDENT_SAMPLES; i++) {
+		u32 offset = span * i / max(MORSE_FW_RESIDENT_SAMPLES - 1, 1);
+		u32 copy;
+
+		offset = ROUND_DOWN_TO_WORD(offset);
+		copy = offset < filesz ? min(filesz - offset, sample_len) : 0;
+
+		if (morse_dm_read(mors, address + offset, buf, sample_len))
+			return false;
+
+		if (memcmp(buf, data + offset, copy) ||
+		    memchr_inv(buf + copy, 0xff, sample_len - copy))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * A segment can be left in place if the same image put it there on the last download, the
+ * firmware does not write to it, and sampled contents on the chip still match.
+ */
+static bool morse_firmware_segment_is_resident(struct morse *mors, u32 fw_crc,
+					       unsigned int index,
+					       const morse_elf_phdr *phdr,
+					       const struct morse_fw_segment *seg,
+					       const u8 *data, u8 *buf, u32 buf_len)
+{
+	struct morse_fw_load_info *info = &mors->fw_load;
+	const struct morse_fw_segment *prev;
+
+	if (!fw_load_skip_resident || info->image_crc != fw_crc || index >= info->num_segments)
+		return false;
+
+	prev = &info->segments[index];
+
+	if (phdr->p_flags & PF_W)
+		return false;
+
+	if (prev->address != seg->address || prev->len != seg->len || prev->crc != seg->crc)
+		return false;
+
+	return morse_firmware_segment_sample_matches(mors, seg->address, data, phdr->p_filesz,
+						     seg->len, buf, buf_len);
+}
+
+static int morse_firmware_load(struct morse *mors, const struct firmware *fw, u32 fw_crc)
 {
 	int i;
 	int ret = 0;
+	unsigned int num_segments = 0;
 	morse_elf_ehdr ehdr;
 	morse_elf_phdr phdr;
 	morse_elf_shdr shdr;
 	morse_elf_shdr sh_strtab;
 	const char *sh_strs;
-
-	u8 *fw_buf = devm_kmalloc(mors->dev, ROUND_BYTES_TO_WORD(fw->size), GFP_KERNEL);
-
-	if (!fw_buf)
-		return -ENOMEM;
+	struct morse_fw_load_info *info = &mors->fw_load;
+	u32 buf_len = min_t(u32, ROUND_BYTES_TO_WORD(fw->size), MORSE_FW_LOAD_CHUNK_SIZE);
+	u8 *fw_buf;
 
 	if (get_file_header(fw->data, &ehdr) != 0) {
 		MORSE_ERR(mors, "Wrong file format\n");
@@ -178,11 +318,23 @@ static int morse_firmware_load(struct morse *mors, const struct firmware *fw)
 		return -1;
 	}
 
+	fw_buf = devm_kmalloc(mors->dev, buf_len, GFP_KERNEL);
+	if (!fw_buf)
+		return -ENOMEM;
+
 	sh_strs = (const char *)fw->data + sh_strtab.sh_offset;
 
+	info->bytes_written = 0;
+	info->bytes_skipped = 0;
+	info->write_us = 0;
+	info->verify_us = 0;
+
 	for (i = 0; i < ehdr.e_phnum; i++) {
 		int status;
 		int address;
+		bool resident;
+		ktime_t start;
+		struct morse_fw_segment seg;
 
 		morse_elf_phdr *p =
 			(morse_elf_phdr *)(fw->data + ehdr.e_phoff + i * ehdr.e_phentsize);
@@ -192,6 +344,7 @@ static int morse_firmware_load(struct morse *mors, const struct firmware *fw)
 		phdr.p_paddr = le32_to_cpu((__force __le32)p->p_paddr);
 		phdr.p_filesz = le32_to_cpu((__force __le32)p->p_filesz);
 		phdr.p_memsz = le32_to_cpu((__force __le32)p->p_memsz);
+		phdr.p_flags = le32_to_cpu((__force __le32)p->p_flags);
 
 		/* In current design, the iflash/dflash are only used in self-hosted mode. For
 		 * hosted mode, if the sections are found in the combined image, driver
@@ -204,21 +357,69 @@ static int morse_firmware_load(struct morse *mors, const struct firmware *fw)
 		if (phdr.p_type != PT_LOAD || !phdr.p_memsz)
 			continue;
 
-		if (phdr.p_filesz && phdr.p_offset &&
-					(phdr.p_offset + phdr.p_filesz) < fw->size) {
-			u32 padded_size = ROUND_BYTES_TO_WORD(phdr.p_filesz);
+		if (!phdr.p_filesz || !phdr.p_offset ||
+		    (phdr.p_offset + phdr.p_filesz) >= fw->size)
+			continue;
 
-			memcpy(fw_buf, fw->data + phdr.p_offset, padded_size);
-			/* Set padding to 0xff */
-			memset(fw_buf + phdr.p_filesz, 0xff, padded_size - phdr.p_filesz);
-			morse_claim_bus(mors);
-			status = morse_dm_write(mors, address, fw_buf, padded_size);
-			morse_release_bus(mors);
-			if (status) {
-				ret = -1;
-				break;
+		seg.address = address;
+		seg.len = ROUND_BYTES_TO_WORD(phdr.p_filesz);
+		seg.crc = morse_firmware_segment_crc(fw->data + phdr.p_offset,
+						     phdr.p_filesz, seg.len);
+
+		morse_claim_bus(mors);
+
+		start = ktime_get();
+		resident = morse_firmware_segment_is_resident(mors, fw_crc, num_segments, &phdr,
+							      &seg, fw->data + phdr.p_offset,
+							      fw_buf, buf_len);
+		info->verify_us += ktime_us_delta(ktime_get(), start);
+
+		if (resident) {
+			info->bytes_skipped += seg.len;
+			status = 0;
+		} else {
+			start = ktime_get();
+			status = morse_firmware_write_segment(mors, address,
+							      fw->data + phdr.p_offset,
+							      phdr.p_filesz, seg.len,
+							      fw_buf, buf_len);
+			info->write_us += ktime_us_delta(ktime_get(), start);
+			if (!status)
+				info->bytes_written += seg.len;
+		}
+
+		if (!status && !resident && fw_load_verify) {
+			u32 chip_crc;
+
+			start = ktime_get();
+			status = morse_firmware_read_crc(mors, address, seg.len,
+							 fw_buf, buf_len, &chip_crc);
+			info->verify_us += ktime_us_delta(ktime_get(), start);
+			if (!status && chip_crc != seg.crc) {
+				MORSE_ERR(mors, "FW segment 0x%x crc mismatch (0x%08x != 0x%08x)\n",
+					  address, chip_crc, seg.crc);
+				status = -EIO;
 			}
 		}
+		morse_release_bus(mors);
+
+		if (status) {
+			ret = -1;
+			break;
+		}
+
+		if (num_segments < ARRAY_SIZE(info->segments))
+			info->segments[num_segments] = seg;
+		num_segments++;
+	}
+
+	/* Only a complete download can be relied on to be resident next time */
+	if (ret || num_segments > ARRAY_SIZE(info->segments)) {
+		info->image_crc = 0;
+		info->num_segments = 0;
+	} else {
+		info->image_crc = fw_crc;
+		info->num_segments = num_segments;
 	}
 
 	for (i = 0; i < ehdr.e_shnum; i++) {
@@ -231,10 +432,9 @@ static int morse_firmware_load(struct morse *mors, const struct firmware *fw)
 
 	}
 
-	{
-		if (ehdr.e_entry != 0)
-			ret = morse_set_boot_addr(mors, ehdr.e_entry);
-	}
+	if (!ret && ehdr.e_entry != 0)
+		ret = morse_set_boot_addr(mors, ehdr.e_entry);
+
 	devm_kfree(mors->dev, fw_buf);
 	return ret;
 }
@@ -903,19 +1103,26 @@ static int morse_firmware_get_init_params(uint test_mode, struct fw_init_params
 }
 
 static int morse_firmware_init_preloaded(struct morse *mors,
-					 const struct firmware *fw,
+					 const struct firmware *fw, u32 fw_crc,
 					 const struct firmware *bcf,
 					 enum morse_config_test_mode test_mode)
 {
 	int ret = 0;
 	int retries = 3;
 	struct fw_init_params init_params;
+	struct morse_fw_load_info *info = &mors->fw_load;
+	ktime_t start = ktime_get();
+	ktime_t stage;
 
 	ret = morse_firmware_get_init_params(test_mode, &init_params);
 	if (ret)
 		goto exit;
 
 	while (retries--) {
+		/* Only report the stages that ran in this attempt */
+		info->bcf_us = 0;
+		info->boot_us = 0;
+
 		if (!mors->chip_was_reset) {
 			ret = morse_firmware_reset(mors);
 		} else {
@@ -929,12 +1136,18 @@ static int morse_firmware_init_preloaded(struct morse *mors,
 
 		if (init_params.download_fw) {
 			ret = ret ? ret : morse_firmware_invalidate_host_ptr(mors);
-			ret = ret ? ret : morse_firmware_load(mors, fw);
-			ret = ret ? ret : morse_bcf_load(mors, bcf, mors->bcf_address);
+			ret = ret ? ret : morse_firmware_load(mors, fw, fw_crc);
+			if (!ret) {
+				stage = ktime_get();
+				ret = morse_bcf_load(mors, bcf, mors->bcf_address);
+				info->bcf_us = ktime_us_delta(ktime_get(), stage);
+			}
 			ret = ret ? ret : morse_firmware_trigger(mors);
 		}
 		if (init_params.get_host_table_ptr && ret == 0) {
+			stage = ktime_get();
 			ret = morse_firmware_get_host_table_ptr(mors);
+			info->boot_us = ktime_us_delta(ktime_get(), stage);
 			if (ret)
 				MORSE_ERR(mors, "FW manifest pointer not set (ret:%d)\n", ret);
 		}
@@ -950,8 +1163,19 @@ static int morse_firmware_init_preloaded(struct morse *mors,
 		 * if we need to retry our init sequencing.
 		 */
 		mors->chip_was_reset = false;
+
+		/* Sampling may have missed a damaged segment, so rewrite everything on retry */
+		info->image_crc = 0;
+		info->num_segments = 0;
 	}
 
+	info->total_us = ktime_us_delta(ktime_get(), start);
+	if (!ret && init_params.download_fw)
+		MORSE_INFO(mors,
+			   "FW download %u us: wrote %u bytes in %u us, skipped %u bytes, verify %u us, bcf %u us, boot %u us\n",
+			   info->total_us, info->bytes_written, info->write_us,
+			   info->bytes_skipped, info->verify_us, info->bcf_us, info->boot_us);
+
 exit:
 	return ret;
 }
@@ -971,6 +1195,7 @@ int morse_firmware_init(struct morse *mors, enum morse_config_test_mode test_mod
 	const char *bcf_name = bcf_path;
 	const struct firmware *fw = NULL;
 	const struct firmware *bcf = NULL;
+	u32 fw_crc;
 	int board_id = 0;
 	char *p;
 	bool use_full_path = true;
@@ -1044,8 +1269,9 @@ int morse_firmware_init(struct morse *mors, enum morse_config_test_mode test_mod
 			dev_err(mors->dev, "Firmware %s not found\n", fw_name);
 		goto exit;
 	}
+	fw_crc = binary_crc(fw);
 	dev_info(mors->dev, "Loaded firmware from %s, size %zu, crc32 0x%08x\n",
-		fw_name, fw->size, binary_crc(fw));
+		fw_name, fw->size, fw_crc);
 
 	ret = request_firmware(&bcf, bcf_name, mors->dev);
 	if (ret != 0) {
@@ -1062,7 +1288,7 @@ int morse_firmware_init(struct morse *mors, enum morse_config_test_mode test_mod
 	/* store the fw binary string used into our coredump */
 	morse_coredump_set_fw_binary_str(mors, fw_name);
 
-	ret = morse_firmware_init_preloaded(mors, fw, bcf, test_mode);
+	ret = morse_firmware_init_preloaded(mors, fw, fw_crc, bcf, test_mode);
 exit:
 	release_firmware(fw);
 	release_firmware(bcf);
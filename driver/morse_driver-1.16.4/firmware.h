@@ -149,6 +149,40 @@ struct extended_host_table {
 	u8 ext_host_table_data_tlvs[];
 } __packed;
 
+/* Number of firmware image segments remembered between downloads */
+#define MORSE_FW_MAX_LOADED_SEGMENTS	(16)
+
+/**
+ * struct morse_fw_segment - A firmware image segment written to the chip
+ */
+struct morse_fw_segment {
+	/** On-chip address of the segment */
+	u32 address;
+	/** Length (bytes) written, including padding */
+	u32 len;
+	/** crc32 of the padded segment */
+	u32 crc;
+};
+
+/**
+ * struct morse_fw_load_info - Record of the last firmware download
+ */
+struct morse_fw_load_info {
+	/** crc32 of the image the segments belong to, 0 if none were recorded */
+	u32 image_crc;
+	u8 num_segments;
+	struct morse_fw_segment segments[MORSE_FW_MAX_LOADED_SEGMENTS];
+
+	/* Breakdown of the last download */
+	u32 bytes_written;
+	u32 bytes_skipped;
+	u32 write_us;
+	u32 verify_us;
+	u32 bcf_us;
+	u32 boot_us;
+	u32 total_us;
+};
+
 int morse_firmware_init(struct morse *mors, enum morse_config_test_mode test_mode);
 
 /**
@@ -38,6 +38,45 @@ bool enable_ext_xtal_init;
 module_param(enable_ext_xtal_init, bool, 0644);
 MODULE_PARM_DESC(enable_ext_xtal_init, "Enable external xtal init sequence (MM610x)");
 
+/* Run chip and network work from high priority worker pools */
+bool wq_highpri;
+module_param(wq_highpri, bool, 0444);
+MODULE_PARM_DESC(wq_highpri, "Allocate driver workqueues with WQ_HIGHPRI");
+
+/*
+ * Concurrency of the network workqueue. One keeps it ordered, anything larger makes it unbound
+ * with its cpumask exposed under /sys/devices/virtual/workqueue.
+ */
+uint net_wq_max_active = 1;
+module_param(net_wq_max_active, uint, 0444);
+MODULE_PARM_DESC(net_wq_max_active,
+		 "Max concurrent network work items (1 = ordered, >1 = unbound with sysfs cpumask)");
+
+struct workqueue_struct *morse_create_chip_wq(struct morse *mors)
+{
+	unsigned int flags = WQ_MEM_RECLAIM;
+
+	if (wq_highpri)
+		flags |= WQ_HIGHPRI;
+
+	return alloc_ordered_workqueue("MorseChipIfWorkQ", flags);
+}
+
+struct workqueue_struct *morse_create_net_wq(struct morse *mors)
+{
+	unsigned int flags = WQ_MEM_RECLAIM;
+
+	if (wq_highpri)
+		flags |= WQ_HIGHPRI;
+
+	if (net_wq_max_active <= 1)
+		return alloc_ordered_workqueue("MorseNetWorkQ", flags);
+
+	/* The name must be unique per device for the sysfs entry to register */
+	return alloc_workqueue("MorseNetWorkQ-%s", flags | WQ_UNBOUND | WQ_SYSFS,
+			       min_t(uint, net_wq_max_active, WQ_MAX_ACTIVE), dev_name(mors->dev));
+}
+
 static int __init morse_init(void)
 {
 	int ret = 0;
@@ -77,6 +116,12 @@ static int __init morse_init(void)
 		pr_err("morse_usb_failed() failed: %d\n", ret);
 #endif
 
+#ifdef CONFIG_MORSE_LOOPBACK
+	ret = morse_loopback_init();
+	if (ret)
+		pr_err("morse_loopback_init() failed: %d\n", ret);
+#endif
+
 	return ret;
 }
 
@@ -92,6 +137,10 @@ static void __exit morse_exit(void)
 #ifdef CONFIG_MORSE_USB
 	morse_usb_exit();
 #endif
+
+#ifdef CONFIG_MORSE_LOOPBACK
+	morse_loopback_exit();
+#endif
 }
 
 module_init(morse_init);
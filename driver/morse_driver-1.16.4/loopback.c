@@ -0,0 +1,1116 @@
+/*
+ * Copyright 2025 Morse Micro
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ */
+
+/*
+ * Loopback bus: an emulated MM8108 in host memory.
+ *
+ * The emulated chip exposes the registers, host table, extended host table and YAPS status
+ * registers that the driver reads during bring-up, plus the YDS (to-chip) and YSL (from-chip)
+ * stream windows. A small emulated firmware drains the to-chip stream on its own workqueue:
+ * commands are answered with a generic success response, transmitted frames are acknowledged
+ * with a synthetic TX status and data frames are optionally reflected back as received frames.
+ *
+ * This lets the whole host datapath (mac80211, skbq, yaps, command handling) be loaded and
+ * profiled without a HaLow module attached. There is no radio, so nothing is ever transmitted.
+ */
+
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/hashtable.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+
+#include "morse.h"
+#include "mac.h"
+#include "debug.h"
+#include "bus.h"
+#include "hw.h"
+#include "firmware.h"
+#include "command.h"
+#include "skb_header.h"
+#include "yaps.h"
+#include "yaps-hw.h"
+
+#define MORSE_LB_DRV_NAME		"morse_loopback"
+#define MORSE_LB_MAX_DEVICES		4
+#define MORSE_LB_CHIP_ID		MM8108B2_ID
+
+/*
+ * Emulated chip memory map. The addresses are arbitrary, they only need to stay clear of the
+ * MM8108 register space used by mm8108_cfg.
+ */
+#define MORSE_LB_SRAM_ADDR		0x80100000
+#define MORSE_LB_SRAM_SIZE		0x400
+#define MORSE_LB_HOST_TABLE_OFFSET	0x000
+#define MORSE_LB_EXT_TABLE_OFFSET	0x100
+#define MORSE_LB_STATUS_REGS_OFFSET	0x200
+#define MORSE_LB_YDS_ADDR		0x80200000
+#define MORSE_LB_YSL_ADDR		0x80300000
+
+/* Offsets of the hostsync interrupt registers from irq_base_address, see hw.h */
+#define MORSE_LB_INT_BANK_SIZE		0x10
+#define MORSE_LB_INT_NUM_BANKS		2
+#define MORSE_LB_INT_STS		0x00
+#define MORSE_LB_INT_SET		0x04
+#define MORSE_LB_INT_CLR		0x08
+#define MORSE_LB_INT_EN			0x0C
+
+/* Emulated YAPS pools (in pages) and queues (in packets) */
+#define MORSE_LB_PAGE_SIZE		256
+#define MORSE_LB_PAGE_OVERHEAD		2	/* Metadata page and phandle WAR page */
+#define MORSE_LB_TC_TX_POOL_PAGES	512
+#define MORSE_LB_TC_CMD_POOL_PAGES	64
+#define MORSE_LB_TC_BCN_POOL_PAGES	32
+#define MORSE_LB_TC_MGMT_POOL_PAGES	64
+#define MORSE_LB_FC_RX_POOL_PAGES	512
+#define MORSE_LB_FC_POOL_PAGES		64
+#define MORSE_LB_TC_TX_Q_SIZE		32
+#define MORSE_LB_TC_CMD_Q_SIZE		4
+#define MORSE_LB_TC_BCN_Q_SIZE		4
+#define MORSE_LB_TC_MGMT_Q_SIZE		8
+/* Never queue more from-chip packets than yaps.c can split out of one YSL read */
+#define MORSE_LB_FC_Q_SIZE		MAX_PKTS_PER_RX_TXN
+
+/* Bytes following the status word in a synthesised command response */
+#define MORSE_LB_CMD_RESP_DATA_LEN	512
+
+/* Signal strength reported for reflected frames */
+#define MORSE_LB_RX_RSSI		(-40)
+
+#define MORSE_LB_FW_VERSION \
+	((MORSE_CMD_SEMVER_MAJOR << 22) | (MORSE_CMD_SEMVER_MINOR << 10) | MORSE_CMD_SEMVER_PATCH)
+
+static uint loopback_devices;
+module_param(loopback_devices, uint, 0444);
+MODULE_PARM_DESC(loopback_devices, "Number of emulated chips to create on the loopback bus (0-4)");
+
+static bool loopback_reflect_tx __read_mostly = true;
+module_param(loopback_reflect_tx, bool, 0644);
+MODULE_PARM_DESC(loopback_reflect_tx, "Reflect transmitted data frames back as received frames");
+
+#define MORSE_LB_DBG(_m, _f, _a...)		morse_dbg(FEATURE_ID_LOOPBACK, _m, _f, ##_a)
+#define MORSE_LB_INFO(_m, _f, _a...)		morse_info(FEATURE_ID_LOOPBACK, _m, _f, ##_a)
+#define MORSE_LB_WARN(_m, _f, _a...)		morse_warn(FEATURE_ID_LOOPBACK, _m, _f, ##_a)
+#define MORSE_LB_ERR(_m, _f, _a...)		morse_err(FEATURE_ID_LOOPBACK, _m, _f, ##_a)
+
+/**
+ * struct morse_lb_reg - A register without special behaviour, reads back the last value written
+ *
+ * @node: Entry in morse_lb.regs
+ * @addr: Register address
+ * @value: Register value
+ */
+struct morse_lb_reg {
+	struct hlist_node node;
+	u32 addr;
+	u32 value;
+};
+
+/**
+ * struct morse_lb_stats - Emulated firmware counters
+ *
+ * @tc_pkts: Packets taken from the to-chip stream
+ * @tc_bytes: Bytes taken from the to-chip stream, including delimiters
+ * @cmds: Commands answered
+ * @tx_status: TX statuses reported
+ * @rx_reflected: Transmitted frames reflected back as received frames
+ * @fc_bytes: Bytes read by the host from the from-chip stream
+ * @fc_full: Times the emulated firmware stalled on a full from-chip queue
+ * @bad_pkts: To-chip packets dropped because of a bad header
+ * @delim_errors: Invalid to-chip delimiters
+ * @irqs: Interrupts delivered to the host
+ */
+struct morse_lb_stats {
+	u64 tc_pkts;
+	u64 tc_bytes;
+	u64 cmds;
+	u64 tx_status;
+	u64 rx_reflected;
+	u64 fc_bytes;
+	u64 fc_full;
+	u64 bad_pkts;
+	u64 delim_errors;
+	u64 irqs;
+};
+
+/**
+ * struct morse_lb - Emulated chip state
+ *
+ * @mors: Morse chip instance
+ * @bus_lock: Held between claim and release of the bus
+ * @chip_lock: Protects all of the emulated chip state below
+ * @sram: Host table, extended host table and YAPS status registers
+ * @int_sts: Hostsync interrupt status, per bank
+ * @int_en: Hostsync interrupt enable, per bank
+ * @irq_masked: Host has masked the bus interrupt
+ * @regs: Plain registers, hashed by address
+ * @tc_q: To-chip packets waiting for the emulated firmware
+ * @tc_num_pkts: Packets waiting per to-chip queue
+ * @tc_pool_pages: Free pages per to-chip pool
+ * @delim_crc_fail: A corrupt to-chip delimiter was seen
+ * @fc_buf: From-chip stream, YAPS_HW_WINDOW_SIZE_BYTES long
+ * @fc_len: Bytes queued in @fc_buf
+ * @fc_num_pkts: Packets queued in @fc_buf
+ * @op_freq_100khz: Operating frequency from the last SET_CHANNEL command
+ * @fw_wq: Workqueue running the emulated firmware
+ * @fw_work: Emulated firmware, drains @tc_q
+ * @irq_work: Delivers interrupts to the host
+ * @stats: Emulated firmware counters
+ */
+struct morse_lb {
+	struct morse *mors;
+	struct mutex bus_lock;
+	struct mutex chip_lock;
+
+	u8 sram[MORSE_LB_SRAM_SIZE] __aligned(8);
+	u32 int_sts[MORSE_LB_INT_NUM_BANKS];
+	u32 int_en[MORSE_LB_INT_NUM_BANKS];
+	bool irq_masked;
+	DECLARE_HASHTABLE(regs, 5);
+
+	struct sk_buff_head tc_q;
+	u32 tc_num_pkts[MORSE_YAPS_NUM_TC_Q];
+	u32 tc_pool_pages[MORSE_YAPS_NUM_TC_Q];
+	bool delim_crc_fail;
+
+	u8 *fc_buf;
+	u32 fc_len;
+	u32 fc_num_pkts;
+
+	u16 op_freq_100khz;
+
+	struct workqueue_struct *fw_wq;
+	struct work_struct fw_work;
+	struct work_struct irq_work;
+
+	struct morse_lb_stats stats;
+};
+
+/* To-chip queue of a packet waiting in morse_lb.tc_q */
+#define MORSE_LB_SKB_TC_QUEUE(_skb)	(*(u8 *)(_skb)->cb)
+
+static const u32 morse_lb_tc_pool_size[MORSE_YAPS_NUM_TC_Q] = {
+	[MORSE_YAPS_TX_Q] = MORSE_LB_TC_TX_POOL_PAGES,
+	[MORSE_YAPS_CMD_Q] = MORSE_LB_TC_CMD_POOL_PAGES,
+	[MORSE_YAPS_BEACON_Q] = MORSE_LB_TC_BCN_POOL_PAGES,
+	[MORSE_YAPS_MGMT_Q] = MORSE_LB_TC_MGMT_POOL_PAGES,
+};
+
+static struct platform_device *morse_lb_pdevs[MORSE_LB_MAX_DEVICES];
+
+static inline struct morse_lb *morse_lb_from_mors(struct morse *mors)
+{
+	return (struct morse_lb *)mors->drv_priv;
+}
+
+static u32 morse_lb_pages_required(u32 size)
+{
+	return DIV_ROUND_UP(size, MORSE_LB_PAGE_SIZE) + MORSE_LB_PAGE_OVERHEAD;
+}
+
+static struct morse_lb_reg *morse_lb_reg_find(struct morse_lb *lb, u32 addr)
+{
+	struct morse_lb_reg *reg;
+
+	hash_for_each_possible(lb->regs, reg, node, addr) {
+		if (reg->addr == addr)
+			return reg;
+	}
+	return NULL;
+}
+
+static void morse_lb_reg_store(struct morse_lb *lb, u32 addr, u32 value)
+{
+	struct morse_lb_reg *reg = morse_lb_reg_find(lb, addr);
+
+	if (!reg) {
+		/* Writing zero to an unknown register is the same as leaving it alone */
+		if (!value)
+			return;
+		reg = kzalloc(sizeof(*reg), GFP_KERNEL);
+		if (!reg)
+			return;
+		reg->addr = addr;
+		hash_add(lb->regs, &reg->node, addr);
+	}
+	reg->value = value;
+}
+
+static void morse_lb_regs_free(struct morse_lb *lb)
+{
+	struct morse_lb_reg *reg;
+	struct hlist_node *tmp;
+	int bkt;
+
+	hash_for_each_safe(lb->regs, bkt, tmp, reg, node) {
+		hash_del(&reg->node);
+		kfree(reg);
+	}
+}
+
+/* Publish the emulated YAPS state through the status register block */
+static void morse_lb_update_status(struct morse_lb *lb)
+{
+	struct morse_yaps_status_registers *regs =
+	    (struct morse_yaps_status_registers *)&lb->sram[MORSE_LB_STATUS_REGS_OFFSET];
+
+	regs->tc_tx_pool_num_pages = (__force u32)cpu_to_le32(lb->tc_pool_pages[MORSE_YAPS_TX_Q]);
+	regs->tc_cmd_pool_num_pages = (__force u32)cpu_to_le32(lb->tc_pool_pages[MORSE_YAPS_CMD_Q]);
+	regs->tc_beacon_pool_num_pages =
+	    (__force u32)cpu_to_le32(lb->tc_pool_pages[MORSE_YAPS_BEACON_Q]);
+	regs->tc_mgmt_pool_num_pages =
+	    (__force u32)cpu_to_le32(lb->tc_pool_pages[MORSE_YAPS_MGMT_Q]);
+	regs->fc_rx_pool_num_pages = (__force u32)cpu_to_le32(MORSE_LB_FC_RX_POOL_PAGES);
+	regs->fc_resp_pool_num_pages = (__force u32)cpu_to_le32(MORSE_LB_FC_POOL_PAGES);
+	regs->fc_tx_sts_pool_num_pages = (__force u32)cpu_to_le32(MORSE_LB_FC_POOL_PAGES);
+	regs->fc_aux_pool_num_pages = (__force u32)cpu_to_le32(MORSE_LB_FC_POOL_PAGES);
+	regs->tc_tx_num_pkts = (__force u32)cpu_to_le32(lb->tc_num_pkts[MORSE_YAPS_TX_Q]);
+	regs->tc_cmd_num_pkts = (__force u32)cpu_to_le32(lb->tc_num_pkts[MORSE_YAPS_CMD_Q]);
+	regs->tc_beacon_num_pkts = (__force u32)cpu_to_le32(lb->tc_num_pkts[MORSE_YAPS_BEACON_Q]);
+	regs->tc_mgmt_num_pkts = (__force u32)cpu_to_le32(lb->tc_num_pkts[MORSE_YAPS_MGMT_Q]);
+	regs->fc_num_pkts = (__force u32)cpu_to_le32(lb->fc_num_pkts);
+	regs->fc_done_num_pkts = 0;
+	regs->fc_rx_bytes_in_queue = (__force u32)cpu_to_le32(lb->fc_len);
+	regs->tc_delim_crc_fail_detected = (__force u32)cpu_to_le32(lb->delim_crc_fail);
+	regs->fc_host_ysl_status = 0;
+	regs->lock = 0;
+}
+
+/* Called with chip_lock held */
+static void morse_lb_check_irq(struct morse_lb *lb)
+{
+	int i;
+
+	if (lb->irq_masked || !lb->mors->chip_wq)
+		return;
+
+	for (i = 0; i < MORSE_LB_INT_NUM_BANKS; i++) {
+		if (lb->int_sts[i] & lb->int_en[i]) {
+			queue_work(lb->mors->chip_wq, &lb->irq_work);
+			return;
+		}
+	}
+}
+
+static void morse_lb_raise_irq(struct morse_lb *lb, u32 bits)
+{
+	if (!bits)
+		return;
+	lb->int_sts[0] |= bits;
+	morse_lb_check_irq(lb);
+}
+
+static void morse_lb_irq_work(struct work_struct *work)
+{
+	struct morse_lb *lb = container_of(work, struct morse_lb, irq_work);
+	struct morse *mors = lb->mors;
+
+	lb->stats.irqs++;
+	morse_claim_bus(mors);
+	morse_hw_irq_handle(mors);
+	morse_release_bus(mors);
+
+	/* Anything raised while the host was handling the last batch */
+	mutex_lock(&lb->chip_lock);
+	morse_lb_check_irq(lb);
+	mutex_unlock(&lb->chip_lock);
+}
+
+/* Returns true if @bytes over @pkts packets fit in the from-chip queue */
+static bool morse_lb_fc_has_space(struct morse_lb *lb, u32 bytes, u32 pkts)
+{
+	return (lb->fc_len + bytes <= YAPS_HW_WINDOW_SIZE_BYTES) &&
+	       (lb->fc_num_pkts + pkts <= MORSE_LB_FC_Q_SIZE);
+}
+
+static u32 morse_lb_fc_pkt_bytes(u32 body_len)
+{
+	u32 size = sizeof(struct morse_buff_skb_header) + body_len;
+
+	return sizeof(u32) + size + YAPS_CALC_PADDING(size);
+}
+
+/* Append one packet to the from-chip stream. Space must have been checked by the caller. */
+static void morse_lb_fc_put(struct morse_lb *lb, enum morse_yaps_from_chip_q fc_queue,
+			    const struct morse_buff_skb_header *hdr, const void *body, u32 body_len)
+{
+	u32 size = sizeof(*hdr) + body_len;
+	u32 padding = YAPS_CALC_PADDING(size);
+	u8 *p = lb->fc_buf + lb->fc_len;
+	u32 delim;
+
+	delim = (size & 0x3FFF) | YAPS_DELIM_SET_PADDING(padding) |
+		YAPS_DELIM_SET_POOL_ID(fc_queue);
+	delim |= YAPS_DELIM_SET_CRC(morse_yaps_crc(delim));
+
+	put_unaligned_le32(delim, p);
+	p += sizeof(delim);
+	memcpy(p, hdr, sizeof(*hdr));
+	p += sizeof(*hdr);
+	if (body_len)
+		memcpy(p, body, body_len);
+	memset(p + body_len, 0, padding);
+
+	lb->fc_len += sizeof(delim) + size + padding;
+	lb->fc_num_pkts++;
+}
+
+static u32 morse_lb_fc_count(struct morse_lb *lb)
+{
+	u32 pos = 0;
+	u32 count = 0;
+
+	while (pos + sizeof(u32) <= lb->fc_len) {
+		u32 delim = get_unaligned_le32(lb->fc_buf + pos);
+
+		pos += sizeof(delim) + YAPS_DELIM_GET_PHANDLE_SIZE(delim) +
+		       YAPS_DELIM_GET_PADDING(delim);
+		count++;
+	}
+	return count;
+}
+
+static void morse_lb_ysl_read(struct morse_lb *lb, u8 *data, int len)
+{
+	u32 n = min_t(u32, len, lb->fc_len);
+
+	memcpy(data, lb->fc_buf, n);
+	memset(data + n, 0, len - n);
+
+	/* The host reads whole packets as advertised by fc_rx_bytes_in_queue */
+	if (n < lb->fc_len)
+		memmove(lb->fc_buf, lb->fc_buf + n, lb->fc_len - n);
+	lb->fc_len -= n;
+	lb->fc_num_pkts = lb->fc_len ? morse_lb_fc_count(lb) : 0;
+	lb->stats.fc_bytes += n;
+
+	morse_lb_update_status(lb);
+
+	/* The emulated firmware may have been waiting for room */
+	if (n && !skb_queue_empty(&lb->tc_q))
+		queue_work(lb->fw_wq, &lb->fw_work);
+}
+
+static void morse_lb_yds_write(struct morse_lb *lb, const u8 *data, int len)
+{
+	int pos = 0;
+	bool kick = false;
+
+	while (pos + (int)sizeof(u32) <= len) {
+		u32 delim = get_unaligned_le32(data + pos);
+		u32 size = YAPS_DELIM_GET_PHANDLE_SIZE(delim);
+		u32 tc_queue = YAPS_DELIM_GET_POOL_ID(delim);
+		u32 total = size + YAPS_DELIM_GET_PADDING(delim);
+		struct sk_buff *skb;
+
+		if (YAPS_DELIM_GET_CRC(delim) != morse_yaps_crc(delim) || !size ||
+		    tc_queue >= MORSE_YAPS_NUM_TC_Q || pos + sizeof(delim) + total > len) {
+			MORSE_LB_ERR(lb->mors, "%s: bad delimiter 0x%08x at %d\n",
+				     __func__, delim, pos);
+			lb->delim_crc_fail = true;
+			lb->stats.delim_errors++;
+			break;
+		}
+		pos += sizeof(delim);
+
+		skb = alloc_skb(size, GFP_KERNEL);
+		if (skb) {
+			skb_put_data(skb, data + pos, size);
+			MORSE_LB_SKB_TC_QUEUE(skb) = tc_queue;
+			__skb_queue_tail(&lb->tc_q, skb);
+			lb->tc_num_pkts[tc_queue]++;
+			lb->tc_pool_pages[tc_queue] -= min(lb->tc_pool_pages[tc_queue],
+							   morse_lb_pages_required(size));
+		}
+
+		lb->stats.tc_pkts++;
+		lb->stats.tc_bytes += sizeof(delim) + total;
+		kick |= YAPS_DELIM_GET_IRQ(delim);
+		pos += total;
+	}
+
+	morse_lb_update_status(lb);
+	if (kick)
+		queue_work(lb->fw_wq, &lb->fw_work);
+}
+
+static int morse_lb_fw_cmd(struct morse_lb *lb, const u8 *body, u32 len)
+{
+	const struct morse_cmd_req *req = (const struct morse_cmd_req *)body;
+	struct morse_buff_skb_header hdr = { 0 };
+	struct morse_cmd_resp *resp;
+	u32 resp_len = sizeof(*resp) + MORSE_LB_CMD_RESP_DATA_LEN;
+
+	if (len < sizeof(req->hdr))
+		return -EINVAL;
+
+	if (!morse_lb_fc_has_space(lb, morse_lb_fc_pkt_bytes(resp_len), 1))
+		return -ENOSPC;
+
+	/* Remember the channel so reflected frames are reported on it */
+	if (le16_to_cpu(req->hdr.message_id) == MORSE_CMD_ID_SET_CHANNEL &&
+	    len >= sizeof(struct morse_cmd_req_set_channel)) {
+		const struct morse_cmd_req_set_channel *set_chan =
+		    (const struct morse_cmd_req_set_channel *)req;
+		u32 freq_hz = le32_to_cpu(set_chan->op_chan_freq_hz);
+
+		if (freq_hz != U32_MAX)
+			lb->op_freq_100khz = freq_hz / 100000;
+	}
+
+	resp = kzalloc(resp_len, GFP_KERNEL);
+	if (!resp)
+		return -ENOMEM;
+
+	resp->hdr = req->hdr;
+	resp->hdr.flags = cpu_to_le16(MORSE_CMD_TYPE_RESP);
+	resp->hdr.len = cpu_to_le16(resp_len - sizeof(resp->hdr));
+	resp->status = 0;
+
+	hdr.sync = MORSE_SKB_HEADER_SYNC;
+	hdr.channel = MORSE_SKB_CHAN_COMMAND;
+	hdr.len = cpu_to_le16(resp_len);
+	morse_lb_fc_put(lb, MORSE_YAPS_CMD_RESP_Q, &hdr, resp, resp_len);
+	kfree(resp);
+
+	lb->stats.cmds++;
+	return 0;
+}
+
+static int morse_lb_fw_tx(struct morse_lb *lb, const struct morse_buff_skb_header *tx_hdr,
+			  const u8 *body, u32 len)
+{
+	const struct morse_skb_tx_info *tx_info = &tx_hdr->tx_info;
+	u32 tx_flags = le32_to_cpu(tx_info->flags);
+	bool report = !(tx_flags & MORSE_TX_STATUS_FLAGS_NO_REPORT);
+	bool reflect = loopback_reflect_tx &&
+		       (tx_hdr->channel == MORSE_SKB_CHAN_DATA ||
+			tx_hdr->channel == MORSE_SKB_CHAN_DATA_NOACK);
+	struct morse_buff_skb_header hdr = { 0 };
+	u32 bytes = 0;
+	u32 pkts = 0;
+
+	if (report) {
+		bytes += morse_lb_fc_pkt_bytes(sizeof(struct morse_skb_tx_status));
+		pkts++;
+	}
+	if (reflect) {
+		bytes += morse_lb_fc_pkt_bytes(len);
+		pkts++;
+	}
+	if (!morse_lb_fc_has_space(lb, bytes, pkts))
+		return -ENOSPC;
+
+	if (report) {
+		struct morse_skb_tx_status tx_sts = { 0 };
+
+		/* Every frame is acknowledged first time at the requested rate */
+		tx_sts.flags = 0;
+		tx_sts.pkt_id = tx_info->pkt_id;
+		tx_sts.tid = tx_info->tid;
+		tx_sts.channel = tx_hdr->channel;
+		memcpy(tx_sts.rates, tx_info->rates, sizeof(tx_sts.rates));
+
+		hdr.sync = MORSE_SKB_HEADER_SYNC;
+		hdr.channel = MORSE_SKB_CHAN_TX_STATUS;
+		hdr.len = cpu_to_le16(sizeof(tx_sts));
+		morse_lb_fc_put(lb, MORSE_YAPS_TX_STATUS_Q, &hdr, &tx_sts, sizeof(tx_sts));
+		lb->stats.tx_status++;
+	}
+
+	if (reflect) {
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.sync = MORSE_SKB_HEADER_SYNC;
+		hdr.channel = MORSE_SKB_CHAN_DATA;
+		hdr.len = cpu_to_le16(len);
+		hdr.rx_status.flags =
+		    cpu_to_le32(MORSE_RX_STATUS_FLAGS_VIF_ID_SET(MORSE_TX_CONF_FLAGS_VIF_ID_GET(tx_flags)));
+		hdr.rx_status.morse_ratecode = tx_info->rates[0].morse_ratecode;
+		hdr.rx_status.rssi = cpu_to_le16((u16)MORSE_LB_RX_RSSI);
+		hdr.rx_status.freq_100khz = cpu_to_le16(lb->op_freq_100khz);
+		hdr.rx_status.rx_timestamp_us = cpu_to_le64(ktime_to_us(ktime_get()));
+		morse_lb_fc_put(lb, MORSE_YAPS_RX_Q, &hdr, body, len);
+		lb->stats.rx_reflected++;
+	}
+
+	return 0;
+}
+
+/*
+ * Handle one to-chip packet. Returns -ENOSPC if its replies do not fit in the from-chip queue
+ * yet, in which case the packet stays queued.
+ */
+static int morse_lb_fw_handle_pkt(struct morse_lb *lb, struct sk_buff *skb)
+{
+	struct morse_buff_skb_header *hdr = (struct morse_buff_skb_header *)skb->data;
+	const u8 *body;
+	u32 len;
+
+	if (skb->len < sizeof(*hdr) || hdr->sync != MORSE_SKB_HEADER_SYNC)
+		goto bad_pkt;
+
+	body = skb->data + sizeof(*hdr) + hdr->offset;
+	len = le16_to_cpu(hdr->len);
+	if (body + len > skb_tail_pointer(skb))
+		goto bad_pkt;
+
+	switch (hdr->channel) {
+	case MORSE_SKB_CHAN_COMMAND:
+		return morse_lb_fw_cmd(lb, body, len);
+	case MORSE_SKB_CHAN_LOOPBACK:
+		/* Bus benchmark packets go straight back to the host */
+		if (!morse_lb_fc_has_space(lb, morse_lb_fc_pkt_bytes(len), 1))
+			return -ENOSPC;
+		morse_lb_fc_put(lb, MORSE_YAPS_AUX_Q, hdr, body, len);
+		return 0;
+	default:
+		return morse_lb_fw_tx(lb, hdr, body, len);
+	}
+
+bad_pkt:
+	lb->stats.bad_pkts++;
+	return -EINVAL;
+}
+
+static void morse_lb_fw_work(struct work_struct *work)
+{
+	struct morse_lb *lb = container_of(work, struct morse_lb, fw_work);
+	u32 fc_num_pkts;
+	u32 irqs = 0;
+	struct sk_buff *skb;
+
+	mutex_lock(&lb->chip_lock);
+	fc_num_pkts = lb->fc_num_pkts;
+
+	while ((skb = skb_peek(&lb->tc_q))) {
+		u8 tc_queue = MORSE_LB_SKB_TC_QUEUE(skb);
+
+		if (morse_lb_fw_handle_pkt(lb, skb) == -ENOSPC) {
+			lb->stats.fc_full++;
+			break;
+		}
+
+		__skb_unlink(skb, &lb->tc_q);
+		lb->tc_num_pkts[tc_queue]--;
+		lb->tc_pool_pages[tc_queue] = min(lb->tc_pool_pages[tc_queue] +
+						  morse_lb_pages_required(skb->len),
+						  morse_lb_tc_pool_size[tc_queue]);
+		consume_skb(skb);
+		irqs |= BIT(MORSE_INT_YAPS_FC_PACKET_FREED_UP_IRQN);
+	}
+
+	if (lb->fc_num_pkts != fc_num_pkts)
+		irqs |= BIT(MORSE_INT_YAPS_FC_PKT_WAITING_IRQN);
+
+	morse_lb_update_status(lb);
+	morse_lb_raise_irq(lb, irqs);
+	mutex_unlock(&lb->chip_lock);
+}
+
+/* Emulated firmware has booted: publish the host table and reset the YAPS state */
+static void morse_lb_fw_boot(struct morse_lb *lb)
+{
+	struct host_table *host_table =
+	    (struct host_table *)&lb->sram[MORSE_LB_HOST_TABLE_OFFSET];
+	struct extended_host_table *ext_table =
+	    (struct extended_host_table *)&lb->sram[MORSE_LB_EXT_TABLE_OFFSET];
+	struct extended_host_table_capabilities_s1g *caps;
+	struct extended_host_table_yaps_table *yaps;
+	struct morse_yaps_hw_table *tbl;
+	u8 *p;
+	int i;
+
+	memset(lb->sram, 0, sizeof(lb->sram));
+
+	host_table->magic_number = cpu_to_le32(mm8108_cfg.regs->magic_num_value);
+	host_table->fw_version_number = cpu_to_le32(MORSE_LB_FW_VERSION);
+	host_table->extended_host_table_addr =
+	    cpu_to_le32(MORSE_LB_SRAM_ADDR + MORSE_LB_EXT_TABLE_OFFSET);
+
+	/* Leave the MAC address as zero so the driver assigns one */
+	p = ext_table->ext_host_table_data_tlvs;
+
+	caps = (struct extended_host_table_capabilities_s1g *)p;
+	caps->header.tag = cpu_to_le16(MORSE_FW_HOST_TABLE_TAG_S1G_CAPABILITIES);
+	caps->header.length = cpu_to_le16(sizeof(*caps));
+	caps->flags[0] = cpu_to_le32(BIT(MORSE_CAPS_2MHZ) | BIT(MORSE_CAPS_4MHZ) |
+				     BIT(MORSE_CAPS_8MHZ) | BIT(MORSE_CAPS_SGI) |
+				     BIT(MORSE_CAPS_AMPDU) | BIT(MORSE_CAPS_AMSDU));
+	caps->maximum_ampdu_length = 3;
+	p += sizeof(*caps);
+
+	yaps = (struct extended_host_table_yaps_table *)p;
+	yaps->header.tag = cpu_to_le16(MORSE_FW_HOST_TABLE_TAG_YAPS_TABLE);
+	yaps->header.length = cpu_to_le16(sizeof(*yaps));
+	tbl = &yaps->yaps_table;
+	tbl->ysl_addr = cpu_to_le32(MORSE_LB_YSL_ADDR);
+	tbl->yds_addr = cpu_to_le32(MORSE_LB_YDS_ADDR);
+	tbl->status_regs_addr = cpu_to_le32(MORSE_LB_SRAM_ADDR + MORSE_LB_STATUS_REGS_OFFSET);
+	tbl->tc_tx_pool_size = cpu_to_le16(MORSE_LB_TC_TX_POOL_PAGES);
+	tbl->fc_rx_pool_size = cpu_to_le16(MORSE_LB_FC_RX_POOL_PAGES);
+	tbl->tc_cmd_pool_size = MORSE_LB_TC_CMD_POOL_PAGES;
+	tbl->tc_beacon_pool_size = MORSE_LB_TC_BCN_POOL_PAGES;
+	tbl->tc_mgmt_pool_size = MORSE_LB_TC_MGMT_POOL_PAGES;
+	tbl->fc_resp_pool_size = MORSE_LB_FC_POOL_PAGES;
+	tbl->fc_tx_sts_pool_size = MORSE_LB_FC_POOL_PAGES;
+	tbl->fc_aux_pool_size = MORSE_LB_FC_POOL_PAGES;
+	tbl->tc_tx_q_size = MORSE_LB_TC_TX_Q_SIZE;
+	tbl->tc_cmd_q_size = MORSE_LB_TC_CMD_Q_SIZE;
+	tbl->tc_beacon_q_size = MORSE_LB_TC_BCN_Q_SIZE;
+	tbl->tc_mgmt_q_size = MORSE_LB_TC_MGMT_Q_SIZE;
+	tbl->fc_q_size = MORSE_LB_FC_Q_SIZE;
+	tbl->fc_done_q_size = MORSE_LB_FC_Q_SIZE;
+	tbl->yaps_reserved_page_size = 0;
+	p += sizeof(*yaps);
+
+	ext_table->extended_host_table_length = cpu_to_le32(p - (u8 *)ext_table);
+
+	__skb_queue_purge(&lb->tc_q);
+	for (i = 0; i < MORSE_YAPS_NUM_TC_Q; i++) {
+		lb->tc_num_pkts[i] = 0;
+		lb->tc_pool_pages[i] = morse_lb_tc_pool_size[i];
+	}
+	lb->delim_crc_fail = false;
+	lb->fc_len = 0;
+	lb->fc_num_pkts = 0;
+	morse_lb_update_status(lb);
+
+	morse_lb_reg_store(lb, mm8108_cfg.regs->manifest_ptr_address,
+			   MORSE_LB_SRAM_ADDR + MORSE_LB_HOST_TABLE_OFFSET);
+}
+
+static bool morse_lb_is_sram(u32 addr, int len)
+{
+	return addr >= MORSE_LB_SRAM_ADDR && len >= 0 &&
+	       addr - MORSE_LB_SRAM_ADDR + len <= MORSE_LB_SRAM_SIZE;
+}
+
+/* Returns the hostsync interrupt bank and register offset for @addr, or -1 */
+static int morse_lb_int_reg(u32 addr, u32 *offset)
+{
+	u32 base = mm8108_cfg.regs->irq_base_address;
+
+	if (addr < base || addr >= base + MORSE_LB_INT_NUM_BANKS * MORSE_LB_INT_BANK_SIZE)
+		return -1;
+	*offset = (addr - base) % MORSE_LB_INT_BANK_SIZE;
+	return (addr - base) / MORSE_LB_INT_BANK_SIZE;
+}
+
+/* Called with chip_lock held */
+static u32 morse_lb_read_word(struct morse_lb *lb, u32 addr)
+{
+	struct morse_lb_reg *reg;
+	u32 offset;
+	int bank;
+
+	if (addr == mm8108_cfg.chip_id_address)
+		return MORSE_LB_CHIP_ID;
+
+	if (morse_lb_is_sram(addr, sizeof(u32)))
+		return get_unaligned_le32(&lb->sram[addr - MORSE_LB_SRAM_ADDR]);
+
+	bank = morse_lb_int_reg(addr, &offset);
+	if (bank >= 0) {
+		if (offset == MORSE_LB_INT_STS)
+			return lb->int_sts[bank];
+		if (offset == MORSE_LB_INT_EN)
+			return lb->int_en[bank];
+		return 0;
+	}
+
+	reg = morse_lb_reg_find(lb, addr);
+	return reg ? reg->value : 0;
+}
+
+/* Called with chip_lock held */
+static void morse_lb_write_word(struct morse_lb *lb, u32 addr, u32 value)
+{
+	u32 offset;
+	int bank;
+
+	if (morse_lb_is_sram(addr, sizeof(u32))) {
+		put_unaligned_le32(value, &lb->sram[addr - MORSE_LB_SRAM_ADDR]);
+		return;
+	}
+
+	bank = morse_lb_int_reg(addr, &offset);
+	if (bank >= 0) {
+		switch (offset) {
+		case MORSE_LB_INT_SET:
+			lb->int_sts[bank] |= value;
+			break;
+		case MORSE_LB_INT_CLR:
+			lb->int_sts[bank] &= ~value;
+			break;
+		case MORSE_LB_INT_EN:
+			lb->int_en[bank] = value;
+			break;
+		default:
+			break;
+		}
+		morse_lb_check_irq(lb);
+		return;
+	}
+
+	morse_lb_reg_store(lb, addr, value);
+}
+
+static int morse_lb_dm_read(struct morse *mors, u32 addr, u8 *data, int len)
+{
+	struct morse_lb *lb = morse_lb_from_mors(mors);
+	int i;
+
+	if (len < 0)
+		return -EINVAL;
+
+	mutex_lock(&lb->chip_lock);
+	if (addr == MORSE_LB_YSL_ADDR || addr == MORSE_LB_YSL_ADDR + 4) {
+		morse_lb_ysl_read(lb, data, len);
+	} else if (morse_lb_is_sram(addr, len)) {
+		memcpy(data, &lb->sram[addr - MORSE_LB_SRAM_ADDR], len);
+	} else {
+		for (i = 0; i + sizeof(u32) <= len; i += sizeof(u32))
+			put_unaligned_le32(morse_lb_read_word(lb, addr + i), data + i);
+		memset(data + i, 0, len - i);
+	}
+	mutex_unlock(&lb->chip_lock);
+
+	return 0;
+}
+
+static int morse_lb_dm_write(struct morse *mors, u32 addr, const u8 *data, int len)
+{
+	struct morse_lb *lb = morse_lb_from_mors(mors);
+	int i;
+
+	if (len < 0)
+		return -EINVAL;
+
+	mutex_lock(&lb->chip_lock);
+	if (addr == MORSE_LB_YDS_ADDR) {
+		morse_lb_yds_write(lb, data, len);
+	} else if (morse_lb_is_sram(addr, len)) {
+		memcpy(&lb->sram[addr - MORSE_LB_SRAM_ADDR], data, len);
+	} else {
+		for (i = 0; i + sizeof(u32) <= len; i += sizeof(u32))
+			morse_lb_write_word(lb, addr + i, get_unaligned_le32(data + i));
+	}
+	mutex_unlock(&lb->chip_lock);
+
+	return 0;
+}
+
+static int morse_lb_reg32_read(struct morse *mors, u32 addr, u32 *data)
+{
+	struct morse_lb *lb = morse_lb_from_mors(mors);
+
+	mutex_lock(&lb->chip_lock);
+	*data = morse_lb_read_word(lb, addr);
+	mutex_unlock(&lb->chip_lock);
+
+	return 0;
+}
+
+static int morse_lb_reg32_write(struct morse *mors, u32 addr, u32 data)
+{
+	struct morse_lb *lb = morse_lb_from_mors(mors);
+
+	mutex_lock(&lb->chip_lock);
+	morse_lb_write_word(lb, addr, data);
+	mutex_unlock(&lb->chip_lock);
+
+	return 0;
+}
+
+static void morse_lb_claim_bus(struct morse *mors)
+{
+	struct morse_lb *lb = morse_lb_from_mors(mors);
+
+	mutex_lock(&lb->bus_lock);
+}
+
+static void morse_lb_release_bus(struct morse *mors)
+{
+	struct morse_lb *lb = morse_lb_from_mors(mors);
+
+	mutex_unlock(&lb->bus_lock);
+}
+
+static int morse_lb_reset_bus(struct morse *mors)
+{
+	return 0;
+}
+
+static void morse_lb_bus_enable(struct morse *mors, bool enable)
+{
+}
+
+static void morse_lb_set_irq(struct morse *mors, bool enable)
+{
+	struct morse_lb *lb = morse_lb_from_mors(mors);
+
+	mutex_lock(&lb->chip_lock);
+	lb->irq_masked = !enable;
+	morse_lb_check_irq(lb);
+	mutex_unlock(&lb->chip_lock);
+}
+
+static const struct morse_bus_ops morse_lb_ops = {
+	.dm_read = morse_lb_dm_read,
+	.dm_write = morse_lb_dm_write,
+	.reg32_read = morse_lb_reg32_read,
+	.reg32_write = morse_lb_reg32_write,
+	.set_bus_enable = morse_lb_bus_enable,
+	.claim = morse_lb_claim_bus,
+	.release = morse_lb_release_bus,
+	.reset = morse_lb_reset_bus,
+	.set_irq = morse_lb_set_irq,
+	.bulk_alignment = MORSE_DEFAULT_BULK_ALIGNMENT,
+};
+
+#ifdef CONFIG_MORSE_DEBUGFS
+static int morse_lb_read_stats(struct seq_file *file, void *data)
+{
+	struct morse *mors = dev_get_drvdata(file->private);
+	struct morse_lb *lb = morse_lb_from_mors(mors);
+	struct morse_lb_stats stats;
+	u32 fc_len;
+	u32 tc_pkts;
+
+	mutex_lock(&lb->chip_lock);
+	stats = lb->stats;
+	fc_len = lb->fc_len;
+	tc_pkts = skb_queue_len(&lb->tc_q);
+	mutex_unlock(&lb->chip_lock);
+
+	seq_printf(file, "tc_pkts: %llu\n", stats.tc_pkts);
+	seq_printf(file, "tc_bytes: %llu\n", stats.tc_bytes);
+	seq_printf(file, "tc_queued: %u\n", tc_pkts);
+	seq_printf(file, "cmds: %llu\n", stats.cmds);
+	seq_printf(file, "tx_status: %llu\n", stats.tx_status);
+	seq_printf(file, "rx_reflected: %llu\n", stats.rx_reflected);
+	seq_printf(file, "fc_bytes: %llu\n", stats.fc_bytes);
+	seq_printf(file, "fc_queued_bytes: %u\n", fc_len);
+	seq_printf(file, "fc_full: %llu\n", stats.fc_full);
+	seq_printf(file, "bad_pkts: %llu\n", stats.bad_pkts);
+	seq_printf(file, "delim_errors: %llu\n", stats.delim_errors);
+	seq_printf(file, "irqs: %llu\n", stats.irqs);
+
+	return 0;
+}
+#endif
+
+static void morse_lb_chip_free(struct morse_lb *lb)
+{
+	if (lb->fw_wq) {
+		destroy_workqueue(lb->fw_wq);
+		lb->fw_wq = NULL;
+	}
+	__skb_queue_purge(&lb->tc_q);
+	morse_lb_regs_free(lb);
+	kfree(lb->fc_buf);
+	lb->fc_buf = NULL;
+}
+
+static int morse_lb_probe(struct platform_device *pdev)
+{
+	int ret;
+	struct morse *mors;
+	struct morse_lb *lb;
+
+	mors = morse_mac_create(sizeof(*lb), &pdev->dev);
+	if (!mors) {
+		dev_err(&pdev->dev, "morse_mac_create failed\n");
+		return -ENOMEM;
+	}
+
+	mors->bus_ops = &morse_lb_ops;
+	mors->bus_type = MORSE_HOST_BUS_TYPE_LOOPBACK;
+
+	lb = morse_lb_from_mors(mors);
+	lb->mors = mors;
+	mutex_init(&lb->bus_lock);
+	mutex_init(&lb->chip_lock);
+	hash_init(lb->regs);
+	__skb_queue_head_init(&lb->tc_q);
+	INIT_WORK(&lb->fw_work, morse_lb_fw_work);
+	INIT_WORK(&lb->irq_work, morse_lb_irq_work);
+	platform_set_drvdata(pdev, mors);
+
+	lb->fc_buf = kzalloc(YAPS_HW_WINDOW_SIZE_BYTES, GFP_KERNEL);
+	if (!lb->fc_buf) {
+		ret = -ENOMEM;
+		goto err_chip;
+	}
+
+	lb->fw_wq = alloc_ordered_workqueue("MorseLoopbackFwQ", 0);
+	if (!lb->fw_wq) {
+		ret = -ENOMEM;
+		goto err_chip;
+	}
+
+	ret = morse_chip_cfg_detect_and_init(mors, &mm81xx_chip_series);
+	if (ret < 0) {
+		MORSE_LB_ERR(mors, "morse_chip_cfg_detect_and_init failed: %d\n", ret);
+		goto err_chip;
+	}
+	MORSE_LB_INFO(mors, "Morse Micro loopback device created, chip ID=0x%04x\n",
+		      mors->chip_id);
+
+	mors->cfg->mm_ps_gpios_supported = false;
+	mors->board_serial = serial;
+
+	/* There is no firmware to download, the emulated chip boots straight away */
+	mutex_lock(&lb->chip_lock);
+	morse_lb_fw_boot(lb);
+	mutex_unlock(&lb->chip_lock);
+
+	if (!morse_hw_is_already_loaded(mors)) {
+		MORSE_LB_ERR(mors, "emulated firmware failed verification\n");
+		ret = -EIO;
+		goto err_chip;
+	}
+
+	mors->chip_wq = morse_create_chip_wq(mors);
+	if (!mors->chip_wq) {
+		MORSE_LB_ERR(mors, "morse_create_chip_wq() failed\n");
+		ret = -ENOMEM;
+		goto err_chip;
+	}
+
+	mors->net_wq = morse_create_net_wq(mors);
+	if (!mors->net_wq) {
+		MORSE_LB_ERR(mors, "morse_create_net_wq() failed\n");
+		ret = -ENOMEM;
+		goto err_net_wq;
+	}
+
+	ret = mors->cfg->ops->init(mors);
+	if (ret) {
+		MORSE_LB_ERR(mors, "chip_if_init failed: %d\n", ret);
+		goto err_buffs;
+	}
+
+	ret = morse_firmware_parse_extended_host_table(mors);
+	if (ret) {
+		MORSE_LB_ERR(mors, "failed to parse extended host table: %d\n", ret);
+		goto err_host_table;
+	}
+
+	ret = morse_mac_register(mors);
+	if (ret) {
+		MORSE_LB_ERR(mors, "morse_mac_register failed: %d\n", ret);
+		goto err_host_table;
+	}
+
+#ifdef CONFIG_MORSE_DEBUGFS
+	debugfs_create_devm_seqfile(mors->dev, "loopback_stats",
+				    mors->debug.debugfs_phy, morse_lb_read_stats);
+#endif
+
+	return 0;
+
+err_host_table:
+	mors->cfg->ops->finish(mors);
+err_buffs:
+	flush_workqueue(mors->net_wq);
+	destroy_workqueue(mors->net_wq);
+err_net_wq:
+	morse_lb_set_irq(mors, false);
+	cancel_work_sync(&lb->irq_work);
+	flush_workqueue(mors->chip_wq);
+	destroy_workqueue(mors->chip_wq);
+	mors->chip_wq = NULL;
+err_chip:
+	morse_lb_chip_free(lb);
+	platform_set_drvdata(pdev, NULL);
+	morse_mac_destroy(mors);
+	return ret;
+}
+
+#if KERNEL_VERSION(6, 11, 0) > LINUX_VERSION_CODE
+static int morse_lb_remove(struct platform_device *pdev)
+#else
+static void morse_lb_remove(struct platform_device *pdev)
+#endif
+{
+	struct morse *mors = platform_get_drvdata(pdev);
+
+	if (mors) {
+		struct morse_lb *lb = morse_lb_from_mors(mors);
+
+		morse_mac_unregister(mors);
+		mors->cfg->ops->finish(mors);
+
+		/* Stop the emulated firmware before the host side workqueues go away */
+		morse_lb_set_irq(mors, false);
+		cancel_work_sync(&lb->fw_work);
+		cancel_work_sync(&lb->irq_work);
+
+		flush_workqueue(mors->chip_wq);
+		destroy_workqueue(mors->chip_wq);
+		mors->chip_wq = NULL;
+		flush_workqueue(mors->net_wq);
+		destroy_workqueue(mors->net_wq);
+
+		morse_lb_chip_free(lb);
+		morse_mac_destroy(mors);
+		platform_set_drvdata(pdev, NULL);
+	}
+
+	dev_info(&pdev->dev, "Morse loopback device removed\n");
+#if KERNEL_VERSION(6, 11, 0) > LINUX_VERSION_CODE
+	return 0;
+#endif
+}
+
+static struct platform_driver morse_lb_driver = {
+	.probe = morse_lb_probe,
+	.remove = morse_lb_remove,
+	.driver = {
+		.name = MORSE_LB_DRV_NAME,
+	},
+};
+
+int __init morse_loopback_init(void)
+{
+	int ret;
+	int i;
+
+	ret = platform_driver_register(&morse_lb_driver);
+	if (ret) {
+		MORSE_PR_ERR(FEATURE_ID_LOOPBACK, "platform_driver_register() failed: %d\n", ret);
+		return ret;
+	}
+
+	for (i = 0; i < min_t(uint, loopback_devices, MORSE_LB_MAX_DEVICES); i++) {
+		struct platform_device *pdev;
+
+		pdev = platform_device_register_simple(MORSE_LB_DRV_NAME, i, NULL, 0);
+		if (IS_ERR(pdev)) {
+			MORSE_PR_ERR(FEATURE_ID_LOOPBACK, "failed to create loopback device %d: %ld\n",
+				     i, PTR_ERR(pdev));
+			break;
+		}
+		morse_lb_pdevs[i] = pdev;
+	}
+
+	return 0;
+}
+
+void __exit morse_loopback_exit(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(morse_lb_pdevs); i++) {
+		if (morse_lb_pdevs[i])
+			platform_device_unregister(morse_lb_pdevs[i]);
+		morse_lb_pdevs[i] = NULL;
+	}
+
+	platform_driver_unregister(&morse_lb_driver);
+}
@@ -47,6 +47,7 @@
 #endif
 #include "led.h"
 #include "monitor.h"
+#include "trace.h"
 
 #define RATE(rate100m, _flags) { \
 	.bitrate = (rate100m), \
@@ -347,6 +348,16 @@ static bool enable_wiphy;
 module_param(enable_wiphy, bool, 0644);
 MODULE_PARM_DESC(enable_wiphy, "Enable FullMAC (Wiphy) interface");
 
+/* Enable/disable NAPI delivery of received frames to mac80211 */
+static bool enable_rx_napi __read_mostly = true;
+module_param(enable_rx_napi, bool, 0444);
+MODULE_PARM_DESC(enable_rx_napi, "Deliver received frames to mac80211 from a NAPI context");
+
+/* Frames delivered to mac80211 per NAPI poll */
+static uint rx_napi_weight __read_mostly = NAPI_POLL_WEIGHT;
+module_param(rx_napi_weight, uint, 0444);
+MODULE_PARM_DESC(rx_napi_weight, "Maximum frames delivered to mac80211 per NAPI poll");
+
 /* OCS type */
 uint ocs_type __read_mostly = MORSE_CMD_OCS_TYPE_RAW;
 module_param(ocs_type, uint, 0644);
@@ -1649,8 +1660,9 @@ static void morse_mac_update_custom_max_idle_period(struct morse_vif *mors_vif,
 		/* Convert to S1G (USF/UI) format */
 		bss_max_idle_period->max_idle_period = cpu_to_le16(s1g_max_idle_period);
 
-		ies_mask->ies[WLAN_EID_BSS_MAX_IDLE_PERIOD].ptr = (u8 *)bss_max_idle_period;
-		ies_mask->ies[WLAN_EID_BSS_MAX_IDLE_PERIOD].len = sizeof(*bss_max_idle_period);
+		morse_dot11_ies_mask_set_ie(ies_mask, WLAN_EID_BSS_MAX_IDLE_PERIOD,
+					    (u8 *)bss_max_idle_period,
+					    sizeof(*bss_max_idle_period));
 	}
 }
 
@@ -2977,6 +2989,15 @@ static int morse_mac_ops_add_interface(struct ieee80211_hw *hw, struct ieee80211
 			goto exit;
 		}
 
+		mors_vif->ap->aid_to_sta = kcalloc(MORSE_AP_AID_BITMAP_SIZE,
+						   sizeof(*mors_vif->ap->aid_to_sta), GFP_KERNEL);
+		if (!mors_vif->ap->aid_to_sta) {
+			kfree(mors_vif->ap);
+			mors_vif->ap = NULL;
+			ret = -ENOMEM;
+			goto exit;
+		}
+
 		if (mors->cfg->enable_short_bcn_as_dtim && enable_page_slicing) {
 			MORSE_ERR(mors,
 				  "%s: short dtim beacon can't be enabled while page slicing is enabled, disabling short dtim beacon",
@@ -3164,6 +3185,7 @@ static void morse_mac_ops_remove_interface(struct ieee80211_hw *hw, struct ieee8
 		}
 
 		morse_pre_assoc_peer_list_vif_release(mors);
+		kfree(mors_vif->ap->aid_to_sta);
 		kfree(mors_vif->ap);
 		mors_vif->ap = NULL;
 	}
@@ -3622,6 +3644,9 @@ morse_mac_ops_bss_info_changed(struct ieee80211_hw *hw,
 	if (changed & BSS_CHANGED_PS)
 		morse_mac_config_ps(mors, vif);
 
+	if (changed & (BSS_CHANGED_BEACON | BSS_CHANGED_BEACON_INT | BSS_CHANGED_BEACON_ENABLED))
+		morse_beacon_template_invalidate(mors_vif);
+
 	if (changed & BSS_CHANGED_BEACON)
 		MORSE_INFO(mors,
 				"BSS Changed beacon data, reset flag=%d, csa_active=%d ecsa_chan_configured=%d\n",
@@ -4364,6 +4389,11 @@ morse_mac_ops_sta_state(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 	mors_vif = (struct morse_vif *)vif->drv_priv;
 	mors_sta = (struct morse_sta *)sta->drv_priv;
 
+#ifdef CONFIG_MORSE_RC
+	if (old_state == IEEE80211_STA_NOTEXIST && new_state == IEEE80211_STA_NONE)
+		morse_rc_sta_init(mors_sta);
+#endif
+
 	/* Ignore both NOTEXIST to NONE and NONE to NOTEXIST */
 	if ((old_state == IEEE80211_STA_NOTEXIST && new_state == IEEE80211_STA_NONE) ||
 	    (old_state == IEEE80211_STA_NONE && new_state == IEEE80211_STA_NOTEXIST))
@@ -4488,6 +4518,9 @@ morse_mac_ops_sta_state(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 				morse_pre_assoc_peer_delete(mors, sta->addr);
 			}
 
+			if (aid < MORSE_AP_AID_BITMAP_SIZE)
+				rcu_assign_pointer(mors_vif->ap->aid_to_sta[aid], sta);
+
 			morse_aid_bitmap_update(mors_vif->ap);
 		}
 
@@ -4527,6 +4560,11 @@ morse_mac_ops_sta_state(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 					   aid);
 			}
 
+			/* mac80211 frees the station after an RCU grace period */
+			if (aid < MORSE_AP_AID_BITMAP_SIZE &&
+			    rcu_access_pointer(mors_vif->ap->aid_to_sta[aid]) == sta)
+				RCU_INIT_POINTER(mors_vif->ap->aid_to_sta[aid], NULL);
+
 			morse_aid_bitmap_update(mors_vif->ap);
 
 			/* delete mesh peer from CSSID list */
@@ -6010,11 +6048,105 @@ static int morse_mac_process_s1g_mgmt_or_beacon(struct morse *mors,
 	return morse_mac_process_s1g_caps(mors, vif, skb, ies_mask);
 }
 
+static int morse_mac_rx_napi_poll(struct napi_struct *napi, int budget)
+{
+	struct morse *mors = container_of(napi, struct morse, rx_napi);
+	struct sk_buff *skb;
+	int done = 0;
+
+	while (done < budget) {
+		skb = skb_dequeue(&mors->rx_napi_q);
+		if (!skb)
+			break;
+
+		ieee80211_rx_napi(mors->hw, NULL, skb, napi);
+		done++;
+	}
+
+	/* Frames may have been queued after the dequeue above came up empty */
+	if (done < budget && napi_complete_done(napi, done) &&
+	    !skb_queue_empty(&mors->rx_napi_q))
+		napi_schedule(napi);
+
+	return done;
+}
+
+void morse_mac_rx_deliver(struct morse *mors, struct sk_buff *skb)
+{
+	if (!mors->napi_dev) {
+		ieee80211_rx_irqsafe(mors->hw, skb);
+		return;
+	}
+
+	skb_queue_tail(&mors->rx_napi_q, skb);
+}
+
+void morse_mac_rx_napi_schedule(struct morse *mors)
+{
+	if (!mors->napi_dev || skb_queue_empty(&mors->rx_napi_q))
+		return;
+
+	/* Called from process context, the poll runs when bottom halves are re-enabled */
+	local_bh_disable();
+	napi_schedule(&mors->rx_napi);
+	local_bh_enable();
+}
+
+static int morse_mac_rx_napi_init(struct morse *mors)
+{
+	if (!enable_rx_napi || enable_wiphy)
+		return 0;
+
+	skb_queue_head_init(&mors->rx_napi_q);
+
+#if KERNEL_VERSION(6, 10, 0) <= LINUX_VERSION_CODE
+	mors->napi_dev = alloc_netdev_dummy(0);
+#else
+	mors->napi_dev = kzalloc(sizeof(*mors->napi_dev), GFP_KERNEL);
+	if (mors->napi_dev)
+		init_dummy_netdev(mors->napi_dev);
+#endif
+	if (!mors->napi_dev)
+		return -ENOMEM;
+
+#if KERNEL_VERSION(5, 19, 0) <= LINUX_VERSION_CODE
+	netif_napi_add_weight(mors->napi_dev, &mors->rx_napi, morse_mac_rx_napi_poll,
+			      max_t(uint, rx_napi_weight, 1));
+#else
+	netif_napi_add(mors->napi_dev, &mors->rx_napi, morse_mac_rx_napi_poll,
+		       max_t(uint, rx_napi_weight, 1));
+#endif
+	napi_enable(&mors->rx_napi);
+
+	return 0;
+}
+
+/* Stop delivering frames to mac80211. Anything still queued is dropped on finish. */
+static void morse_mac_rx_napi_stop(struct morse *mors)
+{
+	if (mors->napi_dev)
+		napi_disable(&mors->rx_napi);
+}
+
+static void morse_mac_rx_napi_finish(struct morse *mors)
+{
+	if (!mors->napi_dev)
+		return;
+
+	netif_napi_del(&mors->rx_napi);
+	skb_queue_purge(&mors->rx_napi_q);
+#if KERNEL_VERSION(6, 10, 0) <= LINUX_VERSION_CODE
+	free_netdev(mors->napi_dev);
+#else
+	kfree(mors->napi_dev);
+#endif
+	mors->napi_dev = NULL;
+}
+
 void morse_mac_skb_recv(struct morse *mors,
 			struct sk_buff *skb,
 			struct morse_skb_rx_status *hdr_rx_status)
 {
-	struct ieee80211_hw *hw = mors->hw;
 	struct dot11ah_ies_mask *ies_mask = NULL;
 	struct ieee80211_vif *vif;
 	struct ieee80211_rx_status rx_status = {0};
@@ -6039,6 +6171,16 @@ void morse_mac_skb_recv(struct morse *mors,
 	if (!skb->data || skb->len == 0)
 		goto exit;
 
+	/* Only data frames are received with their body in page fragments. Anything that is
+	 * parsed or captured as a whole must be linear.
+	 */
+	if (skb_is_nonlinear(skb)) {
+		hdr = (struct ieee80211_hdr *)skb->data;
+		if ((mors->monitor_mode || !ieee80211_is_data(hdr->frame_control)) &&
+		    skb_linearize(skb))
+			goto exit;
+	}
+
 #ifdef CONFIG_MORSE_MONITOR
 	if (mors->monitor_mode) {
 		morse_mon_rx(mors, skb, hdr_rx_status);
@@ -6129,7 +6271,8 @@ void morse_mac_skb_recv(struct morse *mors,
 	morse_dot11ah_s1g_to_11n_rx_packet(vif, skb, length_11n, ies_mask);
 
 	if (skb->len > 0) {
-		ieee80211_rx_irqsafe(hw, skb);
+		trace_morse_mac_rx(mors, skb, hdr_rx_status);
+		morse_mac_rx_deliver(mors, skb);
 		skb_needs_free = false;
 	}
 
@@ -7042,6 +7185,12 @@ int morse_mac_register(struct morse *mors)
 		goto err;
 	}
 
+	ret = morse_mac_rx_napi_init(mors);
+	if (ret) {
+		MORSE_ERR(mors, "morse_mac_rx_napi_init failed %d\n", ret);
+		goto err;
+	}
+
 	morse_led_init(mors);
 
 	/* We manage our own regdb, as Linux has no S1G support yet */
@@ -7056,7 +7205,7 @@ int morse_mac_register(struct morse *mors)
 	if (ret) {
 		MORSE_ERR(mors, "ieee80211_register_hw failed %d\n", ret);
 		morse_led_exit(mors);
-		goto err;
+		goto err_free_napi;
 	}
 
 	/* Set the initial regdomain from the country code, if it has not been set by the regdb yet.
@@ -7141,7 +7290,10 @@ err_free_mon:
 
 err_unregister_hw:
 	morse_led_exit(mors);
+	morse_mac_rx_napi_stop(mors);
 	ieee80211_unregister_hw(hw);
+err_free_napi:
+	morse_mac_rx_napi_finish(mors);
 err:
 	return ret;
 }
@@ -7198,8 +7350,7 @@ struct morse *morse_mac_create(size_t priv_size, struct device *dev)
 
 	mors->dev = dev;
 	mutex_init(&mors->lock);
-	mutex_init(&mors->cmd_lock);
-	mutex_init(&mors->cmd_wait);
+	morse_cmd_tx_init(mors);
 	spin_lock_init(&mors->vif_list_lock);
 
 	/* Initialise coredump structures */
@@ -7251,6 +7402,9 @@ static void morse_mac_deinit(struct morse *mors)
 		cancel_work_sync(&mors->health_check);
 	}
 
+	/* No more frames to mac80211 once it is unregistered */
+	morse_mac_rx_napi_stop(mors);
+
 	if (enable_wiphy)
 		morse_wiphy_deinit(mors);
 	else
@@ -7313,6 +7467,7 @@ void morse_mac_destroy(struct morse *mors)
 		morse_watchdog_cleanup(mors);
 
 	morse_coredump_destroy(mors);
+	morse_mac_rx_napi_finish(mors);
 
 	if (enable_wiphy)
 		morse_wiphy_destroy(mors);
@@ -47,6 +47,24 @@ struct morse *morse_mac_create(size_t priv_size, struct device *dev);
 void morse_mac_destroy(struct morse *mors);
 void morse_mac_skb_recv(struct morse *mors, struct sk_buff *skb,
 		       struct morse_skb_rx_status *hdr_rx_status);
+
+/**
+ * morse_mac_rx_deliver - Hand a converted frame to mac80211
+ *
+ * @mors: Morse chip instance
+ * @skb: Frame, with its ieee80211_rx_status already filled in
+ *
+ * When NAPI is enabled the frame is queued and delivered by the next NAPI poll, so the caller
+ * must follow a batch of deliveries with morse_mac_rx_napi_schedule().
+ */
+void morse_mac_rx_deliver(struct morse *mors, struct sk_buff *skb);
+
+/**
+ * morse_mac_rx_napi_schedule - Schedule delivery of queued frames to mac80211
+ *
+ * @mors: Morse chip instance
+ */
+void morse_mac_rx_napi_schedule(struct morse *mors);
 int morse_mac_event_recv(struct morse *mors, struct sk_buff *skb);
 int morse_mac_register(struct morse *mors);
 void morse_mac_unregister(struct morse *mors);
@@ -228,7 +228,6 @@ int morse_process_beacon_from_mbssid_ie(struct morse *mors, struct sk_buff *skb,
 	int max_bssid_indicator;
 	u32 mbssid_ie_offset;
 	struct mbssid_ie ie_elem;
-	struct ieee80211_hw *hw = mors->hw;
 	int bcn_length_11n;
 
 	if (!ies_mask->ies[WLAN_EID_MULTIPLE_BSSID].ptr)
@@ -250,8 +249,8 @@ int morse_process_beacon_from_mbssid_ie(struct morse *mors, struct sk_buff *skb,
 		int mbssid_index;
 
 		if (sub->id == WLAN_EID_SSID) {
-			ies_mask->ies[WLAN_EID_SSID].ptr = (u8 *)sub->data;
-			ies_mask->ies[WLAN_EID_SSID].len = (u8)sub->datalen;
+			morse_dot11_ies_mask_set_ie(ies_mask, WLAN_EID_SSID, (u8 *)sub->data,
+						    (u8)sub->datalen);
 		}
 
 		if (sub->id != WLAN_EID_MULTI_BSSID_IDX ||
@@ -290,7 +289,7 @@ int morse_process_beacon_from_mbssid_ie(struct morse *mors, struct sk_buff *skb,
 		morse_dot11ah_s1g_to_11n_rx_packet(vif, skb_beacon, bcn_length_11n, ies_mask);
 
 		if (skb_beacon->len > 0)
-			ieee80211_rx_irqsafe(hw, skb_beacon);
+			morse_mac_rx_deliver(mors, skb_beacon);
 		else
 			morse_mac_skb_free(mors, skb_beacon);
 	}
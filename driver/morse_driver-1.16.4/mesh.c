@@ -410,7 +410,9 @@ int morse_mac_process_mesh_tx_mgmt(struct morse_vif *mors_vif,
 			if (skb_probe_resp->len > 0 && rx_status->band == NL80211_BAND_5GHZ) {
 				MORSE_MESH_DBG(mors, "%s: Indicating SKB for probe resp\n",
 					       __func__);
-				ieee80211_rx_irqsafe(mors->hw, skb_probe_resp);
+				morse_mac_rx_deliver(mors, skb_probe_resp);
+				/* Not part of an RX dispatch batch, so kick NAPI here */
+				morse_mac_rx_napi_schedule(mors);
 			}
 			/* Add this mesh peer into cssid list */
 			morse_dot11ah_add_mesh_peer(ies_mask,
@@ -281,21 +281,42 @@ static u16 bit_index(u16 in, u32 bit_pos)
 	return index - 1;
 }
 
-void rate_update_index(struct mmrc_table *tb, struct mmrc_rate *rate)
+/**
+ * Precompute the position of every rate parameter value among the set bits of
+ * the capabilities, so a rate can be mapped to its row without bit scanning.
+ */
+static void build_rate_index_maps(struct mmrc_table *tb)
 {
-	u16 index = 0;
-	/* Information about our rates */
+	u32 i;
 	u16 bw = BIT_COUNT(tb->caps.bandwidth);
 	u16 streams = BIT_COUNT(tb->caps.spatial_streams);
 	u16 guard = BIT_COUNT(tb->caps.guard);
-	u16 rows = rows_from_sta_caps(&tb->caps);
 
-	index = bit_index(tb->caps.guard, rate->guard) +
-		bit_index(tb->caps.bandwidth, rate->bw) * guard +
-		bit_index(tb->caps.spatial_streams, rate->ss) * guard * bw +
-		bit_index(tb->caps.rates, rate->rate) * bw * streams * guard;
+	for (i = 0; i < sizeof(tb->mcs_pos); i++)
+		tb->mcs_pos[i] = bit_index(tb->caps.rates, i);
+	for (i = 0; i < sizeof(tb->bw_pos); i++)
+		tb->bw_pos[i] = bit_index(tb->caps.bandwidth, i);
+	for (i = 0; i < sizeof(tb->ss_pos); i++)
+		tb->ss_pos[i] = bit_index(tb->caps.spatial_streams, i);
+	for (i = 0; i < sizeof(tb->guard_pos); i++)
+		tb->guard_pos[i] = bit_index(tb->caps.guard, i);
+
+	tb->bw_stride = guard;
+	tb->ss_stride = guard * bw;
+	tb->mcs_stride = guard * bw * streams;
+	tb->row_count = rows_from_sta_caps(&tb->caps);
+}
+
+void rate_update_index(struct mmrc_table *tb, struct mmrc_rate *rate)
+{
+	u16 index;
+
+	index = tb->guard_pos[rate->guard] +
+		tb->bw_pos[rate->bw] * tb->bw_stride +
+		tb->ss_pos[rate->ss] * tb->ss_stride +
+		tb->mcs_pos[rate->rate] * tb->mcs_stride;
 
-	if (index >= rows) {
+	if (index >= tb->row_count) {
 		MMRC_OSAL_ASSERT(0);
 		index = 0;
 	}
@@ -303,7 +324,11 @@ void rate_update_index(struct mmrc_table *tb, struct mmrc_rate *rate)
 	rate->index = index;
 }
 
-struct mmrc_rate get_rate_row(struct mmrc_table *tb, u16 index)
+/**
+ * Reconstruct the rate of a row from the STA capabilities. Only used to build
+ * the precomputed rows, see get_rate_row() for lookups.
+ */
+static struct mmrc_rate build_rate_row(struct mmrc_table *tb, u16 index)
 {
 	struct mmrc_rate rate;
 	u16 ss_index;
@@ -359,6 +384,14 @@ struct mmrc_rate get_rate_row(struct mmrc_table *tb, u16 index)
 	return rate;
 }
 
+struct mmrc_rate get_rate_row(struct mmrc_table *tb, u16 index)
+{
+	if (index < tb->row_count)
+		return tb->table[index].row.rate;
+
+	return build_rate_row(tb, index);
+}
+
 u16 rows_from_sta_caps(struct mmrc_sta_capabilities *caps)
 {
 	u16 rows = 0;
@@ -508,9 +541,10 @@ u32 mmrc_calculate_theoretical_throughput(struct mmrc_rate rate)
  * @param index The index in the table of the rate to calculate throughput for
  * @return u32 The expected throughput for the given rate
  */
-static u32 calculate_throughput(struct mmrc_table *tb, u8 index)
+static u32 calculate_throughput(struct mmrc_table *tb, u16 index)
 {
-	struct mmrc_rate rate = get_rate_row(tb, index);
+	const struct mmrc_rate_row *row = &tb->table[index].row;
+	const struct mmrc_rate rate = row->rate;
 
 	/**
 	 * Avoid the overflow (observed for 8MHz MCS9 rate: 43333) by dividing first before
@@ -521,11 +555,10 @@ static u32 calculate_throughput(struct mmrc_table *tb, u8 index)
 		return 0;
 	else if (rate.index == tb->best_tp.index && tb->interference_likely)
 		/* Assist the best rate by increasing the probability by the averaged variation */
-		return (mmrc_calculate_theoretical_throughput(rate) / 100) *
+		return (row->theoretical_tp / 100) *
 				(tb->table[rate.index].prob + tb->probability_variation);
 	else
-		return (mmrc_calculate_theoretical_throughput(rate) / 100) *
-						tb->table[rate.index].prob;
+		return (row->theoretical_tp / 100) * tb->table[rate.index].prob;
 }
 
 bool validate_rate(struct mmrc_table *tb, struct mmrc_rate *rate)
@@ -578,26 +611,24 @@ bool validate_rate(struct mmrc_table *tb, struct mmrc_rate *rate)
 
 static u16 find_baseline_index(struct mmrc_table *tb)
 {
-	u32 i, theoretical_tp, min_theoretical_tp;
-	u16 row_count = rows_from_sta_caps(&tb->caps);
+	u32 i, min_theoretical_tp;
 	u16 min_theoretical_tp_index = 0;
-	struct mmrc_rate rate;
+	const struct mmrc_rate_row *row;
 
 #if MMRC_MODE == MMRC_MODE_80211AH
 	if (tb->caps.rates & MMRC_MASK(MMRC_MCS10))
 		return 0;
 #endif
 
-	min_theoretical_tp = mmrc_calculate_theoretical_throughput(get_rate_row(tb, 0));
-	for (i = 0; i < row_count; i++)	{
-		rate = get_rate_row(tb, i);
-		if (!validate_rate(tb, &rate))
+	min_theoretical_tp = tb->table[0].row.theoretical_tp;
+	for (i = 0; i < tb->row_count; i++) {
+		row = &tb->table[i].row;
+		if (!row->valid)
 			continue;
 
-		theoretical_tp = mmrc_calculate_theoretical_throughput(rate);
-		if (min_theoretical_tp > theoretical_tp) {
-			min_theoretical_tp = theoretical_tp;
-			min_theoretical_tp_index = rate.index;
+		if (min_theoretical_tp > row->theoretical_tp) {
+			min_theoretical_tp = row->theoretical_tp;
+			min_theoretical_tp_index = row->rate.index;
 		}
 	}
 
@@ -646,9 +677,10 @@ static void mmrc_fill_retry_rates(struct mmrc_table *tb)
 
 /**
  * Updates the mmrc_table with the appropriate rate priority based on the
- * latest update statistics
+ * latest update statistics. Only the valid rows with evidence, linked from
+ * @first_candidate in row order by mmrc_update(), are considered.
  */
-static void generate_table_priority(struct mmrc_table *tb, u32 new_stats)
+static void generate_table_priority(struct mmrc_table *tb, u32 new_stats, u16 first_candidate)
 {
 	u16 i;
 	u16 best_row = tb->best_tp.index;
@@ -669,13 +701,8 @@ static void generate_table_priority(struct mmrc_table *tb, u32 new_stats)
 		return;
 	}
 
-	for (i = 0; i < rows_from_sta_caps(&tb->caps); i++) {
-		tmp = get_rate_row(tb, i);
-		if (!validate_rate(tb, &tmp))
-			continue;
-
-		if (tb->table[tmp.index].evidence == 0)
-			continue;
+	for (i = first_candidate; i != MMRC_ROW_NONE; i = tb->table[i].row.next_candidate) {
+		tmp = tb->table[i].row.rate;
 
 		/**
 		 * Besides better throughput, also consider this rate better if lower rates
@@ -771,11 +798,29 @@ static void generate_table_priority(struct mmrc_table *tb, u32 new_stats)
 		tb->newly_unconverged = false;
 }
 
-static u32 calculate_attempt_time(struct mmrc_rate *rate, size_t size)
+/**
+ * Get the transmit time of a rate for the default packet size, from its
+ * precomputed row when the rate matches it.
+ */
+static u32 rate_tx_time(struct mmrc_table *tb, struct mmrc_rate *rate)
+{
+	const struct mmrc_rate_row *row;
+
+	if (rate->index < tb->row_count) {
+		row = &tb->table[rate->index].row;
+		if (row->rate.rate == rate->rate && row->rate.bw == rate->bw &&
+		    row->rate.ss == rate->ss && row->rate.guard == rate->guard)
+			return row->tx_time;
+	}
+
+	return get_tx_time(rate);
+}
+
+static u32 calculate_attempt_time(struct mmrc_table *tb, struct mmrc_rate *rate, size_t size)
 {
 	u32 time;
 
-	time = get_tx_time(rate);
+	time = rate_tx_time(tb, rate);
 
 	if (size > DEFAULT_PACKET_SIZE_BYTES)
 		time = (time * ((size * 1000) / DEFAULT_PACKET_SIZE_BYTES)) / 1000;
@@ -814,7 +859,7 @@ static void calculate_remaining_attempts(struct mmrc_table *tb,
 			calculate_throughput(tb, tb->best_prob.index)))
 			continue;
 
-		attempt_time = calculate_attempt_time(&rate->rates[i], size);
+		attempt_time = calculate_attempt_time(tb, &rate->rates[i], size);
 		if (!attempt_time)
 			continue;
 
@@ -830,7 +875,8 @@ static void calculate_remaining_attempts(struct mmrc_table *tb,
 /**
  * Allocate initial attempts to all rates in a rate table
  */
-static void allocate_initial_attempts(struct mmrc_rate_table *rate, s32 *rem_time, size_t size)
+static void allocate_initial_attempts(struct mmrc_table *tb, struct mmrc_rate_table *rate,
+				      s32 *rem_time, size_t size)
 {
 	u32 i;
 
@@ -840,7 +886,7 @@ static void allocate_initial_attempts(struct mmrc_rate_table *rate, s32 *rem_tim
 		if (rate->rates[i].rate == MMRC_MCS_UNUSED)
 			break;
 
-		attempt_time = calculate_attempt_time(&rate->rates[i], size);
+		attempt_time = calculate_attempt_time(tb, &rate->rates[i], size);
 
 		/* if the time for a single attempt is very long, lets just try once */
 		if (attempt_time > MAX_WINDOW_ATTEMPT_TIME) {
@@ -923,13 +969,14 @@ void mmrc_get_rates(struct mmrc_table *tb,
 				random_index = tb->current_lookaround_rate_index;
 				try_current_lookaround = false;
 			} else {
-				random_index = osal_mmrc_random_u32(rows_from_sta_caps(&tb->caps));
+				random_index = osal_mmrc_random_u32(tb->row_count);
 			}
-			random = get_rate_row(tb, random_index);
 
-			if (!validate_rate(tb, &random))
+			if (!tb->table[random_index].row.valid)
 				continue;
 
+			random = tb->table[random_index].row.rate;
+
 #if MMRC_MODE == MMRC_MODE_80211AH
 			if (random.rate == MMRC_MCS10)
 				continue;
@@ -937,7 +984,7 @@ void mmrc_get_rates(struct mmrc_table *tb,
 			if (tb->table[random_index].evidence > 0)
 				random_tp = calculate_throughput(tb, random_index);
 			else
-				random_tp = mmrc_calculate_theoretical_throughput(random);
+				random_tp = tb->table[random_index].row.theoretical_tp;
 
 			/* Skip rates that can only be worse than the current best */
 			if (random_tp <= best_tp)
@@ -1001,7 +1048,7 @@ void mmrc_get_rates(struct mmrc_table *tb,
 		out->rates[i].flags |= MMRC_MASK(MMRC_FLAGS_CTS_RTS);
 
 	/* Allocate initial attempts for rate */
-	allocate_initial_attempts(out, &rem_time, size);
+	allocate_initial_attempts(tb, out, &rem_time, size);
 
 	/* Calculate and allocate remaining attempts */
 	calculate_remaining_attempts(tb, out, &rem_time, size);
@@ -1122,6 +1169,9 @@ void mmrc_update(struct mmrc_table *tb)
 	u32 min_stats;
 	u32 throughput;
 	u32 evidence_sent;
+	u16 first_candidate = MMRC_ROW_NONE;
+	u16 last_candidate = MMRC_ROW_NONE;
+	struct mmrc_rate_row *row;
 
 	tb->cycle_cnt++;
 
@@ -1131,7 +1181,7 @@ void mmrc_update(struct mmrc_table *tb)
 	else
 		min_stats = STATS_MIN_INIT;
 
-	for (i = 0; i < rows_from_sta_caps(&tb->caps); i++) {
+	for (i = 0; i < tb->row_count; i++) {
 		/* This algorithm is keeping track of the amount of evidence,
 		 * being packets that have been recently sent at this rate.
 		 * This value is smoothed with an EWMA function over time and
@@ -1162,6 +1212,22 @@ void mmrc_update(struct mmrc_table *tb)
 		if (tb->table[i].evidence > EVIDENCE_MAX)
 			tb->table[i].evidence = EVIDENCE_MAX;
 
+		/*
+		 * Link the rows worth ranking so generate_table_priority() does not
+		 * rescan the table. A row's statistics are kept in the same or an
+		 * earlier row (it only differs when the guard is downgraded), so its
+		 * evidence is already final here.
+		 */
+		row = &tb->table[i].row;
+		row->next_candidate = MMRC_ROW_NONE;
+		if (row->valid && tb->table[row->rate.index].evidence != 0) {
+			if (last_candidate == MMRC_ROW_NONE)
+				first_candidate = i;
+			else
+				tb->table[last_candidate].row.next_candidate = i;
+			last_candidate = i;
+		}
+
 		/* Try to use statistics from acknowledged AMPDUs first*/
 		attempts_for_stats = tb->table[i].back_mpdu_success +
 				tb->table[i].back_mpdu_failure;
@@ -1219,7 +1285,7 @@ void mmrc_update(struct mmrc_table *tb)
 		tb->table[i].avg_throughput_counter++;
 	}
 
-	generate_table_priority(tb, new_stats);
+	generate_table_priority(tb, new_stats, first_candidate);
 
 	/* Switch to faster lookaround mode if rates drop low at very low bandwidth or we are
 	 * in unconverged mode. Switching at low bandwidth and rate is to help recover quickly
@@ -1350,16 +1416,37 @@ static void mmrc_init_rates(struct mmrc_table *tb, s8 rssi)
 	mmrc_fill_retry_rates(tb);
 }
 
+/**
+ * Precompute the rate, validity and airtime values of every row for the
+ * current capabilities.
+ */
+static void build_rate_rows(struct mmrc_table *tb)
+{
+	u16 i;
+	struct mmrc_rate_row *row;
+
+	for (i = 0; i < tb->row_count; i++) {
+		row = &tb->table[i].row;
+		row->rate = build_rate_row(tb, i);
+		row->valid = validate_rate(tb, &row->rate);
+		row->theoretical_tp = mmrc_calculate_theoretical_throughput(row->rate);
+		row->tx_time = get_tx_time(&row->rate);
+		row->next_candidate = MMRC_ROW_NONE;
+	}
+}
+
 void mmrc_sta_init(struct mmrc_table *tb, struct mmrc_sta_capabilities *caps, s8 rssi)
 {
 	u32 i;
-	u16 row_count = rows_from_sta_caps(caps);
 
 	/* This zeros the mmrc_table memory required for the given capabilities */
 	memset(tb, 0, mmrc_memory_required_for_caps(caps));
 	memcpy(&tb->caps, caps, sizeof(tb->caps));
 
-	for (i = 0; i < row_count; i++) {
+	build_rate_index_maps(tb);
+	build_rate_rows(tb);
+
+	for (i = 0; i < tb->row_count; i++) {
 		tb->table[i].prob = RATE_INIT_PROBABILITY;
 		tb->table[i].evidence = 0;
 		tb->table[i].sum_throughput = 0;
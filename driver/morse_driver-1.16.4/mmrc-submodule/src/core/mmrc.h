@@ -208,6 +208,32 @@ struct mmrc_sta_capabilities {
 	u8 sgi_per_bw	: 5;
 };
 
+/**
+ * Marks the end of a list of rows in an mmrc_table
+ */
+#define MMRC_ROW_NONE 0xFFFF
+
+/**
+ * Description of a row in the mmrc_table, precomputed from the STA capabilities
+ * in @ref mmrc_sta_init so rows need not be reconstructed on every lookup
+ */
+struct mmrc_rate_row {
+	/** The rate of this row, its index is the row holding the statistics for the rate */
+	struct mmrc_rate rate;
+
+	/** The theoretical throughput of the rate in bps */
+	u32 theoretical_tp;
+
+	/** The transmit time of the rate for the default packet size in microseconds */
+	u32 tx_time;
+
+	/** The next row with evidence, only valid while updating the table */
+	u16 next_candidate;
+
+	/** Whether the rate is a valid combination for the STA */
+	bool valid;
+};
+
 /**
  * Statistics table of a STA
  */
@@ -255,6 +281,9 @@ struct mmrc_stats_table {
 
 	/** Have we sent aggregates at this rate since the last update */
 	bool have_sent_ampdus;
+
+	/** The precomputed description of this row */
+	struct mmrc_rate_row row;
 };
 
 /**
@@ -336,6 +365,23 @@ struct mmrc_table {
 	/** Number of rate control cycles the best rate has remained unchanged */
 	s32 best_rate_cycle_count;
 
+	/** The number of rows in the table for the capabilities */
+	u16 row_count;
+
+	/**
+	 * Position of each MCS, bandwidth, spatial stream and guard value among those
+	 * supported by the capabilities, used to map a rate to its row
+	 */
+	u8 mcs_pos[MMRC_RATE_TO_BITFIELD(~0) + 1];
+	u8 bw_pos[MMRC_BW_TO_BITFIELD(~0) + 1];
+	u8 ss_pos[MMRC_SS_TO_BITFIELD(~0) + 1];
+	u8 guard_pos[MMRC_GUARD_TO_BITFIELD(~0) + 1];
+
+	/** The number of rows between consecutive bandwidths, spatial streams and MCSs */
+	u16 bw_stride;
+	u16 ss_stride;
+	u16 mcs_stride;
+
 	/**
 	 * The probability table for the STA. This MUST always be the last
 	 * element in the struct.
@@ -353,6 +399,9 @@ struct mmrc_table {
  * @param caps The capabilities of this STA.
  * @param rssi The average RSSI value for this station.
  *
+ * The per row rate descriptions and airtime values are computed here once, so
+ * they are only rebuilt when the capabilities change.
+ *
  * @note If the STA capabilities change this function will need to be called again
  * and the @c mmrc_table may need to be reallocated if allocated using
  * @ref mmrc_memory_required_for_caps
@@ -122,6 +122,7 @@ static int stats_read(struct seq_file *file, void *data)
 		struct morse_rc_sta *mrc_sta = container_of(pos, struct morse_rc_sta, list);
 		struct morse_sta *sta = container_of(mrc_sta, struct morse_sta, rc);
 
+		spin_lock(&mrc_sta->lock);
 		tb = mrc_sta->tb;
 		caps_size = rows_from_sta_caps(&tb->caps);
 
@@ -203,6 +204,7 @@ static int stats_read(struct seq_file *file, void *data)
 		seq_printf(file,
 			   "\n Amount of packets sent: %u including: %u look-around packets\n\n",
 			   total_sent_packets - tb->total_lookaround, tb->total_lookaround);
+		spin_unlock(&mrc_sta->lock);
 	}
 
 	spin_unlock_bh(&mors->mrc.lock);
@@ -231,6 +233,7 @@ static int stats_csv_read(struct seq_file *file, void *data)
 		struct morse_rc_sta *mrc_sta = container_of(pos, struct morse_rc_sta, list);
 		struct morse_sta *sta = container_of(mrc_sta, struct morse_sta, rc);
 
+		spin_lock(&mrc_sta->lock);
 		tb = mrc_sta->tb;
 		caps_size = rows_from_sta_caps(&tb->caps);
 
@@ -284,6 +287,7 @@ static int stats_csv_read(struct seq_file *file, void *data)
 			seq_printf(file, ",%u", rate_stats->back_mpdu_failure);
 			seq_printf(file, ",%pM\n", sta->addr);
 		}
+		spin_unlock(&mrc_sta->lock);
 	}
 
 	spin_unlock_bh(&mors->mrc.lock);
@@ -306,8 +310,10 @@ static ssize_t set_fixed_rate(struct file *file, const char __user *user_buf,
 	list_for_each(pos, &mors->mrc.stas) {
 		struct morse_rc_sta *mrc_sta = container_of(pos, struct morse_rc_sta, list);
 
+		spin_lock(&mrc_sta->lock);
 		fixed_rate = get_rate_row(mrc_sta->tb, value);
 		mmrc_set_fixed_rate(mrc_sta->tb, fixed_rate);
+		spin_unlock(&mrc_sta->lock);
 	}
 	spin_unlock_bh(&mors->mrc.lock);
 	return count;
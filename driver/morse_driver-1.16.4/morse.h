@@ -16,6 +16,11 @@
 #include <linux/version.h>
 #include <linux/crc32.h>
 #include <linux/notifier.h>
+#include <linux/rwsem.h>
+#include <linux/semaphore.h>
+#include <linux/timekeeping.h>
+#include <linux/rbtree.h>
+#include <linux/mempool.h>
 #if KERNEL_VERSION(4, 9, 81) < LINUX_VERSION_CODE
 #include <linux/nospec.h>
 #endif
@@ -150,6 +155,38 @@ enum morse_config_test_mode {
 struct morse_buff;
 struct morse_bus_ops;
 
+/**
+ * struct morse_wq_stats - Utilisation of a driver workqueue
+ *
+ * @runs: number of work items measured
+ * @busy_ns: total time spent executing measured work items
+ * @max_ns: longest single measured work item
+ * @last_read_busy_ns: @busy_ns when the stats were last read
+ * @last_read_ns: time the stats were last read
+ */
+struct morse_wq_stats {
+	atomic64_t runs;
+	atomic64_t busy_ns;
+	u64 max_ns;
+	u64 last_read_busy_ns;
+	u64 last_read_ns;
+};
+
+static inline u64 morse_wq_stats_start(void)
+{
+	return ktime_get_ns();
+}
+
+static inline void morse_wq_stats_end(struct morse_wq_stats *stats, u64 start_ns)
+{
+	u64 elapsed = ktime_get_ns() - start_ns;
+
+	atomic64_inc(&stats->runs);
+	atomic64_add(elapsed, &stats->busy_ns);
+	if (elapsed > READ_ONCE(stats->max_ns))
+		WRITE_ONCE(stats->max_ns, elapsed);
+}
+
 /**
  * modparam variables
  */
@@ -163,6 +200,8 @@ extern u8 macaddr[ETH_ALEN];
 extern bool enable_ibss_probe_filtering;
 extern uint ocs_type;
 extern uint sdio_reset_time;
+extern bool wq_highpri;
+extern uint net_wq_max_active;
 
 /**
  * enum morse_mac_subbands_mode - flags to describe sub-bands handling
@@ -197,9 +236,11 @@ struct morse_twt_sta_vif {
  * struct morse_twt - contains TWT state and configuration information
  *
  * @stas		List of structures containing a agreements for a STA.
- * @wake_intervals	List of structures used as heads for lists of agreements with the same
- *			wake interval. These are arranged in order from the smallest to largest wake
- *			intervals.
+ * @sta_index		Tree of the same structures keyed by STA address, for lookups.
+ * @wake_intervals	Tree of structures used as heads for trees of agreements with the same
+ *			wake interval, keyed by wake interval.
+ * @sta_pool		Preallocated pool the STA structures are allocated from.
+ * @wake_interval_pool	Preallocated pool the wake interval structures are allocated from.
  * @events		A queue of TWT events to be processed.
  * @tx			A queue of TWT data to be sent.
  * @req_event_tx	A TWT request event to be sent in the (re)assoc request frame.
@@ -212,7 +253,10 @@ struct morse_twt_sta_vif {
  */
 struct morse_twt {
 	struct list_head stas;
-	struct list_head wake_intervals;
+	struct rb_root sta_index;
+	struct rb_root wake_intervals;
+	mempool_t *sta_pool;
+	mempool_t *wake_interval_pool;
 	struct list_head events;
 	struct list_head tx;
 	u8 *req_event_tx;
@@ -440,12 +484,37 @@ struct morse_ap {
 	struct morse_raw raw;
 	/** BSS statistics */
 	struct morse_bss_stats_context bss_stats;
+	/** Last TIM converted to S1G, reused while the traffic bitmap is unchanged */
+	struct dot11ah_s1g_tim_cache tim_cache;
 	/**
 	 * Bitmap of AIDs currently in use. Bit position corresponds to the AID.
 	 */
 	DECLARE_BITMAP(aid_bitmap, MORSE_AP_AID_BITMAP_SIZE);
+	/**
+	 * Associated stations indexed by AID (MORSE_AP_AID_BITMAP_SIZE entries), kept in step
+	 * with @aid_bitmap. Entries are RCU protected, see morse_ap_find_sta_by_aid().
+	 */
+	struct ieee80211_sta __rcu **aid_to_sta;
 };
 
+/**
+ * morse_ap_find_sta_by_aid() - Look up an associated station by AID.
+ * @ap: AP specific information of the interface
+ * @aid: association ID of the station
+ *
+ * Must be called under rcu_read_lock(), the returned station is only valid until the
+ * matching rcu_read_unlock().
+ *
+ * Return: the station, or NULL if no station is associated with @aid.
+ */
+static inline struct ieee80211_sta *morse_ap_find_sta_by_aid(struct morse_ap *ap, u16 aid)
+{
+	if (!ap || !ap->aid_to_sta || aid >= MORSE_AP_AID_BITMAP_SIZE)
+		return NULL;
+
+	return rcu_dereference(ap->aid_to_sta[aid]);
+}
+
 struct morse_mbca_config {
 	/**
 	 * Configuration to enable or disable MBCA TBTT selection and adjustment.
@@ -538,6 +607,31 @@ struct morse_mesh_config_list {
 	spinlock_t lock;
 };
 
+/**
+ * struct morse_beacon_template - A converted S1G beacon cached between TBTTs
+ *
+ * Only the elements that do not change from one beacon to the next are kept in @ies_mask;
+ * the TIM, RPS and the other per-beacon elements are patched in by the beacon tasklet.
+ */
+struct morse_beacon_template {
+	/** S1G beacon the template was captured from, header followed by ordered elements */
+	u8 *frame;
+	/** Length of @frame */
+	u16 len;
+	/** Length of the S1G header, including the optional fields, at the start of @frame */
+	u16 hdr_len;
+	/** Static elements of @frame, pointing into @frame */
+	struct dot11ah_ies_mask *ies_mask;
+	/** Value of &morse_vif->beacon_template_gen when captured */
+	u32 gen;
+	/** Value of the vendor IE list generation when captured */
+	u32 vendor_ie_gen;
+	/** Channel configuration the S1G operation element was built from */
+	struct morse_channel_info channel_info;
+	/** Whether the template may be used */
+	bool valid;
+};
+
 /**
  * enum morse_scan_state_flags - Scan state flags in fullmac mode.
  */
@@ -641,6 +735,9 @@ struct morse_vif {
 		/** Number of elements in the OUI filter list */
 		u8 n_oui_filters;
 
+		/** Incremented whenever ie_list changes, so cached frames can be rebuilt */
+		u32 generation;
+
 		/** Spinlock to protect access to these fields */
 		spinlock_t lock;
 	} vendor_ie;
@@ -667,6 +764,16 @@ struct morse_vif {
 	 */
 	struct tasklet_struct beacon_tasklet;
 
+	/**
+	 * Converted S1G beacons cached by the beacon tasklet, indexed by short beacon
+	 */
+	struct morse_beacon_template beacon_template[2];
+
+	/**
+	 * Incremented to invalidate the cached beacon templates
+	 */
+	atomic_t beacon_template_gen;
+
 	/** Tasklet for responding to NDP probe requests received by chip */
 	struct tasklet_struct ndp_probe_req_resp;
 
@@ -927,6 +1034,8 @@ struct morse_debug {
 		unsigned int rx_invalid_count;
 		unsigned int invalid_checksum;
 		unsigned int invalid_tx_status_checksum;
+		unsigned int rx_burst_reads;
+		unsigned int rx_burst_pages;
 	} page_stats;
 #if defined(CONFIG_MORSE_DEBUG_IRQ)
 	struct {
@@ -1049,6 +1158,9 @@ struct morse {
 	bool reset_required;
 	bool chip_was_reset;
 
+	/** @fw_load: segments and timing of the last firmware download */
+	struct morse_fw_load_info fw_load;
+
 	/* wiphy device registered with cfg80211 */
 	struct wiphy *wiphy;
 
@@ -1104,11 +1216,14 @@ struct morse {
 
 	/* Command sequence counter */
 	u16 cmd_seq;
-	struct completion *cmd_comp;
+	/* Commands awaiting a response from the chip, matched on host ID sequence */
+	struct list_head cmd_inflight;
 	/* Mutex to martial command completion and retries */
 	struct mutex cmd_lock;
-	/* Allow only one command at a time */
-	struct mutex cmd_wait;
+	/* Held for read by each command in flight, for write by commands needing ordering */
+	struct rw_semaphore cmd_order;
+	/* Bounds the number of commands in flight */
+	struct semaphore cmd_slots;
 
 	/** User-initiated coredump complete signal mechanism */
 	struct completion *user_coredump_comp;
@@ -1117,6 +1232,12 @@ struct morse {
 	u32 bcf_address;
 
 	struct tasklet_struct tasklet_txq;
+
+	/* NAPI context delivering received frames to mac80211, NULL napi_dev if disabled */
+	struct net_device *napi_dev;
+	struct napi_struct rx_napi;
+	struct sk_buff_head rx_napi_q;
+
 	/* Serialise high-level operations to the morse structure */
 	struct mutex lock;
 	/**
@@ -1191,6 +1312,11 @@ struct morse {
 	/* Work queue used by code copying between Linux and local buffers */
 	struct workqueue_struct *net_wq;
 
+	/* Utilisation of the chip interface work on chip_wq */
+	struct morse_wq_stats chip_wq_stats;
+	/* Utilisation of the skbq dispatch work on net_wq */
+	struct morse_wq_stats net_wq_stats;
+
 	/* Work queues for resetting and restarting the system */
 	struct work_struct reset;
 	struct work_struct soft_reset;
@@ -1318,6 +1444,29 @@ static inline enum morse_page_aci dot11_tid_to_ac(enum qos_tid_up_index tid)
 	}
 }
 
+/**
+ * morse_create_chip_wq() - Allocate the workqueue that runs chip interface work
+ *
+ * The queue is always ordered as its work items own the bus.
+ *
+ * @mors: Morse chip instance
+ *
+ * Return: the workqueue, or NULL on failure
+ */
+struct workqueue_struct *morse_create_chip_wq(struct morse *mors);
+
+/**
+ * morse_create_net_wq() - Allocate the workqueue that runs skbq dispatch and network work
+ *
+ * Ordered unless the net_wq_max_active module parameter is greater than one, in which case
+ * the queue is unbound and its CPU affinity is configurable through sysfs.
+ *
+ * @mors: Morse chip instance
+ *
+ * Return: the workqueue, or NULL on failure
+ */
+struct workqueue_struct *morse_create_net_wq(struct morse *mors);
+
 #ifdef CONFIG_MORSE_SDIO
 int __init morse_sdio_init(void);
 void __exit morse_sdio_exit(void);
@@ -1333,6 +1482,11 @@ int __init morse_usb_init(void);
 void __exit morse_usb_exit(void);
 #endif
 
+#ifdef CONFIG_MORSE_LOOPBACK
+int __init morse_loopback_init(void);
+void __exit morse_loopback_exit(void);
+#endif
+
 static inline bool morse_is_data_tx_allowed(struct morse *mors)
 {
 	return !test_bit(MORSE_STATE_FLAG_DATA_TX_STOPPED, &mors->state_flags) &&
@@ -1405,6 +1559,13 @@ static inline bool is_assoc_frame(__le16 frame_control)
 
 int morse_beacon_init(struct morse_vif *mors_vif);
 void morse_beacon_finish(struct morse_vif *mors_vif);
+
+/**
+ * morse_beacon_template_invalidate() - Force the next beacon to be rebuilt from mac80211
+ *
+ * @mors_vif: Interface whose beacon contents changed
+ */
+void morse_beacon_template_invalidate(struct morse_vif *mors_vif);
 void morse_beacon_irq_handle(struct morse *mors, u32 status);
 
 /**
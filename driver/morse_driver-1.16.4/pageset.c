@@ -14,6 +14,7 @@
 #include "hw.h"
 #include "bus.h"
 #include "ipmon.h"
+#include "trace.h"
 #include <linux/gpio.h>
 #include "pager_if_hw.h"
 #include "pager_if_sw.h"
@@ -28,9 +29,20 @@
 #define MAX_PAGES_PER_RX_TXN	32
 #endif
 
-/* How frequently to notify the chip when RX pages are returned */
-#ifndef PAGE_RETURN_NOTIFY_INT
-#define PAGE_RETURN_NOTIFY_INT	4
+/*
+ * Number of RX pages popped and read together. The chip is notified of returned pages, and
+ * pending beacon requests are checked, after each batch.
+ */
+#ifndef MAX_PAGES_PER_RX_BATCH
+#define MAX_PAGES_PER_RX_BATCH	8
+#endif
+
+/*
+ * Largest stretch of unused chip memory between two RX pages that is read through to merge them
+ * into a single bus transaction. Beyond this a separate read is cheaper than the extra bytes.
+ */
+#ifndef MAX_RX_BURST_GAP_BYTES
+#define MAX_RX_BURST_GAP_BYTES	512
 #endif
 
 /* Time in milliseconds to wait for the beacon tasklet to queue the beacon to skbq */
@@ -349,6 +361,7 @@ static int morse_pageset_write(struct morse_pageset *pageset, struct sk_buff *sk
 	morse_debug_fw_hostif_log_record(mors, true, skb, hdr);
 
 	ret = populated_pager->ops->write_page(populated_pager, &page, 0, skb->data, write_len);
+	trace_morse_pageset_write(mors, pageset->flags, page.addr, write_len, hdr->channel);
 	if (ret) {
 		MORSE_ERR(mors, "%s failed to write page: %d\n", __func__, ret);
 		/* Put the page back into the cache */
@@ -383,67 +396,131 @@ exit:
 	return ret;
 }
 
-static int morse_pageset_read(struct morse_pageset *pageset)
+/*
+ * Take the next populated page from the chip. CMD responses, then TX statuses from the pager
+ * bypass locations are preferred before other RX; we treat these page types as 'first-class'
+ * citizens. On success the page address is decoded and @len holds the (word aligned) number of
+ * bytes to read out of it.
+ */
+static int morse_pageset_rx_pop(struct morse_pageset *pageset, struct morse_page *page, int *len)
 {
-	int ret = 0;
+	int ret;
 	struct morse *mors = pageset->mors;
-	struct sk_buff *skb = NULL;
-	struct morse_skbq *mq = NULL;
-	struct morse_pager *return_pager = pageset->return_pager;
 	struct morse_pager *populated_pager = pageset->populated_pager;
 	struct morse_chip_if_state *chip_if = mors->chip_if;
-	struct morse_page page = { .addr = 0, .size_bytes = 0 };
-	struct morse_buff_skb_header *hdr;
-	int skb_len;
-	int max_checksum_rounds = 2;
-	int count = 0;
-	bool checksum_valid = !(mors->chip_if->validate_skb_checksum);
 
-	/* Preference CMD responses, then TX statuses from the pager bypass
-	 * locations before processing other RX. We treat these page types as
-	 * 'first-class' citizens.
-	 */
 	if (kfifo_len(&chip_if->bypass.cmd_resp.to_process) > 0) {
-		ret = kfifo_get(&chip_if->bypass.cmd_resp.to_process, &page.addr);
+		ret = kfifo_get(&chip_if->bypass.cmd_resp.to_process, &page->addr);
 		WARN_ON(ret == 0);
-		page.size_bytes = populated_pager->page_size_bytes;
+		page->size_bytes = populated_pager->page_size_bytes;
 	} else if (kfifo_len(&chip_if->bypass.tx_sts.to_process) > 0) {
-		ret = kfifo_get(&chip_if->bypass.tx_sts.to_process, &page.addr);
+		ret = kfifo_get(&chip_if->bypass.tx_sts.to_process, &page->addr);
 		WARN_ON(ret == 0);
-		page.size_bytes = populated_pager->page_size_bytes;
+		page->size_bytes = populated_pager->page_size_bytes;
 	} else {
 		/* Pop one page from pager */
-		ret = populated_pager->ops->pop(populated_pager, &page);
-		if (ret) {
-			/* No pages left */
-			page.addr = 0;
-			goto exit;
-		}
+		ret = populated_pager->ops->pop(populated_pager, page);
+		if (ret)
+			return ret;
 	}
 
-	skb_len = round_up(page.addr >> 20, 4);
-	page.addr = ((page.addr & 0xFFFFF) | mors->cfg->regs->pager_base_address);
+	*len = round_up(page->addr >> 20, 4);
+	page->addr = ((page->addr & 0xFFFFF) | mors->cfg->regs->pager_base_address);
 
-	/* Allocate an skb for the page data, copy header to it */
-	skb = dev_alloc_skb(skb_len);
-	if (!skb) {
-		ret = -ENOMEM;
-		goto exit;
-	}
-	skb_put(skb, skb_len);
+	return 0;
+}
+
+/*
+ * Read a batch of popped pages into their skbs. Runs of pages that sit close together in chip
+ * memory are fetched with a single bus read into the burst buffer and copied out, so a batch of
+ * back-to-back RX pages costs one bus transaction instead of one per page.
+ */
+static int morse_pageset_rx_read_pages(struct morse_pageset *pageset, struct morse_page *pages,
+				       struct sk_buff **skbs, const int *lens, int num_pages)
+{
+	int ret = 0;
+	int first, last, i;
+	struct morse_pager *populated_pager = pageset->populated_pager;
 
-	/* Read page data */
-	ret = populated_pager->ops->read_page(populated_pager, &page, 0, skb->data, skb_len);
+	for (first = 0; first < num_pages; first = last + 1) {
+		struct morse_page span;
+		u32 end;
+		int err;
 
-	if (ret) {
-		MORSE_ERR(mors, "%s failed to read page: %d\n", __func__, ret);
-		/* Error is considered catastrophic, pass up error to stop
-		 * more page pops.
+		if (!skbs[first]) {
+			last = first;
+			continue;
+		}
+
+		/* Grow the run while the next page follows closely enough to be worth reading
+		 * through the gap, and the run still fits in the burst buffer.
 		 */
-		goto exit;
+		end = pages[first].addr + lens[first];
+		for (last = first; pageset->rx_burst_buf && last + 1 < num_pages; last++) {
+			const struct morse_page *next = &pages[last + 1];
+
+			if (!skbs[last + 1] || next->addr < end ||
+			    next->addr - end > MAX_RX_BURST_GAP_BYTES ||
+			    next->addr + lens[last + 1] - pages[first].addr >
+			    pageset->rx_burst_buf_len)
+				break;
+			end = next->addr + lens[last + 1];
+		}
+
+		if (first == last) {
+			err = populated_pager->ops->read_page(populated_pager, &pages[first], 0,
+							      skbs[first]->data, lens[first]);
+		} else {
+			/* Both pager implementations map pages linearly in chip memory, so the
+			 * run can be read as one oversized page.
+			 */
+			span.addr = pages[first].addr;
+			span.size_bytes = end - span.addr;
+			err = populated_pager->ops->read_page(populated_pager, &span, 0,
+							      pageset->rx_burst_buf,
+							      span.size_bytes);
+			for (i = first; !err && i <= last; i++)
+				memcpy(skbs[i]->data,
+				       pageset->rx_burst_buf + (pages[i].addr - span.addr), lens[i]);
+			pageset->mors->debug.page_stats.rx_burst_reads++;
+			pageset->mors->debug.page_stats.rx_burst_pages += last - first + 1;
+		}
+
+		if (err) {
+			MORSE_ERR(pageset->mors, "%s failed to read page: %d\n", __func__, err);
+			for (i = first; i <= last; i++) {
+				dev_kfree_skb(skbs[i]);
+				skbs[i] = NULL;
+			}
+			ret = err;
+		}
 	}
 
+	return ret;
+}
+
+/*
+ * Validate a page that has been read from the chip and hand it to the matching skbq. The page is
+ * always given back to the chip through the return pager, and the skb is consumed.
+ */
+static int morse_pageset_rx_page(struct morse_pageset *pageset, struct morse_page *page,
+				 struct sk_buff *skb, int skb_len)
+{
+	int ret = 0;
+	struct morse *mors = pageset->mors;
+	struct morse_skbq *mq = NULL;
+	struct morse_pager *return_pager = pageset->return_pager;
+	struct morse_pager *populated_pager = pageset->populated_pager;
+	struct morse_buff_skb_header *hdr;
+	int max_checksum_rounds = 2;
+	int count = 0;
+	bool checksum_valid = !(mors->chip_if->validate_skb_checksum);
+
+	if (!skb)
+		goto exit;
+
 	hdr = (struct morse_buff_skb_header *)skb->data;
+	trace_morse_pageset_read(mors, pageset->flags, page->addr, skb_len, hdr->channel);
 
 	morse_debug_fw_hostif_log_record(mors, false, skb, hdr);
 
@@ -452,20 +529,19 @@ static int morse_pageset_read(struct morse_pageset *pageset)
 		bool chip_owned = (hdr->sync == MORSE_SKB_HEADER_CHIP_OWNED_SYNC);
 
 		MORSE_DBG(mors, "%s sync error:0x%02X page[addr:0x%08x len:%d]\n",
-			  __func__, hdr->sync, page.addr, hdr->len);
+			  __func__, hdr->sync, page->addr, hdr->len);
 
 		if (chip_owned) {
 			/* Chip already owns the page, clear page address
 			 * to indicate that it should not be returned
 			 */
 			mors->debug.page_stats.page_owned_by_chip++;
-			page.addr = 0;
+			page->addr = 0;
 		}
 
 		/* Not considered catastrophic, continue to read pages out of the
 		 * pager.
 		 */
-		ret = 0;
 		goto exit;
 	}
 
@@ -481,7 +557,7 @@ static int morse_pageset_read(struct morse_pageset *pageset)
 		if (hdr->channel != MORSE_SKB_CHAN_TX_STATUS)
 			break;
 		ret =
-		    populated_pager->ops->read_page(populated_pager, &page, 0, skb->data, skb_len);
+		    populated_pager->ops->read_page(populated_pager, page, 0, skb->data, skb_len);
 		if (ret)
 			break;
 		count++;
@@ -490,7 +566,7 @@ static int morse_pageset_read(struct morse_pageset *pageset)
 	if (!checksum_valid) {
 		MORSE_DBG(mors,
 			  "%s: SKB checksum is invalid, page:[a:0x%08x len:%d] hdr:[c:%02X s:%02X]",
-			  __func__, page.addr, skb_len, hdr->channel, hdr->sync);
+			  __func__, page->addr, skb_len, hdr->channel, hdr->sync);
 		if (hdr->channel == MORSE_SKB_CHAN_TX_STATUS)
 			mors->debug.page_stats.invalid_tx_status_checksum++;
 		goto exit;
@@ -503,7 +579,7 @@ static int morse_pageset_read(struct morse_pageset *pageset)
 	if (hdr->offset > 3) {
 		MORSE_ERR(mors,
 			  "%s: corrupted skb header offset [offset=%u], hdr.len %d, page addr: 0x%08x\n",
-			  __func__, hdr->offset, hdr->len, page.addr);
+			  __func__, hdr->offset, hdr->len, page->addr);
 
 		/* Should we actually do that, or just fail the page and go to exit_return_page? */
 		hdr->offset = (le16_to_cpu(hdr->len) & 0x03) ?
@@ -529,7 +605,6 @@ static int morse_pageset_read(struct morse_pageset *pageset)
 		/* Not considered catastrophic, continue to read pages out of the
 		 * pager.
 		 */
-		ret = 0;
 		goto exit;
 	}
 
@@ -579,11 +654,74 @@ exit:
 	/* If the SKB did not successfully make it into an MQ, it must be freed */
 	dev_kfree_skb(skb);
 
-	if (page.addr) {
+	if (page->addr) {
 		/* Put the emptied page to send it back to the chip */
-		ret = return_pager->ops->put(return_pager, &page);
+		int err = return_pager->ops->put(return_pager, page);
+
+		if (err) {
+			MORSE_ERR(mors, "%s: return page failed: %d\n", __func__, err);
+			ret = ret ? ret : err;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * morse_pageset_read() - Read a batch of populated pages out of the chip.
+ *
+ * @pageset: The from-chip pageset.
+ * @max_pages: Largest number of pages to take in this batch.
+ * @num_read: Set to the number of pages taken from the chip.
+ *
+ * All pages are popped before any data is read so that their skbs can be allocated together and
+ * neighbouring pages fetched in shared bus transactions.
+ *
+ * Return: 0 if a full batch was read, otherwise the error that ended the batch (-EAGAIN once the
+ * chip has no more populated pages).
+ */
+static int morse_pageset_read(struct morse_pageset *pageset, int max_pages, int *num_read)
+{
+	int ret = 0;
+	int err;
+	int i;
+	int num_pages = 0;
+	struct morse_page pages[MAX_PAGES_PER_RX_BATCH];
+	struct sk_buff *skbs[MAX_PAGES_PER_RX_BATCH];
+	int lens[MAX_PAGES_PER_RX_BATCH];
+
+	max_pages = min_t(int, max_pages, MAX_PAGES_PER_RX_BATCH);
+
+	while (num_pages < max_pages) {
+		ret = morse_pageset_rx_pop(pageset, &pages[num_pages], &lens[num_pages]);
 		if (ret)
-			MORSE_ERR(mors, "%s: return page failed: %d\n", __func__, ret);
+			break;
+		num_pages++;
+	}
+
+	*num_read = num_pages;
+
+	/* Allocate an skb for each page up front, ahead of any bus access. A page without an
+	 * skb is handed straight back to the chip and its contents dropped.
+	 */
+	for (i = 0; i < num_pages; i++) {
+		skbs[i] = dev_alloc_skb(lens[i]);
+		if (!skbs[i]) {
+			ret = -ENOMEM;
+			continue;
+		}
+		skb_put(skbs[i], lens[i]);
+	}
+
+	err = morse_pageset_rx_read_pages(pageset, pages, skbs, lens, num_pages);
+	/* Errors from reading are considered catastrophic, pass them up to stop more page pops */
+	if (err)
+		ret = err;
+
+	for (i = 0; i < num_pages; i++) {
+		err = morse_pageset_rx_page(pageset, &pages[i], skbs[i], lens[i]);
+		if (err && (!ret || ret == -EAGAIN))
+			ret = err;
 	}
 
 	return ret;
@@ -783,6 +921,7 @@ static bool morse_pageset_rx_handler(struct morse_pageset *pageset,
 {
 	int ret = 0;
 	int count = 0;
+	int num_read;
 	bool return_notify_req = false;
 	bool do_beacon_irq_check = is_beacon_pending;
 
@@ -790,10 +929,13 @@ static bool morse_pageset_rx_handler(struct morse_pageset *pageset,
 
 	/* Read as many pages out as are available up to the RX limit */
 	do {
-		ret = morse_pageset_read(pageset);
-		count++;
+		ret = morse_pageset_read(pageset, MAX_PAGES_PER_RX_TXN - count, &num_read);
+		count += num_read;
+		if (!num_read)
+			break;
+
 		return_notify_req = true;
-		if ((count % PAGE_RETURN_NOTIFY_INT) == 0) {
+		if (ret == 0) {
 			pageset->return_pager->ops->notify(pageset->return_pager);
 			return_notify_req = false;
 
@@ -842,6 +984,9 @@ void morse_pagesets_stale_tx_work(struct work_struct *work)
 	if (flushed) {
 		MORSE_DBG(mors, "%s: Flushed %d stale TX SKBs\n", __func__, flushed);
 
+		/* Dropped frames no longer count against the data TX queue limits */
+		morse_skbq_may_wake_tx_queues(mors);
+
 		if (mors->ps.enable &&
 		    !mors->ps.suspended && (morse_pagesets_get_tx_buffered_count(mors) == 0)) {
 			/* Evaluate ps to check if it was gated on a stale tx status */
@@ -859,6 +1004,7 @@ void morse_pagesets_work(struct work_struct *work)
 	unsigned long *flags = &mors->chip_if->event_flags;
 	int rx_buffered_on_entry = morse_pageset_get_rx_buffered_count(mors);
 	bool is_beacon_pending = false;
+	u64 start_ns;
 
 	if (!flags_on_entry)
 		return;
@@ -867,6 +1013,8 @@ void morse_pagesets_work(struct work_struct *work)
 	if (test_bit(MORSE_STATE_FLAG_CHIP_UNRESPONSIVE, &mors->state_flags))
 		return;
 
+	start_ns = morse_wq_stats_start();
+
 	/* Disable power save in case it is running */
 	morse_ps_disable(mors);
 	morse_claim_bus(mors);
@@ -968,6 +1116,8 @@ void morse_pagesets_work(struct work_struct *work)
 	morse_release_bus(mors);
 	morse_ps_enable(mors);
 
+	morse_wq_stats_end(&mors->chip_wq_stats, start_ns);
+
 	/* A single RX event may represent the reception
 	 * of many pages. We might not be able to process all these pages
 	 * immediately. As such, manually requeue a chip work item - the firmware
@@ -1013,6 +1163,18 @@ int morse_pageset_init(struct morse *mors, struct morse_pageset *pageset,
 	INIT_KFIFO(pageset->reserved_pages);
 	INIT_KFIFO(pageset->cached_pages);
 
+	if (pageset->flags & MORSE_CHIP_IF_FLAGS_DIR_TO_HOST) {
+		pageset->rx_burst_buf_len = populated_pager->page_size_bytes *
+					    MAX_PAGES_PER_RX_BATCH;
+		pageset->rx_burst_buf = kmalloc(pageset->rx_burst_buf_len, GFP_KERNEL);
+		/* Not fatal, pages are then read one at a time */
+		if (!pageset->rx_burst_buf) {
+			MORSE_WARN(mors, "%s: no RX burst buffer, reading single pages\n",
+				   __func__);
+			pageset->rx_burst_buf_len = 0;
+		}
+	}
+
 	chip_if_direction_flag = pageset->flags & MORSE_PAGER_FLAGS_DIR_TO_HOST ?
 				 MORSE_CHIP_IF_FLAGS_DIR_TO_HOST :
 				 MORSE_CHIP_IF_FLAGS_DIR_TO_CHIP;
@@ -1053,6 +1215,10 @@ void morse_pageset_finish(struct morse_pageset *pageset)
 	pageset->return_pager = NULL;
 	pageset->populated_pager = NULL;
 
+	kfree(pageset->rx_burst_buf);
+	pageset->rx_burst_buf = NULL;
+	pageset->rx_burst_buf_len = 0;
+
 	if (pageset->flags & MORSE_CHIP_IF_FLAGS_DATA) {
 		morse_skbq_finish(&pageset->beacon_q);
 		morse_skbq_finish(&pageset->mgmt_q);
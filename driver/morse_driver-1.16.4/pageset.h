@@ -90,6 +90,10 @@ struct morse_pageset {
 	DECLARE_KFIFO(reserved_pages, struct morse_page, CMD_RSVED_KFIFO_LEN);
 	DECLARE_KFIFO(cached_pages, struct morse_page, CACHED_PAGES_KFIFO_LEN);
 
+	/* Bounce buffer for multi-page RX reads, only allocated for the to-host pageset */
+	u8 *rx_burst_buf;
+	u32 rx_burst_buf_len;
+
 #ifdef CONFIG_MORSE_PAGESET_TRACE
 	struct pageset_trace trace;
 #endif
@@ -8,7 +8,6 @@
 #include "command.h"
 
 #define INVALID_AID_VALUE				(-1)
-#define INVALID_AID_IDX_VALUE				(-1)
 
 /* Masks for RAW assignment */
 #define IEEE80211_S1G_RPS_RAW_CONTROL_TYPE_SHIFT	(0)
@@ -255,7 +254,7 @@ static struct morse_aid_list *morse_generate_aid_list(unsigned long *aid_bitmap,
 	 */
 	const int num_bits = max_aid + 1;
 
-	list = kmalloc(sizeof(list) + (num_aids * sizeof(list->aids[0])), gfp);
+	list = kmalloc(struct_size(list, aids, num_aids), gfp);
 	if (!list)
 		return NULL;
 
@@ -365,6 +364,42 @@ u8 morse_raw_get_rps_ie_size(struct morse_vif *mors_vif)
 	return ap->raw.rps_ie_len;
 }
 
+/**
+ * morse_raw_calc_assignment_size() - Calculates the size of the RAW assignment for a config
+ *
+ * @config		RAW configuration
+ *
+ * Return: size of the encoded RAW assignment in bytes
+ */
+static u16 morse_raw_calc_assignment_size(const struct morse_raw_config *config)
+{
+	u16 size = sizeof(struct ieee80211_s1g_rps_raw_assignment);
+
+	/* Check for unsupported types. */
+	switch (config->type) {
+	case IEEE80211_S1G_RPS_RAW_TYPE_SOUNDING:
+	case IEEE80211_S1G_RPS_RAW_TYPE_SIMPLEX:
+	case IEEE80211_S1G_RPS_RAW_TYPE_TRIGGERING:
+		WARN_ON(true);
+		break;
+	case IEEE80211_S1G_RPS_RAW_TYPE_GENERIC:
+		/* If the start time is 0 we can omit the start time field. */
+		if (config->start_time_us != 0)
+			size += sizeof(struct morse_raw_start_time_t);
+
+		/*
+		 * While we could omit the RAW group configuration if the same as the last
+		 * RAW we will include it for simplicity.
+		 */
+		size += sizeof(struct morse_raw_group_t);
+
+		if (morse_raw_cfg_is_periodic(config))
+			size += sizeof(struct morse_raw_periodic_t);
+	}
+
+	return size;
+}
+
 /**
  * morse_raw_calc_rps_ie_size() -	Calculates the RPS IE size required for the provided RAW
  *									configurations
@@ -387,33 +422,33 @@ static int morse_raw_calc_rps_ie_size(const struct morse_raw_config *const *conf
 
 	WARN_ON(!config_list);
 
-	for (i = 0; i < num_configs; i++) {
-		/* Check for unsupported types. */
-		switch (config_list[i]->type) {
-		case IEEE80211_S1G_RPS_RAW_TYPE_SOUNDING:
-		case IEEE80211_S1G_RPS_RAW_TYPE_SIMPLEX:
-		case IEEE80211_S1G_RPS_RAW_TYPE_TRIGGERING:
-			WARN_ON(true);
-			break;
-		case IEEE80211_S1G_RPS_RAW_TYPE_GENERIC:
-			/* If the start time is 0 we can omit the start time field. */
-			if (config_list[i]->start_time_us != 0)
-				size += sizeof(struct morse_raw_start_time_t);
-
-			/*
-			 * While we could omit the RAW group configuration if the same as the last
-			 * RAW we will include it for simplicity.
-			 */
-			size += sizeof(struct morse_raw_group_t);
+	for (i = 0; i < num_configs; i++)
+		size += morse_raw_calc_assignment_size(config_list[i]);
 
-			if (morse_raw_cfg_is_periodic(config_list[i]))
-				size += sizeof(struct morse_raw_periodic_t);
-		}
+	return size;
+}
 
-		size += sizeof(struct ieee80211_s1g_rps_raw_assignment);
-	}
+/**
+ * morse_raw_cfg_has_spreading() - Returns true if the config is spreading connected STAs over
+ *	multiple beacons
+ *
+ * @config		RAW configuration
+ */
+static bool morse_raw_cfg_has_spreading(const struct morse_raw_config *config)
+{
+	return config->beacon_spreading.nominal_sta_per_beacon &&
+	       !(config->start_aid_idx < 0) && !(config->end_aid_idx < 0);
+}
 
-	return size;
+/**
+ * morse_raw_cfg_varies_per_beacon() - Returns true if the encoded assignment for the config can
+ *	change from one beacon to the next with no change in config or BSS membership
+ *
+ * @config		RAW configuration
+ */
+static bool morse_raw_cfg_varies_per_beacon(const struct morse_raw_config *config)
+{
+	return morse_raw_cfg_is_periodic(config) || morse_raw_cfg_has_spreading(config);
 }
 
 u8 *morse_raw_get_rps_ie(struct morse_vif *mors_vif)
@@ -499,93 +534,43 @@ static u8 *morse_raw_generate_assignment(struct morse_vif *mors_vif,
 					 struct morse_raw_config *config, u8 *rps_ie_start)
 {
 	struct morse *mors = morse_vif_to_morse(mors_vif);
-	/* Pages aren't used yet so always use zero. */
 	struct morse_aid_list *aid_list = mors_vif->ap->raw.aid_list;
-	u16 num_stas;
-	int current_beacon_start_aid_idx = INVALID_AID_IDX_VALUE;
-	int current_beacon_end_aid_idx = INVALID_AID_IDX_VALUE;
+	int current_beacon_start_aid_idx;
+	int current_beacon_end_aid_idx;
 	u16 current_beacon_start_aid;
 	u16 current_beacon_end_aid;
-	u32 i;
-
 	u16 sta_per_beacon;
-	u16 sta_per_beacon_mod;
 
 	/* If beacon spreading is enabled and there are connected STAs find the subgroup of STAs for
-	 * this beacon.
+	 * this beacon. The split was calculated when the AID list was last refreshed, so this only
+	 * has to advance the cursor.
 	 */
-	if (config->beacon_spreading.nominal_sta_per_beacon &&
-	    !(config->start_aid_idx < 0) && !(config->end_aid_idx < 0)) {
-		/* Calculate how many STAs in each RAW. */
-		num_stas = config->end_aid_idx - config->start_aid_idx + 1;
-
-		MORSE_RAW_DBG(mors, "num_stas: %d, nspb:%d max_spread:%d\n",
-			      num_stas, config->beacon_spreading.nominal_sta_per_beacon,
-				  config->beacon_spreading.max_spread);
-
-		/* Increase the number of stations per RAW to avoid spreading over
-		 * too many beacons if necessary.
-		 */
-		if (config->beacon_spreading.max_spread &&
-		    ((num_stas / config->beacon_spreading.nominal_sta_per_beacon)
-				> config->beacon_spreading.max_spread)) {
-			sta_per_beacon = num_stas / config->beacon_spreading.max_spread;
-			sta_per_beacon_mod = num_stas % config->beacon_spreading.max_spread;
-		} else {
-			u16 beacon_count = num_stas /
-				config->beacon_spreading.nominal_sta_per_beacon;
-
-			if (num_stas % config->beacon_spreading.nominal_sta_per_beacon)
-				beacon_count++;
-
-			sta_per_beacon = num_stas / beacon_count;
-			sta_per_beacon_mod = num_stas % beacon_count;
-			MORSE_RAW_DBG(mors, "beacon_cnt:%d\n", beacon_count);
-		}
-
-		MORSE_RAW_DBG(mors, "sta_per_beacon, mod: %u, %u\n",
-			      sta_per_beacon, sta_per_beacon_mod);
-
-		/* Find where we should start the AID range for this beacon from. */
-		MORSE_RAW_DBG(mors, "Last spread AID: %u\n", config->beacon_spreading.last_aid);
-		for (i = config->start_aid_idx;
-		     (i <= config->end_aid_idx) && (i < aid_list->num_aids); i++) {
-			if (aid_list->aids[i] > config->beacon_spreading.last_aid) {
-				current_beacon_start_aid_idx = i;
-				break;
-			}
-		}
+	if (morse_raw_cfg_has_spreading(config)) {
+		current_beacon_start_aid_idx = config->beacon_spreading.next_aid_idx;
 
 		/* If the last end AID was the last of the connected STAs then start the cycle from
 		 * the beginning.
 		 */
-		if (current_beacon_start_aid_idx == INVALID_AID_IDX_VALUE)
+		if (current_beacon_start_aid_idx < config->start_aid_idx ||
+		    current_beacon_start_aid_idx > config->end_aid_idx)
 			current_beacon_start_aid_idx = config->start_aid_idx;
 
 		/* If we are in one of the earlier RAWs add an additional STA to deal with the
 		 * modulus calculated earlier.
 		 */
+		sta_per_beacon = config->beacon_spreading.sta_per_beacon;
 		if (((current_beacon_start_aid_idx - config->start_aid_idx) / sta_per_beacon) <
-		    sta_per_beacon_mod)
+		    config->beacon_spreading.sta_per_beacon_mod)
 			sta_per_beacon++;
 
 		/* Find the end AID for this beacon. */
-		for (i = current_beacon_start_aid_idx;
-		     (i <= config->end_aid_idx) &&
-		     (i < (current_beacon_start_aid_idx + sta_per_beacon)) &&
-		     (i < aid_list->num_aids); i++) {
-			current_beacon_end_aid_idx = i;
-		}
-
-		if (current_beacon_end_aid_idx < current_beacon_start_aid_idx) {
-			/* This should never happen */
-			MORSE_WARN_ON_ONCE(FEATURE_ID_RAW, 1);
-			current_beacon_end_aid_idx = current_beacon_start_aid_idx;
-		}
+		current_beacon_end_aid_idx = min_t(int, config->end_aid_idx,
+			current_beacon_start_aid_idx + sta_per_beacon - 1);
 
 		current_beacon_start_aid = aid_list->aids[current_beacon_start_aid_idx];
 		current_beacon_end_aid = aid_list->aids[current_beacon_end_aid_idx];
-		config->beacon_spreading.last_aid = aid_list->aids[current_beacon_end_aid_idx];
+		config->beacon_spreading.last_aid = current_beacon_end_aid;
+		config->beacon_spreading.next_aid_idx = current_beacon_end_aid_idx + 1;
 		MORSE_RAW_DBG(mors, "Start, End AID idx: %u, %u\n",
 			      current_beacon_start_aid_idx, current_beacon_end_aid_idx);
 		MORSE_RAW_DBG(mors, "Start, End AID: %u, %u\n",
@@ -602,8 +587,45 @@ static u8 *morse_raw_generate_assignment(struct morse_vif *mors_vif,
 		current_beacon_start_aid, current_beacon_end_aid);
 }
 
+/**
+ * morse_raw_patch_rps_ie() - Re-encode, in place, only the assignments of the cached RPS IE
+ * that change from beacon to beacon (beacon spreading and PRAW counters).
+ * Note: Caller should hold the RAW lock
+ *
+ * @mors_vif:	Morse interface
+ */
+static void morse_raw_patch_rps_ie(struct morse_vif *mors_vif)
+{
+	struct morse_raw *raw = &mors_vif->ap->raw;
+	struct morse_raw_config *config;
+	u8 rps_ie_len = raw->rps_ie_len;
+	u8 *head = raw->rps_ie;
+	u8 *end;
+	int i;
+
+	/* Invalidate current raw until we are finished by setting to 0. */
+	raw->rps_ie_len = 0;
+
+	for (i = 0; i < raw->rps_ie_num_configs; i++) {
+		config = raw->rps_ie_configs[i];
+
+		if (morse_raw_cfg_varies_per_beacon(config)) {
+			end = morse_raw_generate_assignment(mors_vif, config, head);
+			WARN_ON(end != head + morse_raw_calc_assignment_size(config));
+			head = end;
+		} else {
+			head += morse_raw_calc_assignment_size(config);
+		}
+	}
+
+	WARN_ON(head != (raw->rps_ie + rps_ie_len));
+	raw->rps_ie_len = rps_ie_len;
+}
+
 /**
  * morse_raw_generate_rps_ie() - Generate and update the RPS IE depending on RAW configurations.
+ * If the configs are the same as those already encoded and nothing has been marked stale, the
+ * cached RPS IE is kept and only the per-beacon fields are refreshed.
  * Note: Caller should hold the RAW lock
  *
  * @mors:		Morse chip struct
@@ -621,11 +643,19 @@ static int morse_raw_generate_rps_ie(struct morse_vif *mors_vif,
 	u8 old_rps_ie_len;
 	struct morse *mors = morse_vif_to_morse(mors_vif);
 	struct morse_raw *raw = &mors_vif->ap->raw;
+	bool stale = test_and_clear_bit(RAW_STATE_RPS_IE_STALE, &raw->flags);
+	int size;
+
+	if (!stale && raw->rps_ie && raw->rps_ie_len &&
+	    raw->rps_ie_num_configs == num_configs &&
+	    !memcmp(raw->rps_ie_configs, config_list, num_configs * sizeof(config_list[0]))) {
+		morse_raw_patch_rps_ie(mors_vif);
+		return 0;
+	}
 
 	/* Calculate the size so we can allocate memory */
-	int size =
-	    morse_raw_calc_rps_ie_size((const struct morse_raw_config * const *)config_list,
-				       num_configs);
+	size = morse_raw_calc_rps_ie_size((const struct morse_raw_config * const *)config_list,
+					  num_configs);
 
 	MORSE_RAW_DBG(mors, "Number of RAWs: %u\n", num_configs);
 	MORSE_RAW_DBG(mors, "RPS IE size: %d\n", size);
@@ -650,6 +680,7 @@ static int morse_raw_generate_rps_ie(struct morse_vif *mors_vif,
 	/* Check we got our allocated memory. */
 	if (!raw->rps_ie) {
 		MORSE_RAW_DBG(mors, "Failed to allocate RAW RPS IE\n");
+		raw->rps_ie_num_configs = 0;
 		return -ENOMEM;
 	}
 
@@ -667,6 +698,9 @@ static int morse_raw_generate_rps_ie(struct morse_vif *mors_vif,
 	WARN_ON(head != (raw->rps_ie + size));
 	raw->rps_ie_len = size;
 
+	memcpy(raw->rps_ie_configs, config_list, num_configs * sizeof(config_list[0]));
+	raw->rps_ie_num_configs = num_configs;
+
 	return 0;
 }
 
@@ -828,6 +862,77 @@ static void raw_update_aid_indexes(struct morse_raw_config *cfg,
 	}
 }
 
+/**
+ * raw_update_spreading() - Recalculate the beacon spreading split for a RAW config and
+ * reposition its cursor after the last AID that was sent
+ *
+ * @cfg: RAW config to update
+ * @aid_list: Current AID list
+ */
+static void raw_update_spreading(struct morse_raw_config *cfg,
+		const struct morse_aid_list *aid_list)
+{
+	u16 nominal = cfg->beacon_spreading.nominal_sta_per_beacon;
+	u16 max_spread = cfg->beacon_spreading.max_spread;
+	u16 num_stas;
+	u16 beacon_count;
+	int idx;
+
+	if (!morse_raw_cfg_has_spreading(cfg))
+		return;
+
+	/* Calculate how many STAs in each RAW. */
+	num_stas = cfg->end_aid_idx - cfg->start_aid_idx + 1;
+
+	/* Increase the number of stations per RAW to avoid spreading over
+	 * too many beacons if necessary.
+	 */
+	if (max_spread && (num_stas / nominal) > max_spread) {
+		beacon_count = max_spread;
+	} else {
+		beacon_count = num_stas / nominal;
+		if (num_stas % nominal)
+			beacon_count++;
+	}
+
+	cfg->beacon_spreading.sta_per_beacon = num_stas / beacon_count;
+	cfg->beacon_spreading.sta_per_beacon_mod = num_stas % beacon_count;
+
+	/* Continue the cycle from the first AID after the last one sent */
+	idx = raw_bsearch_aid_indexes(aid_list, cfg->beacon_spreading.last_aid);
+	if (aid_list->aids[idx] <= cfg->beacon_spreading.last_aid)
+		idx++;
+	cfg->beacon_spreading.next_aid_idx = max_t(int, idx, cfg->start_aid_idx);
+}
+
+/**
+ * morse_raw_update_aid_ranges() - Recalculate the AID index ranges and beacon spreading split
+ * of the active beacon spreading RAWs against the cached AID list
+ *
+ * @raw: RAW context
+ */
+static void morse_raw_update_aid_ranges(struct morse_raw *raw)
+{
+	struct morse_raw_config *config_ptr;
+
+	lockdep_assert_held(&raw->lock);
+
+	if (!raw->aid_list)
+		return;
+
+	list_for_each_entry(config_ptr, &raw->active_raws, active_list) {
+		/* only care about AID indexes for active beacon spreading RAWs */
+		if (config_ptr->beacon_spreading.nominal_sta_per_beacon) {
+			/* Reset indices */
+			config_ptr->start_aid_idx = INVALID_AID_VALUE;
+			config_ptr->end_aid_idx = INVALID_AID_VALUE;
+
+			raw_update_aid_indexes(config_ptr, raw->aid_list);
+			raw_update_spreading(config_ptr, raw->aid_list);
+		}
+	}
+}
+
 /**
  * morse_raw_refresh_aids() - Refresh AID list used for beacon spreading
  *
@@ -837,7 +942,6 @@ static void raw_update_aid_indexes(struct morse_raw_config *cfg,
 static void morse_raw_refresh_aids(struct morse_ap *ap, struct morse_raw *raw)
 {
 	struct morse_aid_list *aid_list;
-	struct morse_raw_config *config_ptr;
 
 	lockdep_assert_held(&raw->lock);
 
@@ -854,16 +958,7 @@ static void morse_raw_refresh_aids(struct morse_ap *ap, struct morse_raw *raw)
 
 	WARN_ON(aid_list->num_aids > 0 && !(u16 *)aid_list->aids);
 
-	list_for_each_entry(config_ptr, &raw->active_raws, active_list) {
-		/* only care about AID indexes for active beacon spreading RAWs */
-		if (config_ptr->beacon_spreading.nominal_sta_per_beacon) {
-			/* Reset indices */
-			config_ptr->start_aid_idx = INVALID_AID_VALUE;
-			config_ptr->end_aid_idx = INVALID_AID_VALUE;
-
-			raw_update_aid_indexes(config_ptr, aid_list);
-		}
-	}
+	morse_raw_update_aid_ranges(raw);
 }
 
 int morse_raw_process_rx_mgmt(struct morse *mors, struct ieee80211_vif *vif,
@@ -942,6 +1037,9 @@ static void morse_raw_do_update(struct morse_vif *mors_vif)
 
 		/* Start broadcasting PRAWs for the new STAs */
 		morse_raw_start_praw_transmission(raw, false);
+	} else if (test_bit(RAW_STATE_RPS_IE_STALE, &raw->flags)) {
+		/* Config changed, AID membership did not. Only the group ranges need updating. */
+		morse_raw_update_aid_ranges(raw);
 	}
 
 	/* A beacon has been sent.
@@ -1021,6 +1119,7 @@ static void morse_raw_do_update(struct morse_vif *mors_vif)
 	}
 cleanup:
 	raw->rps_ie_len = 0;
+	raw->rps_ie_num_configs = 0;
 	kfree(raw->rps_ie);
 	raw->rps_ie = NULL;
 	mutex_unlock(&raw->lock);
@@ -1582,6 +1681,9 @@ void morse_raw_trigger_update(struct morse_vif *mors_vif, bool refresh_aids)
 	if (!raw->aid_list || refresh_aids)
 		set_bit(RAW_STATE_REFRESH_AIDS, &raw->flags);
 
+	/* Membership or config changed, so the cached RPS IE can't be patched in place */
+	set_bit(RAW_STATE_RPS_IE_STALE, &raw->flags);
+
 	schedule_work(&raw->update_work);
 }
 
@@ -1657,8 +1759,11 @@ void morse_raw_finish(struct morse_vif *mors_vif)
 
 	/* Free RAW and clean up */
 	raw->rps_ie_len = 0;
+	raw->rps_ie_num_configs = 0;
 	kfree(raw->rps_ie);
 	raw->rps_ie = NULL;
+	kfree(raw->aid_list);
+	raw->aid_list = NULL;
 
 	list_for_each_entry_safe(config, tmp, &raw->raw_config_list, list)
 		morse_raw_delete_config(raw, config);
@@ -209,6 +209,15 @@ struct morse_raw_config {
 		u16 nominal_sta_per_beacon;
 		/** Last AID that was used in a beacon with spreading. */
 		u16 last_aid;
+		/**
+		 * Number of STAs placed in each beacon, derived from the AID index range. Cached
+		 * when the AID list or config changes so the per-beacon update is O(1).
+		 */
+		u16 sta_per_beacon;
+		/** Number of leading beacons in the cycle that carry one additional STA */
+		u16 sta_per_beacon_mod;
+		/** Index into the AID list of the first AID for the next beacon */
+		s32 next_aid_idx;
 	} beacon_spreading;
 
 	/**
@@ -241,6 +250,8 @@ enum raw_state_flags {
 	RAW_STATE_REFRESH_AIDS,
 	/** A beacon has been sent since the last update */
 	RAW_STATE_BEACON_SENT,
+	/** Config or BSS membership changed, the cached RPS IE must be fully rebuilt */
+	RAW_STATE_RPS_IE_STALE,
 };
 
 /**
@@ -255,6 +266,13 @@ struct morse_raw {
 	u8 *rps_ie;
 	/** The size of the currently generated RPS IE */
 	u8 rps_ie_len;
+	/**
+	 * The configs encoded in the current RPS IE, in order. While this set is unchanged and
+	 * the IE is not stale, only assignments that vary per beacon are re-encoded in place.
+	 */
+	struct morse_raw_config *rps_ie_configs[MAX_NUM_RAWS];
+	/** Number of entries in @rps_ie_configs */
+	u8 rps_ie_num_configs;
 	struct {
 		/**
 		 * Number of static configurations active across active_raws and active_praws.
@@ -41,6 +41,17 @@ static int fixed_guard __read_mostly;
 module_param(fixed_guard, int, 0644);
 MODULE_PARM_DESC(fixed_guard, "Fixed guard interval (only used when enable_fixed_rate is on)");
 
+/* Bound the time the rate control work spends in a single run */
+static uint rc_update_batch __read_mostly = 32;
+module_param(rc_update_batch, uint, 0644);
+MODULE_PARM_DESC(rc_update_batch, "Maximum number of stations updated per rate control work run");
+
+/*
+ * Stations due for an update within this time are updated together, so the work does
+ * not wake for every station when their update times are spread out.
+ */
+#define MORSE_RC_UPDATE_SLACK_MS		(MMRC_UPDATE_FREQUENCY_MS / 5)
+
 #define MORSE_RC_MMRC_BW_TO_FLAGS(X)				\
 	(((X) == MMRC_BW_1MHZ) ? MORSE_SKB_RATE_FLAGS_1MHZ :	\
 	((X) == MMRC_BW_2MHZ) ? MORSE_SKB_RATE_FLAGS_2MHZ :	\
@@ -63,25 +74,57 @@ MODULE_PARM_DESC(fixed_guard, "Fixed guard interval (only used when enable_fixed
 #define MORSE_RC_WARN_RATELIMITED(_m, _f, _a...)		\
 	morse_warn_ratelimited(FEATURE_ID_RATECONTROL, _m, _f, ##_a)
 
+static bool morse_rc_sta_update_due(struct morse_rc_sta *mrc_sta, unsigned long now)
+{
+	unsigned long due = mrc_sta->last_update +
+		msecs_to_jiffies(MMRC_UPDATE_FREQUENCY_MS - MORSE_RC_UPDATE_SLACK_MS);
+
+	return time_after_eq(now, due);
+}
+
 static void morse_rc_work(struct work_struct *work)
 {
 	struct morse_rc *mrc = container_of(work, struct morse_rc, work);
-	struct list_head *pos;
+	struct morse_rc_sta *mrc_sta;
+	unsigned long next = jiffies + msecs_to_jiffies(MMRC_UPDATE_FREQUENCY_MS);
+	uint batch = max_t(uint, rc_update_batch, 1);
+	bool more = false;
+	uint n;
 
 	spin_lock_bh(&mrc->lock);
 
-	list_for_each(pos, &mrc->stas) {
-		struct morse_rc_sta *mrc_sta = container_of(pos, struct morse_rc_sta, list);
+	/*
+	 * The list is kept in update order, so only the stations at the head can be due.
+	 * Update at most one batch of them and come back for the rest, so a run does
+	 * not grow with the number of stations.
+	 */
+	for (n = 0; n < batch; n++) {
 		unsigned long now = jiffies;
 
-		mrc_sta->last_update = now;
+		mrc_sta = list_first_entry_or_null(&mrc->stas, struct morse_rc_sta, list);
+		if (!mrc_sta || !morse_rc_sta_update_due(mrc_sta, now))
+			break;
 
+		spin_lock(&mrc_sta->lock);
+		mrc_sta->last_update = now;
 		mmrc_update(mrc_sta->tb);
+		spin_unlock(&mrc_sta->lock);
+
+		list_move_tail(&mrc_sta->list, &mrc->stas);
+	}
+
+	mrc_sta = list_first_entry_or_null(&mrc->stas, struct morse_rc_sta, list);
+	if (mrc_sta) {
+		more = morse_rc_sta_update_due(mrc_sta, jiffies);
+		next = mrc_sta->last_update + msecs_to_jiffies(MMRC_UPDATE_FREQUENCY_MS);
 	}
 
 	spin_unlock_bh(&mrc->lock);
 
-	mod_timer(&mrc->timer, jiffies + msecs_to_jiffies(100));
+	if (more)
+		queue_work(mrc->mors->net_wq, &mrc->work);
+	else
+		mod_timer(&mrc->timer, next);
 }
 
 #if KERNEL_VERSION(4, 14, 0) > LINUX_VERSION_CODE
@@ -310,22 +353,44 @@ int morse_rc_sta_add(struct morse *mors, struct ieee80211_vif *vif, struct ieee8
 	table_mem_size = mmrc_memory_required_for_caps(&caps);
 	MORSE_RC_DBG(mors, "%s: Mem for table: %zd", __func__, table_mem_size);
 	tb = kzalloc(table_mem_size, GFP_KERNEL);
+	if (!tb)
+		return -ENOMEM;
 
 	/* Initialise the STA rate control table */
 	mmrc_sta_init(tb, &caps, msta->avg_rssi);
 
 	spin_lock_bh(&mors->mrc.lock);
+	spin_lock(&msta->rc.lock);
 
-	kfree(msta->rc.tb);
-	msta->rc.tb = tb;
-	list_add(&msta->rc.list, &mors->mrc.stas);
+	/* A station is on the list exactly when it has a table */
+	if (msta->rc.tb)
+		list_move_tail(&msta->rc.list, &mors->mrc.stas);
+	else
+		list_add_tail(&msta->rc.list, &mors->mrc.stas);
+	swap(msta->rc.tb, tb);
 	msta->rc.last_update = jiffies;
 
+	spin_unlock(&msta->rc.lock);
 	spin_unlock_bh(&mors->mrc.lock);
 
+	kfree(tb);
+
 	return 0;
 }
 
+void morse_rc_sta_init(struct morse_sta *msta)
+{
+	/* mac80211 replays NOTEXIST->NONE for existing stations on restart, while
+	 * rc may still hold the lock. drv_priv is zeroed on allocation, so an
+	 * initialised list head means this station has been set up already.
+	 */
+	if (msta->rc.list.prev)
+		return;
+
+	spin_lock_init(&msta->rc.lock);
+	INIT_LIST_HEAD(&msta->rc.list);
+}
+
 static void rc_reinit_sta(void *data, struct ieee80211_sta *sta)
 {
 	struct ieee80211_vif *vif = data;
@@ -379,7 +444,6 @@ bool _morse_rc_set_fixed_rate(struct morse *mors,
 			      int mcs, int bw, int ss, int guard, const char *caller)
 {
 	struct morse_sta *msta = (struct morse_sta *)sta->drv_priv;
-	struct list_head *pos;
 	struct mmrc_rate fixed_rate;
 	bool ret_val = true;
 
@@ -394,16 +458,10 @@ bool _morse_rc_set_fixed_rate(struct morse *mors,
 	fixed_rate.ss = (ss - 1);
 	fixed_rate.guard = guard;
 
-	spin_lock_bh(&mors->mrc.lock);
-	list_for_each(pos, &mors->mrc.stas) {
-		struct morse_rc_sta *mrc_sta = list_entry(pos, struct morse_rc_sta, list);
-
-		if (&msta->rc == mrc_sta) {
-			ret_val = mmrc_set_fixed_rate(msta->rc.tb, fixed_rate);
-			break;
-		}
-	}
-	spin_unlock_bh(&mors->mrc.lock);
+	spin_lock_bh(&msta->rc.lock);
+	if (msta->rc.tb)
+		ret_val = mmrc_set_fixed_rate(msta->rc.tb, fixed_rate);
+	spin_unlock_bh(&msta->rc.lock);
 
 	if (!ret_val)
 		MORSE_RC_ERR(mors, "%s failed, caller %s ss %d bw %d mcs %d guard %d\n",
@@ -415,14 +473,19 @@ bool _morse_rc_set_fixed_rate(struct morse *mors,
 void morse_rc_sta_remove(struct morse *mors, struct ieee80211_sta *sta)
 {
 	struct morse_sta *msta = (struct morse_sta *)sta->drv_priv;
+	struct mmrc_table *tb;
 
 	spin_lock_bh(&mors->mrc.lock);
-	if (msta->rc.tb) {
+	spin_lock(&msta->rc.lock);
+	tb = msta->rc.tb;
+	if (tb) {
 		list_del_init(&msta->rc.list);
-		kfree(msta->rc.tb);
 		msta->rc.tb = NULL;
 	}
+	spin_unlock(&msta->rc.lock);
 	spin_unlock_bh(&mors->mrc.lock);
+
+	kfree(tb);
 }
 
 static void morse_rc_sta_fill_basic_rates(struct morse_skb_tx_info *tx_info,
@@ -454,19 +517,14 @@ static int morse_rc_sta_get_rates(struct morse *mors,
 				  struct mmrc_rate_table *rates, size_t size)
 {
 	int ret = -ENOENT;
-	struct list_head *pos;
-
-	spin_lock_bh(&mors->mrc.lock);
-	list_for_each(pos, &mors->mrc.stas) {
-		struct morse_rc_sta *mrc_sta = list_entry(pos, struct morse_rc_sta, list);
 
-		if (&msta->rc == mrc_sta) {
-			ret = 0;
-			mmrc_get_rates(msta->rc.tb, rates, size);
-			break;
-		}
+	/* Only contends with the periodic update of this station, never the whole pass */
+	spin_lock_bh(&msta->rc.lock);
+	if (msta->rc.tb) {
+		ret = 0;
+		mmrc_get_rates(msta->rc.tb, rates, size);
 	}
-	spin_unlock_bh(&mors->mrc.lock);
+	spin_unlock_bh(&msta->rc.lock);
 
 	return ret;
 }
@@ -646,21 +704,14 @@ static void morse_rc_sta_set_rates(struct morse *mors,
 				   int attempts,
 				   bool is_agg_mode, u32 success, u32 failure)
 {
-	struct list_head *pos;
-
-	spin_lock_bh(&mors->mrc.lock);
-	list_for_each(pos, &mors->mrc.stas) {
-		struct morse_rc_sta *mrc_sta = list_entry(pos, struct morse_rc_sta, list);
-
-		if (&msta->rc == mrc_sta) {
-			if (is_agg_mode)
-				mmrc_feedback_agg(msta->rc.tb, rates, attempts, success, failure);
-			else
-				mmrc_feedback(msta->rc.tb, rates, attempts);
-			break;
-		}
+	spin_lock_bh(&msta->rc.lock);
+	if (msta->rc.tb) {
+		if (is_agg_mode)
+			mmrc_feedback_agg(msta->rc.tb, rates, attempts, success, failure);
+		else
+			mmrc_feedback(msta->rc.tb, rates, attempts);
 	}
-	spin_unlock_bh(&mors->mrc.lock);
+	spin_unlock_bh(&msta->rc.lock);
 }
 
 void morse_rc_sta_feedback_rates(struct morse *mors, struct sk_buff *skb,
@@ -796,7 +847,8 @@ void morse_rc_sta_state_check(struct morse *mors,
 		struct morse_vif *mors_vif = ieee80211_vif_to_morse_vif(vif);
 
 		/* Newly associated, add to RC */
-		morse_rc_sta_add(mors, vif, sta);
+		if (morse_rc_sta_add(mors, vif, sta))
+			return;
 
 		/* Set fixed rate */
 		if (enable_fixed_rate)
@@ -824,7 +876,7 @@ void morse_rc_sta_state_check(struct morse *mors,
 		morse_rc_sta_remove(mors, sta);
 	} else if (old_state < new_state &&
 		   old_state == IEEE80211_STA_NONE &&
-		   msta->rc.list.prev) {
+		   msta->rc.tb) {
 		/* Special case for driver warning issue causing a sta to be left on the list */
 		MORSE_RC_INFO(mors, "Remove stale sta from rc list\n");
 		morse_rc_sta_remove(mors, sta);
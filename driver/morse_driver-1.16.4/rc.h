@@ -17,8 +17,12 @@
 #define INIT_MAX_RATES_NUM 4
 
 struct morse_rc {
-	/* Serialise rate control queue manipulation and timer functions */
+	/*
+	 * Serialise rate control queue manipulation and timer functions. Nests outside
+	 * of the per station lock.
+	 */
 	spinlock_t lock;
+	/* Stations with a rate table, least recently updated first */
 	struct list_head stas;
 	struct timer_list timer;
 	struct work_struct work;
@@ -26,12 +30,22 @@ struct morse_rc {
 };
 
 struct morse_rc_sta {
+	/* Protects the rate table, taken on the TX and TX status paths */
+	spinlock_t lock;
 	struct mmrc_table *tb;
 	struct list_head list;
 
 	unsigned long last_update;
 };
 
+/**
+ * morse_rc_sta_init() - Initialise the rate control state of a new station
+ *
+ * @msta: The station, called before it is first used for rate control. Later calls for
+ *        the same station, such as on a restart, leave its state untouched.
+ */
+void morse_rc_sta_init(struct morse_sta *msta);
+
 int morse_rc_init(struct morse *mors);
 
 int morse_rc_deinit(struct morse *mors);
@@ -21,12 +21,37 @@
 #include "ipmon.h"
 #include "wiphy.h"
 #include "bus.h"
+#include "trace.h"
 
 /* Enable/Disable avoid buffer bloating */
 static uint max_txq_len __read_mostly = 32;
 module_param(max_txq_len, uint, 0644);
 MODULE_PARM_DESC(max_txq_len, "Maximum number of queued TX packets");
 
+static bool enable_dynamic_txq_limit __read_mostly = true;
+module_param(enable_dynamic_txq_limit, bool, 0644);
+MODULE_PARM_DESC(enable_dynamic_txq_limit,
+		 "Size data TX queues from TX status completions instead of max_txq_len");
+
+static uint dynamic_txq_limit_min __read_mostly = (3 * 1024);
+module_param(dynamic_txq_limit_min, uint, 0644);
+MODULE_PARM_DESC(dynamic_txq_limit_min,
+		 "Minimum bytes a data TX queue may hold queued and in flight");
+
+static uint dynamic_txq_limit_max __read_mostly = (256 * 1024);
+module_param(dynamic_txq_limit_max, uint, 0644);
+MODULE_PARM_DESC(dynamic_txq_limit_max,
+		 "Maximum bytes a data TX queue may hold queued and in flight");
+
+/*
+ * Lower bound on the dynamic limit requested by a mode that raised max_txq_len (e.g. mesh, which
+ * forwards for its peers), so it keeps its deeper queues with dynamic limits enabled.
+ */
+static u32 dynamic_txq_limit_floor __read_mostly;
+
+/* Bytes per packet assumed when turning a packet count into a byte limit */
+#define MORSE_SKBQ_LIMIT_PKT_BYTES	(ETH_DATA_LEN)
+
 static u32 tx_queued_lifetime_ms __read_mostly = (1000);
 module_param(tx_queued_lifetime_ms, uint, 0644);
 MODULE_PARM_DESC(tx_queued_lifetime_ms,
@@ -37,6 +62,11 @@ module_param(tx_status_lifetime_ms, uint, 0644);
 MODULE_PARM_DESC(tx_status_lifetime_ms,
 		 "Maximum lifetime (ms) for pending Tx packets before considered dropped");
 
+/* Time the excess over a data TX queue limit must persist before the limit is reduced */
+#ifndef MORSE_SKBQ_LIMIT_SLACK_HOLD_MS
+#define MORSE_SKBQ_LIMIT_SLACK_HOLD_MS	(1000)
+#endif
+
 #define MORSE_SKB_DBG(_m, _f, _a...)		morse_dbg(FEATURE_ID_SKB, _m, _f, ##_a)
 #define MORSE_SKB_INFO(_m, _f, _a...)		morse_info(FEATURE_ID_SKB, _m, _f, ##_a)
 #define MORSE_SKB_WARN(_m, _f, _a...)		morse_warn(FEATURE_ID_SKB, _m, _f, ##_a)
@@ -49,16 +79,48 @@ MODULE_PARM_DESC(tx_status_lifetime_ms,
  * is awaiting the tx_status to come back.
  */
 struct morse_tx_status_drv_data {
+	union {
+		/**
+		 * Time (jiffies) at which this packet has spent too long in the pending queue,
+		 * waiting for status notification from the firmware, and should be considered lost.
+		 */
+		unsigned long tx_status_expiry;
+		/**
+		 * The TX status matched to this packet. Only set once the packet has been taken off
+		 * the pending queue, while it waits to be reported.
+		 */
+		struct morse_skb_tx_status *tx_sts;
+	};
 	/**
-	 * Time (jiffies) at which this packet has spent too long in the pending queue, waiting for
-	 * status notification from the firmware, and should be considered lost.
+	 * Packet ID the packet was sent with. Kept here as the morse header may already have been
+	 * stripped by the time the packet leaves the pending queue.
 	 */
-	unsigned long tx_status_expiry;
+	u32 pkt_id;
+	/** Length the packet was accounted with in the pending queue size. */
+	u32 len;
 };
 
+/**
+ * Get tx_status driver data from skb control buffer. Only valid once packet has been sent to
+ * the chip
+ */
+static inline struct morse_tx_status_drv_data *__get_tx_status_driver_data(struct sk_buff *skb)
+{
+	struct ieee80211_tx_info *tx_info = IEEE80211_SKB_CB(skb);
+
+	BUILD_BUG_ON(sizeof(struct morse_tx_status_drv_data) >
+		     sizeof(tx_info->status.status_driver_data));
+	return (struct morse_tx_status_drv_data *)&tx_info->status.status_driver_data[0];
+}
+
 static int __skbq_data_tx_finish(struct morse_skbq *mq, struct sk_buff *skb,
 				 struct morse_skb_tx_status *tx_sts);
 
+static void __skbq_data_tx_unlink(struct morse_skbq *mq, struct sk_buff *skb);
+
+static void morse_skbq_data_tx_report(struct morse *mors, struct sk_buff *skb,
+				      struct morse_skb_tx_status *tx_sts);
+
 static struct sk_buff *__skbq_get_pending_by_id(struct morse *mors,
 						struct morse_skbq *mq,
 						u32 pkt_id);
@@ -161,6 +223,24 @@ void morse_set_max_skb_txq_len(int new_max_txq_len)
 		return;
 
 	max_txq_len = new_max_txq_len;
+	dynamic_txq_limit_floor = min_t(u32, new_max_txq_len * MORSE_SKBQ_LIMIT_PKT_BYTES,
+					MORSE_SKBQ_SIZE);
+}
+
+/*
+ * Bounds of the dynamic limit. Both are writable at runtime, so an inverted pair is swapped
+ * rather than pinning the limit at the maximum.
+ */
+static void morse_skbq_limit_bounds(u32 *min_limit, u32 *max_limit)
+{
+	u32 lo = READ_ONCE(dynamic_txq_limit_min);
+	u32 hi = READ_ONCE(dynamic_txq_limit_max);
+
+	if (lo > hi)
+		swap(lo, hi);
+
+	*min_limit = max_t(u32, lo, READ_ONCE(dynamic_txq_limit_floor));
+	*max_limit = max(hi, *min_limit);
 }
 
 static inline u32 __morse_skbq_size(const struct morse_skbq *mq)
@@ -173,17 +253,98 @@ static inline u32 __morse_skbq_space(const struct morse_skbq *mq)
 	return MORSE_SKBQ_SIZE - __morse_skbq_size(mq);
 }
 
+/* Bytes queued for the chip plus those sent and still awaiting a TX status */
+static inline u32 __morse_skbq_inflight(const struct morse_skbq *mq)
+{
+	return mq->skbq_size + mq->pending_size;
+}
+
 static inline bool __morse_skbq_over_threshold(struct morse_skbq *mq)
 {
+	if (enable_dynamic_txq_limit)
+		return __morse_skbq_inflight(mq) > mq->limit.limit;
+
 	return max_txq_len ? (mq->skbq.qlen >= max_txq_len) : (__morse_skbq_space(mq) <= 2 * 1024);
 }
 
 static inline bool __morse_skbq_under_threshold(struct morse_skbq *mq)
 {
+	if (enable_dynamic_txq_limit)
+		return __morse_skbq_inflight(mq) <= mq->limit.limit;
+
 	return max_txq_len ?
 	    (mq->skbq.qlen < (max_txq_len - 2)) : (__morse_skbq_space(mq) >= (5 * 1024));
 }
 
+static inline u32 __morse_skbq_posdiff(u32 a, u32 b)
+{
+	return a > b ? a - b : 0;
+}
+
+static void __morse_skbq_limit_reset(struct morse_skbq *mq)
+{
+	u32 max_limit;
+
+	memset(&mq->limit, 0, sizeof(mq->limit));
+	morse_skbq_limit_bounds(&mq->limit.limit, &max_limit);
+	mq->limit.lowest_slack = U32_MAX;
+	mq->limit.slack_start_time = jiffies;
+}
+
+/*
+ * Re-evaluate the limit of a data TX queue once a batch of TX statuses has been processed,
+ * following the kernel's dynamic queue limits algorithm (lib/dynamic_queue_limits.c).
+ *
+ * The limit grows when the queue ran dry while it was over the limit, as the chip was starved
+ * of data it could have been sending. It shrinks when data has been left over at every
+ * completion for a whole hold period, by the smallest excess seen during that period.
+ *
+ * Must be called with mq->lock held.
+ */
+static void __morse_skbq_limit_completed(struct morse_skbq *mq)
+{
+	struct morse_skbq_limit *ql = &mq->limit;
+	u32 completed = ql->completed;
+	u32 inflight = __morse_skbq_inflight(mq);
+	u32 ovlimit = __morse_skbq_posdiff(inflight + completed, ql->limit);
+	bool all_prev_completed = (completed >= ql->prev_inflight);
+	u32 limit = ql->limit;
+	u32 min_limit;
+	u32 max_limit;
+
+	if ((ovlimit && !inflight) || (ql->prev_ovlimit && all_prev_completed)) {
+		/* Starved: grow by what went through beyond the last in flight amount */
+		limit += __morse_skbq_posdiff(completed, ql->prev_inflight) + ql->prev_ovlimit;
+		ql->slack_start_time = jiffies;
+		ql->lowest_slack = U32_MAX;
+	} else if (inflight && ql->prev_inflight && !all_prev_completed) {
+		u32 slack = __morse_skbq_posdiff(limit + ql->prev_ovlimit, 2 * completed);
+
+		ql->lowest_slack = min(ql->lowest_slack, slack);
+		if (time_after(jiffies, ql->slack_start_time +
+			       msecs_to_jiffies(MORSE_SKBQ_LIMIT_SLACK_HOLD_MS))) {
+			limit = __morse_skbq_posdiff(limit, ql->lowest_slack);
+			ql->slack_start_time = jiffies;
+			ql->lowest_slack = U32_MAX;
+		}
+	}
+
+	morse_skbq_limit_bounds(&min_limit, &max_limit);
+	limit = clamp_t(u32, limit, min_limit, max_limit);
+	if (limit != ql->limit) {
+		if (limit > ql->limit)
+			ql->increases++;
+		else
+			ql->decreases++;
+		ql->limit = limit;
+		ovlimit = 0;
+	}
+
+	ql->prev_ovlimit = ovlimit;
+	ql->prev_inflight = inflight;
+	ql->completed = 0;
+}
+
 static inline void morse_flush_txskb(struct morse *mors, struct sk_buff *skb)
 {
 	if (is_fullmac_mode()) {
@@ -193,6 +354,46 @@ static inline void morse_flush_txskb(struct morse *mors, struct sk_buff *skb)
 	ieee80211_free_txskb(mors->hw, skb);
 }
 
+static inline struct sk_buff **__morse_skbq_pending_slot(struct morse_skbq *mq, u32 pkt_id)
+{
+	return &mq->pending_index[pkt_id & (MORSE_SKBQ_PENDING_INDEX_SIZE - 1)];
+}
+
+/*
+ * Index a packet joining the pending queue by its packet ID. If the slot is held by another
+ * pending packet (IDs a multiple of the index size apart) the packet is only counted, and lookups
+ * fall back to walking the pending queue while any such packets remain.
+ */
+static void __morse_skbq_pending_index_add(struct morse_skbq *mq, struct sk_buff *skb)
+{
+	struct sk_buff **slot =
+		__morse_skbq_pending_slot(mq, __get_tx_status_driver_data(skb)->pkt_id);
+
+	if (!*slot)
+		*slot = skb;
+	else
+		mq->pending_unindexed++;
+}
+
+static void __morse_skbq_pending_index_del(struct morse_skbq *mq, struct sk_buff *skb)
+{
+	struct sk_buff **slot =
+		__morse_skbq_pending_slot(mq, __get_tx_status_driver_data(skb)->pkt_id);
+
+	if (*slot == skb) {
+		*slot = NULL;
+	} else {
+		MORSE_WARN_ON(FEATURE_ID_SKB, mq->pending_unindexed == 0);
+		mq->pending_unindexed -= min_t(u32, mq->pending_unindexed, 1);
+	}
+}
+
+static void __morse_skbq_pending_index_reset(struct morse_skbq *mq)
+{
+	memset(mq->pending_index, 0, sizeof(mq->pending_index));
+	mq->pending_unindexed = 0;
+}
+
 /*
  * Remove an SKB from a morse queue.
  * This function MUST be used to remove SKBs from a morse queue.
@@ -204,6 +405,11 @@ static void __morse_skbq_unlink(struct morse_skbq *mq, struct sk_buff_head *queu
 	if (queue == &mq->skbq) {
 		MORSE_WARN_ON(FEATURE_ID_SKB, skb->len > mq->skbq_size);
 		mq->skbq_size -= min(skb->len, mq->skbq_size);
+	} else if (queue == &mq->pending) {
+		u32 len = __get_tx_status_driver_data(skb)->len;
+
+		__morse_skbq_pending_index_del(mq, skb);
+		mq->pending_size -= min(len, mq->pending_size);
 	}
 
 	__skb_unlink(skb, queue);
@@ -224,6 +430,9 @@ static int __morse_skbq_put(struct morse_skbq *mq, struct sk_buff_head *queue,
 			return -ENOMEM;
 		}
 		mq->skbq_size += skb->len;
+	} else if (queue == &mq->pending) {
+		__morse_skbq_pending_index_add(mq, skb);
+		mq->pending_size += __get_tx_status_driver_data(skb)->len;
 	}
 
 	if (queue_before)
@@ -271,16 +480,13 @@ static struct morse_skbq *__morse_skbq_match_tx_status_to_skbq(struct morse *mor
 	return mq;
 }
 
-static void morse_skbq_skb_finish_fullmac(struct morse_skbq *mq, struct sk_buff *skb,
-					  struct morse_skb_tx_status *tx_sts)
+static void morse_skbq_fullmac_tx_report(struct morse *mors, struct sk_buff *skb,
+					 struct morse_skb_tx_status *tx_sts)
 {
-	struct morse *mors = mq->mors;
 	struct morse_vif *mors_vif = morse_wiphy_get_sta_vif(mors);
 	struct wireless_dev *wdev = &mors_vif->wdev;
 	u32 cookie = le32_to_cpu(tx_sts->pkt_id);
 
-	__morse_skbq_unlink(mq, &mq->pending, skb);
-
 	cfg80211_mgmt_tx_status(wdev, cookie, skb->data, skb->len, true, GFP_ATOMIC);
 	morse_mac_skb_free(mors, skb);
 }
@@ -309,6 +515,14 @@ static void insert_pending_skb_to_skbq(struct morse_skbq *mq,
 		return;
 	}
 
+	/* Re-buffered frames are usually older than anything still queued */
+	mhdr = (struct morse_buff_skb_header *)skb_peek(&mq->skbq)->data;
+	MORSE_WARN_ON(FEATURE_ID_SKB, insertion_id == mhdr->tx_info.pkt_id);
+	if (le32_to_cpu(insertion_id) < le32_to_cpu(mhdr->tx_info.pkt_id)) {
+		__morse_skbq_put(mq, &mq->skbq, skb, true, NULL);
+		return;
+	}
+
 	/* Otherwise, re-insert to correct spot in skbq */
 	skb_queue_walk_safe(&mq->skbq, pfirst, pnext) {
 		mhdr = (struct morse_buff_skb_header *)pfirst->data;
@@ -416,14 +630,30 @@ static bool tx_skb_is_ps_filtered(struct morse_skbq *mq, struct sk_buff *skb,
 	return true;
 }
 
+/**
+ * morse_skbq_tx_status_process() - Process a batch of TX statuses from the chip
+ *
+ * @mors: Morse chip struct
+ * @skb: SKB holding an array of &struct morse_skb_tx_status
+ *
+ * Statuses are matched against the pending queues first, taking a queue's lock once for each
+ * run of statuses belonging to it rather than once per status. Matched packets are collected and
+ * reported to mac80211 (or cfg80211) after all queue locks have been released.
+ */
 static void morse_skbq_tx_status_process(struct morse *mors, struct sk_buff *skb)
 {
 	int i;
 	struct morse_skb_tx_status *tx_sts = (struct morse_skb_tx_status *)skb->data;
 	int count = skb->len / sizeof(*tx_sts);
+	struct morse_skbq *locked_mq = NULL;
+	struct sk_buff_head done;
+	struct sk_buff *tx_skb;
+	struct morse_skbq *qs;
+	int num_qs;
+
+	__skb_queue_head_init(&done);
 
 	for (i = 0; i < count; tx_sts++, i++) {
-		struct sk_buff *tx_skb;
 		struct morse_skbq *mq = __morse_skbq_match_tx_status_to_skbq(mors, tx_sts);
 		bool is_ps_filtered = (le32_to_cpu(tx_sts->flags) &
 								MORSE_TX_STATUS_FLAGS_PS_FILTERED);
@@ -434,20 +664,27 @@ static void morse_skbq_tx_status_process(struct morse *mors, struct sk_buff *skb
 			continue;
 		}
 
-		spin_lock_bh(&mq->lock);
+		/* Statuses for a queue generally arrive back to back, only switch lock on change */
+		if (mq != locked_mq) {
+			if (locked_mq)
+				spin_unlock_bh(&locked_mq->lock);
+			spin_lock_bh(&mq->lock);
+			locked_mq = mq;
+		}
+
 		tx_skb = __skbq_get_pending_by_id(mors, mq, le32_to_cpu(tx_sts->pkt_id));
 		if (!tx_skb) {
 			MORSE_SKB_DBG(mors, "No pending pkt match found [pktid:%d chan:%d]\n",
 				      tx_sts->pkt_id, tx_sts->channel);
-			spin_unlock_bh(&mq->lock);
 			continue;
 		}
 
+		trace_morse_skbq_tx_status(mq, tx_skb, tx_sts);
+
 		if (le32_to_cpu(tx_sts->flags) & MORSE_TX_STATUS_PAGE_INVALID) {
 			/* Drop invalid SKBs */
 			mors->debug.page_stats.tx_status_page_invalid++;
 			__skbq_drop_pending_skb(mq, tx_skb);
-			spin_unlock_bh(&mq->lock);
 			continue;
 		}
 
@@ -455,26 +692,60 @@ static void morse_skbq_tx_status_process(struct morse *mors, struct sk_buff *skb
 			/* Drop SKBs that can't be sent due to duty cycle restrictions  */
 			mors->debug.page_stats.tx_status_duty_cycle_cant_send++;
 			__skbq_drop_pending_skb(mq, tx_skb);
-			spin_unlock_bh(&mq->lock);
 			continue;
 		}
 
 		if (is_ps_filtered && tx_skb_is_ps_filtered(mq, tx_skb, tx_sts)) {
 			/* Has been consumed by tx_skb_is_ps_filtered */
-			spin_unlock_bh(&mq->lock);
 			continue;
 		}
 
+		if (tx_sts->channel == MORSE_SKB_CHAN_DATA ||
+		    tx_sts->channel == MORSE_SKB_CHAN_DATA_NOACK)
+			mq->limit.completed += __get_tx_status_driver_data(tx_skb)->len;
+
 		morse_skb_remove_hdr_after_sent_to_chip(tx_skb);
 
 		if (is_fullmac_mode())
-			morse_skbq_skb_finish_fullmac(mq, tx_skb, tx_sts);
+			__morse_skbq_unlink(mq, &mq->pending, tx_skb);
+		else
+			__skbq_data_tx_unlink(mq, tx_skb);
+
+		/* The status buffer outlives the batch, so it can be referenced until reported */
+		__get_tx_status_driver_data(tx_skb)->tx_sts = tx_sts;
+		__skb_queue_tail(&done, tx_skb);
+	}
+
+	if (locked_mq)
+		spin_unlock_bh(&locked_mq->lock);
+
+	/* mac80211 TX status reporting must run with bottom halves disabled */
+	local_bh_disable();
+	while ((tx_skb = __skb_dequeue(&done))) {
+		struct morse_skb_tx_status *sts = __get_tx_status_driver_data(tx_skb)->tx_sts;
+
+		if (is_fullmac_mode())
+			morse_skbq_fullmac_tx_report(mors, tx_skb, sts);
 		else
-			morse_skbq_skb_finish(mq, tx_skb, tx_sts);
+			morse_skbq_data_tx_report(mors, tx_skb, sts);
+	}
+	local_bh_enable();
+
+	/* Limits are re-evaluated once per batch, as the completion rate is what sizes them */
+	mors->cfg->ops->skbq_get_tx_qs(mors, &qs, &num_qs);
+	for (i = 0; i < num_qs; i++) {
+		struct morse_skbq *mq = &qs[i];
 
+		spin_lock_bh(&mq->lock);
+		if (mq->limit.completed)
+			__morse_skbq_limit_completed(mq);
 		spin_unlock_bh(&mq->lock);
 	}
 
+	if (enable_dynamic_txq_limit &&
+	    test_bit(MORSE_STATE_FLAG_DATA_QS_STOPPED, &mors->state_flags))
+		morse_skbq_may_wake_tx_queues(mors);
+
 	if (mors->ps.enable &&
 	    !mors->ps.suspended && (mors->cfg->ops->skbq_get_tx_buffered_count(mors) == 0)) {
 		/* Evaluate ps to check if it was gated on a pending tx status */
@@ -491,6 +762,7 @@ static void morse_skbq_dispatch_work(struct work_struct *dispatch_work)
 	struct sk_buff_head skbq;
 	struct sk_buff *pfirst, *pnext;
 	u8 channel;
+	u64 start_ns = morse_wq_stats_start();
 
 	__skb_queue_head_init(&skbq);
 
@@ -530,6 +802,11 @@ static void morse_skbq_dispatch_work(struct work_struct *dispatch_work)
 		}
 	}
 
+	/* Hand the whole batch to mac80211 in one NAPI poll */
+	morse_mac_rx_napi_schedule(mors);
+
+	morse_wq_stats_end(&mors->net_wq_stats, start_ns);
+
 	/* rerun recv in case skbq was full and we couldn't copy data */
 	set_bit(MORSE_RX_PEND, &mors->chip_if->event_flags);
 	queue_work(mors->chip_wq, &mors->chip_if_work);
@@ -622,6 +899,11 @@ int morse_skbq_purge(struct morse_skbq *mq, struct sk_buff_head *skbq)
 	if (mq)
 		spin_lock_bh(&mq->lock);
 
+	if (mq && skbq == &mq->pending) {
+		__morse_skbq_pending_index_reset(mq);
+		mq->pending_size = 0;
+	}
+
 	while ((skb = __skb_dequeue(skbq))) {
 		cnt++;
 		dev_kfree_skb_any(skb);
@@ -663,6 +945,7 @@ int morse_skbq_deq_num_items(struct morse_skbq *mq, struct sk_buff_head *skbq, i
 		if (count >= num_items)
 			break;
 		__morse_skbq_unlink(mq, &mq->skbq, pfirst);
+		trace_morse_skbq_dequeue(mq, pfirst);
 		__skb_queue_tail(skbq, pfirst);
 		++count;
 	}
@@ -699,6 +982,12 @@ void morse_skbq_show(const struct morse_skbq *mq, struct seq_file *file)
 {
 	seq_printf(file, "pkts:%d skbq:%d pending:%d\n",
 		   mq->skbq.qlen, mq->skbq_size, mq->pending.qlen);
+
+	if ((mq->flags & MORSE_CHIP_IF_FLAGS_DATA) && (mq->flags & MORSE_CHIP_IF_FLAGS_DIR_TO_CHIP))
+		seq_printf(file, "  limit:%u inflight:%u max:%u inc:%u dec:%u stops:%u%s\n",
+			   mq->limit.limit, __morse_skbq_inflight(mq), mq->limit.max_inflight,
+			   mq->limit.increases, mq->limit.decreases, mq->limit.stops,
+			   enable_dynamic_txq_limit ? "" : " (disabled)");
 }
 
 void morse_skbq_stop_tx_queues(struct morse *mors)
@@ -785,8 +1074,13 @@ static int morse_skbq_tx(struct morse_skbq *mq, struct sk_buff *skb, u8 channel)
 
 	/* Fill packet ID in TX info */
 	__morse_skbq_pkt_id(mq, skb);
+	if (!rc)
+		trace_morse_skbq_enqueue(mq, skb);
 
+	mq->limit.max_inflight = max(mq->limit.max_inflight, __morse_skbq_inflight(mq));
 	mq_over_threshold = __morse_skbq_over_threshold(mq);
+	if (channel == MORSE_SKB_CHAN_DATA && mq_over_threshold)
+		mq->limit.stops++;
 	spin_unlock_bh(&mq->lock);
 
 	/* For data packets stop queues */
@@ -835,19 +1129,6 @@ static int morse_skbq_tx(struct morse_skbq *mq, struct sk_buff *skb, u8 channel)
 	return rc;
 }
 
-/**
- * Get tx_status driver data from skb control buffer. Only valid once packet has been sent to
- * the chip
- */
-static inline struct morse_tx_status_drv_data *__get_tx_status_driver_data(struct sk_buff *skb)
-{
-	struct ieee80211_tx_info *tx_info = IEEE80211_SKB_CB(skb);
-
-	BUILD_BUG_ON(sizeof(struct morse_tx_status_drv_data) >
-		     sizeof(tx_info->status.status_driver_data));
-	return (struct morse_tx_status_drv_data *)&tx_info->status.status_driver_data[0];
-}
-
 /**
  * Move the skb to the pending queue, and take a timestamp of when we have waited too long for a
  * tx_status from the chip.
@@ -859,6 +1140,9 @@ static inline void __skbq_tx_move_to_pending(struct morse_skbq *mq, struct sk_bu
 	/* Use coarse as we care more about this function being fast than being ms accurate.
 	 */
 	pend_info->tx_status_expiry = jiffies + msecs_to_jiffies(tx_status_lifetime_ms);
+	pend_info->pkt_id =
+		le32_to_cpu(((struct morse_buff_skb_header *)skb->data)->tx_info.pkt_id);
+	pend_info->len = skb->len;
 	__morse_skbq_put(mq, &mq->pending, skb, false, NULL);
 }
 
@@ -952,7 +1236,7 @@ struct sk_buff *morse_skbq_tx_pending(struct morse_skbq *mq)
 	return pfirst;
 }
 
-/* Get a pending frame by its ID. This will also drop frames with
+/* Get a pending frame by its ID. This will also drop timed out frames with
  * older packet ids that are in the list
  */
 static struct sk_buff *__skbq_get_pending_by_id(struct morse *mors,
@@ -960,19 +1244,36 @@ static struct sk_buff *__skbq_get_pending_by_id(struct morse *mors,
 						u32 pkt_id)
 {
 	struct sk_buff *pfirst, *pnext;
-	struct sk_buff *ret = NULL;
+	struct sk_buff *ret = *__morse_skbq_pending_slot(mq, pkt_id);
 
-	/* Move sent packets to pending list waiting for feedback */
+	if (ret && __get_tx_status_driver_data(ret)->pkt_id != pkt_id)
+		ret = NULL;
+
+	/* Only packets that lost their index slot need a walk to be found */
+	if (!ret && mq->pending_unindexed) {
+		skb_queue_walk(&mq->pending, pfirst) {
+			if (__get_tx_status_driver_data(pfirst)->pkt_id == pkt_id) {
+				ret = pfirst;
+				break;
+			}
+		}
+	}
+
+	/* Only the packets sent ahead of the matched one are swept. Each is checked against its own
+	 * expiry, as tx_status_lifetime_ms can change at runtime and leave older packets behind
+	 * younger ones.
+	 */
 	skb_queue_walk_safe(&mq->pending, pfirst, pnext) {
 		struct morse_buff_skb_header *hdr;
 
-		hdr = (struct morse_buff_skb_header *)pfirst->data;
-		if (le32_to_cpu(hdr->tx_info.pkt_id) == pkt_id) {
-			ret = pfirst;
+		if (pfirst == ret)
 			break;
 
-		} else if (le32_to_cpu(hdr->tx_info.pkt_id) < pkt_id &&
-					__has_pending_tx_skb_timed_out(pfirst)) {
+		if (!__has_pending_tx_skb_timed_out(pfirst))
+			continue;
+
+		hdr = (struct morse_buff_skb_header *)pfirst->data;
+		if (le32_to_cpu(hdr->tx_info.pkt_id) < pkt_id) {
 			/* Returned TX statuses may appear out-of-order during AMPDU */
 			MORSE_SKB_DBG(mors,
 				      "%s: pending TX SKB timed out [id:%d,chan:%d] (curr:%d)\n",
@@ -1034,13 +1335,23 @@ static void __skbq_qosnullfunc_to_nullfunc(struct sk_buff *skb)
 static int __skbq_cmd_finish(struct morse_skbq *mq, struct sk_buff *skb)
 {
 	struct morse *mors = mq->mors;
+	struct sk_buff *pfirst;
+	bool is_pending = false;
+
+	/* Several commands may be outstanding, so check which queue this one is on */
+	skb_queue_walk(&mq->pending, pfirst) {
+		if (pfirst == skb) {
+			is_pending = true;
+			break;
+		}
+	}
 
-	if (mq->pending.qlen > 0) {
+	if (is_pending) {
 		__morse_skbq_unlink(mq, &mq->pending, skb);
 		dev_kfree_skb(skb);
 	} else if (mq->skbq.qlen > 0) {
 		/* Command was probably timed out before being sent */
-		MORSE_SKB_INFO(mors, "Command pending queue empty. Removing from SKBQ.\n");
+		MORSE_SKB_INFO(mors, "Command not in pending queue. Removing from SKBQ.\n");
 		__morse_skbq_unlink(mq, &mq->skbq, skb);
 		dev_kfree_skb(skb);
 	} else {
@@ -1233,17 +1544,19 @@ static void morse_skbq_tx_status_fill(struct morse *mors,
 }
 #endif /* CONFIG_MORSE_RC */
 
-/* TX status/Response received remove packet from pending TX finish */
-static int __skbq_data_tx_finish(struct morse_skbq *mq, struct sk_buff *skb,
-				 struct morse_skb_tx_status *tx_sts)
+/* TX status received, take the packet off the pending queue. Caller must hold the queue lock. */
+static void __skbq_data_tx_unlink(struct morse_skbq *mq, struct sk_buff *skb)
 {
-	struct morse *mors = mq->mors;
-
 	if (morse_skbq_mon)
-		morse_skbq_mon_adjust(mors, skb, 0);
+		morse_skbq_mon_adjust(mq->mors, skb, 0);
 
 	__morse_skbq_unlink(mq, &mq->pending, skb);
+}
 
+/* Report the TX status of a packet already removed from its pending queue */
+static void morse_skbq_data_tx_report(struct morse *mors, struct sk_buff *skb,
+				      struct morse_skb_tx_status *tx_sts)
+{
 	/* Workaround Linux */
 	__skbq_qosnullfunc_to_nullfunc(skb);
 
@@ -1280,6 +1593,14 @@ static int __skbq_data_tx_finish(struct morse_skbq *mq, struct sk_buff *skb,
 #endif
 		rcu_read_unlock();
 	}
+}
+
+/* TX status/Response received remove packet from pending TX finish */
+static int __skbq_data_tx_finish(struct morse_skbq *mq, struct sk_buff *skb,
+				 struct morse_skb_tx_status *tx_sts)
+{
+	__skbq_data_tx_unlink(mq, skb);
+	morse_skbq_data_tx_report(mq->mors, skb, tx_sts);
 
 	return 0;
 }
@@ -1330,6 +1651,9 @@ void morse_skbq_init(struct morse *mors, struct morse_skbq *mq, u16 flags)
 	mq->skbq_size = 0;
 	mq->flags = flags;
 	mq->pkt_seq = 0;
+	mq->pending_size = 0;
+	__morse_skbq_pending_index_reset(mq);
+	__morse_skbq_limit_reset(mq);
 	if (flags & MORSE_CHIP_IF_FLAGS_DIR_TO_HOST)
 		INIT_WORK(&mq->dispatch_work, morse_skbq_dispatch_work);
 }
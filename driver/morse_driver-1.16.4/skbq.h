@@ -17,8 +17,30 @@
 #define MORSE_SKBQ_SIZE			(4 * 128 * 1024)
 #endif
 
+/* Slots in the pending queue packet ID index, must be a power of 2 */
+#define MORSE_SKBQ_PENDING_INDEX_SIZE	256
+
 struct morse;
 
+/**
+ * struct morse_skbq_limit - Dynamic limit on the data a TX queue holds queued and in flight.
+ *
+ * Modelled on the kernel's dynamic queue limits: the limit is re-evaluated each time a batch of
+ * TX statuses completes, so that just enough data is kept with the chip to keep it busy.
+ */
+struct morse_skbq_limit {
+	u32 limit;		/* current limit (bytes) on queued and in flight data */
+	u32 completed;		/* bytes completed in the TX status batch being processed */
+	u32 prev_ovlimit;	/* bytes over the limit at the previous completion */
+	u32 prev_inflight;	/* bytes in flight after the previous completion */
+	u32 lowest_slack;	/* lowest excess seen in the current hold period */
+	unsigned long slack_start_time;	/* start (jiffies) of the current hold period */
+	u32 max_inflight;	/* high water mark of bytes in flight */
+	u32 increases;
+	u32 decreases;
+	u32 stops;		/* times this queue stopped the mac80211 queues */
+};
+
 struct morse_skbq {
 	u32 pkt_seq;		/* SKB sequence used in tx_status */
 	u16 flags;
@@ -27,6 +49,10 @@ struct morse_skbq {
 	struct morse *mors;	/* mainly for debugging */
 	struct sk_buff_head skbq;
 	struct sk_buff_head pending;	/* packets sent pending feedback */
+	struct sk_buff *pending_index[MORSE_SKBQ_PENDING_INDEX_SIZE];	/* pending by pkt_id */
+	u32 pending_unindexed;		/* pending packets whose index slot was taken */
+	u32 pending_size;		/* bytes in the pending queue */
+	struct morse_skbq_limit limit;	/* dynamic TX queue limit (data queues) */
 	struct work_struct dispatch_work;
 };
 
@@ -1517,17 +1517,15 @@ static int morse_spi_probe(struct spi_device *spi)
 			 mspi->max_block_count);
 
 	if (morse_test_mode_is_interactive(test_mode)) {
-		mors->chip_wq = create_singlethread_workqueue("MorseChipIfWorkQ");
+		mors->chip_wq = morse_create_chip_wq(mors);
 		if (!mors->chip_wq) {
-			MORSE_SPI_ERR(mors,
-				      "create_singlethread_workqueue(MorseChipIfWorkQ) failed\n");
+			MORSE_SPI_ERR(mors, "morse_create_chip_wq() failed\n");
 			ret = -ENOMEM;
 			goto err_exit;
 		}
-		mors->net_wq = create_singlethread_workqueue("MorseNetWorkQ");
+		mors->net_wq = morse_create_net_wq(mors);
 		if (!mors->net_wq) {
-			MORSE_SPI_ERR(mors,
-				      "create_singlethread_workqueue(MorseNetWorkQ) failed\n");
+			MORSE_SPI_ERR(mors, "morse_create_net_wq() failed\n");
 			ret = -ENOMEM;
 			goto err_exit;
 		}
@@ -11,12 +11,20 @@
 #include <linux/tracepoint.h>
 #include "morse.h"
 #include "debug.h"
+#include "skbq.h"
+#include "skb_header.h"
 
 #undef TRACE_SYSTEM
 #define TRACE_SYSTEM morse
 
 #define MORSE_MSG_MAX 200
 
+#if KERNEL_VERSION(6, 10, 0) > LINUX_VERSION_CODE
+#define MORSE_TRACE_ASSIGN_DEVICE(mors)	__assign_str(device, dev_name((mors)->dev))
+#else
+#define MORSE_TRACE_ASSIGN_DEVICE(mors)	__assign_str(device)
+#endif
+
 DECLARE_EVENT_CLASS(morse_log_event,
 	TP_PROTO(const struct morse *mors, struct va_format *vaf),
 	TP_ARGS(mors, vaf),
@@ -69,6 +77,227 @@ DEFINE_EVENT(morse_log_event, morse_dbg_ratelimited,
 	TP_PROTO(const struct morse *mors, struct va_format *vaf), TP_ARGS(mors, vaf)
 );
 
+/*
+ * Datapath events. The ftrace ring buffer timestamps every record, so latencies are derived by
+ * pairing events: skbq enqueue/dequeue/tx_status share a pkt_id, command send/response share a
+ * host_id. Where a duration is cheaper to measure at the source it is carried explicitly.
+ */
+
+DECLARE_EVENT_CLASS(morse_skbq_event,
+	TP_PROTO(const struct morse_skbq *mq, const struct sk_buff *skb),
+	TP_ARGS(mq, skb),
+	TP_STRUCT__entry(__string(device, dev_name(mq->mors->dev))
+			 __field(u16, flags)
+			 __field(u8, channel)
+			 __field(u16, queue)
+			 __field(u32, pkt_id)
+			 __field(u32, len)
+			 __field(u32, qlen)
+			 __field(u32, qbytes)),
+	TP_fast_assign(const struct morse_buff_skb_header *hdr =
+			(const struct morse_buff_skb_header *)skb->data;
+
+		       MORSE_TRACE_ASSIGN_DEVICE(mq->mors);
+		       __entry->flags = mq->flags;
+		       __entry->channel = hdr->channel;
+		       __entry->queue = skb_get_queue_mapping(skb);
+		       __entry->pkt_id = le32_to_cpu(hdr->tx_info.pkt_id);
+		       __entry->len = skb->len;
+		       __entry->qlen = skb_queue_len(&mq->skbq);
+		       __entry->qbytes = mq->skbq_size;),
+	TP_printk("%s mq=0x%04x chan=%u queue=%u pkt_id=%u len=%u qlen=%u qbytes=%u",
+		  __get_str(device), __entry->flags, __entry->channel, __entry->queue,
+		  __entry->pkt_id, __entry->len, __entry->qlen, __entry->qbytes)
+);
+
+DEFINE_EVENT(morse_skbq_event, morse_skbq_enqueue,
+	TP_PROTO(const struct morse_skbq *mq, const struct sk_buff *skb), TP_ARGS(mq, skb)
+);
+
+DEFINE_EVENT(morse_skbq_event, morse_skbq_dequeue,
+	TP_PROTO(const struct morse_skbq *mq, const struct sk_buff *skb), TP_ARGS(mq, skb)
+);
+
+TRACE_EVENT(morse_skbq_tx_status,
+	TP_PROTO(const struct morse_skbq *mq, const struct sk_buff *skb,
+		 const struct morse_skb_tx_status *tx_sts),
+	TP_ARGS(mq, skb, tx_sts),
+	TP_STRUCT__entry(__string(device, dev_name(mq->mors->dev))
+			 __field(u16, flags)
+			 __field(u8, channel)
+			 __field(u8, tid)
+			 __field(u32, pkt_id)
+			 __field(u32, sts_flags)
+			 __field(u32, len)
+			 __field(u32, pending)),
+	TP_fast_assign(MORSE_TRACE_ASSIGN_DEVICE(mq->mors);
+		       __entry->flags = mq->flags;
+		       __entry->channel = tx_sts->channel;
+		       __entry->tid = tx_sts->tid;
+		       __entry->pkt_id = le32_to_cpu(tx_sts->pkt_id);
+		       __entry->sts_flags = le32_to_cpu(tx_sts->flags);
+		       __entry->len = skb->len;
+		       __entry->pending = skb_queue_len(&mq->pending);),
+	TP_printk("%s mq=0x%04x chan=%u tid=%u pkt_id=%u sts_flags=0x%08x len=%u pending=%u",
+		  __get_str(device), __entry->flags, __entry->channel, __entry->tid,
+		  __entry->pkt_id, __entry->sts_flags, __entry->len, __entry->pending)
+);
+
+DECLARE_EVENT_CLASS(morse_yaps_event,
+	TP_PROTO(const struct morse *mors, int queue, int num_pkts, int num_done, u32 bytes,
+		 int ret),
+	TP_ARGS(mors, queue, num_pkts, num_done, bytes, ret),
+	TP_STRUCT__entry(__string(device, dev_name(mors->dev))
+			 __field(int, queue)
+			 __field(int, num_pkts)
+			 __field(int, num_done)
+			 __field(u32, bytes)
+			 __field(int, ret)),
+	TP_fast_assign(MORSE_TRACE_ASSIGN_DEVICE(mors);
+		       __entry->queue = queue;
+		       __entry->num_pkts = num_pkts;
+		       __entry->num_done = num_done;
+		       __entry->bytes = bytes;
+		       __entry->ret = ret;),
+	TP_printk("%s queue=%d pkts=%d done=%d bytes=%u ret=%d",
+		  __get_str(device), __entry->queue, __entry->num_pkts, __entry->num_done,
+		  __entry->bytes, __entry->ret)
+);
+
+DEFINE_EVENT(morse_yaps_event, morse_yaps_tx,
+	TP_PROTO(const struct morse *mors, int queue, int num_pkts, int num_done, u32 bytes,
+		 int ret),
+	TP_ARGS(mors, queue, num_pkts, num_done, bytes, ret)
+);
+
+DEFINE_EVENT(morse_yaps_event, morse_yaps_rx,
+	TP_PROTO(const struct morse *mors, int queue, int num_pkts, int num_done, u32 bytes,
+		 int ret),
+	TP_ARGS(mors, queue, num_pkts, num_done, bytes, ret)
+);
+
+DECLARE_EVENT_CLASS(morse_pageset_event,
+	TP_PROTO(const struct morse *mors, u8 pageset_flags, u32 addr, u32 len, u8 channel),
+	TP_ARGS(mors, pageset_flags, addr, len, channel),
+	TP_STRUCT__entry(__string(device, dev_name(mors->dev))
+			 __field(u8, pageset_flags)
+			 __field(u8, channel)
+			 __field(u32, addr)
+			 __field(u32, len)),
+	TP_fast_assign(MORSE_TRACE_ASSIGN_DEVICE(mors);
+		       __entry->pageset_flags = pageset_flags;
+		       __entry->channel = channel;
+		       __entry->addr = addr;
+		       __entry->len = len;),
+	TP_printk("%s pageset=0x%02x chan=%u addr=0x%08x len=%u",
+		  __get_str(device), __entry->pageset_flags, __entry->channel,
+		  __entry->addr, __entry->len)
+);
+
+DEFINE_EVENT(morse_pageset_event, morse_pageset_write,
+	TP_PROTO(const struct morse *mors, u8 pageset_flags, u32 addr, u32 len, u8 channel),
+	TP_ARGS(mors, pageset_flags, addr, len, channel)
+);
+
+DEFINE_EVENT(morse_pageset_event, morse_pageset_read,
+	TP_PROTO(const struct morse *mors, u8 pageset_flags, u32 addr, u32 len, u8 channel),
+	TP_ARGS(mors, pageset_flags, addr, len, channel)
+);
+
+TRACE_EVENT(morse_cmd_send,
+	TP_PROTO(const struct morse *mors, u16 message_id, u16 host_id, u32 len, int retry),
+	TP_ARGS(mors, message_id, host_id, len, retry),
+	TP_STRUCT__entry(__string(device, dev_name(mors->dev))
+			 __field(u16, message_id)
+			 __field(u16, host_id)
+			 __field(u32, len)
+			 __field(int, retry)),
+	TP_fast_assign(MORSE_TRACE_ASSIGN_DEVICE(mors);
+		       __entry->message_id = message_id;
+		       __entry->host_id = host_id;
+		       __entry->len = len;
+		       __entry->retry = retry;),
+	TP_printk("%s cmd=0x%04x host_id=0x%04x len=%u retry=%d",
+		  __get_str(device), __entry->message_id, __entry->host_id,
+		  __entry->len, __entry->retry)
+);
+
+TRACE_EVENT(morse_cmd_resp,
+	TP_PROTO(const struct morse *mors, u16 message_id, u16 host_id, u32 len, bool is_resp),
+	TP_ARGS(mors, message_id, host_id, len, is_resp),
+	TP_STRUCT__entry(__string(device, dev_name(mors->dev))
+			 __field(u16, message_id)
+			 __field(u16, host_id)
+			 __field(u32, len)
+			 __field(bool, is_resp)),
+	TP_fast_assign(MORSE_TRACE_ASSIGN_DEVICE(mors);
+		       __entry->message_id = message_id;
+		       __entry->host_id = host_id;
+		       __entry->len = len;
+		       __entry->is_resp = is_resp;),
+	TP_printk("%s %s=0x%04x host_id=0x%04x len=%u",
+		  __get_str(device), __entry->is_resp ? "resp" : "evt",
+		  __entry->message_id, __entry->host_id, __entry->len)
+);
+
+TRACE_EVENT(morse_cmd_done,
+	TP_PROTO(const struct morse *mors, u16 message_id, u16 host_id, int ret, s64 duration_us),
+	TP_ARGS(mors, message_id, host_id, ret, duration_us),
+	TP_STRUCT__entry(__string(device, dev_name(mors->dev))
+			 __field(u16, message_id)
+			 __field(u16, host_id)
+			 __field(int, ret)
+			 __field(s64, duration_us)),
+	TP_fast_assign(MORSE_TRACE_ASSIGN_DEVICE(mors);
+		       __entry->message_id = message_id;
+		       __entry->host_id = host_id;
+		       __entry->ret = ret;
+		       __entry->duration_us = duration_us;),
+	TP_printk("%s cmd=0x%04x host_id=0x%04x ret=%d duration_us=%lld",
+		  __get_str(device), __entry->message_id, __entry->host_id,
+		  __entry->ret, __entry->duration_us)
+);
+
+TRACE_EVENT(morse_beacon_tasklet,
+	TP_PROTO(const struct morse *mors, u16 vif_id, u32 len, bool short_beacon,
+		 s64 duration_ns),
+	TP_ARGS(mors, vif_id, len, short_beacon, duration_ns),
+	TP_STRUCT__entry(__string(device, dev_name(mors->dev))
+			 __field(u16, vif_id)
+			 __field(u32, len)
+			 __field(bool, short_beacon)
+			 __field(s64, duration_ns)),
+	TP_fast_assign(MORSE_TRACE_ASSIGN_DEVICE(mors);
+		       __entry->vif_id = vif_id;
+		       __entry->len = len;
+		       __entry->short_beacon = short_beacon;
+		       __entry->duration_ns = duration_ns;),
+	TP_printk("%s vif=%u len=%u %s duration_ns=%lld",
+		  __get_str(device), __entry->vif_id, __entry->len,
+		  __entry->short_beacon ? "short" : "long", __entry->duration_ns)
+);
+
+TRACE_EVENT(morse_mac_rx,
+	TP_PROTO(const struct morse *mors, const struct sk_buff *skb,
+		 const struct morse_skb_rx_status *rx_status),
+	TP_ARGS(mors, skb, rx_status),
+	TP_STRUCT__entry(__string(device, dev_name(mors->dev))
+			 __field(u32, len)
+			 __field(u32, flags)
+			 __field(s16, rssi)
+			 __field(u16, freq_100khz)
+			 __field(u64, rx_timestamp_us)),
+	TP_fast_assign(MORSE_TRACE_ASSIGN_DEVICE(mors);
+		       __entry->len = skb->len;
+		       __entry->flags = le32_to_cpu(rx_status->flags);
+		       __entry->rssi = (s16)le16_to_cpu(rx_status->rssi);
+		       __entry->freq_100khz = le16_to_cpu(rx_status->freq_100khz);
+		       __entry->rx_timestamp_us = le64_to_cpu(rx_status->rx_timestamp_us);),
+	TP_printk("%s len=%u flags=0x%08x rssi=%d freq_100khz=%u fw_ts_us=%llu",
+		  __get_str(device), __entry->len, __entry->flags, __entry->rssi,
+		  __entry->freq_100khz, __entry->rx_timestamp_us)
+);
+
 #endif
 
 /* we don't want to use include/trace/events */
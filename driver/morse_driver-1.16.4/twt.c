@@ -6,6 +6,8 @@
  */
 
 #include <linux/math64.h>
+#include <linux/rbtree_augmented.h>
+#include <linux/mempool.h>
 
 #include "command.h"
 #include "twt.h"
@@ -19,6 +21,10 @@
 #define TWT_SETUP_CMD_UNKNOWN	(8)
 #define TWT_WAKE_DUR_UNIT_256	(256)
 
+/* Objects held in reserve so agreement setup does not depend on atomic allocations */
+#define TWT_STA_POOL_SIZE		(32)
+#define TWT_WAKE_INTERVAL_POOL_SIZE	(8)
+
 #define MORSE_TWT_DBG(_m, _f, _a...)		morse_dbg(FEATURE_ID_TWT, _m, _f, ##_a)
 #define MORSE_TWT_INFO(_m, _f, _a...)		morse_info(FEATURE_ID_TWT, _m, _f, ##_a)
 #define MORSE_TWT_WARN(_m, _f, _a...)		morse_warn(FEATURE_ID_TWT, _m, _f, ##_a)
@@ -192,6 +198,8 @@ void morse_twt_dump_wake_interval_tree(struct seq_file *file, struct morse_vif *
 	struct morse_twt *twt;
 	struct morse_twt_wake_interval *wi;
 	struct morse_twt_agreement *agr;
+	struct rb_node *wi_node;
+	struct rb_node *agr_node;
 
 	if (!file || !mors_vif)
 		return;
@@ -202,16 +210,17 @@ void morse_twt_dump_wake_interval_tree(struct seq_file *file, struct morse_vif *
 	seq_printf(file, "%s:\n", morse_vif_name(morse_vif_to_ieee80211_vif(mors_vif)));
 	twt = &mors_vif->twt;
 	spin_lock_bh(&twt->lock);
-	list_for_each_entry(wi, &twt->wake_intervals, list) {
-		agr = list_first_entry_or_null(&wi->agreements, struct morse_twt_agreement, list);
-		if (!agr) {
+	for (wi_node = rb_first(&twt->wake_intervals); wi_node; wi_node = rb_next(wi_node)) {
+		wi = rb_entry(wi_node, struct morse_twt_wake_interval, node);
+		if (RB_EMPTY_ROOT(&wi->agreements)) {
 			seq_puts(file, "Empty wake interval\n");
 			continue;
 		}
 
-		seq_printf(file, "TWT Wake interval: %lluus\n", agr->data.wake_interval_us);
+		seq_printf(file, "TWT Wake interval: %lluus\n", wi->wake_interval_us);
 
-		list_for_each_entry(agr, &wi->agreements, list) {
+		for (agr_node = rb_first(&wi->agreements); agr_node; agr_node = rb_next(agr_node)) {
+			agr = rb_entry(agr_node, struct morse_twt_agreement, node);
 			seq_printf(file,
 				   "\tTWT Wake time: %llu us, Wake Duration: %u us, State: %u\n",
 				   agr->data.wake_time_us, agr->data.wake_duration_us, agr->state);
@@ -326,15 +335,21 @@ void morse_twt_dump_event(struct morse *mors, struct morse_twt_event *event)
 static struct morse_twt_sta *morse_twt_get_sta(struct morse *mors,
 					       struct morse_vif *mors_vif, u8 *addr)
 {
-	struct morse_twt_sta *sta;
-	struct morse_twt_sta *temp;
+	struct rb_node *node;
 
 	if (!mors || !mors_vif)
 		return NULL;
 
-	list_for_each_entry_safe(sta, temp, &mors_vif->twt.stas, list) {
-		MORSE_TWT_DBG(mors, "%s: STA addr %pM (want %pM)\n", __func__, sta->addr, addr);
-		if (ether_addr_equal(sta->addr, addr))
+	node = mors_vif->twt.sta_index.rb_node;
+	while (node) {
+		struct morse_twt_sta *sta = rb_entry(node, struct morse_twt_sta, node);
+		int cmp = memcmp(addr, sta->addr, ETH_ALEN);
+
+		if (cmp < 0)
+			node = node->rb_left;
+		else if (cmp > 0)
+			node = node->rb_right;
+		else
 			return sta;
 	}
 
@@ -648,63 +663,224 @@ static enum ieee80211_twt_setup_cmd morse_twt_get_command(__le16 req_type)
 
 static struct morse_twt_sta *morse_twt_add_sta(struct morse *mors, struct morse_twt *twt, u8 *addr)
 {
-	struct morse_twt_sta *sta = kzalloc(sizeof(*sta), GFP_ATOMIC);
+	struct rb_node **link = &twt->sta_index.rb_node;
+	struct rb_node *parent = NULL;
+	struct morse_twt_sta *sta;
 	int i;
 
+	while (*link) {
+		struct morse_twt_sta *cur = rb_entry(*link, struct morse_twt_sta, node);
+		int cmp = memcmp(addr, cur->addr, ETH_ALEN);
+
+		parent = *link;
+		if (cmp < 0)
+			link = &parent->rb_left;
+		else if (cmp > 0)
+			link = &parent->rb_right;
+		else
+			return cur;
+	}
+
+	sta = mempool_alloc(twt->sta_pool, GFP_ATOMIC);
 	if (!sta)
 		return NULL;
 
+	memset(sta, 0, sizeof(*sta));
 	ether_addr_copy(sta->addr, addr);
 	sta->dialog_token = 0;
 	sta->action_is_pending = false;
 
-	/* By initializing these agreements as list heads we can use list_empty() to see if they are
-	 * in a wake interval list or not.
-	 */
+	/* Cleared nodes let RB_EMPTY_NODE() tell whether an agreement is scheduled or not. */
 	for (i = 0; i < MORSE_TWT_AGREEMENTS_MAX_PER_STA; i++)
-		INIT_LIST_HEAD(&sta->agreements[i].list);
+		RB_CLEAR_NODE(&sta->agreements[i].node);
 
+	rb_link_node(&sta->node, parent, link);
+	rb_insert_color(&sta->node, &twt->sta_index);
 	list_add_tail(&sta->list, &twt->stas);
 
 	return sta;
 }
 
+/*
+ * Service periods of a wake interval are kept in an rbtree ordered by their offset into the
+ * interval. Each node also carries the unallocated time after its service period (the gap to
+ * the next one, unbounded for the last), and the tree is augmented with the largest gap in each
+ * subtree so the first gap that fits a new service period can be found in logarithmic time.
+ */
+static u64 morse_twt_sp_subtree_max_gap(struct morse_twt_agreement *agr)
+{
+	u64 max_gap = agr->gap_us;
+	struct morse_twt_agreement *child;
+
+	if (agr->node.rb_left) {
+		child = rb_entry(agr->node.rb_left, struct morse_twt_agreement, node);
+		max_gap = max(max_gap, child->subtree_max_gap_us);
+	}
+
+	if (agr->node.rb_right) {
+		child = rb_entry(agr->node.rb_right, struct morse_twt_agreement, node);
+		max_gap = max(max_gap, child->subtree_max_gap_us);
+	}
+
+	return max_gap;
+}
+
+static void morse_twt_sp_propagate(struct rb_node *rb, struct rb_node *stop)
+{
+	while (rb != stop) {
+		struct morse_twt_agreement *agr = rb_entry(rb, struct morse_twt_agreement, node);
+		u64 max_gap = morse_twt_sp_subtree_max_gap(agr);
+
+		if (agr->subtree_max_gap_us == max_gap)
+			break;
+
+		agr->subtree_max_gap_us = max_gap;
+		rb = rb_parent(&agr->node);
+	}
+}
+
+static void morse_twt_sp_copy(struct rb_node *rb_old, struct rb_node *rb_new)
+{
+	struct morse_twt_agreement *old = rb_entry(rb_old, struct morse_twt_agreement, node);
+	struct morse_twt_agreement *new = rb_entry(rb_new, struct morse_twt_agreement, node);
+
+	new->subtree_max_gap_us = old->subtree_max_gap_us;
+}
+
+static void morse_twt_sp_rotate(struct rb_node *rb_old, struct rb_node *rb_new)
+{
+	struct morse_twt_agreement *old = rb_entry(rb_old, struct morse_twt_agreement, node);
+	struct morse_twt_agreement *new = rb_entry(rb_new, struct morse_twt_agreement, node);
+
+	new->subtree_max_gap_us = old->subtree_max_gap_us;
+	old->subtree_max_gap_us = morse_twt_sp_subtree_max_gap(old);
+}
+
+static const struct rb_augment_callbacks morse_twt_sp_callbacks = {
+	.propagate = morse_twt_sp_propagate,
+	.copy = morse_twt_sp_copy,
+	.rotate = morse_twt_sp_rotate,
+};
+
+/* Recalculate the gap after a service period once its successor has changed. */
+static void morse_twt_sp_update_gap(struct morse_twt_agreement *agr)
+{
+	struct rb_node *next = rb_next(&agr->node);
+	u64 end_us = agr->sp_offset_us + agr->data.wake_duration_us;
+
+	if (next) {
+		u64 next_offset_us = rb_entry(next, struct morse_twt_agreement, node)->sp_offset_us;
+
+		agr->gap_us = next_offset_us > end_us ? next_offset_us - end_us : 0;
+	} else {
+		agr->gap_us = U64_MAX;
+	}
+
+	morse_twt_sp_propagate(&agr->node, NULL);
+}
+
+static void morse_twt_sp_insert(struct morse_twt_wake_interval *wi,
+				struct morse_twt_agreement *agr)
+{
+	struct rb_node **link = &wi->agreements.rb_node;
+	struct rb_node *parent = NULL;
+	struct rb_node *prev;
+
+	div64_u64_rem(agr->data.wake_time_us, wi->wake_interval_us, &agr->sp_offset_us);
+
+	while (*link) {
+		struct morse_twt_agreement *cur = rb_entry(*link, struct morse_twt_agreement, node);
+
+		parent = *link;
+		if (agr->sp_offset_us < cur->sp_offset_us)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+
+	/* A zero gap cannot raise any subtree maximum, so the tree stays valid until the real gap
+	 * is known.
+	 */
+	agr->gap_us = 0;
+	agr->subtree_max_gap_us = 0;
+	agr->wi = wi;
+	rb_link_node(&agr->node, parent, link);
+	rb_insert_augmented(&agr->node, &wi->agreements, &morse_twt_sp_callbacks);
+
+	morse_twt_sp_update_gap(agr);
+	prev = rb_prev(&agr->node);
+	if (prev)
+		morse_twt_sp_update_gap(rb_entry(prev, struct morse_twt_agreement, node));
+}
+
+static void morse_twt_sp_erase(struct morse_twt_wake_interval *wi,
+			       struct morse_twt_agreement *agr)
+{
+	struct rb_node *prev = rb_prev(&agr->node);
+
+	rb_erase_augmented(&agr->node, &wi->agreements, &morse_twt_sp_callbacks);
+	RB_CLEAR_NODE(&agr->node);
+	agr->wi = NULL;
+
+	if (prev)
+		morse_twt_sp_update_gap(rb_entry(prev, struct morse_twt_agreement, node));
+}
+
+/* Find the earliest service period followed by a gap of at least duration_us. */
+static struct morse_twt_agreement *morse_twt_sp_find_gap(struct morse_twt_wake_interval *wi,
+							 u64 duration_us)
+{
+	struct rb_node *node = wi->agreements.rb_node;
+
+	while (node) {
+		struct morse_twt_agreement *agr = rb_entry(node, struct morse_twt_agreement, node);
+
+		if (node->rb_left &&
+		    rb_entry(node->rb_left, struct morse_twt_agreement, node)->subtree_max_gap_us >=
+		    duration_us) {
+			node = node->rb_left;
+			continue;
+		}
+
+		if (agr->gap_us >= duration_us)
+			return agr;
+
+		node = node->rb_right;
+	}
+
+	return NULL;
+}
+
 /**
- * morse_twt_agreement_remove() - Removes an agreement from a wake_interval list. Will also
- *					remove the wake interval list entry if the list becomes
- *					empty.
+ * morse_twt_agreement_remove() - Removes an agreement from its wake interval. Will also
+ *				  remove the wake interval entry if it becomes empty.
  *
  * @mors	Morse device
+ * @twt		The TWT struct
  * @agr		The TWT agreement
  *
  * @return 0 on success, else error code
  */
-static int morse_twt_agreement_remove(struct morse *mors, struct morse_twt_agreement *agr)
+static int morse_twt_agreement_remove(struct morse *mors, struct morse_twt *twt,
+				      struct morse_twt_agreement *agr)
 {
-	struct list_head *prev;
 	struct morse_twt_wake_interval *wi;
 
 	if (!mors || !agr)
 		return -EINVAL;
 
-	if (list_empty(&agr->list)) {
-		MORSE_TWT_DBG(mors, "Agreement not in wake interval list - skipping\n");
+	if (RB_EMPTY_NODE(&agr->node)) {
+		MORSE_TWT_DBG(mors, "Agreement not in wake interval tree - skipping\n");
 		return 0;
 	}
 
-	prev = agr->list.prev;
-	/* list_del_init() is used so we can use list_empty() afterwards since the STA may still
-	 * exist.
-	 */
-	list_del_init(&agr->list);
+	wi = agr->wi;
+	morse_twt_sp_erase(wi, agr);
 
-	/* If the previous list entry is empty it must be the head. Remove wake interval head if it
-	 * is now empty.
-	 */
-	if (list_empty(prev)) {
-		wi = container_of(prev, struct morse_twt_wake_interval, agreements);
-		list_del(&wi->list);
-		kfree(wi);
+	/* Remove wake interval entry if it is now empty. */
+	if (RB_EMPTY_ROOT(&wi->agreements)) {
+		rb_erase(&wi->node, &twt->wake_intervals);
+		mempool_free(wi, twt->wake_interval_pool);
 	}
 
 	return 0;
@@ -737,7 +913,7 @@ static int morse_twt_sta_remove(struct morse *mors,
 	/* Remove each agreement from the wake interval linked list. */
 	for (i = 0; i < MORSE_TWT_AGREEMENTS_MAX_PER_STA; i++) {
 		MORSE_TWT_DBG(mors, "Remove TWT agreement %u\n", i);
-		morse_twt_agreement_remove(mors, &sta->agreements[i]);
+		morse_twt_agreement_remove(mors, twt, &sta->agreements[i]);
 	}
 	/* Clear STA VIF */
 	if (vif->type == NL80211_IFTYPE_STATION) {
@@ -747,8 +923,9 @@ static int morse_twt_sta_remove(struct morse *mors,
 
 	/* Remove the agreements from the sta list and purge queues. */
 	morse_twt_tx_queue_purge(mors, twt, sta->addr);
+	rb_erase(&sta->node, &twt->sta_index);
 	list_del(&sta->list);
-	kfree(sta);
+	mempool_free(sta, twt->sta_pool);
 	return 0;
 }
 
@@ -818,7 +995,7 @@ static int morse_twt_sta_agreement_remove(struct morse *mors,
 
 	agr = &sta->agreements[flow_id];
 	WARN_ON_ONCE(agr->state != MORSE_TWT_STATE_NO_AGREEMENT);
-	morse_twt_agreement_remove(mors, agr);
+	morse_twt_agreement_remove(mors, twt, agr);
 
 	/* Check if there are any agreements and remove STA if there aren't any. */
 	for (i = 0; i < MORSE_TWT_AGREEMENTS_MAX_PER_STA; i++) {
@@ -847,79 +1024,53 @@ static int morse_twt_sta_agreement_add(struct morse *mors,
 }
 
 /**
- * morse_twt_agreement_wake_interval_get() -	Get the wake interval list head. Creates one if it
- *						doesn't exits already.
+ * morse_twt_agreement_wake_interval_get() -	Get the wake interval entry. Creates one if it
+ *						doesn't exist already.
  *
  * @mors		Morse device
  * @twt			The TWT struct
  * @wake_interval_us	The wake interval (us) to search for
  *
- * @return A wake interval head struct on success otherwise NULL.
+ * @return A wake interval entry on success otherwise NULL.
  */
 static struct morse_twt_wake_interval *morse_twt_agreement_wake_interval_get(struct morse *mors,
 									     struct morse_twt *twt,
 									     u64 wake_interval_us)
 {
-	struct list_head *head;
+	struct rb_node **link;
+	struct rb_node *parent = NULL;
 	struct morse_twt_wake_interval *wi;
-	struct morse_twt_wake_interval *temp;
-	struct morse_twt_agreement *agr;
 
-	if (!twt)
+	if (!twt || !wake_interval_us)
 		return NULL;
 
-	head = &twt->wake_intervals;
+	link = &twt->wake_intervals.rb_node;
+	while (*link) {
+		wi = rb_entry(*link, struct morse_twt_wake_interval, node);
+		parent = *link;
 
-	if (list_empty(&twt->wake_intervals)) {
-		wi = kmalloc(sizeof(*wi), GFP_ATOMIC);
-		if (!wi)
-			return NULL;
-		INIT_LIST_HEAD(&wi->agreements);
-		list_add(&wi->list, head);
-		return wi;
+		if (wake_interval_us < wi->wake_interval_us)
+			link = &parent->rb_left;
+		else if (wake_interval_us > wi->wake_interval_us)
+			link = &parent->rb_right;
+		else
+			return wi;
 	}
 
-	list_for_each_entry(wi, head, list) {
-		u64 wi_us;
-
-		/* Find this wake interval by looking at the first agreement */
-		agr = list_first_entry_or_null(&wi->agreements, struct morse_twt_agreement, list);
-		if (!agr)
-			return NULL;
-
-		wi_us = agr->data.wake_interval_us;
+	wi = mempool_alloc(twt->wake_interval_pool, GFP_ATOMIC);
+	if (!wi)
+		return NULL;
 
-		/* We found the exact value. */
-		if (wi_us == wake_interval_us) {
-			return wi;
-			/* The exact value doesn't exist but a larger one is in the list. */
-		} else if (wi_us > wake_interval_us) {
-			temp = kmalloc(sizeof(*temp), GFP_ATOMIC);
-			if (!temp)
-				return NULL;
-			INIT_LIST_HEAD(&temp->agreements);
-			if (wi->list.prev == head)
-				list_add(&temp->list, head);
-			else
-				list_add(&temp->list, &list_prev_entry(wi, list)->list);
-
-			return temp;
-			/* The exact value is not in the list and there are no larger ones. */
-		} else if (wi->list.next == head) {
-			temp = kmalloc(sizeof(*temp), GFP_ATOMIC);
-			if (!temp)
-				return NULL;
-			INIT_LIST_HEAD(&temp->agreements);
-			list_add_tail(&temp->list, head);
-			return temp;
-		}
-	}
+	wi->wake_interval_us = wake_interval_us;
+	wi->agreements = RB_ROOT;
+	rb_link_node(&wi->node, parent, link);
+	rb_insert_color(&wi->node, &twt->wake_intervals);
 
-	return NULL;
+	return wi;
 }
 
 /**
- * morse_twt_agreement_wake_interval_add() -	Adds an agreement to a wake interval list.
+ * morse_twt_agreement_wake_interval_add() -	Schedules an agreement in its wake interval.
  *
  * @mors	Morse device
  * @twt		The TWT struct
@@ -932,86 +1083,53 @@ static int morse_twt_agreement_wake_interval_add(struct morse *mors,
 						 struct morse_twt_agreement *agr)
 {
 	struct morse_twt_wake_interval *wi;
-	struct morse_twt_agreement *ptr;
-	struct morse_twt_agreement *ptr_next;
+	struct morse_twt_agreement *prev;
 
 	/* Agreement is not accepted until the accept message is sent. */
 	if (!agr ||
 	    agr->state == MORSE_TWT_STATE_NO_AGREEMENT || agr->state == MORSE_TWT_STATE_AGREEMENT)
 		return -EINVAL;
 
+	/* A renegotiated agreement gives up its old service period first. */
+	morse_twt_agreement_remove(mors, twt, agr);
+
 	MORSE_TWT_DBG(mors, "Get TWT wake interval head for %lluus\n", agr->data.wake_interval_us);
 
-	/* Obtain the wake interval list for the specified wake interval. */
+	/* Obtain the entry for the specified wake interval. */
 	wi = morse_twt_agreement_wake_interval_get(mors, twt, agr->data.wake_interval_us);
 	if (!wi)
 		return -EINVAL;
 
-	if (list_empty(&wi->agreements)) {
+	if (RB_EMPTY_ROOT(&wi->agreements)) {
 		agr->data.wake_time_us = 0;
-		list_add(&agr->list, &wi->agreements);
+		morse_twt_sp_insert(wi, agr);
 		MORSE_TWT_DBG(mors, "First TWT entry for wake interval %lluus\n",
 			  agr->data.wake_interval_us);
 		return 0;
 	}
 
-	/* For now just add accepted 'Demand' agreements to the end. */
+	/* For now just add accepted 'Demand' agreements at the wake time they asked for. */
 	if (morse_twt_get_command(agr->data.params.req_type) == TWT_SETUP_CMD_DEMAND) {
-		list_add_tail(&agr->list, &wi->agreements);
-		MORSE_TWT_DBG(mors, "Demand TWT entry for wake time %lluus added to tail\n",
+		morse_twt_sp_insert(wi, agr);
+		MORSE_TWT_DBG(mors, "Demand TWT entry for wake time %lluus added\n",
 			  agr->data.wake_time_us);
 		return 0;
 	}
 
-	/* Iterate through the list of agreements with the same wake interval. Either insert into a
-	 * gap which is large enough or add to the end. The wake time of the first agreement is used
-	 * as the reference. The firmware is left to calculate the next service period based on the
-	 * wake time and wake interval.
+	/* Place the service period in the earliest gap which is large enough, or after the last
+	 * one. The wake time of the first agreement is used as the reference. The firmware is left
+	 * to calculate the next service period based on the wake time and wake interval.
 	 */
-	list_for_each_entry(ptr, &wi->agreements, list) {
-		u64 cur_next_wake_offset_us;
-		u64 next_next_wake_offset_us;
-		u64 unalloc_dur_us;
-
-		if (list_is_last(&ptr->list, &wi->agreements)) {
-			agr->data.wake_time_us =
-			    ptr->data.wake_time_us + ptr->data.wake_duration_us;
-
-			list_add(&agr->list, &ptr->list);
-			return 0;
-		}
+	prev = morse_twt_sp_find_gap(wi, agr->data.wake_duration_us);
+	if (!prev)
+		return -EBADSLT;
 
-		/* Time may have elapsed from the initial wake time so wrap values. */
-		ptr_next = list_next_entry(ptr, list);
-		div64_u64_rem(ptr->data.wake_time_us,
-			      ptr->data.wake_interval_us, &cur_next_wake_offset_us);
-		div64_u64_rem(ptr_next->data.wake_time_us,
-			      ptr_next->data.wake_interval_us, &next_next_wake_offset_us);
+	/* Adjust wake time to align with the end of the previous service period. */
+	agr->data.wake_time_us = prev->data.wake_time_us + prev->data.wake_duration_us;
+	morse_twt_sp_insert(wi, agr);
+	MORSE_TWT_DBG(mors, "Added TWT entry for wake time %llu\n", agr->data.wake_time_us);
 
-		/* If the next agreement offset is before the previous unwrap once to preserve
-		 * order.
-		 */
-		if (cur_next_wake_offset_us > next_next_wake_offset_us)
-			next_next_wake_offset_us += ptr->data.wake_interval_us;
-
-		/* Calculate gap between consecutive TWT service periods. */
-		unalloc_dur_us = next_next_wake_offset_us -
-		    (cur_next_wake_offset_us + ptr->data.wake_duration_us);
-
-		/* Service period fits between the current and next service periods. */
-		if (unalloc_dur_us >= agr->data.wake_duration_us) {
-			/* Adjust wake time to align with the end of the previous service period. */
-			agr->data.wake_time_us =
-			    ptr->data.wake_time_us + ptr->data.wake_duration_us;
-
-			list_add(&agr->list, &ptr->list);
-			MORSE_TWT_DBG(mors, "Added TWT entry for wake time %llu\n",
-				  agr->data.wake_time_us);
-			return 0;
-		}
-	}
-
-	return -EBADSLT;
+	return 0;
 }
 
 /**
@@ -2012,6 +2130,18 @@ static void morse_twt_handle_cmd_work(struct work_struct *work)
 	morse_twt_process_pending_cmds(mors, mors_vif);
 }
 
+static void morse_twt_pools_destroy(struct morse_twt *twt)
+{
+	/* mempool_destroy() only accepts NULL from v4.3 onwards */
+	if (twt->sta_pool)
+		mempool_destroy(twt->sta_pool);
+	if (twt->wake_interval_pool)
+		mempool_destroy(twt->wake_interval_pool);
+
+	twt->sta_pool = NULL;
+	twt->wake_interval_pool = NULL;
+}
+
 void morse_twt_init_vif(struct morse *mors, struct morse_vif *mors_vif,
 			bool enable_twt, bool is_ap, bool is_sta,
 			bool ps_is_enabled, bool ps_is_offloaded,
@@ -2022,7 +2152,10 @@ void morse_twt_init_vif(struct morse *mors, struct morse_vif *mors_vif,
 
 	spin_lock_init(&twt->lock);
 	INIT_LIST_HEAD(&twt->stas);
-	INIT_LIST_HEAD(&twt->wake_intervals);
+	twt->sta_index = RB_ROOT;
+	twt->wake_intervals = RB_ROOT;
+	twt->sta_pool = NULL;
+	twt->wake_interval_pool = NULL;
 	INIT_LIST_HEAD(&twt->events);
 	INIT_LIST_HEAD(&twt->tx);
 	twt->requester = false;
@@ -2070,6 +2203,16 @@ void morse_twt_init_vif(struct morse *mors, struct morse_vif *mors_vif,
 		return;
 	}
 
+	twt->sta_pool = mempool_create_kmalloc_pool(TWT_STA_POOL_SIZE,
+						    sizeof(struct morse_twt_sta));
+	twt->wake_interval_pool = mempool_create_kmalloc_pool(TWT_WAKE_INTERVAL_POOL_SIZE,
+							      sizeof(struct morse_twt_wake_interval));
+	if (!twt->sta_pool || !twt->wake_interval_pool) {
+		MORSE_TWT_ERR(mors, "TWT is disabled - failed to allocate pools\n");
+		morse_twt_pools_destroy(twt);
+		return;
+	}
+
 	twt->dialog_token = 0;
 
 	INIT_WORK(&twt->work, morse_twt_handle_event_work);
@@ -2105,6 +2248,7 @@ void morse_twt_finish_vif(struct morse *mors, struct morse_vif *mors_vif)
 	spin_unlock_bh(&twt->lock);
 
 	morse_twt_event_queue_purge(mors, mors_vif, NULL);
+	morse_twt_pools_destroy(twt);
 }
 
 static int twt_calculate_wake_duration(int wake_duration)
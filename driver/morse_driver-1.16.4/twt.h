@@ -10,6 +10,7 @@
 
 #include <linux/types.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/workqueue.h>
 #include <net/netlink.h>
 
@@ -51,8 +52,19 @@ struct morse_twt_agreement_data {
 	struct ieee80211_twt_params params;
 } __packed;
 
+struct morse_twt_wake_interval;
+
 struct morse_twt_agreement {
-	struct list_head list;
+	/** Node in the service period tree of its wake interval, cleared when not scheduled */
+	struct rb_node node;
+	/** Wake interval the agreement is scheduled in */
+	struct morse_twt_wake_interval *wi;
+	/** Service period start as an offset (us) into the wake interval, the tree key */
+	u64 sp_offset_us;
+	/** Unallocated time (us) after this service period, before the next one starts */
+	u64 gap_us;
+	/** Largest gap_us in the subtree rooted at this node */
+	u64 subtree_max_gap_us;
 	enum morse_twt_state state;
 	struct morse_twt_agreement_data data;
 };
@@ -106,6 +118,8 @@ struct morse_dot11ah_s1g_twt_action {
 
 struct morse_twt_sta {
 	struct list_head list;
+	/* Node in the STA index, keyed by address */
+	struct rb_node node;
 	u8 addr[ETH_ALEN];
 	/* dialog token of pending action frame */
 	u8 dialog_token;
@@ -115,8 +129,11 @@ struct morse_twt_sta {
 };
 
 struct morse_twt_wake_interval {
-	struct list_head list;
-	struct list_head agreements;
+	/* Node in the wake interval tree, keyed by wake interval */
+	struct rb_node node;
+	u64 wake_interval_us;
+	/* Scheduled agreements, keyed by service period offset */
+	struct rb_root agreements;
 };
 
 static inline struct morse_vif *morse_twt_to_morse_vif(struct morse_twt *twt)
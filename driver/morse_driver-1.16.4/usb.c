@@ -7,6 +7,8 @@
 #include "linux/jiffies.h"
 #include <linux/module.h>
 #include <linux/usb.h>
+#include <linux/debugfs.h>
+#include <linux/sched/task_stack.h>
 
 #include "morse.h"
 #include "mac.h"
@@ -34,6 +36,23 @@
  */
 #define URB_TIMEOUT_MS                  250
 
+/**
+ * Number of memory transfer slots. Each slot holds one USB_MAX_TRANSFER_SIZE chunk of a
+ * dm_read/dm_write request, so this is the upper bound on chunks in flight at once.
+ */
+#define MORSE_USB_MAX_XFERS		8
+
+/**
+ * Chunks shorter than this always go through the bounce buffer, as copying them is cheaper than
+ * mapping the caller's buffer for DMA.
+ */
+#define MORSE_USB_ZERO_COPY_MIN_LEN	256
+
+/* Number of memory transfer chunks to keep in flight, 1 disables pipelining */
+static uint usb_max_inflight_xfers __read_mostly = 4;
+module_param(usb_max_inflight_xfers, uint, 0644);
+MODULE_PARM_DESC(usb_max_inflight_xfers, "Max pipelined USB memory transfers in flight (1-8)");
+
 #define MORSE_USB_DBG(_m, _f, _a...)		morse_dbg(FEATURE_ID_USB, _m, _f, ##_a)
 #define MORSE_USB_INFO(_m, _f, _a...)		morse_info(FEATURE_ID_USB, _m, _f, ##_a)
 #define MORSE_USB_WARN(_m, _f, _a...)		morse_warn(FEATURE_ID_USB, _m, _f, ##_a)
@@ -56,6 +75,63 @@ struct morse_usb_endpoint {
 	int size;		/* Size of endpoint */
 };
 
+struct morse_usb;
+
+/**
+ * struct morse_usb_xfer - A memory transfer slot, one command URB followed by one bulk URB
+ *
+ * @musb: Owning USB device
+ * @cmd: Command block sent ahead of the bulk data (DMA coherent)
+ * @cmd_dma: DMA address of @cmd
+ * @cmd_urb: URB carrying @cmd
+ * @data_urb: URB carrying the bulk data
+ * @buffer: Bulk data buffer of USB_MAX_TRANSFER_SIZE bytes
+ * @dest: Destination of a read. NULL for writes
+ * @bounced: The bulk data goes through @buffer rather than the caller's buffer
+ * @len: Length of the bulk data
+ * @status: First error reported on either URB
+ * @cmd_orphaned: The command URB was accepted but the bulk URB failed to submit, so the chip
+ *                may have a command whose data will never be carried
+ * @done: Signalled when the bulk URB has finished
+ */
+struct morse_usb_xfer {
+	struct morse_usb *musb;
+	struct morse_usb_command *cmd;
+	dma_addr_t cmd_dma;
+	struct urb *cmd_urb;
+	struct urb *data_urb;
+	u8 *buffer;
+	u8 *dest;
+	bool bounced;
+	int len;
+	int status;
+	bool cmd_orphaned;
+	struct completion done;
+};
+
+/**
+ * struct morse_usb_xfer_stats - How memory transfer chunks were carried
+ *
+ * @zero_copy_rd: Reads received directly into the caller's buffer
+ * @zero_copy_wr: Writes sent directly from the caller's buffer
+ * @bounce_rd: Reads received through the bounce buffer
+ * @bounce_wr: Writes sent through the bounce buffer
+ * @bounce_small: Chunks bounced because they were shorter than MORSE_USB_ZERO_COPY_MIN_LEN
+ * @bounce_unaligned: Chunks bounced because the caller's buffer was misaligned
+ * @bounce_unmappable: Chunks bounced because the caller's buffer cannot be DMA mapped
+ * @resyncs: Times the memory endpoints were resynchronised after killing a transfer pipeline
+ */
+struct morse_usb_xfer_stats {
+	u64 zero_copy_rd;
+	u64 zero_copy_wr;
+	u64 bounce_rd;
+	u64 bounce_wr;
+	u64 bounce_small;
+	u64 bounce_unaligned;
+	u64 bounce_unmappable;
+	u64 resyncs;
+};
+
 enum morse_usb_flags {
 	MORSE_USB_FLAG_ATTACHED,
 	MORSE_USB_FLAG_SUSPENDED
@@ -80,9 +156,17 @@ struct morse_usb {
 	/* indicate if CMD urb is in progress */
 	bool ongoing_cmd;
 
-	/* for synchronisation between commands and transfers */
-	bool ongoing_rw;	/* a command is going on */
-	wait_queue_head_t rw_in_wait;	/* to wait for an ongoing command */
+	/* to wait for an ongoing command */
+	wait_queue_head_t rw_in_wait;
+
+	/* Memory transfer slots used to pipeline dm_read/dm_write */
+	struct morse_usb_xfer xfers[MORSE_USB_MAX_XFERS];
+
+	/* Anchors every in-flight memory transfer URB */
+	struct usb_anchor xfer_anchor;
+
+	/* Protected by @lock */
+	struct morse_usb_xfer_stats xfer_stats;
 
 	/* Bitmask of flags for state of USB device */
 	unsigned long flags;
@@ -321,16 +405,13 @@ error:
 	return retval;
 }
 
-/* Non-destructive USB reset */
-int morse_usb_ndr_reset(struct morse *mors)
+/* Non-destructive USB reset, with musb->lock held */
+static int __morse_usb_ndr_reset(struct morse_usb *musb)
 {
 	int ret;
-	struct morse_usb *musb = (struct morse_usb *)mors->drv_priv;
+	struct morse *mors = usb_get_intfdata(musb->interface);
 	struct morse_usb_command cmd;
 
-	mutex_lock(&musb->lock);
-
-	musb->ongoing_rw = 1;
 	musb->errors = 0;
 
 	cmd.dir = cpu_to_le32(MORSE_USB_RESET);
@@ -344,16 +425,47 @@ int morse_usb_ndr_reset(struct morse *mors)
 	else
 		ret = 0;
 
-	musb->ongoing_rw = 0;
+	return ret;
+}
+
+/* Non-destructive USB reset */
+int morse_usb_ndr_reset(struct morse *mors)
+{
+	int ret;
+	struct morse_usb *musb = (struct morse_usb *)mors->drv_priv;
+
+	mutex_lock(&musb->lock);
+	ret = __morse_usb_ndr_reset(musb);
 	mutex_unlock(&musb->lock);
 
 	return ret;
 }
 
-static void morse_usb_mem_rw_callback(struct urb *urb)
+static void morse_usb_xfer_cmd_callback(struct urb *urb)
 {
-	struct morse *mors = urb->context;
-	struct morse_usb *musb = (struct morse_usb *)mors->drv_priv;
+	struct morse_usb_xfer *xfer = urb->context;
+	struct morse *mors = usb_get_intfdata(xfer->musb->interface);
+
+	if (!urb->status)
+		return;
+
+	/* sync/async unlink faults aren't errors */
+	if (!(urb->status == -ENOENT ||
+	      urb->status == -ECONNRESET || urb->status == -ESHUTDOWN))
+		MORSE_USB_ERR(mors, "%s - nonzero write bulk status received: %d\n",
+			      __func__, urb->status);
+
+	if (!xfer->status)
+		xfer->status = urb->status;
+
+	/* The chip will never act on the bulk data without its command, so don't wait for it */
+	usb_unlink_urb(xfer->data_urb);
+}
+
+static void morse_usb_xfer_data_callback(struct urb *urb)
+{
+	struct morse_usb_xfer *xfer = urb->context;
+	struct morse *mors = usb_get_intfdata(xfer->musb->interface);
 
 	MORSE_USB_DBG(mors, "%s status: %d\n", __func__, urb->status);
 	/* sync/async unlink faults aren't errors */
@@ -361,175 +473,290 @@ static void morse_usb_mem_rw_callback(struct urb *urb)
 		if (!(urb->status == -ENOENT ||
 		      urb->status == -ECONNRESET || urb->status == -ESHUTDOWN))
 			MORSE_USB_ERR(mors,
-				      "%s - nonzero write bulk status received: %d\n",
-				      __func__, urb->status);
-		musb->errors = urb->status;
+				      "%s - nonzero %s bulk status received: %d\n",
+				      __func__, xfer->dest ? "read" : "write", urb->status);
+		if (!xfer->status)
+			xfer->status = urb->status;
+	} else if (xfer->dest && xfer->bounced && !xfer->status) {
+		/* Hand the data over now so the copy overlaps with the transfers still in flight */
+		memcpy(xfer->dest, xfer->buffer, xfer->len);
 	}
 
-	musb->ongoing_rw = 0;
-	wake_up(&musb->rw_in_wait);
+	complete(&xfer->done);
 }
 
-static int morse_usb_mem_read(struct morse_usb *musb, u32 address, u8 *data, ssize_t size)
+/**
+ * morse_usb_xfer_can_map() - Check whether a chunk can be DMA'd straight from/to the caller.
+ *
+ * @musb: Morse USB device
+ * @data: Caller's buffer for the chunk
+ * @len: Chunk length
+ * @is_read: The chunk is received from the chip
+ *
+ * The buffer must be in the kernel linear map and not on the stack. Reads must also start and
+ * end on a cache line boundary so the DMA cannot clobber neighbouring data sharing the line on
+ * non-coherent hosts. Anything else is carried through the bounce buffer instead.
+ *
+ * Return: true if the chunk can be transferred without a copy.
+ */
+static bool morse_usb_xfer_can_map(struct morse_usb *musb, const u8 *data, int len, bool is_read)
 {
-	int ret;
-	struct morse_usb_command cmd;
-	struct morse *mors = usb_get_intfdata(musb->interface);
+	const unsigned long align = is_read ? dma_get_cache_alignment() : sizeof(u32);
 
-	if (!test_bit(MORSE_USB_FLAG_ATTACHED, &musb->flags))
-		return -ENODEV;
+	if (len < MORSE_USB_ZERO_COPY_MIN_LEN) {
+		musb->xfer_stats.bounce_small++;
+		return false;
+	}
 
-	mutex_lock(&musb->lock);
+	if (!virt_addr_valid(data) || object_is_on_stack(data)) {
+		musb->xfer_stats.bounce_unmappable++;
+		return false;
+	}
 
-	musb->ongoing_rw = 1;
-	musb->errors = 0;
+	if (!IS_ALIGNED((unsigned long)data, align) || !IS_ALIGNED(len, align)) {
+		musb->xfer_stats.bounce_unaligned++;
+		return false;
+	}
 
-	/* Send command ahead to prepare for Tokens */
-	cmd.dir = cpu_to_le32(MORSE_USB_READ);
-	cmd.address = cpu_to_le32(address);
-	cmd.length = cpu_to_le32(size);
+	return true;
+}
 
-	morse_usb_buff_log(mors, (const char *)&cmd, sizeof(cmd), "CMDBUF: ");
+/**
+ * morse_usb_xfer_submit() - Queue a single chunk of a memory transfer.
+ *
+ * @musb: Morse USB device
+ * @xfer: Idle transfer slot to use
+ * @dir: MORSE_USB_READ or MORSE_USB_WRITE
+ * @address: Chip address of the chunk
+ * @data: Host buffer of the chunk
+ * @len: Chunk length, at most USB_MAX_TRANSFER_SIZE
+ *
+ * The command URB and the bulk data URB are both submitted without waiting, so several chunks
+ * can be queued on the memory endpoints back to back. Where possible the bulk URB uses the
+ * caller's buffer directly, see morse_usb_xfer_can_map(). The USB core keeps URBs on an endpoint in
+ * submission order, so each command still reaches the chip ahead of its data.
+ *
+ * Return: 0 if both URBs were submitted, otherwise an error code. On error nothing is left in
+ * flight for @xfer, but @xfer->cmd_orphaned is set if the command may have reached the chip.
+ */
+static int morse_usb_xfer_submit(struct morse_usb *musb, struct morse_usb_xfer *xfer,
+				 enum morse_usb_command_direction dir, u32 address, u8 *data,
+				 int len)
+{
+	int ret;
+	unsigned int pipe;
+	struct morse *mors = usb_get_intfdata(musb->interface);
 
-	ret = morse_usb_cmd(musb, (const char *)&cmd, sizeof(cmd));
-	if (ret < 0) {
-		MORSE_USB_ERR(mors, "morse_usb_cmd error %d\n", ret);
-		goto error;
+	xfer->cmd->dir = cpu_to_le32(dir);
+	xfer->cmd->address = cpu_to_le32(address);
+	xfer->cmd->length = cpu_to_le32(len);
+	xfer->len = len;
+	xfer->status = 0;
+	xfer->cmd_orphaned = false;
+	reinit_completion(&xfer->done);
+
+	morse_usb_buff_log(mors, (const char *)xfer->cmd, sizeof(*xfer->cmd), "CMDBUF: ");
+
+	usb_fill_bulk_urb(xfer->cmd_urb, musb->udev,
+			  usb_sndbulkpipe(musb->udev, musb->endpoints[MORSE_EP_CMD].addr),
+			  xfer->cmd, sizeof(*xfer->cmd), morse_usb_xfer_cmd_callback, xfer);
+
+	xfer->bounced = !morse_usb_xfer_can_map(musb, data, len, dir == MORSE_USB_READ);
+
+	if (dir == MORSE_USB_READ) {
+		xfer->dest = data;
+		pipe = usb_rcvbulkpipe(musb->udev, musb->endpoints[MORSE_EP_MEM_RD].addr);
+		if (xfer->bounced)
+			musb->xfer_stats.bounce_rd++;
+		else
+			musb->xfer_stats.zero_copy_rd++;
+	} else {
+		xfer->dest = NULL;
+		morse_usb_buff_log(mors, (const char *)data, len, "WR-DATA: ");
+		pipe = usb_sndbulkpipe(musb->udev, musb->endpoints[MORSE_EP_MEM_WR].addr);
+		if (xfer->bounced) {
+			memcpy(xfer->buffer, data, len);
+			musb->xfer_stats.bounce_wr++;
+		} else {
+			musb->xfer_stats.zero_copy_wr++;
+		}
 	}
 
-	/* Let's be fast push the next URB, don't wait until command is done */
-	usb_fill_bulk_urb(musb->endpoints[MORSE_EP_MEM_RD].urb,
-			  musb->udev,
-			  usb_rcvbulkpipe(musb->udev,
-					  musb->endpoints[MORSE_EP_MEM_RD].addr),
-			  musb->endpoints[MORSE_EP_MEM_RD].buffer,
-			  size, morse_usb_mem_rw_callback, mors);
+	/* Without URB_NO_TRANSFER_DMA_MAP the USB core maps whichever buffer is used */
+	usb_fill_bulk_urb(xfer->data_urb, musb->udev, pipe, xfer->bounced ? xfer->buffer : data,
+			  len, morse_usb_xfer_data_callback, xfer);
 
-	/* do it */
-	ret = usb_submit_urb(musb->endpoints[MORSE_EP_MEM_RD].urb, GFP_ATOMIC);
-	if (ret < 0) {
-		MORSE_USB_ERR(mors, "%s - failed submitting read urb, error %d\n", __func__, ret);
-		ret = (ret == -ENOMEM) ? ret : -EIO;
+	usb_anchor_urb(xfer->cmd_urb, &musb->xfer_anchor);
+	ret = usb_submit_urb(xfer->cmd_urb, GFP_KERNEL);
+	if (ret) {
+		MORSE_USB_ERR(mors, "%s - failed submitting command urb, error %d\n",
+			      __func__, ret);
+		usb_unanchor_urb(xfer->cmd_urb);
 		goto error;
 	}
 
-	ret = wait_event_interruptible_timeout(musb->rw_in_wait, (!musb->ongoing_rw),
-					       msecs_to_jiffies(URB_TIMEOUT_MS));
-	if (ret < 0) {
-		MORSE_USB_ERR(mors, "%s: wait_event_interruptible: error %d\n", __func__, ret);
+	usb_anchor_urb(xfer->data_urb, &musb->xfer_anchor);
+	ret = usb_submit_urb(xfer->data_urb, GFP_KERNEL);
+	if (ret) {
+		MORSE_USB_ERR(mors, "%s - failed submitting %s urb, error %d\n",
+			      __func__, xfer->dest ? "read" : "write", ret);
+		usb_unanchor_urb(xfer->data_urb);
+		usb_kill_urb(xfer->cmd_urb);
+		xfer->cmd_orphaned = true;
 		goto error;
-	} else if (ret == 0) {
-		/* Timed out. */
-		usb_kill_urb(musb->endpoints[MORSE_EP_MEM_RD].urb);
 	}
 
-	if (musb->errors) {
-		ret = musb->errors;
-		MORSE_USB_ERR(mors, "%s error %d\n", __func__, ret);
-		goto error;
-	}
+	return 0;
 
-	memcpy(data, musb->endpoints[MORSE_EP_MEM_RD].buffer, size);
+error:
+	return (ret == -ENOMEM) ? ret : -EIO;
+}
 
-	morse_usb_buff_log(mors, (const char *)data, size, "RD-DATA: ");
+/**
+ * morse_usb_xfer_wait() - Wait for a submitted transfer slot to finish.
+ *
+ * @musb: Morse USB device
+ * @xfer: Transfer slot previously passed to morse_usb_xfer_submit()
+ *
+ * Return: 0 on success, otherwise an error code.
+ */
+static int morse_usb_xfer_wait(struct morse_usb *musb, struct morse_usb_xfer *xfer)
+{
+	struct morse *mors = usb_get_intfdata(musb->interface);
 
-	ret = size;
+	if (!wait_for_completion_timeout(&xfer->done, msecs_to_jiffies(URB_TIMEOUT_MS))) {
+		MORSE_USB_ERR(mors, "%s: timed out waiting for urb\n", __func__);
+		usb_kill_urb(xfer->cmd_urb);
+		usb_kill_urb(xfer->data_urb);
+		return -ETIMEDOUT;
+	}
 
-error:
-	musb->ongoing_rw = 0;
-	mutex_unlock(&musb->lock);
+	if (xfer->status) {
+		MORSE_USB_ERR(mors, "%s error %d\n", __func__, xfer->status);
+		return xfer->status;
+	}
 
-	return ret;
+	if (xfer->dest)
+		morse_usb_buff_log(mors, (const char *)xfer->dest, xfer->len, "RD-DATA: ");
+
+	return 0;
 }
 
-static int morse_usb_mem_write(struct morse_usb *musb, u32 address, u8 *data, ssize_t size)
+/**
+ * morse_usb_mem_resync() - Bring the memory endpoints back in step after killing transfers.
+ *
+ * @musb: Morse USB device, with musb->lock held
+ *
+ * Killing the pipeline can cancel data URBs whose commands already reached the chip, leaving the
+ * chip expecting or sending data the host no longer will. Clear the host side state of the bulk
+ * endpoints and reset the chip's USB command handling so the next transfer starts clean.
+ */
+static void morse_usb_mem_resync(struct morse_usb *musb)
 {
-	int ret;
-	struct morse_usb_command cmd;
 	struct morse *mors = usb_get_intfdata(musb->interface);
+	int ret;
 
-	if (!test_bit(MORSE_USB_FLAG_ATTACHED, &musb->flags))
-		return -ENODEV;
-
-	mutex_lock(&musb->lock);
+	musb->xfer_stats.resyncs++;
 
-	musb->ongoing_rw = 1;
-	musb->errors = 0;
+	ret = usb_clear_halt(musb->udev,
+			     usb_sndbulkpipe(musb->udev, musb->endpoints[MORSE_EP_CMD].addr));
+	if (!ret)
+		ret = usb_clear_halt(musb->udev, usb_rcvbulkpipe(musb->udev,
+						musb->endpoints[MORSE_EP_MEM_RD].addr));
+	if (!ret)
+		ret = usb_clear_halt(musb->udev, usb_sndbulkpipe(musb->udev,
+						musb->endpoints[MORSE_EP_MEM_WR].addr));
+	if (!ret)
+		ret = __morse_usb_ndr_reset(musb);
 
-	/* Send command ahead to prepare for Tokens */
-	cmd.dir = cpu_to_le32(MORSE_USB_WRITE);
-	cmd.address = cpu_to_le32(address);
-	cmd.length = cpu_to_le32(size);
-	ret = morse_usb_cmd(musb, (const char *)&cmd, sizeof(cmd));
-	if (ret < 0) {
-		MORSE_USB_ERR(mors, "morse_usb_mem_read error %d\n", ret);
-		goto error;
-	}
+	if (ret)
+		MORSE_USB_ERR(mors, "%s: failed to resync memory endpoints: %d\n", __func__, ret);
+}
 
-	morse_usb_buff_log(mors, (const char *)data, size, "WR-DATA: ");
+/**
+ * morse_usb_mem_xfer() - Read or write chip memory through the pipelined transfer slots.
+ *
+ * @musb: Morse USB device
+ * @dir: MORSE_USB_READ or MORSE_USB_WRITE
+ * @address: Chip start address
+ * @data: Host buffer
+ * @len: Number of bytes to transfer
+ *
+ * The request is split into USB_MAX_TRANSFER_SIZE chunks, and up to usb_max_inflight_xfers of
+ * them are kept in flight so the link stays busy rather than idling for every round trip. The
+ * call returns only once every chunk has completed, so callers of the bus ops still see a
+ * synchronous transfer.
+ *
+ * Return: @len on success, otherwise an error code.
+ */
+static int morse_usb_mem_xfer(struct morse_usb *musb, enum morse_usb_command_direction dir,
+			      u32 address, u8 *data, int len)
+{
+	int ret = 0;
+	int err;
+	int chunk;
+	int offset = 0;
+	int head = 0;
+	int tail = 0;
+	int inflight = 0;
+	bool killed = false;
+	const int depth = clamp_t(int, usb_max_inflight_xfers, 1, MORSE_USB_MAX_XFERS);
 
-	memcpy(musb->endpoints[MORSE_EP_MEM_WR].buffer, data, size);
+	if (!test_bit(MORSE_USB_FLAG_ATTACHED, &musb->flags))
+		return -ENODEV;
 
-	/* prepare a read */
-	usb_fill_bulk_urb(musb->endpoints[MORSE_EP_MEM_WR].urb,
-			  musb->udev,
-			  usb_sndbulkpipe(musb->udev,
-					  musb->endpoints[MORSE_EP_MEM_WR].addr),
-			  musb->endpoints[MORSE_EP_MEM_WR].buffer,
-			  size, morse_usb_mem_rw_callback, mors);
+	mutex_lock(&musb->lock);
 
-	/* do it */
-	ret = usb_submit_urb(musb->endpoints[MORSE_EP_MEM_WR].urb, GFP_ATOMIC);
-	if (ret < 0) {
-		MORSE_USB_ERR(mors, "%s - failed submitting write urb, error %d\n",
-			      __func__, ret);
-		ret = (ret == -ENOMEM) ? ret : -EIO;
-		goto error;
-	}
+	while (offset < len || inflight) {
+		if (!ret && offset < len && inflight < depth) {
+			chunk = min_t(int, len - offset, USB_MAX_TRANSFER_SIZE);
+			ret = morse_usb_xfer_submit(musb, &musb->xfers[head], dir,
+						    address + offset, data + offset, chunk);
+			if (!ret) {
+				offset += chunk;
+				head = (head + 1) % depth;
+				inflight++;
+			} else if (musb->xfers[head].cmd_orphaned) {
+				/* The chip may be waiting on data for this command */
+				killed = true;
+			}
+			continue;
+		}
 
-	ret = wait_event_interruptible_timeout(musb->rw_in_wait, (!musb->ongoing_rw),
-					       msecs_to_jiffies(URB_TIMEOUT_MS));
-	if (ret < 0) {
-		MORSE_USB_ERR(mors, "%s error %d\n", __func__, ret);
-		goto error;
-	} else if (ret == 0) {
-		/* Timed out. */
-		usb_kill_urb(musb->endpoints[MORSE_EP_MEM_WR].urb);
-	}
+		if (!inflight)
+			break;
 
-	if (musb->errors) {
-		ret = musb->errors;
-		MORSE_USB_ERR(mors, "%s error %d\n", __func__, ret);
-		goto error;
+		err = morse_usb_xfer_wait(musb, &musb->xfers[tail]);
+		if (err && !ret) {
+			ret = err;
+			/* Abandon the rest of the pipeline, the remaining slots complete as killed */
+			usb_kill_anchored_urbs(&musb->xfer_anchor);
+			killed = true;
+		}
+		tail = (tail + 1) % depth;
+		inflight--;
 	}
 
-	ret = size;
+	if (killed && test_bit(MORSE_USB_FLAG_ATTACHED, &musb->flags))
+		morse_usb_mem_resync(musb);
 
-error:
-	musb->ongoing_rw = 0;
 	mutex_unlock(&musb->lock);
-	return ret;
+
+	return ret ? ret : len;
 }
 
 static int morse_usb_dm_write(struct morse *mors, u32 address, const u8 *data, int len)
 {
-	ssize_t offset = 0;
 	int ret;
 	struct morse_usb *musb = (struct morse_usb *)mors->drv_priv;
 
 	if (WARN_ON(len < 0))
 		return -EINVAL;
 
-	while (offset < len) {
-		/* cast to ssize_t is so x64 build doesn't complain. */
-		ret = morse_usb_mem_write(musb, address + offset, (u8 *)(data + offset),
-					  min((ssize_t)(len - offset),
-					      (ssize_t)USB_MAX_TRANSFER_SIZE));
-		if (ret < 0) {
-			MORSE_USB_ERR(mors, "%s failed (errno=%d)\n", __func__, ret);
-			return ret;
-		}
-		offset += ret;
+	ret = morse_usb_mem_xfer(musb, MORSE_USB_WRITE, address, (u8 *)data, len);
+	if (ret < 0) {
+		MORSE_USB_ERR(mors, "%s failed (errno=%d)\n", __func__, ret);
+		return ret;
 	}
 
 	return 0;
@@ -537,24 +764,16 @@ static int morse_usb_dm_write(struct morse *mors, u32 address, const u8 *data, i
 
 static int morse_usb_dm_read(struct morse *mors, u32 address, u8 *data, int len)
 {
-	ssize_t offset = 0;
 	int ret;
 	struct morse_usb *musb = (struct morse_usb *)mors->drv_priv;
 
 	if (WARN_ON(len < 0))
 		return -EINVAL;
 
-	while (offset < len) {
-		/* cast to ssize_t is so x64 build doesn't complain. */
-		ret = morse_usb_mem_read(musb, address + offset, (u8 *)(data + offset),
-					 min((ssize_t)(len - offset),
-					     (ssize_t)USB_MAX_TRANSFER_SIZE));
-
-		if (ret < 0) {
-			MORSE_USB_ERR(mors, "%s failed (errno=%d)\n", __func__, ret);
-			return ret;
-		}
-		offset += ret;
+	ret = morse_usb_mem_xfer(musb, MORSE_USB_READ, address, data, len);
+	if (ret < 0) {
+		MORSE_USB_ERR(mors, "%s failed (errno=%d)\n", __func__, ret);
+		return ret;
 	}
 
 	return 0;
@@ -565,7 +784,7 @@ static int morse_usb_reg32_read(struct morse *mors, u32 address, u32 *val)
 	int ret = 0;
 	struct morse_usb *musb = (struct morse_usb *)mors->drv_priv;
 
-	ret = morse_usb_mem_read(musb, address, (u8 *)val, sizeof(*val));
+	ret = morse_usb_mem_xfer(musb, MORSE_USB_READ, address, (u8 *)val, sizeof(*val));
 	if (ret == sizeof(*val)) {
 		*val = le32_to_cpup((__le32 *)val);
 		return 0;
@@ -581,7 +800,7 @@ static int morse_usb_reg32_write(struct morse *mors, u32 address, u32 val)
 	struct morse_usb *musb = (struct morse_usb *)mors->drv_priv;
 	__le32 val_le = cpu_to_le32(val);
 
-	ret = morse_usb_mem_write(musb, address, (u8 *)&val_le, sizeof(val_le));
+	ret = morse_usb_mem_xfer(musb, MORSE_USB_WRITE, address, (u8 *)&val_le, sizeof(val_le));
 	if (ret == sizeof(val_le))
 		return 0;
 
@@ -637,6 +856,51 @@ static const struct morse_bus_ops morse_usb_ops = {
 	.bulk_alignment = MORSE_DEFAULT_BULK_ALIGNMENT,
 };
 
+static void morse_usb_xfers_free(struct morse_usb *musb)
+{
+	int i;
+
+	for (i = 0; i < MORSE_USB_MAX_XFERS; i++) {
+		struct morse_usb_xfer *xfer = &musb->xfers[i];
+
+		if (xfer->cmd)
+			usb_free_coherent(musb->udev, sizeof(*xfer->cmd), xfer->cmd, xfer->cmd_dma);
+		kfree(xfer->buffer);
+		usb_free_urb(xfer->data_urb);
+		usb_free_urb(xfer->cmd_urb);
+		memset(xfer, 0, sizeof(*xfer));
+	}
+}
+
+static int morse_usb_xfers_alloc(struct morse_usb *musb)
+{
+	int i;
+
+	for (i = 0; i < MORSE_USB_MAX_XFERS; i++) {
+		struct morse_usb_xfer *xfer = &musb->xfers[i];
+
+		xfer->musb = musb;
+		init_completion(&xfer->done);
+
+		xfer->cmd_urb = usb_alloc_urb(0, GFP_KERNEL);
+		xfer->data_urb = usb_alloc_urb(0, GFP_KERNEL);
+		xfer->buffer = kmalloc(USB_MAX_TRANSFER_SIZE, GFP_KERNEL);
+		xfer->cmd = usb_alloc_coherent(musb->udev, sizeof(*xfer->cmd), GFP_KERNEL,
+					       &xfer->cmd_dma);
+		if (!xfer->cmd_urb || !xfer->data_urb || !xfer->buffer || !xfer->cmd)
+			goto err;
+
+		xfer->cmd_urb->transfer_dma = xfer->cmd_dma;
+		xfer->cmd_urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
+
+	return 0;
+
+err:
+	morse_usb_xfers_free(musb);
+	return -ENOMEM;
+}
+
 static int morse_detect_endpoints(struct morse *mors, const struct usb_interface *intf)
 {
 	int ret;
@@ -710,31 +974,7 @@ static int morse_detect_endpoints(struct morse *mors, const struct usb_interface
 	musb->endpoints[MORSE_EP_CMD].urb = usb_alloc_urb(0, GFP_KERNEL);
 	if (!musb->endpoints[MORSE_EP_CMD].urb) {
 		ret = -ENOMEM;
-		goto err_free_urb;
-	}
-
-	musb->endpoints[MORSE_EP_MEM_RD].urb = usb_alloc_urb(0, GFP_KERNEL);
-	if (!musb->endpoints[MORSE_EP_MEM_RD].urb) {
-		ret = -ENOMEM;
-		goto err_free_urb;
-	}
-
-	musb->endpoints[MORSE_EP_MEM_WR].urb = usb_alloc_urb(0, GFP_KERNEL);
-	if (!musb->endpoints[MORSE_EP_MEM_WR].urb) {
-		ret = -ENOMEM;
-		goto err_free_urb;
-	}
-
-	musb->endpoints[MORSE_EP_MEM_RD].buffer = kmalloc(USB_MAX_TRANSFER_SIZE, GFP_KERNEL);
-	if (!musb->endpoints[MORSE_EP_MEM_RD].buffer) {
-		ret = -ENOMEM;
-		goto err_free_urb;
-	}
-
-	musb->endpoints[MORSE_EP_MEM_WR].buffer = kmalloc(USB_MAX_TRANSFER_SIZE, GFP_KERNEL);
-	if (!musb->endpoints[MORSE_EP_MEM_WR].buffer) {
-		ret = -ENOMEM;
-		goto err_free_rd_buff;
+		goto err;
 	}
 
 	musb->endpoints[MORSE_EP_CMD].buffer =
@@ -743,27 +983,54 @@ static int morse_detect_endpoints(struct morse *mors, const struct usb_interface
 
 	if (!musb->endpoints[MORSE_EP_CMD].buffer) {
 		ret = -ENOMEM;
-		goto err_free_wr_buff;
+		goto err_free_urb;
 	}
 
 	/* Assign command to memory out end point */
 	musb->endpoints[MORSE_EP_CMD].addr = musb->endpoints[MORSE_EP_MEM_WR].addr;
 	musb->endpoints[MORSE_EP_CMD].size = musb->endpoints[MORSE_EP_MEM_WR].size;
 
+	ret = morse_usb_xfers_alloc(musb);
+	if (ret)
+		goto err_free_cmd_buff;
+
 	return 0;
 
-err_free_wr_buff:
-	kfree(musb->endpoints[MORSE_EP_MEM_WR].buffer);
-err_free_rd_buff:
-	kfree(musb->endpoints[MORSE_EP_MEM_RD].buffer);
+err_free_cmd_buff:
+	usb_free_coherent(musb->udev, sizeof(struct morse_usb_command),
+			  musb->endpoints[MORSE_EP_CMD].buffer,
+			  musb->endpoints[MORSE_EP_CMD].urb->transfer_dma);
 err_free_urb:
-	usb_free_urb(musb->endpoints[MORSE_EP_MEM_WR].urb);
-	usb_free_urb(musb->endpoints[MORSE_EP_MEM_RD].urb);
 	usb_free_urb(musb->endpoints[MORSE_EP_CMD].urb);
+	musb->endpoints[MORSE_EP_CMD].urb = NULL;
 err:
 	return ret;
 }
 
+#ifdef CONFIG_MORSE_DEBUGFS
+static int morse_usb_read_xfer_stats(struct seq_file *file, void *data)
+{
+	struct morse *mors = dev_get_drvdata(file->private);
+	struct morse_usb *musb = (struct morse_usb *)mors->drv_priv;
+	struct morse_usb_xfer_stats stats;
+
+	mutex_lock(&musb->lock);
+	stats = musb->xfer_stats;
+	mutex_unlock(&musb->lock);
+
+	seq_printf(file, "Zero-copy reads: %llu\n", stats.zero_copy_rd);
+	seq_printf(file, "Zero-copy writes: %llu\n", stats.zero_copy_wr);
+	seq_printf(file, "Bounced reads: %llu\n", stats.bounce_rd);
+	seq_printf(file, "Bounced writes: %llu\n", stats.bounce_wr);
+	seq_printf(file, "Bounced (too small): %llu\n", stats.bounce_small);
+	seq_printf(file, "Bounced (unaligned): %llu\n", stats.bounce_unaligned);
+	seq_printf(file, "Bounced (not DMA-able): %llu\n", stats.bounce_unmappable);
+	seq_printf(file, "Endpoint resyncs: %llu\n", stats.resyncs);
+
+	return 0;
+}
+#endif
+
 static int morse_usb_probe(struct usb_interface *interface, const struct usb_device_id *id)
 {
 	int ret;
@@ -793,6 +1060,7 @@ static int morse_usb_probe(struct usb_interface *interface, const struct usb_dev
 	mutex_init(&musb->lock);
 	mutex_init(&musb->bus_lock);
 	init_waitqueue_head(&musb->rw_in_wait);
+	init_usb_anchor(&musb->xfer_anchor);
 	usb_set_intfdata(interface, mors);
 
 	ret = morse_detect_endpoints(mors, interface);
@@ -827,19 +1095,17 @@ static int morse_usb_probe(struct usb_interface *interface, const struct usb_dev
 		goto err_ep;
 
 	if (morse_test_mode_is_interactive(test_mode)) {
-		mors->chip_wq = create_singlethread_workqueue("MorseChipIfWorkQ");
+		mors->chip_wq = morse_create_chip_wq(mors);
 		if (!mors->chip_wq) {
-			MORSE_USB_ERR(mors,
-				      "create_singlethread_workqueue(MorseChipIfWorkQ) failed\n");
+			MORSE_USB_ERR(mors, "morse_create_chip_wq() failed\n");
 			ret = -ENOMEM;
 			goto err_ep;
 		}
 
-		mors->net_wq = create_singlethread_workqueue("MorseNetWorkQ");
+		mors->net_wq = morse_create_net_wq(mors);
 
 		if (!mors->net_wq) {
-			MORSE_USB_ERR(mors,
-				      "create_singlethread_workqueue(MorseNetWorkQ) failed\n");
+			MORSE_USB_ERR(mors, "morse_create_net_wq() failed\n");
 			ret = -ENOMEM;
 			goto err_net_wq;
 		}
@@ -864,6 +1130,11 @@ static int morse_usb_probe(struct usb_interface *interface, const struct usb_dev
 			MORSE_USB_ERR(mors, "morse_mac_register failed: %d\n", ret);
 			goto err_mac;
 		}
+
+#ifdef CONFIG_MORSE_DEBUGFS
+		debugfs_create_devm_seqfile(mors->dev, "usb_xfer_stats",
+					    mors->debug.debugfs_phy, morse_usb_read_xfer_stats);
+#endif
 	}
 
 #ifdef CONFIG_MORSE_USER_ACCESS
@@ -928,12 +1199,9 @@ static void morse_urb_cleanup(struct morse *mors)
 {
 	struct morse_usb *musb = (struct morse_usb *)mors->drv_priv;
 	struct morse_usb_endpoint *int_ep = &musb->endpoints[MORSE_EP_INT];
-	struct morse_usb_endpoint *rd_ep = &musb->endpoints[MORSE_EP_MEM_RD];
-	struct morse_usb_endpoint *wr_ep = &musb->endpoints[MORSE_EP_MEM_WR];
 	struct morse_usb_endpoint *cmd_ep = &musb->endpoints[MORSE_EP_CMD];
 
-	usb_kill_urb(rd_ep->urb);
-	usb_kill_urb(wr_ep->urb);
+	usb_kill_anchored_urbs(&musb->xfer_anchor);
 	usb_kill_urb(cmd_ep->urb);
 
 	/* Locking the bus. No USB communication after this point */
@@ -947,12 +1215,9 @@ static void morse_urb_cleanup(struct morse *mors)
 		usb_free_coherent(musb->udev, sizeof(struct morse_usb_command),
 				  cmd_ep->buffer, cmd_ep->urb->transfer_dma);
 
-	kfree(wr_ep->buffer);
-	kfree(rd_ep->buffer);
+	morse_usb_xfers_free(musb);
 
 	usb_free_urb(int_ep->urb);
-	usb_free_urb(wr_ep->urb);
-	usb_free_urb(rd_ep->urb);
 	usb_free_urb(cmd_ep->urb);
 }
 
@@ -1011,16 +1276,13 @@ static int morse_usb_suspend(struct usb_interface *intf, pm_message_t message)
 	struct morse *mors = usb_get_intfdata(intf);
 	struct morse_usb *musb = (struct morse_usb *)mors->drv_priv;
 	struct morse_usb_endpoint *int_ep = &musb->endpoints[MORSE_EP_INT];
-	struct morse_usb_endpoint *rd_ep = &musb->endpoints[MORSE_EP_MEM_RD];
-	struct morse_usb_endpoint *wr_ep = &musb->endpoints[MORSE_EP_MEM_WR];
 	struct morse_usb_endpoint *cmd_ep = &musb->endpoints[MORSE_EP_CMD];
 
 	if (!test_bit(MORSE_USB_FLAG_ATTACHED, &musb->flags))
 		return -ENODEV;
 
 	usb_kill_urb(int_ep->urb);
-	usb_kill_urb(rd_ep->urb);
-	usb_kill_urb(wr_ep->urb);
+	usb_kill_anchored_urbs(&musb->xfer_anchor);
 	usb_kill_urb(cmd_ep->urb);
 
 	/* Locking the bus. No USB communication after this point */
@@ -63,6 +63,7 @@ static int morse_vendor_ie_add_to_ie_list(struct morse_vif *mors_vif, u16 mgmt_t
 
 	spin_lock_bh(&mors_vif->vendor_ie.lock);
 	list_add_tail(&item->list, &mors_vif->vendor_ie.ie_list);
+	mors_vif->vendor_ie.generation++;
 	spin_unlock_bh(&mors_vif->vendor_ie.lock);
 
 	return 0;
@@ -90,6 +91,7 @@ static int morse_vendor_ie_clear_ie_list(struct morse_vif *mors_vif, u16 mgmt_ty
 			kfree(vendor_ie);
 		}
 	}
+	mors_vif->vendor_ie.generation++;
 	spin_unlock_bh(&mors_vif->vendor_ie.lock);
 
 	return 0;
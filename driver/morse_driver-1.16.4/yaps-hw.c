@@ -6,6 +6,8 @@
  */
 
 #include "linux/crc7.h"
+#include <linux/ieee80211.h>
+#include <linux/module.h>
 
 #include "yaps-hw.h"
 #include "bus.h"
@@ -13,9 +15,8 @@
 #include "chip_if.h"
 #include "utils.h"
 #include "yaps.h"
+#include "skb_header.h"
 
-#define YAPS_HW_WINDOW_SIZE_BYTES	32768
-#define YAPS_MAX_PKT_SIZE_BYTES		16128
 #define YAPS_DEFAULT_READ_SIZE_BYTES	512
 #define YAPS_METADATA_PAGE_COUNT	1
 
@@ -27,81 +28,40 @@
 #define YAPS_PAGE_SIZE	256
 #define SDIO_BLOCKSIZE	512
 
-/* Calculate padding required for yaps transaction */
-#define YAPS_CALC_PADDING(_bytes) ((_bytes) & 0x3 ? (4 - ((_bytes) & 0x3)) : 0)
+/*
+ * Maximum number of recycled pages the from-chip window is read into. Pages are allocated on
+ * demand; once every one is still referenced by the stack, reads fall back to copying.
+ */
+#define YAPS_RX_PAGES			8
+#define YAPS_RX_PAGE_ORDER		get_order(YAPS_HW_WINDOW_SIZE_BYTES)
+#define YAPS_RX_PAGE_BYTES		(PAGE_SIZE << YAPS_RX_PAGE_ORDER)
 
 /*
- * Yaps data stream delimiter is a 32 bit word with the following fields:
- *
- * pkt_size (14 bits) - Packet size not including delimiter or padding
- * pool_id  (3  bits) - Pool that pages should be allocated from.
- *                      Pool IDs defined in enum yaps_alloc_pool
- * padding  (2  bits) - Padding required to bring packet to word (4 byte) boundary
- * irq      (1  bit ) - Raise a PKT_IRQ on the YDS this is sent to
- * reserved (5  bits) - Reserved, must write as 0
- * crc      (7  bits) - YAPS CRC
+ * Bytes copied into the linear area of a zero-copy RX skb. This holds the skb header, alignment
+ * padding and the 802.11/CCMP headers, which the driver parses and rewrites in place. The frame
+ * body stays in the window page as a fragment.
  */
+#define YAPS_RX_HEAD_BYTES		(sizeof(struct morse_buff_skb_header) + 128)
+
+/* Frames up to this size are cheaper to copy than to pin a window page for */
+#define YAPS_RX_COPYBREAK_BYTES		512
+
+static bool enable_yaps_rx_zero_copy __read_mostly = true;
+module_param(enable_yaps_rx_zero_copy, bool, 0644);
+MODULE_PARM_DESC(enable_yaps_rx_zero_copy,
+		 "Attach received data frames to skbs as fragments of the YAPS RX window");
 
 /* Packet size not including delimiter or padding */
 #define YAPS_DELIM_GET_PKT_SIZE(_yaps_aux, _delim) \
-	(((_delim) & 0x3FFF) - (_yaps_aux)->reserved_yaps_page_size)
+	(YAPS_DELIM_GET_PHANDLE_SIZE(_delim) - (_yaps_aux)->reserved_yaps_page_size)
 #define YAPS_DELIM_SET_PKT_SIZE(_yaps_aux, _pkt_size) \
 	(((_pkt_size) & 0x3FFF) + (_yaps_aux)->reserved_yaps_page_size)
-#define YAPS_DELIM_GET_PHANDLE_SIZE(_delim) (((_delim) & 0x3FFF))
-
-/* Pool that pages should be allocated from. Pool IDs defined in enum yaps_alloc_pool */
-#define YAPS_DELIM_GET_POOL_ID(_delim)		(((_delim) >> 14) & 0x7)
-#define YAPS_DELIM_SET_POOL_ID(_pool_id)	(((_pool_id) & 0x7) << 14)
-/* Padding required to bring packet to word (4 byte) boundary */
-#define YAPS_DELIM_GET_PADDING(_delim)		(((_delim) >> 17) & 0x3)
-#define YAPS_DELIM_SET_PADDING(_padding)	(((_padding) & 0x3) << 17)
-/* Raise a PKT_IRQ on the YDS this is sent to */
-#define YAPS_DELIM_GET_IRQ(_delim)		(((_delim) >> 19) & 0x1)
-#define YAPS_DELIM_SET_IRQ(_irq)		(((_irq) & 0x1) << 19)
-/* Reserved, must write as 0 */
-#define YAPS_DELIM_GET_RESERVED(_delim)		(((_delim) >> 20) & 0x1F)
-#define YAPS_DELIM_SET_RESERVED(_reserved)	(((_reserved) & 0x1F) << 20)
-/* YAPS CRC */
-#define YAPS_DELIM_GET_CRC(_delim)		(((_delim) >> 25) & 0x7F)
-#define YAPS_DELIM_SET_CRC(_crc)		(((_crc) & 0x7F) << 25)
 
 #define MORSE_YAPS_DBG(_m, _f, _a...)		morse_dbg(FEATURE_ID_YAPS, _m, _f, ##_a)
 #define MORSE_YAPS_INFO(_m, _f, _a...)		morse_info(FEATURE_ID_YAPS, _m, _f, ##_a)
 #define MORSE_YAPS_WARN(_m, _f, _a...)		morse_warn(FEATURE_ID_YAPS, _m, _f, ##_a)
 #define MORSE_YAPS_ERR(_m, _f, _a...)		morse_err(FEATURE_ID_YAPS, _m, _f, ##_a)
 
-/* This maps directly to the status window block in chip memory */
-struct morse_yaps_status_registers {
-	/* Allocation pools */
-	u32 tc_tx_pool_num_pages;
-	u32 tc_cmd_pool_num_pages;
-	u32 tc_beacon_pool_num_pages;
-	u32 tc_mgmt_pool_num_pages;
-	u32 fc_rx_pool_num_pages;
-	u32 fc_resp_pool_num_pages;
-	u32 fc_tx_sts_pool_num_pages;
-	u32 fc_aux_pool_num_pages;
-
-	/* To chip/From chip queues for YDS/YSL */
-	u32 tc_tx_num_pkts;
-	u32 tc_cmd_num_pkts;
-	u32 tc_beacon_num_pkts;
-	u32 tc_mgmt_num_pkts;
-	u32 fc_num_pkts;
-	u32 fc_done_num_pkts;
-	u32 fc_rx_bytes_in_queue;
-	u32 tc_delim_crc_fail_detected;
-	union {
-		u32 fc_host_ysl_status; /* ECB */
-		u32 scratch_0; /* ECA - unused */
-	};
-	union {
-		u32 scratch_1; /* ECA. scratch_0 for ECB */
-		u32 lock;
-	};
-	/* scratch 2/3 un-used for ECA and 1/2/3 un-used for ECB */
-} __packed;
-
 struct morse_yaps_hw_aux_data {
 	unsigned long access_lock;
 
@@ -135,6 +95,12 @@ struct morse_yaps_hw_aux_data {
 	char *to_chip_buffer;
 	char *from_chip_buffer;
 
+	/* Pages the from-chip window is read into when zero-copy RX is enabled. Data frames
+	 * reference these as skb fragments; a page is reused once the stack has released them.
+	 */
+	struct page *rx_pages[YAPS_RX_PAGES];
+	u8 rx_page_idx;
+
 	/* Status registers for queues and aloc pools on chip
 	 * This structure is filled directly by bus reads, so it is aligned to 8 bytes to support
 	 * MORSE_SDIO_ALIGNMENT of 1, 2, 4 or 8. Stricter alignment requirements will trigger a
@@ -179,20 +145,6 @@ static void morse_yaps_fill_aux_data_from_hw_tbl(struct morse_yaps_hw_aux_data *
 	aux_data->reserved_yaps_page_size = le16_to_cpu(tbl_ptr->yaps_reserved_page_size);
 }
 
-static inline u8 morse_yaps_crc(u32 word)
-{
-	u8 crc = 0;
-	int len = sizeof(word);
-
-	/* Mask to look at only non-crc bits in both metadata word and delimiters */
-	word &= 0x1ffffff;
-	while (len--) {
-		crc = crc7_be_byte(crc, (word >> 24) & 0xff);
-		word <<= 8;
-	}
-	return crc >> 1;
-}
-
 static inline u32 morse_yaps_delimiter(struct morse_yaps *yaps,
 				unsigned int size, u8 pool_id, bool irq)
 {
@@ -229,45 +181,67 @@ static unsigned int morse_yaps_pages_required(struct morse_yaps *yaps,
 				 YAPS_PHANDLE_CORRUPTION_WAR_EXTRA_PAGE;
 }
 
-/* Checks if a single pkt will fit in the chip using the pool/alloc holding
- * information from the last status register read.
+/* Looks up the pool and queue occupancy counters of a to-chip queue, as of the
+ * last status register read.
  */
-static bool morse_yaps_will_fit(struct morse_yaps *yaps, struct morse_yaps_pkt *pkt, bool update)
+static int morse_yaps_tc_queue_counters(struct morse_yaps *yaps,
+					enum morse_yaps_to_chip_q tc_queue,
+					u32 **pool_pages_avail, u32 **pkts_in_queue,
+					int *queue_size)
 {
-	bool will_fit = true;
-	const int pages_required = morse_yaps_pages_required(yaps, pkt->skb->len);
-	int *pool_pages_avail = NULL;
-	int *pkts_in_queue = NULL;
-	int queue_pkts_avail = 0;
+	struct morse_yaps_status_registers *status_regs = &yaps->aux_data->status_regs;
 
-	switch (pkt->tc_queue) {
+	switch (tc_queue) {
 	case MORSE_YAPS_TX_Q:
-		pool_pages_avail = &yaps->aux_data->status_regs.tc_tx_pool_num_pages;
-		pkts_in_queue = &yaps->aux_data->status_regs.tc_tx_num_pkts;
-		queue_pkts_avail = yaps->aux_data->tc_tx_q_size - *pkts_in_queue;
+		*pool_pages_avail = &status_regs->tc_tx_pool_num_pages;
+		*pkts_in_queue = &status_regs->tc_tx_num_pkts;
+		*queue_size = yaps->aux_data->tc_tx_q_size;
 		break;
 	case MORSE_YAPS_CMD_Q:
-		pool_pages_avail = &yaps->aux_data->status_regs.tc_cmd_pool_num_pages;
-		pkts_in_queue = &yaps->aux_data->status_regs.tc_cmd_num_pkts;
-		queue_pkts_avail = yaps->aux_data->tc_cmd_q_size - *pkts_in_queue;
+		*pool_pages_avail = &status_regs->tc_cmd_pool_num_pages;
+		*pkts_in_queue = &status_regs->tc_cmd_num_pkts;
+		*queue_size = yaps->aux_data->tc_cmd_q_size;
 		break;
 	case MORSE_YAPS_BEACON_Q:
-		pool_pages_avail = &yaps->aux_data->status_regs.tc_beacon_pool_num_pages;
-		pkts_in_queue = &yaps->aux_data->status_regs.tc_beacon_num_pkts;
-		queue_pkts_avail = yaps->aux_data->tc_beacon_q_size - *pkts_in_queue;
+		*pool_pages_avail = &status_regs->tc_beacon_pool_num_pages;
+		*pkts_in_queue = &status_regs->tc_beacon_num_pkts;
+		*queue_size = yaps->aux_data->tc_beacon_q_size;
 		break;
 	case MORSE_YAPS_MGMT_Q:
-		pool_pages_avail = &yaps->aux_data->status_regs.tc_mgmt_pool_num_pages;
-		pkts_in_queue = &yaps->aux_data->status_regs.tc_mgmt_num_pkts;
-		queue_pkts_avail = yaps->aux_data->tc_mgmt_q_size - *pkts_in_queue;
+		*pool_pages_avail = &status_regs->tc_mgmt_pool_num_pages;
+		*pkts_in_queue = &status_regs->tc_mgmt_num_pkts;
+		*queue_size = yaps->aux_data->tc_mgmt_q_size;
 		break;
 	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Checks if a single pkt will fit in the chip using the pool/alloc holding
+ * information from the last status register read.
+ */
+static bool morse_yaps_will_fit(struct morse_yaps *yaps, struct morse_yaps_pkt *pkt, bool update)
+{
+	bool will_fit = true;
+	const int pages_required = morse_yaps_pages_required(yaps, pkt->skb->len);
+	u32 *pool_pages_avail;
+	u32 *pkts_in_queue;
+	int queue_pkts_avail;
+	int queue_size;
+
+	if (morse_yaps_tc_queue_counters(yaps, pkt->tc_queue, &pool_pages_avail,
+					 &pkts_in_queue, &queue_size)) {
 		MORSE_YAPS_ERR(yaps->mors, "yaps invalid tc queue\n");
+		return false;
 	}
 
+	queue_pkts_avail = queue_size - (int)*pkts_in_queue;
+
 	MORSE_WARN_ON_ONCE(FEATURE_ID_DEFAULT, queue_pkts_avail < 0);
 
-	if (pages_required > *pool_pages_avail)
+	if (pages_required > (int)*pool_pages_avail)
 		will_fit = false;
 
 	if (queue_pkts_avail == 0)
@@ -281,6 +255,23 @@ static bool morse_yaps_will_fit(struct morse_yaps *yaps, struct morse_yaps_pkt *
 	return will_fit;
 }
 
+static int morse_yaps_hw_tx_space(struct morse_yaps *yaps, enum morse_yaps_to_chip_q tc_queue,
+				  unsigned int pkt_len)
+{
+	u32 *pool_pages_avail;
+	u32 *pkts_in_queue;
+	int queue_size;
+	int pkts_fit;
+
+	if (morse_yaps_tc_queue_counters(yaps, tc_queue, &pool_pages_avail, &pkts_in_queue,
+					 &queue_size))
+		return 0;
+
+	pkts_fit = (int)*pool_pages_avail / (int)morse_yaps_pages_required(yaps, pkt_len);
+
+	return max(min(pkts_fit, queue_size - (int)*pkts_in_queue), 0);
+}
+
 static int morse_yaps_hw_write_pkt_err_check(struct morse_yaps *yaps, struct morse_yaps_pkt *pkt)
 {
 	if (pkt->skb->len + yaps->aux_data->reserved_yaps_page_size > YAPS_MAX_PKT_SIZE_BYTES)
@@ -418,6 +409,117 @@ static int morse_calc_bytes_remaining(struct morse_yaps *yaps)
 	return (int)bytes_in_queue;
 }
 
+/*
+ * Get a window page that the stack has finished with, allocating one into an empty slot if every
+ * existing page is still referenced by skbs in flight. Pages never leave the ring, so at most
+ * YAPS_RX_PAGES are pinned. Returns NULL if no page is available, in which case the caller falls
+ * back to copying.
+ */
+static struct page *morse_yaps_hw_rx_page_get(struct morse_yaps *yaps)
+{
+	struct morse_yaps_hw_aux_data *aux_data = yaps->aux_data;
+	struct page *page;
+	int empty = -1;
+	int i;
+
+	for (i = 0; i < YAPS_RX_PAGES; i++) {
+		int idx = (aux_data->rx_page_idx + i) % YAPS_RX_PAGES;
+
+		page = aux_data->rx_pages[idx];
+		if (!page) {
+			if (empty < 0)
+				empty = idx;
+			continue;
+		}
+		if (page_ref_count(page) == 1) {
+			aux_data->rx_page_idx = (idx + 1) % YAPS_RX_PAGES;
+			return page;
+		}
+	}
+
+	if (empty < 0)
+		return NULL;
+
+	page = alloc_pages(GFP_KERNEL | __GFP_COMP | __GFP_NOWARN, YAPS_RX_PAGE_ORDER);
+	if (!page)
+		return NULL;
+
+	aux_data->rx_pages[empty] = page;
+	aux_data->rx_page_idx = (empty + 1) % YAPS_RX_PAGES;
+
+	return page;
+}
+
+static void morse_yaps_hw_rx_pages_free(struct morse_yaps_hw_aux_data *aux_data)
+{
+	int i;
+
+	for (i = 0; i < YAPS_RX_PAGES; i++) {
+		if (aux_data->rx_pages[i])
+			put_page(aux_data->rx_pages[i]);
+		aux_data->rx_pages[i] = NULL;
+	}
+}
+
+/*
+ * Only data frames are left in the window page, everything else is parsed as a flat buffer.
+ * The skb checksum of a data frame only covers its headers, which stay in the linear area.
+ */
+static bool morse_yaps_hw_rx_can_frag(const char *pkt, int pkt_size)
+{
+	const struct morse_buff_skb_header *hdr = (const struct morse_buff_skb_header *)pkt;
+	const struct ieee80211_hdr *wlan_hdr = (const struct ieee80211_hdr *)(pkt + sizeof(*hdr));
+
+	if (pkt_size <= YAPS_RX_COPYBREAK_BYTES || hdr->channel != MORSE_SKB_CHAN_DATA ||
+	    hdr->offset)
+		return false;
+
+	return ieee80211_is_data(wlan_hdr->frame_control);
+}
+
+/*
+ * Build an skb for a frame held in an RX window page. The headers are copied into the linear
+ * area and the rest of the frame is attached as a fragment holding a page reference. The
+ * fragment's truesize is charged once the page has been split, see
+ * morse_yaps_hw_rx_charge_page().
+ */
+static struct sk_buff *morse_yaps_hw_rx_frag_skb(struct page *page, const char *pkt,
+						 int pkt_size)
+{
+	struct sk_buff *skb;
+	int head_len = min_t(int, pkt_size, YAPS_RX_HEAD_BYTES);
+
+	skb = dev_alloc_skb(head_len);
+	if (!skb)
+		return NULL;
+
+	memcpy(skb_put(skb, head_len), pkt, head_len);
+
+	get_page(page);
+	skb_add_rx_frag(skb, 0, page, pkt + head_len - (const char *)page_address(page),
+			pkt_size - head_len, 0);
+
+	return skb;
+}
+
+/*
+ * Charge the whole window page to the skbs holding fragments of it, so socket accounting sees
+ * the memory actually pinned rather than only the frame bytes.
+ */
+static void morse_yaps_hw_rx_charge_page(struct morse_yaps_pkt pkts[], int num_pkts,
+					 int num_frags)
+{
+	unsigned int share = YAPS_RX_PAGE_BYTES / num_frags;
+	int i;
+
+	for (i = 0; i < num_pkts; i++) {
+		struct sk_buff *skb = pkts[i].skb;
+
+		if (skb && skb_shinfo(skb)->nr_frags)
+			skb->truesize += max_t(unsigned int, share, skb->data_len);
+	}
+}
+
 static int morse_yaps_hw_read_pkts(struct morse_yaps *yaps,
 				   struct morse_yaps_pkt pkts[],
 				   int num_pkts_max, int *num_pkts_received)
@@ -427,6 +529,8 @@ static int morse_yaps_hw_read_pkts(struct morse_yaps *yaps,
 	char *from_chip_buffer_aligned = PTR_ALIGN(yaps->aux_data->from_chip_buffer,
 						 yaps->mors->bus_ops->bulk_alignment);
 	char *read_ptr = from_chip_buffer_aligned;
+	struct page *rx_page = NULL;
+	int num_frags = 0;
 	int bytes_remaining = morse_calc_bytes_remaining(yaps);
 	bool again = false;
 
@@ -453,9 +557,14 @@ static int morse_yaps_hw_read_pkts(struct morse_yaps *yaps,
 		return ret;
 	}
 
+	if (enable_yaps_rx_zero_copy) {
+		rx_page = morse_yaps_hw_rx_page_get(yaps);
+		if (rx_page)
+			read_ptr = page_address(rx_page);
+	}
+
 	/* Read all available packets to the buffer */
-	ret = morse_dm_read(yaps->mors, yaps->aux_data->ysl_addr,
-			    from_chip_buffer_aligned, bytes_remaining);
+	ret = morse_dm_read(yaps->mors, yaps->aux_data->ysl_addr, read_ptr, bytes_remaining);
 
 	if (ret)
 		goto exit;
@@ -490,6 +599,21 @@ static int morse_yaps_hw_read_pkts(struct morse_yaps *yaps,
 		if (pkts[i].skb)
 			MORSE_YAPS_ERR(yaps->mors, "yaps packet leak\n");
 
+		if (rx_page && total_len <= bytes_remaining &&
+		    morse_yaps_hw_rx_can_frag(read_ptr, pkt_size)) {
+			/* Leave the frame body in the window page */
+			pkts[i].skb = morse_yaps_hw_rx_frag_skb(rx_page, read_ptr, pkt_size);
+			if (!pkts[i].skb) {
+				ret = -ENOMEM;
+				MORSE_YAPS_ERR(yaps->mors, "yaps no mem for skb\n");
+				goto exit;
+			}
+			num_frags++;
+			read_ptr += total_len;
+			bytes_remaining -= total_len;
+			goto next_pkt;
+		}
+
 		/* SKB doesn't want padding */
 		pkts[i].skb = dev_alloc_skb(pkt_size);
 		if (!pkts[i].skb) {
@@ -527,6 +651,7 @@ static int morse_yaps_hw_read_pkts(struct morse_yaps *yaps,
 			read_ptr += read_overhang_len;
 			bytes_remaining = 0;
 		}
+next_pkt:
 		pkts[i].fc_queue = YAPS_DELIM_GET_POOL_ID(delim);
 		*num_pkts_received += 1;
 		i++;
@@ -536,6 +661,9 @@ static int morse_yaps_hw_read_pkts(struct morse_yaps *yaps,
 		ret = -EAGAIN;
 
 exit:
+	if (num_frags)
+		morse_yaps_hw_rx_charge_page(pkts, i, num_frags);
+
 	yaps_hw_unlock(yaps);
 	return ret;
 }
@@ -681,6 +809,7 @@ const struct morse_yaps_ops morse_yaps_hw_ops = {
 	.write_pkts = morse_yaps_hw_write_pkts,
 	.read_pkts = morse_yaps_hw_read_pkts,
 	.update_status = morse_yaps_hw_update_status,
+	.tx_space = morse_yaps_hw_tx_space,
 	.show = morse_yaps_hw_show
 };
 
@@ -776,6 +905,7 @@ void morse_yaps_hw_finish(struct morse *mors)
 	cancel_work_sync(&mors->chip_if_work);
 	cancel_work_sync(&mors->tx_stale_work);
 	if (yaps->aux_data) {
+		morse_yaps_hw_rx_pages_free(yaps->aux_data);
 		kfree(yaps->aux_data->from_chip_buffer);
 		yaps->aux_data->from_chip_buffer = NULL;
 		kfree(yaps->aux_data->to_chip_buffer);
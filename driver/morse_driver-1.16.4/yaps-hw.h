@@ -13,6 +13,75 @@
 #define MORSE_INT_YAPS_FC_PKT_WAITING_IRQN 0
 #define MORSE_INT_YAPS_FC_PACKET_FREED_UP_IRQN 1
 
+#define YAPS_HW_WINDOW_SIZE_BYTES	32768
+#define YAPS_MAX_PKT_SIZE_BYTES		16128
+
+/* Calculate padding required for yaps transaction */
+#define YAPS_CALC_PADDING(_bytes) ((_bytes) & 0x3 ? (4 - ((_bytes) & 0x3)) : 0)
+
+/*
+ * Yaps data stream delimiter is a 32 bit word with the following fields:
+ *
+ * pkt_size (14 bits) - Packet size not including delimiter or padding
+ * pool_id  (3  bits) - Pool that pages should be allocated from.
+ *                      Pool IDs defined in enum yaps_alloc_pool
+ * padding  (2  bits) - Padding required to bring packet to word (4 byte) boundary
+ * irq      (1  bit ) - Raise a PKT_IRQ on the YDS this is sent to
+ * reserved (5  bits) - Reserved, must write as 0
+ * crc      (7  bits) - YAPS CRC
+ */
+
+/* Packet size including any reserved page bytes */
+#define YAPS_DELIM_GET_PHANDLE_SIZE(_delim) (((_delim) & 0x3FFF))
+
+/* Pool that pages should be allocated from. Pool IDs defined in enum yaps_alloc_pool */
+#define YAPS_DELIM_GET_POOL_ID(_delim)		(((_delim) >> 14) & 0x7)
+#define YAPS_DELIM_SET_POOL_ID(_pool_id)	(((_pool_id) & 0x7) << 14)
+/* Padding required to bring packet to word (4 byte) boundary */
+#define YAPS_DELIM_GET_PADDING(_delim)		(((_delim) >> 17) & 0x3)
+#define YAPS_DELIM_SET_PADDING(_padding)	(((_padding) & 0x3) << 17)
+/* Raise a PKT_IRQ on the YDS this is sent to */
+#define YAPS_DELIM_GET_IRQ(_delim)		(((_delim) >> 19) & 0x1)
+#define YAPS_DELIM_SET_IRQ(_irq)		(((_irq) & 0x1) << 19)
+/* Reserved, must write as 0 */
+#define YAPS_DELIM_GET_RESERVED(_delim)		(((_delim) >> 20) & 0x1F)
+#define YAPS_DELIM_SET_RESERVED(_reserved)	(((_reserved) & 0x1F) << 20)
+/* YAPS CRC */
+#define YAPS_DELIM_GET_CRC(_delim)		(((_delim) >> 25) & 0x7F)
+#define YAPS_DELIM_SET_CRC(_crc)		(((_crc) & 0x7F) << 25)
+
+/* This maps directly to the status window block in chip memory */
+struct morse_yaps_status_registers {
+	/* Allocation pools */
+	u32 tc_tx_pool_num_pages;
+	u32 tc_cmd_pool_num_pages;
+	u32 tc_beacon_pool_num_pages;
+	u32 tc_mgmt_pool_num_pages;
+	u32 fc_rx_pool_num_pages;
+	u32 fc_resp_pool_num_pages;
+	u32 fc_tx_sts_pool_num_pages;
+	u32 fc_aux_pool_num_pages;
+
+	/* To chip/From chip queues for YDS/YSL */
+	u32 tc_tx_num_pkts;
+	u32 tc_cmd_num_pkts;
+	u32 tc_beacon_num_pkts;
+	u32 tc_mgmt_num_pkts;
+	u32 fc_num_pkts;
+	u32 fc_done_num_pkts;
+	u32 fc_rx_bytes_in_queue;
+	u32 tc_delim_crc_fail_detected;
+	union {
+		u32 fc_host_ysl_status; /* ECB */
+		u32 scratch_0; /* ECA - unused */
+	};
+	union {
+		u32 scratch_1; /* ECA. scratch_0 for ECB */
+		u32 lock;
+	};
+	/* scratch 2/3 un-used for ECA and 1/2/3 un-used for ECB */
+} __packed;
+
 struct morse_yaps_hw_table {
 	/* Note: no flags actually defined yet, here for future expansion */
 	u8 flags;
@@ -45,6 +114,20 @@ struct morse_yaps_hw_table {
 
 struct morse;
 
+static inline u8 morse_yaps_crc(u32 word)
+{
+	u8 crc = 0;
+	int len = sizeof(word);
+
+	/* Mask to look at only non-crc bits in both metadata word and delimiters */
+	word &= 0x1ffffff;
+	while (len--) {
+		crc = crc7_be_byte(crc, (word >> 24) & 0xff);
+		word <<= 8;
+	}
+	return crc >> 1;
+}
+
 int morse_yaps_hw_init(struct morse *mors);
 void morse_yaps_hw_finish(struct morse *mors);
 void morse_yaps_hw_read_table(struct morse *mors, struct morse_yaps_hw_table *tbl_ptr);
@@ -17,6 +17,7 @@
 #include "command.h"
 #include "skbq.h"
 #include "yaps-hw.h"
+#include "trace.h"
 
 #define BENCHMARK_PKT_LEN		(1496)
 #define BENCHMARK_WAIT_MS		(5000)
@@ -24,15 +25,8 @@
 /* This is a fail safe timeout */
 #define CHIP_FULL_RECOVERY_TIMEOUT_MS 30
 
-/* Defined as the most number of MPDUs per AMPDU */
-#ifndef MAX_PKTS_PER_TX_TXN
-#define MAX_PKTS_PER_TX_TXN	16
-#endif
-
-/* 2 full AMPDUs (and also more than the number of RX pages in chip) */
-#ifndef MAX_PKTS_PER_RX_TXN
-#define MAX_PKTS_PER_RX_TXN	32
-#endif
+/* Weight of the newest packet in the to-chip packet length average, as a shift */
+#define YAPS_TX_AVG_LEN_SHIFT	3
 
 #define MORSE_YAPS_DBG(_m, _f, _a...)		morse_dbg(FEATURE_ID_YAPS, _m, _f, ##_a)
 #define MORSE_YAPS_INFO(_m, _f, _a...)		morse_info(FEATURE_ID_YAPS, _m, _f, ##_a)
@@ -42,10 +36,6 @@
 #define MORSE_YAPS_DBG_RATELIMITED(_m, _f, _a...)		\
 	morse_dbg_ratelimited(FEATURE_ID_YAPS, _m, _f, ##_a)
 
-/* Used to communicate with lower yaps_hw layer */
-static struct morse_yaps_pkt to_chip_pkts[MAX_PKTS_PER_TX_TXN];
-static struct morse_yaps_pkt from_chip_pkts[MAX_PKTS_PER_RX_TXN];
-
 /* Mappings between sk_buff, skbq and yaps */
 static struct morse_skbq *skbq_yaps_tc_q_from_aci(struct morse *mors, int aci)
 {
@@ -239,7 +229,11 @@ static int morse_yaps_read_pkt(struct morse_yaps *yaps, struct sk_buff *skb)
 		goto exit_return_page;
 	}
 
-	skb_trim(skb, skb_len);
+	/* Zero-copy RX skbs carry the frame body as a page fragment */
+	if (pskb_trim(skb, skb_len)) {
+		ret = -ENOMEM;
+		goto exit;
+	}
 	__skb_queue_tail(&skbq, skb);
 
 	if (skbq.qlen)
@@ -264,6 +258,49 @@ exit:
 	return ret;
 }
 
+static enum morse_yaps_to_chip_q morse_yaps_skbq_to_tc_queue(struct morse_yaps *yaps,
+							      struct morse_skbq *mq)
+{
+	if (mq == &yaps->cmd_q)
+		return MORSE_YAPS_CMD_Q;
+	if (mq == &yaps->beacon_q)
+		return MORSE_YAPS_BEACON_Q;
+	if (mq == &yaps->mgmt_q)
+		return MORSE_YAPS_MGMT_Q;
+	return MORSE_YAPS_TX_Q;
+}
+
+/*
+ * Size the next to-chip batch from the space the chip last reported for the queue, assuming
+ * packets of the recently observed length. At least one packet is always taken so a full chip is
+ * still detected through write_pkts().
+ */
+static int morse_yaps_tx_batch_size(struct morse_yaps *yaps, enum morse_yaps_to_chip_q tc_queue,
+				    unsigned int head_len)
+{
+	unsigned int avg_len = yaps->tx_batch[tc_queue].avg_pkt_len;
+	int space;
+
+	if (!yaps->ops->tx_space)
+		return MAX_PKTS_PER_TX_TXN;
+
+	space = yaps->ops->tx_space(yaps, tc_queue, avg_len ? avg_len : head_len);
+
+	return clamp(space, 1, MAX_PKTS_PER_TX_TXN);
+}
+
+static void morse_yaps_tx_batch_update(struct morse_yaps *yaps,
+				       enum morse_yaps_to_chip_q tc_queue, unsigned int pkt_len)
+{
+	u32 *avg_len = &yaps->tx_batch[tc_queue].avg_pkt_len;
+
+	if (!*avg_len)
+		*avg_len = pkt_len;
+	else
+		*avg_len = *avg_len - (*avg_len >> YAPS_TX_AVG_LEN_SHIFT) +
+			   (pkt_len >> YAPS_TX_AVG_LEN_SHIFT);
+}
+
 static int morse_yaps_tx(struct morse_yaps *yaps, struct morse_skbq *mq)
 {
 	int ret = 0;
@@ -271,6 +308,8 @@ static int morse_yaps_tx(struct morse_yaps *yaps, struct morse_skbq *mq)
 	int tc_pkt_idx = 0;
 	int num_pkts_sent = 0;
 	int i;
+	unsigned int head_len;
+	u32 tx_bytes = 0;
 	struct sk_buff *skb;
 	struct sk_buff_head skbq_to_send;
 	struct sk_buff_head skbq_sent;
@@ -278,10 +317,13 @@ static int morse_yaps_tx(struct morse_yaps *yaps, struct morse_skbq *mq)
 	struct sk_buff *pfirst, *pnext;
 	struct morse *mors = yaps->mors;
 	struct morse_buff_skb_header *hdr;
+	struct morse_yaps_pkt *to_chip_pkts = yaps->to_chip_pkts;
+	enum morse_yaps_to_chip_q mq_tc_queue = morse_yaps_skbq_to_tc_queue(yaps, mq);
 
 	/* Check there is something on the queue */
 	spin_lock_bh(&mq->lock);
 	skb = skb_peek(&mq->skbq);
+	head_len = skb ? skb->len : 0;
 	spin_unlock_bh(&mq->lock);
 	if (!skb)
 		return 0;
@@ -297,10 +339,14 @@ static int morse_yaps_tx(struct morse_yaps *yaps, struct morse_skbq *mq)
 		/* Purge old mgmt frames that have not been sent due to congestion */
 		morse_skbq_purge_aged(mors, mq);
 
-	/* We should replace MAX_PKTS_PER_TX_TXN with some heuristic that takes
-	 * into account free space in the queue and free pages in the pool
-	 */
-	num_items = morse_skbq_deq_num_items(mq, &skbq_to_send, MAX_PKTS_PER_TX_TXN);
+	/* Refresh pool and queue space before sizing the batch */
+	ret = yaps->ops->update_status(yaps);
+	if (ret)
+		return ret;
+
+	num_items = morse_skbq_deq_num_items(mq, &skbq_to_send,
+					     morse_yaps_tx_batch_size(yaps, mq_tc_queue, head_len));
+	yaps->tx_batch[mq_tc_queue].last = num_items;
 
 	skb_queue_walk_safe(&skbq_to_send, pfirst, pnext) {
 		enum morse_yaps_to_chip_q tc_queue;
@@ -322,15 +368,14 @@ static int morse_yaps_tx(struct morse_yaps *yaps, struct morse_skbq *mq)
 		}
 		to_chip_pkts[tc_pkt_idx].tc_queue = tc_queue;
 		to_chip_pkts[tc_pkt_idx].skb = pfirst;
+		morse_yaps_tx_batch_update(yaps, mq_tc_queue, pfirst->len);
+		tx_bytes += pfirst->len;
 		tc_pkt_idx++;
 	}
 
 	/* Send queued packets to chip */
-	ret = yaps->ops->update_status(yaps);
-	if (ret)
-		return ret;
-
 	ret = yaps->ops->write_pkts(yaps, to_chip_pkts, tc_pkt_idx, &num_pkts_sent);
+	trace_morse_yaps_tx(mors, mq_tc_queue, tc_pkt_idx, num_pkts_sent, tx_bytes, ret);
 
 	/* Move sent packets to done queue and update stats */
 	for (i = 0; i < num_pkts_sent; ++i) {
@@ -449,13 +494,14 @@ static bool morse_yaps_rx_handler(struct morse_yaps *yaps)
 	int ret = 0;
 	int i;
 	int num_pks_received;
+	u32 rx_bytes = 0;
 
 	ret = yaps->ops->update_status(yaps);
 	if (ret)
 		goto exit;
 
 	ret =
-	    yaps->ops->read_pkts(yaps, from_chip_pkts, ARRAY_SIZE(from_chip_pkts),
+	    yaps->ops->read_pkts(yaps, yaps->from_chip_pkts, ARRAY_SIZE(yaps->from_chip_pkts),
 				 &num_pks_received);
 	if (ret && ret != -EAGAIN) {
 		MORSE_YAPS_ERR(yaps->mors, "YAPS read_pkts fail: %d", ret);
@@ -465,9 +511,17 @@ static bool morse_yaps_rx_handler(struct morse_yaps *yaps)
 	if (num_pks_received == 0)
 		yaps->mors->debug.page_stats.rx_empty++;
 
+	if (trace_morse_yaps_rx_enabled()) {
+		for (i = 0; i < num_pks_received; ++i)
+			if (yaps->from_chip_pkts[i].skb)
+				rx_bytes += yaps->from_chip_pkts[i].skb->len;
+	}
+	trace_morse_yaps_rx(yaps->mors, 0, ARRAY_SIZE(yaps->from_chip_pkts),
+			    num_pks_received, rx_bytes, ret);
+
 	for (i = 0; i < num_pks_received; ++i) {
-		morse_yaps_read_pkt(yaps, from_chip_pkts[i].skb);
-		from_chip_pkts[i].skb = NULL;
+		morse_yaps_read_pkt(yaps, yaps->from_chip_pkts[i].skb);
+		yaps->from_chip_pkts[i].skb = NULL;
 	}
 
 exit:
@@ -497,6 +551,9 @@ void morse_yaps_stale_tx_work(struct work_struct *work)
 	if (flushed) {
 		MORSE_YAPS_DBG(mors, "%s: Flushed %d stale TX SKBs\n", __func__, flushed);
 
+		/* Dropped frames no longer count against the data TX queue limits */
+		morse_skbq_may_wake_tx_queues(mors);
+
 		if (mors->ps.enable &&
 		    !mors->ps.suspended && (morse_yaps_get_tx_buffered_count(mors) == 0)) {
 			/* Evaluate ps to check if it was gated on a stale tx status */
@@ -512,6 +569,7 @@ void morse_yaps_work(struct work_struct *work)
 	int ps_bus_timeout_ms = 0;
 	unsigned long *flags = &mors->chip_if->event_flags;
 	struct morse_yaps *yaps = mors->chip_if->yaps;
+	u64 start_ns;
 
 	/* Don't attempt to interact with device once it becomes unresponsive */
 	if (test_bit(MORSE_STATE_FLAG_CHIP_UNRESPONSIVE, &mors->state_flags))
@@ -520,6 +578,8 @@ void morse_yaps_work(struct work_struct *work)
 	if (!*flags)
 		return;
 
+	start_ns = morse_wq_stats_start();
+
 	/* Disable power save in case it is running */
 	morse_ps_disable(mors);
 	morse_claim_bus(mors);
@@ -610,6 +670,8 @@ exit:
 	morse_release_bus(mors);
 	morse_ps_enable(mors);
 
+	morse_wq_stats_end(&mors->chip_wq_stats, start_ns);
+
 	/* Don't requeue work if we are shutting down. */
 	if (yaps->finish)
 		return;
@@ -768,6 +830,10 @@ void morse_yaps_show(struct morse_yaps *yaps, struct seq_file *file)
 	morse_skbq_show(&yaps->cmd_q, file);
 	morse_skbq_show(&yaps->cmd_resp_q, file);
 
+	for (i = 0; i < ARRAY_SIZE(yaps->tx_batch); i++)
+		seq_printf(file, "tc_q %d: batch %u avg_len %u\n", i,
+			   yaps->tx_batch[i].last, yaps->tx_batch[i].avg_pkt_len);
+
 	yaps->ops->show(yaps, file);
 }
 
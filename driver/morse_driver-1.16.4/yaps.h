@@ -20,6 +20,18 @@
  */
 #define YAPS_TX_SKBQ_MAX			4
 
+/* Upper bound on packets written to the chip in one transaction. The batch actually used is
+ * sized from the free space the chip last reported, see morse_yaps_tx_batch_size().
+ */
+#ifndef MAX_PKTS_PER_TX_TXN
+#define MAX_PKTS_PER_TX_TXN	64
+#endif
+
+/* 2 full AMPDUs (and also more than the number of RX pages in chip) */
+#ifndef MAX_PKTS_PER_RX_TXN
+#define MAX_PKTS_PER_RX_TXN	32
+#endif
+
 /* Enable to support benchmarking the interface */
 
 #define MORSE_YAPS_SUPPORTS_BENCHMARK
@@ -70,6 +82,20 @@ struct morse_yaps {
 	struct morse_skbq cmd_q;
 	struct morse_skbq cmd_resp_q;
 
+	/* Used to communicate with lower yaps_hw layer */
+	struct morse_yaps_pkt to_chip_pkts[MAX_PKTS_PER_TX_TXN];
+	struct morse_yaps_pkt from_chip_pkts[MAX_PKTS_PER_RX_TXN];
+
+	/**
+	 * @tx_batch: Adaptive to-chip batching, per to-chip queue
+	 * @tx_batch.avg_pkt_len: Running average of the packet length (bytes)
+	 * @tx_batch.last: Size of the last batch taken from the skbq
+	 */
+	struct {
+		u32 avg_pkt_len;
+		u16 last;
+	} tx_batch[MORSE_YAPS_NUM_TC_Q];
+
 #ifdef MORSE_YAPS_SUPPORTS_BENCHMARK
 	atomic_t benchmark_cnt_fc;
 	atomic_t benchmark_cnt_tc;
@@ -134,6 +160,19 @@ struct morse_yaps_ops {
 	 */
 	int (*update_status)(struct morse_yaps *yaps);
 
+	/**
+	 * Estimates how many packets could be written to a to-chip queue right now, using the
+	 * pool and queue space from the last status register read.
+	 *
+	 * @yaps: Pointer to yaps instance
+	 * @tc_queue: To-chip queue the packets are for
+	 * @pkt_len: Expected packet length (bytes)
+	 *
+	 * Return: number of packets
+	 */
+	int (*tx_space)(struct morse_yaps *yaps, enum morse_yaps_to_chip_q tc_queue,
+			unsigned int pkt_len);
+
 	/**
 	 * Print debugging info to file
 	 *
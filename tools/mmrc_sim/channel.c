@@ -0,0 +1,200 @@
+/*
+ * Copyright 2022 Morse Micro
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <math.h>
+
+#include "channel.h"
+
+/** Duration of an S1G 1MHz preamble (14 symbols) in microseconds */
+#define PREAMBLE_1MHZ_US 560
+
+/** Duration of an S1G short preamble (6 symbols) in microseconds */
+#define PREAMBLE_SHORT_US 240
+
+/** S1G SIFS in microseconds */
+#define SIFS_US 160
+
+/** Average channel access time (AIFS plus half of CWmin slots) in microseconds */
+#define CHANNEL_ACCESS_US (264 + (15 * 52) / 2)
+
+/** Slope of the PER curve around the MCS threshold, per dB */
+#define PER_SLOPE_PER_DB 2.0
+
+/** The noise floor rises by this much each time the bandwidth doubles */
+#define SNR_PENALTY_PER_BW_DB 3.0
+
+/** Short guard interval needs slightly more SNR */
+#define SNR_PENALTY_SGI_DB 1.0
+
+/**
+ * SNR in dB at which 1MHz MCS0..MCS10 reach 50% PER, indexed by MCS. Loosely
+ * follows the 802.11ah receiver minimum sensitivity steps.
+ */
+static const double snr_threshold_1mhz[MMRC_MCS_UNUSED] = {
+	2.0, 5.0, 7.5, 10.5, 14.0, 17.5, 19.0, 20.5, 24.0, 26.0, -1.0
+};
+
+static int read_lines(const char *path, int (*parse)(void *ctx, const char *line), void *ctx)
+{
+	char line[256];
+	int lineno = 0;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		const char *p = line;
+
+		lineno++;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '#' || *p == '\n' || *p == '\0')
+			continue;
+
+		if (parse(ctx, p)) {
+			fprintf(stderr, "%s:%d: invalid line\n", path, lineno);
+			fclose(f);
+			return -1;
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
+
+void channel_init(struct channel_model *ch, double snr_db)
+{
+	memset(ch, 0, sizeof(*ch));
+	ch->snr_db = snr_db;
+}
+
+void channel_free(struct channel_model *ch)
+{
+	free(ch->fading);
+	ch->fading = NULL;
+	ch->n_fading = 0;
+}
+
+enum mmrc_bw channel_bw_from_mhz(u32 bw_mhz)
+{
+	switch (bw_mhz) {
+	case 1:
+		return MMRC_BW_1MHZ;
+	case 2:
+		return MMRC_BW_2MHZ;
+	case 4:
+		return MMRC_BW_4MHZ;
+	case 8:
+		return MMRC_BW_8MHZ;
+	default:
+		return MMRC_BW_MAX;
+	}
+}
+
+static int parse_per_line(void *ctx, const char *line)
+{
+	struct channel_model *ch = ctx;
+	unsigned int bw_mhz, mcs;
+	double per;
+	enum mmrc_bw bw;
+
+	if (sscanf(line, "%u %u %lf", &bw_mhz, &mcs, &per) != 3)
+		return -1;
+
+	bw = channel_bw_from_mhz(bw_mhz);
+	if (bw == MMRC_BW_MAX || mcs >= MMRC_MCS_UNUSED || per < 0.0 || per > 1.0)
+		return -1;
+
+	ch->per[bw][mcs] = per;
+	ch->per_set[bw][mcs] = true;
+	return 0;
+}
+
+int channel_load_per_table(struct channel_model *ch, const char *path)
+{
+	return read_lines(path, parse_per_line, ch);
+}
+
+static int parse_fading_line(void *ctx, const char *line)
+{
+	struct channel_model *ch = ctx;
+	struct channel_fading_point *fading;
+	unsigned int time_ms;
+	double snr_db;
+
+	if (sscanf(line, "%u %lf", &time_ms, &snr_db) != 2)
+		return -1;
+
+	if (ch->n_fading && ch->fading[ch->n_fading - 1].time_ms > time_ms)
+		return -1;
+
+	fading = realloc(ch->fading, (ch->n_fading + 1) * sizeof(*fading));
+	if (!fading)
+		return -1;
+
+	fading[ch->n_fading].time_ms = time_ms;
+	fading[ch->n_fading].snr_db = snr_db;
+	ch->fading = fading;
+	ch->n_fading++;
+	return 0;
+}
+
+int channel_load_fading_trace(struct channel_model *ch, const char *path)
+{
+	ch->fading_pos = 0;
+	return read_lines(path, parse_fading_line, ch);
+}
+
+double channel_snr_at(struct channel_model *ch, u32 time_ms)
+{
+	if (!ch->n_fading || time_ms < ch->fading[0].time_ms)
+		return ch->snr_db;
+
+	if (ch->fading[ch->fading_pos].time_ms > time_ms)
+		ch->fading_pos = 0;
+
+	while (ch->fading_pos + 1 < ch->n_fading &&
+	       ch->fading[ch->fading_pos + 1].time_ms <= time_ms)
+		ch->fading_pos++;
+
+	return ch->fading[ch->fading_pos].snr_db;
+}
+
+double channel_per(const struct channel_model *ch, const struct mmrc_rate *rate, double snr_db)
+{
+	double threshold;
+
+	if (rate->bw >= MMRC_BW_MAX || rate->rate >= MMRC_MCS_UNUSED)
+		return 1.0;
+
+	if (ch->per_set[rate->bw][rate->rate])
+		return ch->per[rate->bw][rate->rate];
+
+	threshold = snr_threshold_1mhz[rate->rate] + rate->bw * SNR_PENALTY_PER_BW_DB;
+	if (rate->guard == MMRC_GUARD_SHORT)
+		threshold += SNR_PENALTY_SGI_DB;
+
+	return 1.0 / (1.0 + exp(PER_SLOPE_PER_DB * (snr_db - threshold)));
+}
+
+u32 channel_airtime_us(const struct mmrc_rate *rate, size_t mpdu_len, u32 n_mpdu)
+{
+	u32 preamble = rate->bw == MMRC_BW_1MHZ ? PREAMBLE_1MHZ_US : PREAMBLE_SHORT_US;
+	u64 bps = mmrc_calculate_theoretical_throughput(*rate);
+	u64 payload_us;
+
+	if (!bps)
+		bps = mmrc_calculate_theoretical_throughput((struct mmrc_rate) {
+			.rate = MMRC_MCS0, .bw = rate->bw, .guard = rate->guard, .ss = rate->ss });
+
+	payload_us = ((u64)mpdu_len * 8 * n_mpdu * 1000000) / (bps ? bps : 1);
+
+	/* Data preamble and payload, SIFS, then an NDP ACK or BA which is preamble only */
+	return CHANNEL_ACCESS_US + preamble + (u32)payload_us + SIFS_US + preamble;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2022 Morse Micro
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+#ifndef CHANNEL_H__
+#define CHANNEL_H__
+
+#include "mmrc.h"
+
+/**
+ * A point in a fading trace, the SNR holds until the next point
+ */
+struct channel_fading_point {
+	/** Time since the start of the run in milliseconds */
+	u32 time_ms;
+
+	/** The SNR from this time on in dB */
+	double snr_db;
+};
+
+/**
+ * Channel model for a single link
+ *
+ * The packet error rate of a rate is taken from the PER table when it has an
+ * entry for the MCS and bandwidth, otherwise it is derived from the SNR, which
+ * follows the fading trace when one is loaded.
+ */
+struct channel_model {
+	/** The SNR in dB when there is no fading trace */
+	double snr_db;
+
+	/** Packet error rates overriding the SNR model, indexed by bandwidth then MCS */
+	double per[MMRC_BW_MAX][MMRC_MCS_UNUSED];
+
+	/** Whether an entry in @c per is set */
+	bool per_set[MMRC_BW_MAX][MMRC_MCS_UNUSED];
+
+	/** The fading trace, sorted by time */
+	struct channel_fading_point *fading;
+
+	/** The number of points in @c fading */
+	size_t n_fading;
+
+	/** The last trace point used, lookups are expected to move forward in time */
+	size_t fading_pos;
+};
+
+/**
+ * Initialise a channel model with a fixed SNR and no PER overrides.
+ *
+ * @param ch The channel model
+ * @param snr_db The SNR in dB
+ */
+void channel_init(struct channel_model *ch, double snr_db);
+
+/**
+ * Free the memory held by a channel model.
+ *
+ * @param ch The channel model
+ */
+void channel_free(struct channel_model *ch);
+
+/**
+ * Load PER overrides from a file with lines of "<bw_mhz> <mcs> <per>", where
+ * per is a fraction between 0 and 1. Lines starting with '#' are ignored.
+ *
+ * @param ch The channel model
+ * @param path The path of the file
+ * @returns 0 on success, otherwise -1
+ */
+int channel_load_per_table(struct channel_model *ch, const char *path);
+
+/**
+ * Load a fading trace from a file with lines of "<time_ms> <snr_db>", in
+ * increasing time order. Lines starting with '#' are ignored.
+ *
+ * @param ch The channel model
+ * @param path The path of the file
+ * @returns 0 on success, otherwise -1
+ */
+int channel_load_fading_trace(struct channel_model *ch, const char *path);
+
+/**
+ * Get the SNR of the channel at a point in time.
+ *
+ * @param ch The channel model
+ * @param time_ms Time since the start of the run in milliseconds
+ * @returns The SNR in dB
+ */
+double channel_snr_at(struct channel_model *ch, u32 time_ms);
+
+/**
+ * Get the packet error rate of an MPDU sent at a rate.
+ *
+ * @param ch The channel model
+ * @param rate The rate the MPDU is sent at
+ * @param snr_db The current SNR in dB
+ * @returns The probability of the MPDU failing, between 0 and 1
+ */
+double channel_per(const struct channel_model *ch, const struct mmrc_rate *rate, double snr_db);
+
+/**
+ * Get the airtime of a single transmission attempt, including the preamble,
+ * the acknowledgment and the average channel access time.
+ *
+ * @param rate The rate of the transmission
+ * @param mpdu_len The length of each MPDU in bytes
+ * @param n_mpdu The number of MPDUs in the transmission
+ * @returns The airtime in microseconds
+ */
+u32 channel_airtime_us(const struct mmrc_rate *rate, size_t mpdu_len, u32 n_mpdu);
+
+/**
+ * Convert a bandwidth in MHz to an MMRC bandwidth.
+ *
+ * @param bw_mhz The bandwidth in MHz
+ * @returns The MMRC bandwidth or MMRC_BW_MAX if not supported
+ */
+enum mmrc_bw channel_bw_from_mhz(u32 bw_mhz);
+
+#endif /* CHANNEL_H__ */
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2022 Morse Micro
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include "mmrc_osal.h"
+
+static u64 prng_state = 0x9E3779B97F4A7C15ull;
+
+/* xorshift64*, good enough for a channel model and cheap enough not to skew timings */
+static u64 prng_next(void)
+{
+	prng_state ^= prng_state >> 12;
+	prng_state ^= prng_state << 25;
+	prng_state ^= prng_state >> 27;
+	return prng_state * 0x2545F4914F6CDD1Dull;
+}
+
+void osal_mmrc_set_seed(u64 seed)
+{
+	/* xorshift must not be seeded with zero */
+	prng_state = seed ? seed : 0x9E3779B97F4A7C15ull;
+}
+
+void osal_mmrc_seed_random(void)
+{
+	/* Seeded once up front by osal_mmrc_set_seed() to keep runs reproducible */
+}
+
+u32 osal_mmrc_random_u32(u32 max)
+{
+	if (!max)
+		return 0;
+
+	return (u32)((prng_next() >> 32) % max);
+}
+
+double osal_mmrc_random_unit(void)
+{
+	return (prng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2022 Morse Micro
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+#ifndef MMRC_OSAL_H__
+#define MMRC_OSAL_H__
+
+/*
+ * Userspace OSAL for building the MMRC core outside of the kernel. It mirrors
+ * the driver's mmrc/mmrc_osal.h but uses a seeded PRNG so runs are repeatable.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+
+#define BIT_COUNT(_x) (__builtin_popcountl(_x))
+
+#ifndef min
+#define min(_a, _b) ((_a) < (_b) ? (_a) : (_b))
+#endif
+
+#ifndef max
+#define max(_a, _b) ((_a) > (_b) ? (_a) : (_b))
+#endif
+
+#ifndef MMRC_OSAL_ASSERT
+#define MMRC_OSAL_ASSERT(_x) assert(_x)
+#endif
+
+#ifndef MMRC_OSAL_PR_ERR
+#define MMRC_OSAL_PR_ERR(...) fprintf(stderr, __VA_ARGS__)
+#endif
+
+/**
+ * Seed the PRNG used by both MMRC and the channel model.
+ *
+ * @param seed The seed, the same seed gives the same run
+ */
+void osal_mmrc_set_seed(u64 seed);
+
+void osal_mmrc_seed_random(void);
+
+/**
+ * Function to retrieve a random 32bit number between 0 and @c max.
+ *
+ * @param max Maximum value (exclusive)
+ *
+ * @returns A randomly generated integer (0 <= i < max).
+ */
+u32 osal_mmrc_random_u32(u32 max);
+
+/**
+ * Retrieve a uniformly distributed random number in [0, 1).
+ */
+double osal_mmrc_random_unit(void);
+
+#endif /* MMRC_OSAL_H__ */
@@ -0,0 +1,659 @@
+/*
+ * Copyright 2022 Morse Micro
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+/*
+ * Userspace simulator and benchmark for the MMRC core.
+ *
+ * In live mode MMRC drives a single link over the channel model: each frame is
+ * sent along the retry chain returned by mmrc_get_rates(), the outcome of every
+ * attempt is drawn from the PER of its rate and the result is fed back with
+ * mmrc_feedback() or mmrc_feedback_agg(). In replay mode the feedback comes
+ * from a log instead. Either way mmrc_update() runs every
+ * MMRC_UPDATE_FREQUENCY_MS of simulated time, as morse_rc_work does.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+
+#include "mmrc.h"
+#include "channel.h"
+
+#define DEFAULT_DURATION_S	60
+#define DEFAULT_SNR_DB		20.0
+#define DEFAULT_MAX_BW_MHZ	8
+#define DEFAULT_MCS_MASK	(MMRC_MASK(MMRC_MCS10) | 0xFF)
+#define DEFAULT_MPDU_LEN	1500
+#define DEFAULT_SEED		1
+
+/** Fraction of the best achievable goodput the chosen rate must reach to count as converged */
+#define CONVERGED_GOODPUT_PCT	90
+
+/** Number of consecutive updates the chosen rate must hold to count as converged */
+#define CONVERGED_UPDATES	10
+
+#define US_PER_MS		1000
+#define NS_PER_S		1000000000ull
+
+struct sim_config {
+	u32 duration_ms;
+	double snr_db;
+	u32 max_bw_mhz;
+	bool sgi;
+	u16 mcs_mask;
+	u32 max_rates;
+	u32 mpdu_len;
+	u32 ampdu_len;
+	u64 seed;
+	bool verbose;
+	const char *per_path;
+	const char *fading_path;
+	const char *replay_path;
+};
+
+/** Timing samples of one MMRC entry point */
+struct sim_cost {
+	u64 *samples_ns;
+	size_t n_samples;
+	size_t cap;
+	u64 total_ns;
+	u64 max_ns;
+	u64 calls;
+	/** Keep every sample for percentiles, otherwise only totals */
+	bool keep_samples;
+};
+
+struct sim_stats {
+	u64 now_us;
+	u64 delivered_bits;
+	u64 mpdus_ok;
+	u64 mpdus_failed;
+
+	/* Convergence to the best achievable rate, live mode only */
+	double sum_goodput_ratio;
+	u32 n_goodput_ratio;
+	int oracle_index;
+	u64 event_start_us;
+	u64 first_ok_us;
+	u32 ok_run;
+	bool converged;
+	u32 n_events;
+	u32 n_converged;
+	u64 sum_converge_us;
+	u64 max_converge_us;
+
+	u32 best_rate_changes;
+	u16 last_best_index;
+
+	struct sim_cost update_cost;
+	struct sim_cost get_rates_cost;
+};
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+static void cost_add(struct sim_cost *cost, u64 ns)
+{
+	cost->calls++;
+	cost->total_ns += ns;
+	if (ns > cost->max_ns)
+		cost->max_ns = ns;
+
+	if (!cost->keep_samples)
+		return;
+
+	if (cost->n_samples == cost->cap) {
+		size_t cap = cost->cap ? cost->cap * 2 : 1024;
+		u64 *samples = realloc(cost->samples_ns, cap * sizeof(*samples));
+
+		if (!samples) {
+			cost->keep_samples = false;
+			return;
+		}
+		cost->samples_ns = samples;
+		cost->cap = cap;
+	}
+	cost->samples_ns[cost->n_samples++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void cost_report(const char *name, struct sim_cost *cost)
+{
+	if (!cost->calls) {
+		printf("%-16s no calls\n", name);
+		return;
+	}
+
+	printf("%-16s calls %llu, mean %llu ns", name, (unsigned long long)cost->calls,
+	       (unsigned long long)(cost->total_ns / cost->calls));
+
+	if (cost->keep_samples && cost->n_samples) {
+		qsort(cost->samples_ns, cost->n_samples, sizeof(*cost->samples_ns), cmp_u64);
+		printf(", p50 %llu ns, p99 %llu ns",
+		       (unsigned long long)cost->samples_ns[cost->n_samples / 2],
+		       (unsigned long long)cost->samples_ns[(cost->n_samples * 99) / 100]);
+	}
+
+	printf(", max %llu ns\n", (unsigned long long)cost->max_ns);
+}
+
+static void fill_caps(const struct sim_config *cfg, struct mmrc_sta_capabilities *caps)
+{
+	u32 bw_mhz;
+
+	memset(caps, 0, sizeof(*caps));
+	caps->rates = cfg->mcs_mask;
+	caps->spatial_streams = MMRC_MASK(MMRC_SPATIAL_STREAM_1);
+	caps->max_rates = cfg->max_rates;
+	caps->max_retries = MMRC_MAX_CHAIN_ATTEMPTS;
+	caps->guard = MMRC_MASK(MMRC_GUARD_LONG);
+
+	/* Same as the driver, every bandwidth up to the operating bandwidth */
+	for (bw_mhz = cfg->max_bw_mhz; bw_mhz > 0; bw_mhz >>= 1) {
+		enum mmrc_bw bw = channel_bw_from_mhz(bw_mhz);
+
+		caps->bandwidth |= MMRC_MASK(bw);
+		if (cfg->sgi) {
+			caps->sgi_per_bw |= SGI_PER_BW(bw);
+			caps->guard |= MMRC_MASK(MMRC_GUARD_SHORT);
+		}
+	}
+}
+
+/**
+ * Expected goodput of a rate in bps for single MPDU or A-MPDU transmissions,
+ * ignoring retries.
+ */
+static double expected_goodput(const struct sim_config *cfg, const struct channel_model *ch,
+			       const struct mmrc_rate *rate, double snr_db)
+{
+	double per = channel_per(ch, rate, snr_db);
+	u32 airtime = channel_airtime_us(rate, cfg->mpdu_len, cfg->ampdu_len);
+
+	return (1.0 - per) * cfg->mpdu_len * 8.0 * cfg->ampdu_len * 1e6 / airtime;
+}
+
+/** Find the row with the best expected goodput, which MMRC should converge to */
+static int oracle_row(const struct sim_config *cfg, const struct channel_model *ch,
+		      struct mmrc_table *tb, double snr_db, double *goodput)
+{
+	u16 rows = rows_from_sta_caps(&tb->caps);
+	int best = -1;
+	u16 i;
+
+	*goodput = 0.0;
+	for (i = 0; i < rows; i++) {
+		struct mmrc_rate rate = get_rate_row(tb, i);
+		double tp;
+
+		if (!validate_rate(tb, &rate))
+			continue;
+
+		tp = expected_goodput(cfg, ch, &rate, snr_db);
+		if (best < 0 || tp > *goodput) {
+			*goodput = tp;
+			best = rate.index;
+		}
+	}
+
+	return best;
+}
+
+static void print_rate(const char *prefix, const struct mmrc_rate *rate)
+{
+	printf("%sMCS%u %uMHz %s", prefix, rate->rate, 1u << rate->bw,
+	       rate->guard == MMRC_GUARD_SHORT ? "SGI" : "LGI");
+}
+
+static void track_best_rate(struct sim_stats *stats, struct mmrc_table *tb)
+{
+	struct mmrc_rate best = mmrc_sta_get_best_rate(tb);
+
+	if (best.index != stats->last_best_index) {
+		stats->best_rate_changes++;
+		stats->last_best_index = best.index;
+	}
+}
+
+static void track_convergence(const struct sim_config *cfg, struct channel_model *ch,
+			      struct sim_stats *stats, struct mmrc_table *tb)
+{
+	double snr_db = channel_snr_at(ch, stats->now_us / US_PER_MS);
+	struct mmrc_rate best = mmrc_sta_get_best_rate(tb);
+	double oracle_tp, best_tp;
+	int oracle;
+
+	oracle = oracle_row(cfg, ch, tb, snr_db, &oracle_tp);
+	best_tp = expected_goodput(cfg, ch, &best, snr_db);
+
+	if (oracle != stats->oracle_index) {
+		/* The best achievable rate moved, time how long MMRC takes to follow */
+		stats->oracle_index = oracle;
+		stats->event_start_us = stats->now_us;
+		stats->ok_run = 0;
+		stats->converged = false;
+		stats->n_events++;
+	}
+
+	if (oracle_tp > 0.0) {
+		stats->sum_goodput_ratio += best_tp / oracle_tp;
+		stats->n_goodput_ratio++;
+	}
+
+	if (cfg->verbose) {
+		printf("%8llu ms snr %5.1f dB", (unsigned long long)(stats->now_us / US_PER_MS),
+		       snr_db);
+		print_rate(" best ", &best);
+		printf(" %7.1f kbps, achievable %7.1f kbps\n", best_tp / 1000, oracle_tp / 1000);
+	}
+
+	if (stats->converged)
+		return;
+
+	if (best_tp * 100 < oracle_tp * CONVERGED_GOODPUT_PCT) {
+		stats->ok_run = 0;
+		return;
+	}
+
+	if (!stats->ok_run++)
+		stats->first_ok_us = stats->now_us;
+
+	if (stats->ok_run >= CONVERGED_UPDATES) {
+		u64 converge_us = stats->first_ok_us - stats->event_start_us;
+
+		stats->converged = true;
+		stats->n_converged++;
+		stats->sum_converge_us += converge_us;
+		if (converge_us > stats->max_converge_us)
+			stats->max_converge_us = converge_us;
+	}
+}
+
+static void run_update(const struct sim_config *cfg, struct channel_model *ch,
+		       struct sim_stats *stats, struct mmrc_table *tb)
+{
+	u64 start = now_ns();
+
+	mmrc_update(tb);
+	cost_add(&stats->update_cost, now_ns() - start);
+
+	track_best_rate(stats, tb);
+	if (ch)
+		track_convergence(cfg, ch, stats, tb);
+}
+
+/**
+ * Send one frame along the retry chain over the channel and feed the outcome
+ * back to MMRC.
+ */
+static void send_frame(const struct sim_config *cfg, struct channel_model *ch,
+		       struct sim_stats *stats, struct mmrc_table *tb)
+{
+	struct mmrc_rate_table rt;
+	double snr_db = channel_snr_at(ch, stats->now_us / US_PER_MS);
+	u32 retry_count = 0;
+	u32 success = 0;
+	u64 start;
+	int i, a;
+
+	start = now_ns();
+	mmrc_get_rates(tb, &rt, cfg->mpdu_len);
+	cost_add(&stats->get_rates_cost, now_ns() - start);
+
+	for (i = 0; i < MMRC_MAX_CHAIN_LENGTH && !success; i++) {
+		struct mmrc_rate *rate = &rt.rates[i];
+		double per;
+
+		if (rate->rate == MMRC_MCS_UNUSED)
+			break;
+
+		per = channel_per(ch, rate, snr_db);
+		for (a = 0; a < rate->attempts && !success; a++) {
+			u32 m;
+
+			retry_count++;
+			stats->now_us += channel_airtime_us(rate, cfg->mpdu_len, cfg->ampdu_len);
+
+			/* An A-MPDU attempt succeeds if any MPDU gets through and is acknowledged */
+			for (m = 0; m < cfg->ampdu_len; m++)
+				if (osal_mmrc_random_unit() >= per)
+					success++;
+		}
+	}
+
+	/*
+	 * Report one attempt past the end of the chain when every attempt failed, so
+	 * MMRC counts all of them as failures.
+	 */
+	if (!success)
+		retry_count++;
+
+	if (cfg->ampdu_len > 1)
+		mmrc_feedback_agg(tb, &rt, retry_count, success, cfg->ampdu_len - success);
+	else
+		mmrc_feedback(tb, &rt, retry_count);
+
+	stats->mpdus_ok += success;
+	stats->mpdus_failed += cfg->ampdu_len - success;
+	stats->delivered_bits += (u64)success * cfg->mpdu_len * 8;
+}
+
+static int run_live(const struct sim_config *cfg, struct channel_model *ch,
+		    struct sim_stats *stats, struct mmrc_table *tb)
+{
+	u64 end_us = (u64)cfg->duration_ms * US_PER_MS;
+	u64 next_update_us = MMRC_UPDATE_FREQUENCY_MS * US_PER_MS;
+
+	while (stats->now_us < end_us) {
+		send_frame(cfg, ch, stats, tb);
+
+		while (stats->now_us >= next_update_us && next_update_us <= end_us) {
+			u64 now_us = stats->now_us;
+
+			/* Account the update at the time it was due */
+			stats->now_us = next_update_us;
+			run_update(cfg, ch, stats, tb);
+			stats->now_us = now_us;
+			next_update_us += MMRC_UPDATE_FREQUENCY_MS * US_PER_MS;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Replay log format, one TX status per line:
+ *
+ *   <time_ms> <retry_count> <ampdu_success> <ampdu_failure> <rate> [<rate> ...]
+ *
+ * where each rate of the retry chain is "<mcs>,<bw_mhz>,<sgi>,<attempts>" and
+ * ampdu_success and ampdu_failure are both 0 for frames sent outside an A-MPDU.
+ */
+static int parse_replay_line(const char *line, u32 *time_ms, struct mmrc_rate_table *rt,
+			     u32 *retry_count, u32 *success, u32 *failure)
+{
+	int consumed;
+	int i;
+
+	if (sscanf(line, "%u %u %u %u%n", time_ms, retry_count, success, failure, &consumed) != 4)
+		return -1;
+
+	memset(rt, 0, sizeof(*rt));
+	for (i = 0; i < MMRC_MAX_CHAIN_LENGTH; i++)
+		rt->rates[i].rate = MMRC_MCS_UNUSED;
+
+	for (i = 0; i < MMRC_MAX_CHAIN_LENGTH; i++) {
+		unsigned int mcs, bw_mhz, sgi, attempts;
+		enum mmrc_bw bw;
+		int n;
+
+		line += consumed;
+		if (sscanf(line, " %u,%u,%u,%u%n", &mcs, &bw_mhz, &sgi, &attempts, &n) != 4)
+			break;
+		consumed = n;
+
+		bw = channel_bw_from_mhz(bw_mhz);
+		if (bw == MMRC_BW_MAX || mcs >= MMRC_MCS_UNUSED)
+			return -1;
+
+		rt->rates[i].rate = MMRC_RATE_TO_BITFIELD(mcs);
+		rt->rates[i].bw = MMRC_BW_TO_BITFIELD(bw);
+		rt->rates[i].guard = MMRC_GUARD_TO_BITFIELD(sgi ? MMRC_GUARD_SHORT : MMRC_GUARD_LONG);
+		rt->rates[i].ss = MMRC_SS_TO_BITFIELD(MMRC_SPATIAL_STREAM_1);
+		rt->rates[i].attempts = MMRC_ATTEMPTS_TO_BITFIELD(attempts);
+	}
+
+	return i ? 0 : -1;
+}
+
+static int run_replay(const struct sim_config *cfg, struct sim_stats *stats,
+		      struct mmrc_table *tb)
+{
+	u64 next_update_us = MMRC_UPDATE_FREQUENCY_MS * US_PER_MS;
+	char line[256];
+	int lineno = 0;
+	FILE *f = fopen(cfg->replay_path, "r");
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s\n", cfg->replay_path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct mmrc_rate_table rt;
+		u32 time_ms, retry_count, success, failure, total_attempts = 0;
+		int i;
+
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (parse_replay_line(line, &time_ms, &rt, &retry_count, &success, &failure)) {
+			fprintf(stderr, "%s:%d: invalid line\n", cfg->replay_path, lineno);
+			fclose(f);
+			return -1;
+		}
+
+		stats->now_us = (u64)time_ms * US_PER_MS;
+		while (stats->now_us >= next_update_us) {
+			u64 now_us = stats->now_us;
+
+			stats->now_us = next_update_us;
+			run_update(cfg, NULL, stats, tb);
+			if (cfg->verbose) {
+				struct mmrc_rate best = mmrc_sta_get_best_rate(tb);
+
+				printf("%8llu ms", (unsigned long long)(next_update_us / US_PER_MS));
+				print_rate(" best ", &best);
+				printf("\n");
+			}
+			stats->now_us = now_us;
+			next_update_us += MMRC_UPDATE_FREQUENCY_MS * US_PER_MS;
+		}
+
+		for (i = 0; i < MMRC_MAX_CHAIN_LENGTH; i++)
+			if (rt.rates[i].rate != MMRC_MCS_UNUSED)
+				total_attempts += rt.rates[i].attempts;
+
+		if (success + failure) {
+			mmrc_feedback_agg(tb, &rt, retry_count, success, failure);
+		} else {
+			mmrc_feedback(tb, &rt, retry_count);
+			success = retry_count <= total_attempts;
+			failure = !success;
+		}
+
+		stats->mpdus_ok += success;
+		stats->mpdus_failed += failure;
+		stats->delivered_bits += (u64)success * cfg->mpdu_len * 8;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void report(const struct sim_config *cfg, struct sim_stats *stats, struct mmrc_table *tb)
+{
+	struct mmrc_rate best = mmrc_sta_get_best_rate(tb);
+	double duration_s = stats->now_us / 1e6;
+
+	printf("mode             %s\n", cfg->replay_path ? "replay" : "live");
+	printf("seed             %llu\n", (unsigned long long)cfg->seed);
+	printf("duration         %.1f s\n", duration_s);
+	printf("goodput          %.1f kbps (%llu MPDUs delivered, %llu failed)\n",
+	       duration_s > 0 ? stats->delivered_bits / duration_s / 1000 : 0.0,
+	       (unsigned long long)stats->mpdus_ok, (unsigned long long)stats->mpdus_failed);
+
+	if (!cfg->replay_path) {
+		printf("efficiency       %.1f%% of best achievable goodput\n",
+		       stats->n_goodput_ratio ?
+		       100.0 * stats->sum_goodput_ratio / stats->n_goodput_ratio : 0.0);
+		printf("convergence      %u of %u channel changes",
+		       stats->n_converged, stats->n_events);
+		if (stats->n_converged)
+			printf(", mean %llu ms, max %llu ms",
+			       (unsigned long long)(stats->sum_converge_us / stats->n_converged /
+						    US_PER_MS),
+			       (unsigned long long)(stats->max_converge_us / US_PER_MS));
+		printf("\n");
+	}
+
+	printf("best rate        ");
+	print_rate("", &best);
+	printf(", changed %u times\n", stats->best_rate_changes);
+
+	cost_report("mmrc_update", &stats->update_cost);
+	cost_report("mmrc_get_rates", &stats->get_rates_cost);
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "  -d <seconds>   simulated duration (default %u)\n"
+	       "  -s <dB>        SNR when no fading trace is given (default %.1f)\n"
+	       "  -b <MHz>       operating bandwidth, 1, 2, 4 or 8 (default %u)\n"
+	       "  -g             enable short guard interval\n"
+	       "  -m <mask>      supported MCS bitmask (default 0x%x)\n"
+	       "  -c <n>         retry chain length, 1 to %u (default %u)\n"
+	       "  -l <bytes>     MPDU length (default %u)\n"
+	       "  -a <n>         MPDUs per A-MPDU, 1 disables aggregation (default 1)\n"
+	       "  -p <file>      PER table, lines of \"<bw_mhz> <mcs> <per>\"\n"
+	       "  -f <file>      fading trace, lines of \"<time_ms> <snr_db>\"\n"
+	       "  -r <file>      replay a TX status log instead of the channel model\n"
+	       "  -S <seed>      PRNG seed (default %u)\n"
+	       "  -v             print the chosen rate at every update\n"
+	       "  -h             show this help\n",
+	       prog, DEFAULT_DURATION_S, DEFAULT_SNR_DB, DEFAULT_MAX_BW_MHZ, DEFAULT_MCS_MASK,
+	       MMRC_MAX_CHAIN_LENGTH, MMRC_MAX_CHAIN_LENGTH, DEFAULT_MPDU_LEN, DEFAULT_SEED);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sim_config cfg = {
+		.duration_ms = DEFAULT_DURATION_S * 1000,
+		.snr_db = DEFAULT_SNR_DB,
+		.max_bw_mhz = DEFAULT_MAX_BW_MHZ,
+		.mcs_mask = DEFAULT_MCS_MASK,
+		.max_rates = MMRC_MAX_CHAIN_LENGTH,
+		.mpdu_len = DEFAULT_MPDU_LEN,
+		.ampdu_len = 1,
+		.seed = DEFAULT_SEED,
+	};
+	struct sim_stats stats;
+	struct channel_model ch;
+	struct mmrc_sta_capabilities caps;
+	struct mmrc_table *tb;
+	int ret;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:s:b:gm:c:l:a:p:f:r:S:vh")) != -1) {
+		switch (opt) {
+		case 'd':
+			cfg.duration_ms = strtoul(optarg, NULL, 0) * 1000;
+			break;
+		case 's':
+			cfg.snr_db = strtod(optarg, NULL);
+			break;
+		case 'b':
+			cfg.max_bw_mhz = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			cfg.sgi = true;
+			break;
+		case 'm':
+			cfg.mcs_mask = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cfg.max_rates = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			cfg.mpdu_len = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			cfg.ampdu_len = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			cfg.per_path = optarg;
+			break;
+		case 'f':
+			cfg.fading_path = optarg;
+			break;
+		case 'r':
+			cfg.replay_path = optarg;
+			break;
+		case 'S':
+			cfg.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			cfg.verbose = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (channel_bw_from_mhz(cfg.max_bw_mhz) == MMRC_BW_MAX ||
+	    cfg.max_rates < 1 || cfg.max_rates > MMRC_MAX_CHAIN_LENGTH ||
+	    !cfg.mpdu_len || !cfg.ampdu_len || !cfg.duration_ms ||
+	    !(cfg.mcs_mask & (MMRC_MASK(MMRC_MCS_UNUSED) - 1))) {
+		fprintf(stderr, "Invalid configuration\n");
+		usage(argv[0]);
+		return 1;
+	}
+	cfg.mcs_mask &= MMRC_MASK(MMRC_MCS_UNUSED) - 1;
+
+	osal_mmrc_set_seed(cfg.seed);
+
+	channel_init(&ch, cfg.snr_db);
+	if ((cfg.per_path && channel_load_per_table(&ch, cfg.per_path)) ||
+	    (cfg.fading_path && channel_load_fading_trace(&ch, cfg.fading_path))) {
+		channel_free(&ch);
+		return 1;
+	}
+
+	fill_caps(&cfg, &caps);
+	tb = calloc(1, mmrc_memory_required_for_caps(&caps));
+	if (!tb) {
+		channel_free(&ch);
+		return 1;
+	}
+	/* The starting rate depends on RSSI, approximate it from the SNR and a -95dBm noise floor */
+	mmrc_sta_init(tb, &caps, (s8)fmax(-128.0, fmin(0.0, cfg.snr_db - 95.0)));
+
+	memset(&stats, 0, sizeof(stats));
+	stats.oracle_index = -1;
+	stats.last_best_index = mmrc_sta_get_best_rate(tb).index;
+	stats.update_cost.keep_samples = true;
+
+	if (cfg.replay_path)
+		ret = run_replay(&cfg, &stats, tb);
+	else
+		ret = run_live(&cfg, &ch, &stats, tb);
+
+	if (!ret)
+		report(&cfg, &stats, tb);
+
+	free(stats.update_cost.samples_ns);
+	free(tb);
+	channel_free(&ch);
+	return ret ? 1 : 0;
+}
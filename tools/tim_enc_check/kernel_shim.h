@@ -0,0 +1,65 @@
+/*
+ * Copyright 2020 Morse Micro
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef TIM_ENC_CHECK_KERNEL_SHIM_H__
+#define TIM_ENC_CHECK_KERNEL_SHIM_H__
+
+/*
+ * The small part of the kernel API that dot11ah/tim.c uses, so the TIM encoders can be built as a
+ * userspace program.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+
+#define __packed		__attribute__((packed))
+#define likely(_x)		__builtin_expect(!!(_x), 1)
+#define unlikely(_x)		__builtin_expect(!!(_x), 0)
+#define ARRAY_SIZE(_a)		(sizeof(_a) / sizeof((_a)[0]))
+#define GENMASK(_h, _l) \
+	(((~0UL) << (_l)) & (~0UL >> (sizeof(long) * 8 - 1 - (_h))))
+
+#define min(_a, _b)		((_a) < (_b) ? (_a) : (_b))
+#define min_t(_t, _a, _b)	min((_t)(_a), (_t)(_b))
+#define hweight8(_x)		__builtin_popcount((u8)(_x))
+
+static inline unsigned long __ffs(unsigned long word)
+{
+	return __builtin_ctzl(word);
+}
+
+#define module_param(_name, _type, _perm)
+#define MODULE_PARM_DESC(_name, _desc)
+#define EXPORT_SYMBOL(_sym)
+
+/* The encoders log unsupported combinations, which the harness generates on purpose */
+static inline void dot11ah_err(const char *fmt, ...)
+{
+}
+
+#define AID_LIMIT		(2007)
+
+struct ieee80211_tim_ie {
+	u8 dtim_count;
+	u8 dtim_period;
+	u8 bitmap_ctrl;
+	u8 virtual_map[1];
+} __packed;
+
+struct ieee80211_vif;
+struct dot11ah_ies_mask;
+
+#endif /* TIM_ENC_CHECK_KERNEL_SHIM_H__ */
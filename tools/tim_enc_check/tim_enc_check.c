@@ -0,0 +1,263 @@
+/*
+ * Copyright 2020 Morse Micro
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+ * Equivalence check and benchmark for the 11n->S1G TIM encoders in dot11ah/tim.c.
+ *
+ * Random 11n TIMs (bitmap offset, length, density, broadcast bit) are encoded with random
+ * encoding modes, inverse flag, max AID, page slice and page index by both the driver encoder and
+ * the reference per-AID encoder in tim_ref.c, and the elements must be byte-identical. The cached
+ * conversion is checked against a fresh one, and per block mode selection must never give a
+ * longer element than block bitmap mode.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "kernel_shim.h"
+#include "tim.h"
+
+/* Generated from the driver's dot11ah/tim.c, see the Makefile */
+#include "tim_new.c"
+#include "tim_ref.c"
+
+#define DEFAULT_ITERATIONS	200000
+#define DEFAULT_SEED		1
+
+/* Octets of 11n partial virtual bitmap needed to cover AIDs 0..AID_LIMIT */
+#define MAX_VIRTUAL_MAP_LEN	((AID_LIMIT / 8) + 1)
+
+#define NS_PER_S		1000000000ull
+
+struct tim_input {
+	union {
+		struct ieee80211_tim_ie tim;
+		u8 raw[3 + DOT11_MAX_TIM_VIRTUAL_MAP_LENGTH];
+	};
+	u8 virtual_map_len;
+	enum dot11ah_tim_encoding_mode enc_mode;
+	bool inverse_bitmap;
+	u16 max_aid;
+	u8 page_slice_no;
+	u8 page_index;
+};
+
+static u64 prng_state;
+
+static u32 random_u32(u32 max)
+{
+	/* xorshift64* */
+	prng_state ^= prng_state >> 12;
+	prng_state ^= prng_state << 25;
+	prng_state ^= prng_state >> 27;
+
+	return (u32)((prng_state * 0x2545F4914F6CDD1Dull) >> 32) % max;
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/* Fill an octet of the virtual bitmap. Sparse maps look like a few dozing STAs, dense like many */
+static u8 random_octet(u32 density)
+{
+	u8 octet = 0;
+	int bit;
+
+	for (bit = 0; bit < 8; bit++)
+		if (random_u32(100) < density)
+			octet |= 1 << bit;
+
+	return octet;
+}
+
+static void random_input(struct tim_input *in)
+{
+	static const u32 densities[] = { 0, 2, 10, 50, 90, 100 };
+	u32 density = densities[random_u32(ARRAY_SIZE(densities))];
+	u8 octet_offset = 2 * random_u32(MAX_VIRTUAL_MAP_LEN / 2 + 1);
+	u8 max_len = octet_offset < MAX_VIRTUAL_MAP_LEN ? MAX_VIRTUAL_MAP_LEN - octet_offset : 0;
+	u16 highest_aid;
+	int i;
+
+	memset(in, 0, sizeof(*in));
+
+	/* Mostly short maps, as mac80211 trims them, with the occasional full length one */
+	in->virtual_map_len = max_len ? random_u32(random_u32(4) ? min(max_len, 16) + 1 :
+					       max_len + 1) : 0;
+	in->tim.dtim_count = random_u32(256);
+	in->tim.dtim_period = random_u32(256);
+	in->tim.bitmap_ctrl = octet_offset | random_u32(2);
+
+	for (i = 0; i < in->virtual_map_len; i++)
+		in->tim.virtual_map[i] = random_octet(density);
+
+	in->enc_mode = random_u32(4);
+	in->inverse_bitmap = random_u32(4) == 0;
+
+	/* The largest AID in use is at least the one at the end of the map */
+	highest_aid = min((octet_offset + in->virtual_map_len) * 8, AID_LIMIT);
+	in->max_aid = highest_aid + random_u32(AID_LIMIT - highest_aid + 1);
+	in->page_slice_no = random_u32(32);
+	in->page_index = random_u32(4);
+}
+
+static void dump_bytes(const char *name, const u8 *data, int len)
+{
+	int i;
+
+	fprintf(stderr, "%s (%d):", name, len);
+	for (i = 0; i < len; i++)
+		fprintf(stderr, "%s%02x", i % 32 ? " " : "\n  ", data[i]);
+	fprintf(stderr, "\n");
+}
+
+static void dump_mismatch(const char *what, const struct tim_input *in,
+			  const struct dot11ah_s1g_tim_ie *expected, int expected_len,
+			  const struct dot11ah_s1g_tim_ie *actual, int actual_len)
+{
+	fprintf(stderr, "MISMATCH (%s): enc_mode %d inverse %d max_aid %u slice %u page %u\n",
+		what, in->enc_mode, in->inverse_bitmap, in->max_aid, in->page_slice_no,
+		in->page_index);
+	dump_bytes("11n TIM", in->raw, 3 + in->virtual_map_len);
+	dump_bytes("expected", (const u8 *)expected, expected_len);
+	dump_bytes("actual", (const u8 *)actual, actual_len);
+}
+
+static int encode_new(const struct tim_input *in, struct dot11ah_s1g_tim_ie *out)
+{
+	return morse_dot11_tim_to_s1g(out, &in->tim, in->virtual_map_len, in->enc_mode,
+				      in->inverse_bitmap, in->max_aid, in->page_slice_no,
+				      in->page_index);
+}
+
+static int encode_ref(const struct tim_input *in, struct dot11ah_s1g_tim_ie *out)
+{
+	return ref_morse_dot11_tim_to_s1g(out, &in->tim, in->virtual_map_len, in->enc_mode,
+					  in->inverse_bitmap, in->max_aid, in->page_slice_no,
+					  in->page_index);
+}
+
+static int encode_cached(struct dot11ah_s1g_tim_cache *cache, const struct tim_input *in,
+			 struct dot11ah_s1g_tim_ie *out)
+{
+	return morse_dot11_tim_to_s1g_cached(cache, out, &in->tim, in->virtual_map_len,
+					     in->enc_mode, in->inverse_bitmap, in->max_aid,
+					     in->page_slice_no, in->page_index);
+}
+
+/* Time @iterations encodes of every input in @inputs, returning ns per encode */
+static double bench(int (*encode)(const struct tim_input *, struct dot11ah_s1g_tim_ie *),
+		    const struct tim_input *inputs, int num_inputs, int iterations)
+{
+	struct dot11ah_s1g_tim_ie out;
+	volatile int sink = 0;
+	u64 start = now_ns();
+	int i, j;
+
+	for (i = 0; i < iterations; i++)
+		for (j = 0; j < num_inputs; j++)
+			sink += encode(&inputs[j], &out);
+
+	(void)sink;
+	return (double)(now_ns() - start) / ((double)iterations * num_inputs);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n iterations] [-S seed]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	static struct tim_input bench_inputs[1024];
+	struct dot11ah_s1g_tim_cache cache = { 0 };
+	struct tim_input in, prev = { 0 };
+	long iterations = DEFAULT_ITERATIONS;
+	u64 seed = DEFAULT_SEED;
+	long cache_hits = 0;
+	long i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:S:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtol(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	prng_state = seed ? seed : DEFAULT_SEED;
+
+	for (i = 0; i < iterations; i++) {
+		struct dot11ah_s1g_tim_ie expected, actual;
+		int expected_len, actual_len;
+		bool repeat = i && random_u32(2);
+
+		/* Repeat the previous bitmap half the time, as consecutive beacons usually do */
+		if (repeat) {
+			in = prev;
+			in.tim.dtim_count = random_u32(256);
+			cache_hits++;
+		} else {
+			random_input(&in);
+		}
+		prev = in;
+
+		tim_enc_mode_auto = false;
+		expected_len = encode_ref(&in, &expected);
+		actual_len = encode_new(&in, &actual);
+		if (expected_len != actual_len || memcmp(&expected, &actual, actual_len)) {
+			dump_mismatch("reference", &in, &expected, expected_len, &actual,
+				      actual_len);
+			return 1;
+		}
+
+		actual_len = encode_cached(&cache, &in, &actual);
+		if (expected_len != actual_len || memcmp(&expected, &actual, actual_len)) {
+			dump_mismatch("cached", &in, &expected, expected_len, &actual, actual_len);
+			return 1;
+		}
+
+		if (in.inverse_bitmap || in.enc_mode != ENC_MODE_BLOCK)
+			continue;
+
+		tim_enc_mode_auto = true;
+		actual_len = encode_new(&in, &actual);
+		if (actual_len > expected_len) {
+			dump_mismatch("auto longer than block", &in, &expected, expected_len,
+				      &actual, actual_len);
+			return 1;
+		}
+	}
+
+	printf("%ld random TIMs identical to the reference encoder (%ld cache hits)\n",
+	       iterations, cache_hits);
+
+	tim_enc_mode_auto = false;
+	for (i = 0; i < (long)ARRAY_SIZE(bench_inputs); i++)
+		random_input(&bench_inputs[i]);
+
+	printf("reference: %.1f ns/encode\n",
+	       bench(encode_ref, bench_inputs, ARRAY_SIZE(bench_inputs), 100));
+	printf("driver:    %.1f ns/encode\n",
+	       bench(encode_new, bench_inputs, ARRAY_SIZE(bench_inputs), 100));
+
+	return 0;
+}
@@ -0,0 +1,508 @@
+/*
+ * Copyright 2020 Morse Micro
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+ * Reference 11n->S1G TIM encoder: the per-AID implementation from dot11ah/tim.c before the
+ * encoders were changed to work on whole octets. It is kept verbatim apart from the ref_ prefix,
+ * and is included by tim_enc_check.c so its output can be compared with the driver's.
+ */
+
+/**
+ * State structure for parsing from 11n TIM to S1G TIM
+ */
+struct ref_tim_to_s1g_parse_state {
+	/** S1G TIM to fill */
+	struct dot11ah_s1g_tim_ie *s1g_tim;
+
+	/** 11n TIM virtual bitmap */
+	const u8 *virtual_map_11n;
+
+	/** Current index into S1G TIM partial virtual bitmap (ie. length used so far) */
+	u16 index_s1g;
+
+	/** Current length of virtual_map_11n */
+	s16 length_11n;
+
+	/**
+	 * Octet offset for virtual_map_11n. It gives the current octet virtual_map_11n is pointing
+	 * at in the full length 11n TIM (assuming bit 0 octet 0 in the full length 11n TIM is AID
+	 * 0).
+	 *
+	 * E.g. If octet_offset_11n is 5, virtual_map_11n[0] will be the 5th octet of the full TIM
+	 * bitmap. So if (virtual_map_11n[0] & (1<<2)) == TRUE, and octet_offset_11n == 5, traffic
+	 * will be buffered for the STA with AID (5*8)+2 = 42.
+	 */
+	u8 octet_offset_11n;
+};
+
+/* Copy in octet and advance the index */
+static inline void ref_s1g_tim_append_octet(struct ref_tim_to_s1g_parse_state *state, u8 octet)
+{
+	if (likely(state->index_s1g < sizeof(state->s1g_tim->encoded_block_info)))
+		state->s1g_tim->encoded_block_info[state->index_s1g++] = octet;
+}
+
+/* Return a pointer to the current octet and advance the index */
+static inline u8 *ref_s1g_tim_reserve_octet(struct ref_tim_to_s1g_parse_state *state)
+{
+	if (likely(state->index_s1g < sizeof(state->s1g_tim->encoded_block_info)))
+		return &state->s1g_tim->encoded_block_info[state->index_s1g++];
+	else
+		return NULL;
+}
+
+/**
+ * Call in 11n->s1g parsing functions to advance consumed octets in 11n tim.
+ */
+static void ref_consume_11n_tim_octets(struct ref_tim_to_s1g_parse_state *state, u8 num_octets)
+{
+	state->length_11n -= num_octets;
+	state->octet_offset_11n += num_octets;
+	state->virtual_map_11n += num_octets;
+
+	/*
+	 * Trim any holes at the front of the 11n tim.
+	 */
+	while (state->length_11n >= 1 && state->virtual_map_11n[0] == 0) {
+		state->virtual_map_11n++;
+		state->octet_offset_11n++;
+		state->length_11n--;
+	}
+}
+
+/* 9.4.2.5.2 Block Bitmap Mode */
+static void ref_morse_dot11_tim_to_s1g_parse_block_mode(struct ref_tim_to_s1g_parse_state *state,
+						    bool inverse_bitmap, u16 max_aid)
+{
+	int i;
+	int j;
+	u8 num_subblocks;
+	u16 aid_base = state->octet_offset_11n * 8;
+	u8 subblocks_to_block_boundary = S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK -
+			(state->octet_offset_11n % S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK);
+
+	/*
+	 * This will hold the MAX of 8 subblocks before copying back to the s1g_tim struct.
+	 */
+	u8 block_ctrl;
+	u8 block_offset;
+	u8 *block_bitmap;
+	u8 subblocks[S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK];
+
+	/* On inverse mode, all subblocks are inverted */
+	memset(subblocks, inverse_bitmap ? 0xFF : 0x00, sizeof(subblocks));
+
+	/* Set Block Control, block[0] (bit0:bit2) */
+	block_ctrl = ENC_MODE_BLOCK |
+		(inverse_bitmap << IEEE80211_S1G_TIM_BLOCK_CTL_INVERSE_BMAP_SHIFT);
+
+	/* AID[0:12] constructed by concatenating:
+	 *   > pos_q (AID[0:2]),
+	 *   > pos_m (AID[3:5]),
+	 *   > Block Offset field (AID[6:10]),
+	 *   > Page Index field (AID[11:12]) <<-- Caller already set to zero for AID's < 2008
+	 * in sequence from LSB to MSB.
+	 */
+	block_offset = S1G_TIM_AID_TO_BLOCK_OFFSET(aid_base);
+
+	/* Fill in the Block Offset (b3:b7) & Block control (b0:b2) in first byte of the block */
+	ref_s1g_tim_append_octet(state, block_ctrl |
+			     (block_offset << IEEE80211_S1G_TIM_BLOCK_CTL_BLOCK_OFFSET_SHIFT));
+
+	/* fill out block_bitmap & subblocks from 11n tim virtual map */
+	for (i = 0; i < state->length_11n && i < subblocks_to_block_boundary; i++) {
+		u8 temp = state->virtual_map_11n[i];
+
+		for (j = 0; temp != 0; temp >>= 1, j++) {
+			/* bit found */
+			if (temp & 0x1) {
+				/* Work out actual AID (to account for bitmap_offset in 11n tim) */
+				u16 aid = aid_base + (i * S1G_TIM_NUM_AID_PER_SUBBLOCK) + j;
+
+				/* convert aid to positions */
+				u8 pos_m = ((aid >> 3) & 0x7);
+				u8 pos_q = (aid & 0x7);
+
+				/* set/clear the bit in the corresponding subblock */
+				if (inverse_bitmap)
+					subblocks[pos_m] &= ~(0x1 << pos_q);
+				else
+					subblocks[pos_m] |= (0x1 << pos_q);
+			}
+		}
+	}
+
+	ref_consume_11n_tim_octets(state, i);
+
+	/* Save the location of block_bitmap for later */
+	block_bitmap = ref_s1g_tim_reserve_octet(state);
+	if (unlikely(!block_bitmap))
+		return;
+
+	/*
+	 * Copy in subblocks
+	 * Clamp max sub-block based on max AID (for inverse mode)
+	 */
+	num_subblocks = min((u8)(((max_aid - (block_offset * S1G_TIM_NUM_AID_PER_BLOCK)) >> 3) + 1),
+		(u8)ARRAY_SIZE(subblocks));
+
+	for (i = 0; i < num_subblocks; i++) {
+		/* Only include subblocks that have info */
+		if (subblocks[i] != 0) {
+			ref_s1g_tim_append_octet(state, subblocks[i]);
+
+			/* set the bit in the block_bitmap to indicate the subblock is present */
+			*block_bitmap |= (0x1 << i);
+		}
+	}
+}
+
+/* 9.4.2.5.3 Single AID Mode
+ * This mode will try to consume an entire byte. Therefore it will add an encoded block for every
+ * bit set in the virtual map byte it selects. It is up to the caller to make sure only one bit is
+ * set in the virtual map byte, else reap the consequences of inefficency.
+ */
+static void ref_morse_dot11_tim_to_s1g_parse_single_mode(struct ref_tim_to_s1g_parse_state *state,
+						     bool inverse_bitmap)
+{
+	int remainder;
+	u16 aid_base = state->octet_offset_11n * 8;
+	u8 block_ctrl;
+	u8 block_offset = 0;
+	u8 bitmap;
+
+	/*
+	 * Set Block Control, block[0] (bit0:bit2)
+	 */
+	block_ctrl = ENC_MODE_AID |
+		(inverse_bitmap << IEEE80211_S1G_TIM_BLOCK_CTL_INVERSE_BMAP_SHIFT);
+
+	/* AID[0:12] constructed by concatenating:
+	 *   > Single AID subfield (AID[0:5]),
+	 *   > Block Offset field (AID[6:10]),
+	 *   > Page Index field (AID[11:12]) <<-- Caller already set to zero for AID's < 2008
+	 * in sequence from LSB to MSB.
+	 */
+
+	bitmap = state->virtual_map_11n[0];
+	ref_consume_11n_tim_octets(state, 1);
+
+	/*
+	 * Inverse single AID mode, ie. every station except for the specified one has data
+	 * buffered, is not supported as the use case is almost non-existent & can be easily covered
+	 * by other encoding schemes.
+	 *
+	 * Do this here (after we consume 11n TIM bytes) so we don't get stuck in an infinite loop.
+	 */
+	if (inverse_bitmap) {
+		dot11ah_err("Inverse Single AID mode is not supported for transmit.");
+		return;
+	}
+
+	block_offset = S1G_TIM_AID_TO_BLOCK_OFFSET(aid_base);
+
+	for (remainder = 0; remainder < 8; remainder++) {
+		if ((bitmap >> remainder) & 0x01) {
+			u8 single_aid = (aid_base | remainder) & 0x003F;
+
+			ref_s1g_tim_append_octet(state, block_ctrl | (block_offset <<
+						IEEE80211_S1G_TIM_BLOCK_CTL_BLOCK_OFFSET_SHIFT));
+
+			ref_s1g_tim_append_octet(state, single_aid);
+		}
+	}
+}
+
+/* 9.4.2.5.4 OLB Mode */
+static void ref_morse_dot11_tim_to_s1g_parse_olb_mode(struct ref_tim_to_s1g_parse_state *state,
+						  bool inverse_bitmap, u16 max_aid)
+{
+	int i;
+	int j;
+	u16 aid_base = state->octet_offset_11n * 8;
+	u8 block_ctrl;
+	u8 block_offset;
+	u8 num_subblocks = 0;
+	u8 subblocks[S1G_TIM_MAX_BLOCK_SIZE];
+
+	u8 start_idx = 0, stop_idx = 0;
+	u8 empty_front_subblocks = 0, empty_front_blocks = 0;
+
+	/* AID[0:12] constructed by concatenating:
+	 *   > pos_q (AID[0:2]),
+	 *   > Subblock offset m mod 8 (AID[3:5]),
+	 *   > Block K (i.e., Block Offset + [m / 8]) (AID[6:10]),
+	 *   > Page Index field (AID[11:12])
+	 * in sequence from LSB to MSB.
+	 *
+	 * From the spec:
+	 * The Length subfield is 1 octet. A Length subfield equal to n indicates that the Encoded
+	 * Block Information field contains n contiguous subblocks in ascending order from multiple
+	 * blocks starting from the first subblock of the block in position Block Offset.
+	 *
+	 *
+	 * OLB may contain empty subblocks at the start if the first AID is at the top of a block
+	 * boundary.
+	 * OLB has a limitation where for aids/subblocks close to the upper block boundary, all
+	 * subblocks lower than it in the block will still have to be included.
+	 * E.g.
+	 * s1g block:|                 1                    |                  2                   |
+	 * 11n tim:  0x00 0x00 0x00 0x00 0x00 0x00 0xF1 0x00 0x00 0x00 0x00 0x00 0x00 0x00 0x00 0x00
+	 *                                           ^
+	 *
+	 * Will OLB encode as: 0x07 0x00 0x00 0x00 0x00 0x00 0x00 0xF1
+	 *
+	 * Note that this will have a length of 7 with most subblocks being 0 as we are only able to
+	 * offset by the block.
+	 *
+	 * This encoding should only really be used when num sleeping stations > max that can be
+	 * displayed by block mode, or there is a long sequence of contiguous subblocks with bits
+	 * set.
+	 */
+
+	memset(subblocks, inverse_bitmap ? 0xFF : 0x00, sizeof(subblocks));
+
+	/*
+	 * Set Block Control, block[0] (bit0:bit2)
+	 */
+	block_ctrl = ENC_MODE_OLB |
+		(inverse_bitmap << IEEE80211_S1G_TIM_BLOCK_CTL_INVERSE_BMAP_SHIFT);
+
+	block_offset = S1G_TIM_AID_TO_BLOCK_OFFSET(aid_base);
+	start_idx = block_offset * S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK;
+
+	/*
+	 * Walk the 11n tim and copy
+	 */
+	for (i = 0; i < state->length_11n && i < ARRAY_SIZE(subblocks); i++) {
+		u8 temp = state->virtual_map_11n[i];
+
+		for (j = 0; temp != 0; temp >>= 1, j++) {
+			/* bit found */
+			if (temp & 0x1) {
+				/*
+				 * Work out actual AID (to account for bitmap_offset in 11n tim)
+				 */
+				u16 aid = aid_base + (i * S1G_TIM_NUM_AID_PER_SUBBLOCK) + j;
+
+				/* convert aid to positions */
+				u8 pos_m = (aid >> 3);
+				u8 pos_q = (aid & 0x7);
+
+				/* set/clear the bit in the corresponding subblock */
+				if (inverse_bitmap) {
+					subblocks[pos_m] &= ~(0x1 << pos_q);
+				} else {
+					subblocks[pos_m] |= (0x1 << pos_q);
+					/* Store largest used subblock */
+					if (pos_m >= stop_idx)
+						stop_idx = pos_m + 1;
+				}
+			}
+		}
+	}
+
+	ref_consume_11n_tim_octets(state, i);
+
+	/* See if we can trim the length */
+	if (inverse_bitmap) {
+		/* Subblock of max AID is the stop index in inverse mode */
+		stop_idx = ((max_aid) >> 3) + 1;
+
+		/* Count the number of empty starting subblocks */
+		for (i = start_idx; i < stop_idx; i++) {
+			if (subblocks[i] != 0)
+				break;
+			empty_front_subblocks++;
+		}
+
+		/* Can only advance by a block (8 bytes) at a time */
+		empty_front_blocks = empty_front_subblocks / S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK;
+
+		if (empty_front_blocks) {
+			/* Update the offset */
+			block_offset += empty_front_blocks;
+			start_idx += (S1G_TIM_NUM_SUBBLOCKS_PER_BLOCK * empty_front_blocks);
+		}
+
+		/* Try to trim the tail, as stop_idx is set by max AID */
+		while (stop_idx > start_idx && subblocks[stop_idx - 1] == 0)
+			stop_idx--;
+	}
+
+	num_subblocks = stop_idx - start_idx;
+
+	/* insert the data into the encoded block info, if we have any */
+	if (num_subblocks) {
+		ref_s1g_tim_append_octet(state, block_ctrl | (block_offset <<
+						IEEE80211_S1G_TIM_BLOCK_CTL_BLOCK_OFFSET_SHIFT));
+
+		ref_s1g_tim_append_octet(state, num_subblocks);
+
+		for (i = start_idx; i < stop_idx; i++)
+			ref_s1g_tim_append_octet(state, subblocks[i]);
+	}
+}
+
+/*
+ * 9.4.2.5.5 ADE Mode
+ * TODO: ADE for AIDs > 7 (not tested in WFA nor advertised in marketing material)
+ *		support for multiple encoded blocks / looping over 11n tim
+ */
+static void ref_morse_dot11_tim_to_s1g_parse_ade_mode(struct ref_tim_to_s1g_parse_state *state,
+						  bool inverse_bitmap)
+{
+	int i;
+	int remainder;
+	int aid_index = 0;
+	u8 block_offset;
+
+	u16 aid_base = state->octet_offset_11n * 8;
+
+	/* this will hold the MAX of 8 AID's before copying back to the s1g_tim struct */
+	u16 diff_aid_list[8] = { 0 };
+
+	/* AID[0:12] constructed by concatenating:
+	 *	> AID1 = Diff_AID1 + (Page Index 2048 + Block Offset 64)
+	 *	> AIDi = Diff_AIDi + AIDi 1, i = 2 ... n.
+	 */
+
+	/* Note: we have two variables in the first equation (Block Offset and Diff_AID). We will
+	 * assume the diff_aid is always < 64 (bits 0:5), hence Block Offset field is AID[6:10].
+	 */
+	block_offset = S1G_TIM_AID_TO_BLOCK_OFFSET(aid_base);
+
+	if (state->length_11n > 1)
+		dot11ah_err("ADE encoding not supported for AIDs larger than 8\n");
+
+	/* Fill in the Block Offset (b3:b7) in first byte of the block */
+	ref_s1g_tim_append_octet(state, ENC_MODE_ADE | (block_offset <<
+						IEEE80211_S1G_TIM_BLOCK_CTL_BLOCK_OFFSET_SHIFT));
+
+	/* Loop on the virtual_map to extract the active aids and construct the diff_aid array
+	 */
+	for (remainder = 0; remainder < 8; remainder++) {
+		if ((state->virtual_map_11n[0] >> remainder) & 0x01) {
+			/* For active AID's use only the first 6 bits for Diff_AID */
+			u8 diff_aid = (aid_base | remainder) % 64;
+
+			if (aid_index == 0)
+				diff_aid_list[aid_index] = diff_aid;
+			else
+				diff_aid_list[aid_index] = diff_aid - diff_aid_list[aid_index - 1];
+
+			aid_index++;
+		}
+	}
+
+	ref_consume_11n_tim_octets(state, 1);
+
+	if (aid_index > 0) {
+		/* For simplicity, use one octet for each diff_aid, hence the EWL field (len of word
+		 * in bits) will be 0x7, and the total length in octets = number of encoded AIDs
+		 */
+		ref_s1g_tim_append_octet(state, 0x07 /* EWL */ | (aid_index << 3) /* Length */);
+
+		for (i = 0; i < aid_index; i++)
+			ref_s1g_tim_append_octet(state, diff_aid_list[i]);
+	}
+}
+
+static int ref_morse_dot11_tim_to_s1g(struct dot11ah_s1g_tim_ie *s1g_tim,
+			   const struct ieee80211_tim_ie *tim,
+			   u8 tim_virtual_map_length,
+			   enum dot11ah_tim_encoding_mode enc_mode,
+			   bool inverse_bitmap,
+			   u16 max_aid,
+			   u8 page_slice_no,
+			   u8 page_index)
+{
+	u8 octet_offset;
+	struct ref_tim_to_s1g_parse_state state;
+	int s1g_tim_length = 0;
+
+	if (!s1g_tim || !tim)
+		/* Account for max length we will send */
+		return sizeof(*s1g_tim);
+
+	/*
+	 * If all bits in virtual bitmap are 0, the Partial Virtual Bitmap field is not present in
+	 * the TIM element and the Length field of the TIM element is set to 3. If all bits in the
+	 * virtual bitmap are 0 and all the bits of the Bitmap Control field are 0, both the Partial
+	 * Virtual Bitmap field and the Bitmap Control field are not present in the TIM element and
+	 * the Length field of the TIM element is set to 2. The Bitmap Control field is present if
+	 * the Partial Virtual Bitmap field is present.
+	 */
+	s1g_tim_length = sizeof(*s1g_tim)
+			- sizeof(s1g_tim->bitmap_control)
+			- sizeof(s1g_tim->encoded_block_info);
+
+	s1g_tim->dtim_count = tim->dtim_count;
+	s1g_tim->dtim_period = tim->dtim_period;
+
+	/* Let prepare an empty TIM (in case of errors) */
+	s1g_tim->bitmap_control = 0;
+	memset(s1g_tim->encoded_block_info, 0, S1G_TIM_MAX_BLOCK_SIZE);
+
+	/* Set the traffic indicator bit, as per the incoming TIM element */
+	s1g_tim->bitmap_control = (tim->bitmap_ctrl & IEEE80211_TIM_BITMAP_TRAFFIC_INDICATION);
+
+	/* Which octet does the first TIM bitmap block represent? */
+	octet_offset = (tim->bitmap_ctrl & IEEE80211_TIM_BITMAP_OFFSET);
+
+	/* Initialise the parse state structure */
+	state.s1g_tim = s1g_tim;
+	state.index_s1g = 0;
+	state.octet_offset_11n = octet_offset;
+	state.length_11n = tim_virtual_map_length;
+	state.virtual_map_11n = tim->virtual_map;
+
+	/*
+	 * Consume any empty octets at the start of the 11n TIM.
+	 *	This can happen if the virtual map starts at an odd offset, or if we get passed an
+	 *	empty TIM from linux.
+	 */
+	ref_consume_11n_tim_octets(&state, 0);
+
+	while (state.length_11n > 0 && state.index_s1g < sizeof(s1g_tim->encoded_block_info)) {
+		switch (enc_mode) {
+		case ENC_MODE_BLOCK:
+			ref_morse_dot11_tim_to_s1g_parse_block_mode(&state, inverse_bitmap, max_aid);
+			break;
+
+		case ENC_MODE_AID:
+			ref_morse_dot11_tim_to_s1g_parse_single_mode(&state, inverse_bitmap);
+			break;
+
+		case ENC_MODE_OLB:
+			ref_morse_dot11_tim_to_s1g_parse_olb_mode(&state, inverse_bitmap, max_aid);
+			break;
+
+		case ENC_MODE_ADE:
+			ref_morse_dot11_tim_to_s1g_parse_ade_mode(&state, inverse_bitmap);
+			break;
+
+		default:
+			goto error;
+		}
+	}
+
+	/* Only include the tim if we either have BC traffic, or the 11n tim had some bits set. */
+	if (s1g_tim->bitmap_control || state.index_s1g > 0) {
+		s1g_tim->bitmap_control |= (page_slice_no <<
+					    IEEE80211_S1G_TIM_BITMAP_PAGE_SLICE_SHIFT);
+		s1g_tim->bitmap_control |= (page_index <<
+					   IEEE80211_S1G_TIM_BITMAP_PAGE_INDEX_SHIFT);
+
+		/* Bitmap Control field is present if the Partial Virtual Bitmap field is present */
+		s1g_tim_length = s1g_tim_length + state.index_s1g + 1;
+	}
+
+	return s1g_tim_length;
+error:
+	dot11ah_err("Error %s failed\n", __func__);
+	return s1g_tim_length;
+}
@@ -250,7 +250,7 @@ int morse_set_long_sleep_enabled(const char *iface, bool enabled);
 int morse_s1g_op_class_first_chan(u8 s1g_op_class);
 
 /**
- * Issue a morse_cli command to set the S1G operating class for the S1G operating element in
+ * Issue a Morse control command to set the S1G operating class for the S1G operating element in
  * management frames
  *
  * @param ifname	The name of the interface (e.g., wlan0)
@@ -261,7 +261,7 @@ int morse_s1g_op_class_first_chan(u8 s1g_op_class);
 int morse_set_s1g_op_class(const char* ifname, u8 opclass, u8 prim_opclass);
 
 /**
- * Issue a morse_cli command to set the channel parameters
+ * Issue a Morse control command to set the channel parameters
  *
  * @param ifname		The name of the interface (e.g., wlan0)
  * @param oper_freq		Operating center frequency in KHz
@@ -312,7 +312,7 @@ int morse_insert_supported_op_class(struct wpabuf *buf, char *cc, int s1g_chwidt
 #ifdef CONFIG_MORSE_KEEP_ALIVE_OFFLOAD
 
 /**
- * Issue a morse_cli command to set/offload the bss keep-alive frames.
+ * Issue a Morse control command to set/offload the bss keep-alive frames.
  *
  * @param iface			The name of the interface (e.g., wlan0)
  * @param bss_max_idle_period	The BSS max idle period as derived directly
@@ -328,7 +328,7 @@ int morse_set_keep_alive(const char* ifname, u16 bss_max_idle_period, bool as_11
 int morse_twt_conf(const char* ifname, struct morse_twt *twt_config);
 
 /**
- * Issue a morse_cli command to set ecsa channel parameters
+ * Issue a Morse control command to set ecsa channel parameters
  *
  * @param ifname		The name of the interface (e.g., wlan0)
  * @param global_oper_class	Global operating class for the operating country
@@ -349,7 +349,7 @@ int morse_set_ecsa_params(const char* ifname, u8 global_oper_class, u8 prim_chwi
 int morse_set_mbssid_info(const char *ifname, const char *tx_iface_idx,
 					u8 max_bss_index);
 /**
- * Issue a morse_cli command to enable or disable CAC
+ * Issue a Morse control command to enable or disable CAC
  *
  * @param ifname		The name of the interface (e.g., wlan0)
  * @param enable		True to enable CAC, false to disable CAC
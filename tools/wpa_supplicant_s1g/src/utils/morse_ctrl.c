@@ -0,0 +1,721 @@
+/*
+ * Copyright 2022 Morse Micro
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+/*
+ * In-process Morse control commands.
+ *
+ * Each operation is encoded as a Morse command (header + request payload) and
+ * delivered to the driver as an nl80211 vendor command, exactly as morse_cli
+ * does, but over a netlink socket owned by this process instead of by a
+ * forked shell. The socket is opened on first use and kept for the lifetime
+ * of the process.
+ */
+
+#include "includes.h"
+
+#include <net/if.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+
+#include "utils/common.h"
+#include "drivers/nl80211_copy.h"
+
+#include "morse.h"
+
+#define MORSE_CTRL_DEFAULT_IFNAME	"wlan0"
+#define MORSE_CTRL_NL_BUFFER_SIZE	(8192)
+
+/* Vendor subcommand carrying a Morse command to the interface */
+#define MORSE_VENDOR_CMD_TO_MORSE	(0x00)
+
+#define MORSE_CMD_TYPE_REQ		BIT(0)
+
+enum morse_cmd_id {
+	MORSE_CMD_ID_SET_CHANNEL = 0x0001,
+	MORSE_CMD_ID_SET_LONG_SLEEP_CONFIG = 0x0021,
+	MORSE_CMD_ID_SET_KEEP_ALIVE_OFFLOAD = 0x0033,
+	MORSE_CMD_ID_SET_S1G_OP_CLASS = 0xA007,
+	MORSE_CMD_ID_SET_TWT_CONF = 0xA010,
+	MORSE_CMD_ID_SET_ECSA_S1G_INFO = 0xA012,
+	MORSE_CMD_ID_CAC = 0xA014,
+	MORSE_CMD_ID_MBSSID = 0xA016,
+	MORSE_CMD_ID_SET_MESH_CONFIG = 0xA018,
+	MORSE_CMD_ID_SET_MCBA_CONF = 0xA019,
+	MORSE_CMD_ID_DYNAMIC_PEERING_CONFIG = 0xA020,
+	MORSE_CMD_ID_CONFIG_RAW = 0xA021,
+};
+
+/* Command layouts below must match morse_commands.h in the driver */
+
+struct morse_cmd_header {
+	le16 flags;
+	le16 message_id;
+	le16 len;
+	le16 host_id;
+	le16 vif_id;
+	le16 pad;
+} STRUCT_PACKED;
+
+struct morse_cmd_resp_hdr {
+	struct morse_cmd_header hdr;
+	le32 status;
+} STRUCT_PACKED;
+
+struct morse_cmd_req_set_channel {
+	le32 op_chan_freq_hz;
+	u8 op_bw_mhz;
+	u8 pri_bw_mhz;
+	u8 pri_1mhz_chan_idx;
+	u8 dot11_mode;
+	u8 reg_tx_power_set;
+} STRUCT_PACKED;
+
+struct morse_cmd_req_set_long_sleep_config {
+	u8 enabled;
+} STRUCT_PACKED;
+
+struct morse_cmd_req_set_keep_alive_offload {
+	le16 bss_max_idle_period;
+	u8 interpret_as_11ah;
+} STRUCT_PACKED;
+
+struct morse_cmd_req_set_s1g_op_class {
+	u8 opclass;
+	u8 prim_opclass;
+} STRUCT_PACKED;
+
+#define MORSE_CMD_TWT_CONF_OP_CONFIGURE	(0)
+
+struct morse_cmd_req_set_twt_conf {
+	u8 opcode;
+	u8 flow_id;
+	le64 target_wake_time;
+	le64 wake_interval_us;
+	le32 wake_duration_us;
+	u8 twt_setup_command;
+	u8 __padding[3];
+} STRUCT_PACKED;
+
+struct morse_cmd_req_set_ecsa_s1g_info {
+	le32 operating_channel_freq_hz;
+	u8 opclass;
+	u8 primary_channel_bw_mhz;
+	u8 prim_1mhz_ch_idx;
+	u8 operating_channel_bw_mhz;
+	u8 prim_opclass;
+	u8 s1g_cap0;
+	u8 s1g_cap1;
+	u8 s1g_cap2;
+	u8 s1g_cap3;
+} STRUCT_PACKED;
+
+#define MORSE_CMD_CAC_OP_DISABLE		(0)
+#define MORSE_CMD_CAC_OP_ENABLE			(1)
+#define MORSE_CMD_CAC_CFG_CHANGE_RULE_MAX	(8)
+
+struct morse_cmd_req_cac {
+	u8 opcode;
+	u8 rule_tot;
+	struct {
+		le16 arfs;
+		le16 threshold_change;
+	} STRUCT_PACKED rule[MORSE_CMD_CAC_CFG_CHANGE_RULE_MAX];
+} STRUCT_PACKED;
+
+#define MORSE_CMD_IFNAMSIZ		(16)
+
+struct morse_cmd_req_mbssid {
+	u8 max_bssid_indicator;
+	char transmitter_iface[MORSE_CMD_IFNAMSIZ];
+} STRUCT_PACKED;
+
+#define MORSE_CMD_MESH_ID_LEN_MAX	(32)
+
+struct morse_cmd_req_set_mesh_config {
+	u8 mesh_id_len;
+	u8 mesh_id[MORSE_CMD_MESH_ID_LEN_MAX];
+	u8 mesh_beaconless_mode;
+	u8 max_plinks;
+} STRUCT_PACKED;
+
+struct morse_cmd_req_set_mcba_conf {
+	u8 mbca_config;
+	u8 beacon_timing_report_interval;
+	u8 min_beacon_gap_ms;
+	le16 mbss_start_scan_duration_ms;
+	le16 tbtt_adj_interval_ms;
+} STRUCT_PACKED;
+
+struct morse_cmd_req_dynamic_peering_config {
+	u8 enabled;
+	u8 rssi_margin;
+	le32 blacklist_timeout;
+} STRUCT_PACKED;
+
+#define MORSE_CMD_CFG_RAW_FLAG_ENABLE	BIT(0)
+#define MORSE_CMD_CFG_RAW_FLAG_UPDATE	BIT(2)
+
+enum morse_cmd_raw_tlv_tag {
+	MORSE_CMD_RAW_TLV_TAG_SLOT_DEF = 0,
+	MORSE_CMD_RAW_TLV_TAG_GROUP = 1,
+	MORSE_CMD_RAW_TLV_TAG_START_TIME = 2,
+	MORSE_CMD_RAW_TLV_TAG_PRAW = 3,
+	MORSE_CMD_RAW_TLV_TAG_BCN_SPREAD = 4,
+};
+
+struct morse_cmd_raw_tlv_slot_def {
+	u8 tag;
+	le32 raw_duration_us;
+	u8 num_slots;
+	u8 cross_slot_bleed;
+} STRUCT_PACKED;
+
+struct morse_cmd_raw_tlv_group {
+	u8 tag;
+	le16 aid_start;
+	le16 aid_end;
+} STRUCT_PACKED;
+
+struct morse_cmd_raw_tlv_start_time {
+	u8 tag;
+	le32 start_time_us;
+} STRUCT_PACKED;
+
+struct morse_cmd_raw_tlv_praw {
+	u8 tag;
+	u8 periodicity;
+	u8 validity;
+	u8 start_offset;
+	u8 refresh_on_expiry;
+} STRUCT_PACKED;
+
+struct morse_cmd_raw_tlv_bcn_spread {
+	u8 tag;
+	le16 max_spread;
+	le16 nominal_sta_per_bcn;
+} STRUCT_PACKED;
+
+struct morse_cmd_req_config_raw {
+	le32 flags;
+	le16 id;
+	/* Followed by RAW TLVs */
+} STRUCT_PACKED;
+
+/* Largest RAW request issued by morse_raw_priority_enable() */
+struct morse_ctrl_raw_prio_req {
+	struct morse_cmd_req_config_raw raw;
+	struct morse_cmd_raw_tlv_slot_def slot_def;
+	struct morse_cmd_raw_tlv_group group;
+	struct morse_cmd_raw_tlv_start_time start_time;
+	union {
+		struct morse_cmd_raw_tlv_praw praw;
+		struct morse_cmd_raw_tlv_bcn_spread bcn_spread;
+	} STRUCT_PACKED opt;
+} STRUCT_PACKED;
+
+/* Largest request payload carried by a single command */
+#define MORSE_CTRL_MAX_REQ_LEN	(sizeof(struct morse_ctrl_raw_prio_req))
+
+static struct morse_ctrl_state {
+	struct nl_sock *sock;
+	int nl80211_id;
+} morse_ctrl;
+
+struct morse_ctrl_reply {
+	int status;
+	bool have_status;
+};
+
+static void morse_ctrl_close(void)
+{
+	if (morse_ctrl.sock)
+		nl_socket_free(morse_ctrl.sock);
+	morse_ctrl.sock = NULL;
+	morse_ctrl.nl80211_id = 0;
+}
+
+static int morse_ctrl_open(void)
+{
+	int ret;
+
+	if (morse_ctrl.sock)
+		return 0;
+
+	morse_ctrl.sock = nl_socket_alloc();
+	if (!morse_ctrl.sock) {
+		wpa_printf(MSG_ERROR, "morse: Failed to allocate control socket");
+		return -ENOMEM;
+	}
+
+	ret = genl_connect(morse_ctrl.sock);
+	if (ret < 0) {
+		wpa_printf(MSG_ERROR, "morse: Failed to connect control socket (%d)", ret);
+		goto fail;
+	}
+
+	nl_socket_set_buffer_size(morse_ctrl.sock, MORSE_CTRL_NL_BUFFER_SIZE,
+				  MORSE_CTRL_NL_BUFFER_SIZE);
+
+	morse_ctrl.nl80211_id = genl_ctrl_resolve(morse_ctrl.sock, "nl80211");
+	if (morse_ctrl.nl80211_id < 0) {
+		wpa_printf(MSG_ERROR, "morse: nl80211 not found");
+		ret = -ENOENT;
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	morse_ctrl_close();
+	return ret;
+}
+
+static int morse_ctrl_error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+	int *ret = arg;
+
+	*ret = err->error;
+	return NL_SKIP;
+}
+
+static int morse_ctrl_finish_handler(struct nl_msg *msg, void *arg)
+{
+	int *ret = arg;
+
+	*ret = 0;
+	return NL_SKIP;
+}
+
+static int morse_ctrl_ack_handler(struct nl_msg *msg, void *arg)
+{
+	int *ret = arg;
+
+	*ret = 0;
+	return NL_STOP;
+}
+
+static int morse_ctrl_reply_handler(struct nl_msg *msg, void *arg)
+{
+	struct morse_ctrl_reply *reply = arg;
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	const struct morse_cmd_resp_hdr *resp;
+	struct nlattr *attr;
+
+	attr = nla_find(genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0),
+			NL80211_ATTR_VENDOR_DATA);
+	if (!attr || nla_len(attr) < (int)sizeof(*resp))
+		return NL_SKIP;
+
+	resp = nla_data(attr);
+	reply->status = (int)le_to_host32(resp->status);
+	reply->have_status = true;
+	return NL_SKIP;
+}
+
+/**
+ * morse_ctrl_cmd - Send a Morse command to an interface and wait for its confirm
+ *
+ * @ifname:	Interface to address. NULL selects the default interface, as morse_cli does.
+ * @message_id:	Command identifier.
+ * @req:	Request payload, excluding the command header.
+ * @req_len:	Length of @req.
+ *
+ * Returns: 0 on success, a negative errno if the command could not be delivered, or the
+ * non-zero status returned by the driver/firmware.
+ */
+static int morse_ctrl_cmd(const char *ifname, u16 message_id, const void *req, size_t req_len)
+{
+	u8 buf[sizeof(struct morse_cmd_header) + MORSE_CTRL_MAX_REQ_LEN];
+	struct morse_cmd_header *hdr = (struct morse_cmd_header *)buf;
+	struct morse_ctrl_reply reply = { 0 };
+	struct nl_msg *msg;
+	struct nl_cb *cb;
+	unsigned int ifindex;
+	int err;
+	int ret;
+
+	if (!ifname)
+		ifname = MORSE_CTRL_DEFAULT_IFNAME;
+
+	if (req_len > MORSE_CTRL_MAX_REQ_LEN)
+		return -EINVAL;
+
+	ifindex = if_nametoindex(ifname);
+	if (!ifindex) {
+		wpa_printf(MSG_WARNING, "morse: Unknown interface %s", ifname);
+		return -ENODEV;
+	}
+
+	ret = morse_ctrl_open();
+	if (ret)
+		return ret;
+
+	os_memset(hdr, 0, sizeof(*hdr));
+	hdr->flags = host_to_le16(MORSE_CMD_TYPE_REQ);
+	hdr->message_id = host_to_le16(message_id);
+	hdr->len = host_to_le16(req_len);
+	os_memcpy(hdr + 1, req, req_len);
+
+	msg = nlmsg_alloc();
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!msg || !cb) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (!genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, morse_ctrl.nl80211_id, 0, 0,
+			 NL80211_CMD_VENDOR, 0) ||
+	    nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex) ||
+	    nla_put_u32(msg, NL80211_ATTR_VENDOR_ID, MORSE_OUI) ||
+	    nla_put_u32(msg, NL80211_ATTR_VENDOR_SUBCMD, MORSE_VENDOR_CMD_TO_MORSE) ||
+	    nla_put(msg, NL80211_ATTR_VENDOR_DATA, sizeof(*hdr) + req_len, buf)) {
+		ret = -ENOBUFS;
+		goto out;
+	}
+
+	wpa_printf(MSG_DEBUG, "morse: ifname %s command 0x%04x len %zu",
+		   ifname, message_id, req_len);
+
+	ret = nl_send_auto_complete(morse_ctrl.sock, msg);
+	if (ret < 0)
+		goto out_reset;
+
+	err = 1;
+	nl_cb_err(cb, NL_CB_CUSTOM, morse_ctrl_error_handler, &err);
+	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, morse_ctrl_finish_handler, &err);
+	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, morse_ctrl_ack_handler, &err);
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, morse_ctrl_reply_handler, &reply);
+
+	while (err > 0) {
+		ret = nl_recvmsgs(morse_ctrl.sock, cb);
+		if (ret < 0)
+			goto out_reset;
+	}
+
+	ret = err;
+	if (!ret && reply.have_status)
+		ret = reply.status;
+	goto out;
+
+out_reset:
+	/* The socket may be out of sync with the kernel; start afresh next time */
+	wpa_printf(MSG_WARNING, "morse: Control socket failure (%d), resetting", ret);
+	morse_ctrl_close();
+out:
+	nl_cb_put(cb);
+	nlmsg_free(msg);
+	return ret;
+}
+
+int morse_set_long_sleep_enabled(const char *ifname, bool enabled)
+{
+	struct morse_cmd_req_set_long_sleep_config req = { 0 };
+	const char *operation = enabled ? "enable" : "disable";
+	int ret;
+
+	wpa_printf(MSG_INFO, "morse: %s long sleep on ifname %s", operation, ifname);
+
+	req.enabled = enabled;
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_SET_LONG_SLEEP_CONFIG, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"morse: Failed to %s long sleep on ifname %s (%d)",
+			operation, ifname, ret);
+
+	return ret;
+}
+
+int morse_set_s1g_op_class(const char *ifname, u8 opclass, u8 prim_opclass)
+{
+	struct morse_cmd_req_set_s1g_op_class req = { 0 };
+	int ret;
+
+	req.opclass = opclass;
+	req.prim_opclass = prim_opclass;
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_SET_S1G_OP_CLASS, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"morse: Failed to set s1g op class on ifname %s (%d)",
+			ifname, ret);
+
+	return ret;
+}
+
+int morse_set_channel(const char *ifname, int oper_freq, int oper_chwidth, u8 prim_chwidth,
+			u8 prim_1mhz_ch_idx)
+{
+	struct morse_cmd_req_set_channel req = { 0 };
+	int ret;
+
+	req.op_chan_freq_hz = host_to_le32(oper_freq * 1000);
+	req.op_bw_mhz = oper_chwidth;
+	req.pri_bw_mhz = prim_chwidth;
+	req.pri_1mhz_chan_idx = prim_1mhz_ch_idx;
+	req.reg_tx_power_set = 1;
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_SET_CHANNEL, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"morse: Failed to set channel parameters on ifname %s (%d)",
+			ifname, ret);
+
+	return ret;
+}
+
+int morse_set_ecsa_params(const char *ifname, u8 global_oper_class, u8 prim_chwidth,
+				int oper_chwidth, int oper_freq, u8 prim_1mhz_ch_idx,
+				u8 prim_global_op_class, u32 s1g_capab)
+{
+	struct morse_cmd_req_set_ecsa_s1g_info req = { 0 };
+	int ret;
+
+	req.operating_channel_freq_hz = host_to_le32(oper_freq * 1000);
+	req.opclass = global_oper_class;
+	req.primary_channel_bw_mhz = prim_chwidth;
+	req.prim_1mhz_ch_idx = prim_1mhz_ch_idx;
+	req.operating_channel_bw_mhz = oper_chwidth;
+	req.prim_opclass = prim_global_op_class;
+	req.s1g_cap0 = s1g_capab & 0xFF;
+	req.s1g_cap1 = (s1g_capab >> 8) & 0xFF;
+	req.s1g_cap2 = (s1g_capab >> 16) & 0xFF;
+	req.s1g_cap3 = (s1g_capab >> 24) & 0xFF;
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_SET_ECSA_S1G_INFO, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"morse: Failed to set ecsa parameters on ifname %s (%d)",
+			ifname, ret);
+
+	return ret;
+}
+
+int morse_set_mbssid_info(const char *ifname, const char *tx_iface, u8 max_bss_index)
+{
+	struct morse_cmd_req_mbssid req = { 0 };
+	int ret;
+
+	req.max_bssid_indicator = max_bss_index;
+	os_strlcpy(req.transmitter_iface, tx_iface, sizeof(req.transmitter_iface));
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_MBSSID, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"morse: Failed to set MBSSID parameters on ifname %s (%d)",
+			ifname, ret);
+
+	return ret;
+}
+
+int morse_set_keep_alive(const char *ifname, u16 bss_max_idle_period, bool as_11ah)
+{
+	struct morse_cmd_req_set_keep_alive_offload req = { 0 };
+	int ret;
+
+	req.bss_max_idle_period = host_to_le16(bss_max_idle_period);
+	req.interpret_as_11ah = as_11ah;
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_SET_KEEP_ALIVE_OFFLOAD, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"morse: Failed to set bss max idle period on ifname %s (%d)",
+			ifname, ret);
+
+	return ret;
+}
+
+int morse_twt_conf(const char *ifname, struct morse_twt *twt_config)
+{
+	struct morse_cmd_req_set_twt_conf req = { 0 };
+	int ret;
+
+	req.opcode = MORSE_CMD_TWT_CONF_OP_CONFIGURE;
+	req.wake_interval_us = host_to_le64(twt_config->wake_interval_us);
+	req.wake_duration_us = host_to_le32(twt_config->wake_duration_us);
+	req.twt_setup_command = twt_config->setup_command;
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_SET_TWT_CONF, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"morse: Failed to set twt config on ifname %s (%d)",
+			ifname, ret);
+	else
+		wpa_printf(MSG_INFO, "TWT config set successfully");
+
+	return ret;
+}
+
+int morse_cac_conf(const char *ifname, bool enable)
+{
+	struct morse_cmd_req_cac req = { 0 };
+	int ret;
+
+	req.opcode = enable ? MORSE_CMD_CAC_OP_ENABLE : MORSE_CMD_CAC_OP_DISABLE;
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_CAC, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"morse: Failed to %s cac on ifname %s (%d)",
+			enable ? "enable" : "disable", ifname, ret);
+
+	return ret;
+}
+
+int morse_set_mesh_config(const char *ifname, u8 *mesh_id, u8 mesh_id_len, u8 beaconless_mode,
+	u8 max_plinks)
+{
+	struct morse_cmd_req_set_mesh_config req = { 0 };
+	int ret;
+
+	if (mesh_id_len > sizeof(req.mesh_id)) {
+		wpa_printf(MSG_WARNING, "morse: Mesh ID too long (%u)", mesh_id_len);
+		return -EINVAL;
+	}
+
+	wpa_printf(MSG_DEBUG, "morse: Mesh ID:%s", wpa_ssid_txt(mesh_id, mesh_id_len));
+
+	req.mesh_id_len = mesh_id_len;
+	os_memcpy(req.mesh_id, mesh_id, mesh_id_len);
+	req.mesh_beaconless_mode = beaconless_mode;
+	req.max_plinks = max_plinks;
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_SET_MESH_CONFIG, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"morse: Failed to set Mesh Config on ifname %s (%d)",
+			ifname, ret);
+
+	return ret;
+}
+
+int morse_mbca_conf(const char *ifname, u8 mbca_config, u8 min_beacon_gap, u8 tbtt_adj_interval,
+	u8 beacon_timing_report_interval, u16 mbss_start_scan_duration)
+{
+	struct morse_cmd_req_set_mcba_conf req = { 0 };
+	int ret;
+
+	req.mbca_config = mbca_config;
+	req.beacon_timing_report_interval = beacon_timing_report_interval;
+	req.min_beacon_gap_ms = min_beacon_gap;
+	req.mbss_start_scan_duration_ms = host_to_le16(mbss_start_scan_duration);
+	/* tbtt_adj_interval is in seconds, the command takes msecs */
+	req.tbtt_adj_interval_ms = host_to_le16(tbtt_adj_interval * 1000);
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_SET_MCBA_CONF, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"morse: Failed to set mbca config on ifname %s (%d)", ifname, ret);
+
+	return ret;
+}
+
+int morse_set_mesh_dynamic_peering(const char *ifname, bool enabled, u8 rssi_margin,
+	u32 blacklist_timeout)
+{
+	struct morse_cmd_req_dynamic_peering_config req = { 0 };
+	int ret;
+
+	req.enabled = enabled;
+	if (enabled) {
+		req.rssi_margin = rssi_margin;
+		req.blacklist_timeout = host_to_le32(blacklist_timeout);
+	}
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_DYNAMIC_PEERING_CONFIG, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+			"%s: Failed to configure dynamic peering on ifname %s (%d)",
+				__func__, ifname, ret);
+
+	return ret;
+}
+
+int morse_raw_global_enable(const char *ifname, bool enable)
+{
+	struct morse_cmd_req_config_raw req = { 0 };
+	const char *op = enable ? "enable" : "disable";
+	int ret;
+
+	/* RAW id 0 operates on RAW globally */
+	if (enable)
+		req.flags = host_to_le32(MORSE_CMD_CFG_RAW_FLAG_ENABLE);
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_CONFIG_RAW, &req, sizeof(req));
+	if (ret != 0)
+		wpa_printf(MSG_WARNING, "morse: Failed to %s RAW on ifname %s (%d)",
+				op, ifname, ret);
+
+	return ret;
+}
+
+static void morse_raw_prio_to_aid_range(uint8_t prio, uint16_t *aid_start, uint16_t *aid_end)
+{
+	if (prio == 0) {
+		*aid_start = MORSE_RAW_DEFAULT_START_AID;
+		*aid_end = (__UINT16_MAX__ & MORSE_RAW_AID_DEVICE_MASK);
+	} else if ((prio > 0) && (prio < (MORSE_MAX_NUM_RAWS_USER_PRIO - 1))) {
+		*aid_start = (prio << MORSE_RAW_AID_PRIO_SHIFT);
+		*aid_end = *aid_start + (__UINT16_MAX__ & MORSE_RAW_AID_DEVICE_MASK);
+	} else if (prio == (MORSE_MAX_NUM_RAWS_USER_PRIO - 1)) {
+		*aid_start = (prio << MORSE_RAW_AID_PRIO_SHIFT);
+		*aid_end = MAX_AID;
+	} else {
+		WPA_ASSERT(false);
+	}
+}
+
+static inline u16 morse_raw_prio_to_raw_idx(u16 prio)
+{
+	return prio + MORSE_RAW_ID_HOSTAPD_PRIO_OFFSET;
+}
+
+int morse_raw_priority_enable(const char *ifname, bool enable, u8 prio, u32 start_time_us,
+	u32 duration_us, u8 num_slots, bool cross_slot, u16 max_bcn_spread, u16 nom_stas_per_bcn,
+	u8 praw_period, u8 praw_start_offset)
+{
+	struct morse_ctrl_raw_prio_req req;
+	size_t len = sizeof(req.raw);
+	uint16_t aid_start = 0;
+	uint16_t aid_end = 0;
+	int ret;
+
+	os_memset(&req, 0, sizeof(req));
+	req.raw.id = host_to_le16(morse_raw_prio_to_raw_idx(prio));
+
+	if (enable) {
+		morse_raw_prio_to_aid_range(prio, &aid_start, &aid_end);
+
+		req.raw.flags = host_to_le32(MORSE_CMD_CFG_RAW_FLAG_ENABLE |
+					     MORSE_CMD_CFG_RAW_FLAG_UPDATE);
+
+		req.slot_def.tag = MORSE_CMD_RAW_TLV_TAG_SLOT_DEF;
+		req.slot_def.raw_duration_us = host_to_le32(duration_us);
+		req.slot_def.num_slots = num_slots;
+		req.slot_def.cross_slot_bleed = cross_slot;
+
+		req.group.tag = MORSE_CMD_RAW_TLV_TAG_GROUP;
+		req.group.aid_start = host_to_le16(aid_start);
+		req.group.aid_end = host_to_le16(aid_end);
+
+		req.start_time.tag = MORSE_CMD_RAW_TLV_TAG_START_TIME;
+		req.start_time.start_time_us = host_to_le32(start_time_us);
+
+		len = offsetof(struct morse_ctrl_raw_prio_req, opt);
+
+		if (nom_stas_per_bcn) {
+			req.opt.bcn_spread.tag = MORSE_CMD_RAW_TLV_TAG_BCN_SPREAD;
+			req.opt.bcn_spread.max_spread = host_to_le16(max_bcn_spread);
+			req.opt.bcn_spread.nominal_sta_per_bcn = host_to_le16(nom_stas_per_bcn);
+			len += sizeof(req.opt.bcn_spread);
+		} else if (praw_period) {
+			/* Persistent PRAW, refreshed when the validity expires */
+			req.opt.praw.tag = MORSE_CMD_RAW_TLV_TAG_PRAW;
+			req.opt.praw.periodicity = praw_period;
+			req.opt.praw.validity = 255;
+			req.opt.praw.refresh_on_expiry = 1;
+			req.opt.praw.start_offset = praw_start_offset;
+			len += sizeof(req.opt.praw);
+		}
+	}
+
+	ret = morse_ctrl_cmd(ifname, MORSE_CMD_ID_CONFIG_RAW, &req, len);
+	if (ret != 0)
+		wpa_printf(MSG_WARNING,
+				"morse: Failed to set RAW priority %u on ifname %s (ret %d)",
+				prio, ifname, ret);
+
+	return ret;
+}